@@ -0,0 +1,454 @@
+/*
+ * AWS IoT Device Embedded C SDK for ZephyrRTOS
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Compares the throughput of the lock-free ring of the MQTT agent with a
+ * k_msgq of pointers, the two backends of its message context. Producer
+ * threads send numbered messages to a consumer thread of higher priority, as
+ * tasks send commands to the agent, for several numbers of producers. The
+ * consumer also checks that the messages of each producer arrive in order.
+ *
+ * No network is needed. Build and run it on the host with:
+ *
+ *     west build -b native_posix demos/mqtt_agent/message_queue_benchmark
+ *     west build -t run
+ *
+ * Threads of native_posix run one at a time and are only switched in kernel
+ * calls, so the producers contend as on a single CPU. Build it for an SMP
+ * board, such as qemu_x86_64 with CONFIG_SMP=y, to measure the contention of
+ * producers running on several CPUs.
+ *
+ * The benchmark logs the messages per second of each backend, then "PASS",
+ * or "FAIL" if a message was lost or out of order.
+ */
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Kernel includes. */
+#include <zephyr.h>
+
+/* Logging configuration of the benchmark. */
+#include "logging_levels.h"
+
+#ifndef LIBRARY_LOG_NAME
+    #define LIBRARY_LOG_NAME     "MessageQueueBenchmark"
+#endif
+#ifndef LIBRARY_LOG_LEVEL
+    #define LIBRARY_LOG_LEVEL    LOG_INFO
+#endif
+
+#include "logging_stack.h"
+
+/* Message ring include. */
+#include "agent_message_ring.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Number of messages each producer sends in a run.
+ */
+#define BENCHMARK_MESSAGES_PER_PRODUCER    ( 50000U )
+
+/**
+ * @brief Length of the queues. A power of two, as the ring requires.
+ */
+#define BENCHMARK_QUEUE_LENGTH             ( 16U )
+
+/**
+ * @brief Largest number of producers of a run.
+ */
+#define BENCHMARK_MAX_PRODUCERS            ( 4U )
+
+/**
+ * @brief Stack size of the producer and consumer threads.
+ */
+#define BENCHMARK_STACK_SIZE               ( 1024U )
+
+/**
+ * @brief Priority of the consumer, above the producers like the agent above
+ * the tasks sending it commands.
+ */
+#define BENCHMARK_CONSUMER_PRIORITY        ( K_PRIO_PREEMPT( 1 ) )
+
+/**
+ * @brief Priority of the producers.
+ */
+#define BENCHMARK_PRODUCER_PRIORITY        ( K_PRIO_PREEMPT( 2 ) )
+
+/**
+ * @brief Time to wait to send or receive a message before the run fails.
+ */
+#define BENCHMARK_BLOCK_TIME_MS            ( 1000U )
+
+/**
+ * @brief Number of bits of a message holding its number, the producer index
+ * being above them.
+ */
+#define BENCHMARK_SEQUENCE_BITS            ( 24U )
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Backend of a run.
+ */
+typedef enum BenchmarkBackend
+{
+    BenchmarkRing = 0, /**< @brief The lock-free ring. */
+    BenchmarkMsgq      /**< @brief A k_msgq of pointers. */
+} BenchmarkBackend_t;
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Get the time in microseconds.
+ *
+ * Simulated time stands still while threads run on native_posix, so the
+ * clock of the host is read there instead.
+ *
+ * @return The time.
+ */
+static uint64_t getTimeUs( void );
+
+/**
+ * @brief Send a message to the queue of the run.
+ *
+ * @param[in] pMessage The message.
+ *
+ * @return `true` if the message was sent; `false` otherwise.
+ */
+static bool sendMessage( void * pMessage );
+
+/**
+ * @brief Receive a message from the queue of the run.
+ *
+ * @param[out] ppMessage The message.
+ *
+ * @return `true` if a message was received; `false` otherwise.
+ */
+static bool receiveMessage( void ** ppMessage );
+
+/**
+ * @brief Thread sending #BENCHMARK_MESSAGES_PER_PRODUCER messages.
+ *
+ * @param[in] pParameter1 Index of the producer.
+ * @param[in] pParameter2 Unused.
+ * @param[in] pParameter3 Unused.
+ */
+static void producerThread( void * pParameter1,
+                            void * pParameter2,
+                            void * pParameter3 );
+
+/**
+ * @brief Thread receiving the messages of every producer, and checking their
+ * order.
+ *
+ * @param[in] pParameter1 Unused.
+ * @param[in] pParameter2 Unused.
+ * @param[in] pParameter3 Unused.
+ */
+static void consumerThread( void * pParameter1,
+                            void * pParameter2,
+                            void * pParameter3 );
+
+/**
+ * @brief Run the benchmark of a backend with a number of producers, and log
+ * its throughput.
+ *
+ * @param[in] backendToRun The backend.
+ * @param[in] producersToRun The number of producers.
+ *
+ * @return `true` if every message was received in order; `false` otherwise.
+ */
+static bool runBenchmark( BenchmarkBackend_t backendToRun,
+                          uint32_t producersToRun );
+
+/*-----------------------------------------------------------*/
+
+#if defined( CONFIG_BOARD_NATIVE_POSIX )
+
+/**
+ * @brief Time value of the host, as its clock_gettime writes it.
+ */
+    struct HostTimespec
+    {
+        long seconds;     /**< @brief Seconds. */
+        long nanoseconds; /**< @brief Nanoseconds. */
+    };
+
+/**
+ * @brief The clock_gettime of the host C library, which native_posix links.
+ */
+    extern int clock_gettime( int clockId,
+                              struct HostTimespec * pTime );
+
+/**
+ * @brief CLOCK_MONOTONIC of the host.
+ */
+    #define HOST_CLOCK_MONOTONIC    ( 1 )
+#endif
+
+/**
+ * @brief The ring.
+ */
+static AgentMessageRing_t ring;
+
+/**
+ * @brief Slots of the ring.
+ */
+static AgentMessageRingSlot_t ringSlots[ BENCHMARK_QUEUE_LENGTH ];
+
+/**
+ * @brief The message queue.
+ */
+K_MSGQ_DEFINE( messageQueue, sizeof( void * ), BENCHMARK_QUEUE_LENGTH, sizeof( void * ) );
+
+/**
+ * @brief Backend of the current run.
+ */
+static BenchmarkBackend_t backend;
+
+/**
+ * @brief Number of producers of the current run.
+ */
+static uint32_t numProducers;
+
+/**
+ * @brief Number the next message of each producer must have.
+ */
+static uint32_t expectedSequences[ BENCHMARK_MAX_PRODUCERS ];
+
+/**
+ * @brief Number of messages of the current run lost or out of order.
+ */
+static uint32_t numErrors;
+
+/**
+ * @brief Threads and stacks of the producers and of the consumer, the last.
+ */
+static struct k_thread threads[ BENCHMARK_MAX_PRODUCERS + 1U ];
+K_THREAD_STACK_ARRAY_DEFINE( threadStacks, BENCHMARK_MAX_PRODUCERS + 1U, BENCHMARK_STACK_SIZE );
+
+/*-----------------------------------------------------------*/
+
+static uint64_t getTimeUs( void )
+{
+    uint64_t timeUs = 0U;
+
+    #if defined( CONFIG_BOARD_NATIVE_POSIX )
+        struct HostTimespec hostTime = { 0 };
+
+        ( void ) clock_gettime( HOST_CLOCK_MONOTONIC, &hostTime );
+        timeUs = ( ( uint64_t ) hostTime.seconds * 1000000U ) + ( ( uint64_t ) hostTime.nanoseconds / 1000U );
+    #else
+        timeUs = ( uint64_t ) k_uptime_get() * 1000U;
+    #endif
+
+    return timeUs;
+}
+/*-----------------------------------------------------------*/
+
+static bool sendMessage( void * pMessage )
+{
+    bool isSent = false;
+
+    if( backend == BenchmarkRing )
+    {
+        isSent = AgentMessageRing_Send( &ring, pMessage, BENCHMARK_BLOCK_TIME_MS );
+    }
+    else
+    {
+        isSent = ( k_msgq_put( &messageQueue, &pMessage, K_MSEC( BENCHMARK_BLOCK_TIME_MS ) ) == 0 );
+    }
+
+    return isSent;
+}
+/*-----------------------------------------------------------*/
+
+static bool receiveMessage( void ** ppMessage )
+{
+    bool isReceived = false;
+
+    if( backend == BenchmarkRing )
+    {
+        isReceived = AgentMessageRing_Receive( &ring, ppMessage, BENCHMARK_BLOCK_TIME_MS );
+    }
+    else
+    {
+        isReceived = ( k_msgq_get( &messageQueue, ppMessage, K_MSEC( BENCHMARK_BLOCK_TIME_MS ) ) == 0 );
+    }
+
+    return isReceived;
+}
+/*-----------------------------------------------------------*/
+
+static void producerThread( void * pParameter1,
+                            void * pParameter2,
+                            void * pParameter3 )
+{
+    uintptr_t producer = ( uintptr_t ) pParameter1;
+    uintptr_t sequence = 0U;
+    bool isSent = true;
+
+    ( void ) pParameter2;
+    ( void ) pParameter3;
+
+    /* The producer index is stored plus one, so that no message is NULL. */
+    for( sequence = 0U; ( sequence < BENCHMARK_MESSAGES_PER_PRODUCER ) && isSent; sequence++ )
+    {
+        isSent = sendMessage( ( void * ) ( ( ( producer + 1U ) << BENCHMARK_SEQUENCE_BITS ) | sequence ) );
+    }
+
+    if( !isSent )
+    {
+        LogError( ( "Producer %u could not send message %u.",
+                    ( unsigned int ) producer,
+                    ( unsigned int ) sequence ) );
+    }
+}
+/*-----------------------------------------------------------*/
+
+static void consumerThread( void * pParameter1,
+                            void * pParameter2,
+                            void * pParameter3 )
+{
+    uint32_t numMessages = numProducers * BENCHMARK_MESSAGES_PER_PRODUCER;
+    uint32_t message = 0U;
+    uintptr_t producer = 0U;
+    uintptr_t sequence = 0U;
+    void * pMessage = NULL;
+    bool isReceived = true;
+
+    ( void ) pParameter1;
+    ( void ) pParameter2;
+    ( void ) pParameter3;
+
+    for( message = 0U; ( message < numMessages ) && isReceived; message++ )
+    {
+        isReceived = receiveMessage( &pMessage );
+
+        if( isReceived )
+        {
+            producer = ( ( uintptr_t ) pMessage >> BENCHMARK_SEQUENCE_BITS ) - 1U;
+            sequence = ( uintptr_t ) pMessage & ( ( 1U << BENCHMARK_SEQUENCE_BITS ) - 1U );
+
+            if( ( producer >= numProducers ) || ( sequence != expectedSequences[ producer ] ) )
+            {
+                numErrors++;
+            }
+            else
+            {
+                expectedSequences[ producer ]++;
+            }
+        }
+        else
+        {
+            LogError( ( "No message received after %u of %u.",
+                        ( unsigned int ) message,
+                        ( unsigned int ) numMessages ) );
+            numErrors += numMessages - message;
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+static bool runBenchmark( BenchmarkBackend_t backendToRun,
+                          uint32_t producersToRun )
+{
+    uint32_t producer = 0U;
+    uint64_t startTimeUs = 0U;
+    uint64_t elapsedTimeUs = 0U;
+    uint64_t numMessages = ( uint64_t ) producersToRun * BENCHMARK_MESSAGES_PER_PRODUCER;
+
+    backend = backendToRun;
+    numProducers = producersToRun;
+    numErrors = 0U;
+    ( void ) memset( expectedSequences, 0x00, sizeof( expectedSequences ) );
+
+    if( backend == BenchmarkRing )
+    {
+        ( void ) AgentMessageRing_Init( &ring, ringSlots, BENCHMARK_QUEUE_LENGTH );
+    }
+    else
+    {
+        k_msgq_purge( &messageQueue );
+    }
+
+    startTimeUs = getTimeUs();
+
+    /* The consumer starts first, and waits for the first message. */
+    ( void ) k_thread_create( &( threads[ BENCHMARK_MAX_PRODUCERS ] ),
+                              threadStacks[ BENCHMARK_MAX_PRODUCERS ],
+                              K_THREAD_STACK_SIZEOF( threadStacks[ BENCHMARK_MAX_PRODUCERS ] ),
+                              consumerThread,
+                              NULL, NULL, NULL,
+                              BENCHMARK_CONSUMER_PRIORITY,
+                              0,
+                              K_NO_WAIT );
+
+    for( producer = 0U; producer < numProducers; producer++ )
+    {
+        ( void ) k_thread_create( &( threads[ producer ] ),
+                                  threadStacks[ producer ],
+                                  K_THREAD_STACK_SIZEOF( threadStacks[ producer ] ),
+                                  producerThread,
+                                  ( void * ) ( uintptr_t ) producer, NULL, NULL,
+                                  BENCHMARK_PRODUCER_PRIORITY,
+                                  0,
+                                  K_NO_WAIT );
+    }
+
+    ( void ) k_thread_join( &( threads[ BENCHMARK_MAX_PRODUCERS ] ), K_FOREVER );
+    elapsedTimeUs = getTimeUs() - startTimeUs;
+
+    for( producer = 0U; producer < numProducers; producer++ )
+    {
+        ( void ) k_thread_join( &( threads[ producer ] ), K_FOREVER );
+    }
+
+    LogInfo( ( "%s, %u producers: %u messages in %u us, %u messages/s, %u errors.",
+               ( backend == BenchmarkRing ) ? "Ring" : "k_msgq",
+               ( unsigned int ) numProducers,
+               ( unsigned int ) numMessages,
+               ( unsigned int ) elapsedTimeUs,
+               ( unsigned int ) ( ( elapsedTimeUs > 0U ) ? ( ( numMessages * 1000000U ) / elapsedTimeUs ) : 0U ),
+               ( unsigned int ) numErrors ) );
+
+    return( numErrors == 0U );
+}
+/*-----------------------------------------------------------*/
+
+void main( void )
+{
+    uint32_t producersToRun = 0U;
+    bool isPassed = true;
+
+    for( producersToRun = 1U; producersToRun <= BENCHMARK_MAX_PRODUCERS; producersToRun *= 2U )
+    {
+        isPassed = runBenchmark( BenchmarkRing, producersToRun ) && isPassed;
+        isPassed = runBenchmark( BenchmarkMsgq, producersToRun ) && isPassed;
+    }
+
+    LogInfo( ( "Message queue benchmark: %s", isPassed ? "PASS" : "FAIL" ) );
+}
@@ -58,4 +58,22 @@
 #define MQTT_AGENT_MAX_SUBSCRIPTION_FILTER_LENGTH ( 100 )
 #define MQTT_AGENT_MAX_SIMULTANEOUS_CONNECTIONS ( 3 )
 
+/*
+ * Set to 1 to wake the agent up as soon as data is received on its socket,
+ * instead of reading the socket only once it stops waiting for commands.
+ * This starts a thread watching the socket, and needs CONFIG_EVENTFD=y, which
+ * is commented out in prj.conf.
+ */
+#define MQTT_AGENT_ENABLE_SOCKET_WAKEUP ( 0 )
+
+/*
+ * Drop QoS 0 publishes still queued after 10 seconds. Among the queued QoS 0
+ * publishes, the one sent last goes out first, so that fresh telemetry goes
+ * out before the backlog after a reconnection. Other commands are sent first,
+ * in the order they were sent.
+ */
+#define MQTT_AGENT_ENABLE_DEADLINES ( 1 )
+#define MQTT_AGENT_FRESHEST_FIRST ( 1 )
+#define MQTT_AGENT_DEFAULT_QOS0_LIFETIME_MS ( 10000U )
+
 #endif /* ifndef MQTT_AGENT_CONFIG_H */
\ No newline at end of file
@@ -67,9 +67,24 @@
 /* Subscription manager header include. */
 #include "subscription_manager.h"
 
+/* Publish buffers, which carry their own commands. */
+#include "agent_publish_buffer.h"
+
+/* Resubscribe include. */
+#include "agent_resubscribe.h"
+
+/* Shared subscriptions include. */
+#include "agent_subscriptions.h"
+
 /* Transport interface implementation include header for TLS. */
 #include "mbedtls_zephyr.h"
 
+/* Entropy pool include. */
+#include "entropy_pool_zephyr.h"
+
+/* Coalescing transport include. */
+#include "coalescing_transport.h"
+
 /* Wifi connection for ESP32 */
 #include "esp_wifi_wrapper.h"
 
@@ -113,11 +128,32 @@
     #define MQTT_AGENT_NETWORK_BUFFER_SIZE    ( 5000 )
 #endif
 
+/**
+ * @brief Dimensions the buffer in which the packets written for a burst of
+ * commands are coalesced into one TLS record.
+ * @note Specified in bytes.
+ */
+#ifndef MQTT_AGENT_COALESCING_BUFFER_SIZE
+    #define MQTT_AGENT_COALESCING_BUFFER_SIZE    ( 1024 )
+#endif
+
 /**
  * @brief The length of the queue used to hold commands for the agent.
+ *
+ * @note A power of two, as required when #MQTT_AGENT_USE_LOCK_FREE_QUEUE is 1.
  */
 #ifndef MQTT_AGENT_COMMAND_QUEUE_LENGTH
-    #define MQTT_AGENT_COMMAND_QUEUE_LENGTH    ( 10 )
+    #define MQTT_AGENT_COMMAND_QUEUE_LENGTH    ( 16 )
+#endif
+
+/**
+ * @brief Dimensions the memory region holding the subscriptions, their topic
+ * filters and the indexes used to match them.
+ * @note Specified in bytes. The default holds 8 subscriptions to topic filters
+ * of up to 4 levels of up to 16 characters.
+ */
+#ifndef MQTT_AGENT_SUBSCRIPTION_STORAGE_SIZE
+    #define MQTT_AGENT_SUBSCRIPTION_STORAGE_SIZE    SUBSCRIPTION_MANAGER_STORAGE_SIZE( 8U, 4U, 16U )
 #endif
 
 /**
@@ -184,7 +220,7 @@
  */
 struct NetworkContext
 {
-    TlsTransportParams_t * pParams;
+    void * pParams;
 };
 
 /**
@@ -264,6 +300,19 @@ static bool socketConnect( NetworkContext_t * pNetworkContext );
  */
 static bool socketDisconnect( NetworkContext_t * pNetworkContext );
 
+#if ( MQTT_AGENT_ENABLE_SOCKET_WAKEUP == 1 )
+
+/**
+ * @brief Tell whether decrypted bytes are pending in the TLS transport, for the
+ * agent not to wait for the socket while they are.
+ *
+ * @param[in] pContext Network context.
+ *
+ * @return `true` if bytes are pending.
+ */
+    static bool transportHasPendingData( void * pContext );
+#endif
+
 /**
  * @brief Fan out the incoming publishes to the callbacks registered by different
  * tasks. If there are no callbacks registered for the incoming publish, it will be
@@ -277,34 +326,6 @@ static void incomingPublishCallback( MQTTAgentContext_t * pMqttAgentContext,
                                      uint16_t packetId,
                                      MQTTPublishInfo_t * pPublishInfo );
 
-/**
- * @brief Function to attempt to resubscribe to the topics already present in the
- * subscription list.
- *
- * This function will be invoked when this demo requests the broker to
- * reestablish the session and the broker cannot do so. This function will
- * enqueue commands to the MQTT Agent queue and will be processed once the
- * command loop starts.
- *
- * @return `MQTTSuccess` if adding subscribes to the command queue succeeds, else
- * appropriate error code from MQTTAgent_Subscribe.
- * */
-static MQTTStatus_t handleResubscribe( void );
-
-/**
- * @brief Passed into MQTTAgent_Subscribe() as the callback to execute when the
- * broker ACKs the SUBSCRIBE message. This callback implementation is used for
- * handling the completion of resubscribes. Any topic filter failed to resubscribe
- * will be removed from the subscription list.
- *
- * See https://freertos.org/mqtt/mqtt-agent-demo.html#example_mqtt_api_call
- *
- * @param[in] pCommandContext Context of the initial command.
- * @param[in] pReturnInfo The result of the command.
- */
-static void subscriptionCommandCallback( MQTTAgentCommandContext_t * pCommandContext,
-                                         MQTTAgentReturnInfo_t * pReturnInfo );
-
 /**
  * @brief Task used to run the MQTT agent.  In this example the first task that
  * is created is responsible for creating all the other demo tasks.  Then,
@@ -374,6 +395,22 @@ static NetworkContext_t networkContext;
  */
 static TlsTransportParams_t secureSocketsTransportParams;
 
+/**
+ * @brief The network context of the transport given to the MQTT agent, which
+ * coalesces the writes of the agent before passing them to the TLS channel.
+ */
+static NetworkContext_t coalescingNetworkContext;
+
+/**
+ * @brief The transport coalescing the writes of the MQTT agent.
+ */
+static CoalescingTransport_t coalescingTransport;
+
+/**
+ * @brief Buffer of #coalescingTransport.
+ */
+static uint8_t coalescingBuffer[ MQTT_AGENT_COALESCING_BUFFER_SIZE ];
+
 /**
  * @brief Global entry time into the application to use as a reference timestamp
  * in the #getTimeMs function. #getTimeMs will always return the difference
@@ -403,15 +440,31 @@ static MQTTAgentMessageContext_t commandQueue;
 static struct MQTTAgentDemoParams taskParameters[ NUM_SIMPLE_SUB_PUB_TASKS_TO_CREATE ];
 
 /**
- * @brief The global array of subscription elements.
+ * @brief The global list of subscriptions.
  *
- * @note No thread safety is required to this array, since updates to the array
- * elements are done only from the MQTT agent task. The subscription manager
- * implementation expects that the array of the subscription elements used for
- * storing subscriptions to be initialized to 0. As this is a global array, it
- * will be initialized to 0 by default.
+ * @note The subscription manager lets any task update this list while the MQTT
+ * agent task matches incoming publishes against it. The list copies the topic
+ * filters of the subscriptions into #subscriptionStorage, given to it before
+ * the agent is initialized.
+ */
+SubscriptionList_t globalSubscriptionList;
+
+/**
+ * @brief Memory region of #globalSubscriptionList.
  */
-SubscriptionElement_t globalSubscriptionList[ SUBSCRIPTION_MANAGER_MAX_SUBSCRIPTIONS ];
+SUBSCRIPTION_MANAGER_STORAGE_DEFINE( subscriptionStorage, MQTT_AGENT_SUBSCRIPTION_STORAGE_SIZE );
+
+/**
+ * @brief The subscriptions of #globalSubscriptionList shared by the demo tasks,
+ * which only subscribe to a topic filter at the broker once.
+ */
+AgentSubscriptions_t globalAgentSubscriptions;
+
+/**
+ * @brief State of the resubscribe of #globalSubscriptionList, which remains in
+ * use until the broker acknowledged every SUBSCRIBE.
+ */
+static AgentResubscribe_t resubscribe;
 
 /**
  * @brief k_thread struct to hold MQTT Agent thread information.
@@ -419,9 +472,9 @@ SubscriptionElement_t globalSubscriptionList[ SUBSCRIPTION_MANAGER_MAX_SUBSCRIPT
 static struct k_thread mqttAgentThread;
 
 /**
- * @brief The command queue is a Zephyr message queue, which needs a buffer to store its members.
+ * @brief Storage of the members of the command queue.
  */
-char __aligned( 8 ) commandQueueBuffer[ MQTT_AGENT_COMMAND_QUEUE_LENGTH * sizeof( MQTTAgentCommand_t * ) ];
+static AgentMessageStorage_t commandQueueStorage[ AGENT_MESSAGE_STORAGE_LENGTH( MQTT_AGENT_COMMAND_QUEUE_LENGTH ) ];
 
 extern struct k_thread simpleSubPubThreads[ NUM_SIMPLE_SUB_PUB_TASKS_TO_CREATE ];
 
@@ -475,7 +528,7 @@ static int runCoreMqttAgentDemo( bool awsIotMqttMode,
 
 static MQTTStatus_t mqttAgentInit( void )
 {
-    TransportInterface_t transport;
+    TransportInterface_t transport, tlsTransport;
     MQTTStatus_t mqttStatus;
     MQTTFixedBuffer_t fixedBuffer = { .pBuffer = networkBuffer, .size = MQTT_AGENT_NETWORK_BUFFER_SIZE };
     MQTTAgentMessageInterface_t messageInterface =
@@ -488,25 +541,60 @@ static MQTTStatus_t mqttAgentInit( void )
     };
 
     LogDebug( ( "Creating command queue." ) );
-    k_msgq_init( &( commandQueue.queue ), commandQueueBuffer, sizeof( MQTTAgentCommand_t * ), MQTT_AGENT_COMMAND_QUEUE_LENGTH );
-    messageInterface.pMsgCtx = &commandQueue;
-
-    Agent_InitializePool();
-
-    /* Fill in Transport Interface send and receive function pointers. */
-    transport.pNetworkContext = &networkContext;
-    transport.send = MbedTLS_send;
-    transport.recv = MbedTLS_recv;
-
-    /* Initialize MQTT library. */
-    mqttStatus = MQTTAgent_Init( &globalMqttAgentContext,
-                                 &messageInterface,
-                                 &fixedBuffer,
-                                 &transport,
-                                 getTimeMs,
-                                 incomingPublishCallback,
-                                 /* Context to pass into the callback. Passing the pointer to subscription array. */
-                                 globalSubscriptionList );
+
+    if( !Agent_InitializeMessageContext( &commandQueue, commandQueueStorage, MQTT_AGENT_COMMAND_QUEUE_LENGTH ) )
+    {
+        LogError( ( "Failed to create the command queue." ) );
+        mqttStatus = MQTTBadParameter;
+    }
+    else if( !initSubscriptionList( &globalSubscriptionList, subscriptionStorage, sizeof( subscriptionStorage ) ) )
+    {
+        LogError( ( "Failed to initialize the subscription list." ) );
+        mqttStatus = MQTTNoMemory;
+    }
+    else
+    {
+        messageInterface.pMsgCtx = &commandQueue;
+
+        Agent_InitializePool();
+
+        /* The QoS 0 publishes of publish buffers carry their own commands,
+         * which the buffers release. */
+        Agent_SetCommonPoolReleaseHook( AgentPublishBuffer_ReleaseCommand );
+
+        /* Fill in Transport Interface send and receive function pointers. */
+        tlsTransport.pNetworkContext = &networkContext;
+        tlsTransport.send = MbedTLS_send;
+        tlsTransport.recv = MbedTLS_recv;
+
+        /* Coalesce the packets written for each burst of commands, flushing
+         * them before the agent waits for more commands. */
+        ( void ) CoalescingTransport_Init( &coalescingTransport, &tlsTransport, coalescingBuffer, sizeof( coalescingBuffer ) );
+        coalescingNetworkContext.pParams = &coalescingTransport;
+        Agent_SetReceiveHook( &commandQueue, CoalescingTransport_AgentReceiveHook, &coalescingTransport );
+
+        transport.pNetworkContext = &coalescingNetworkContext;
+        transport.send = CoalescingTransport_Send;
+        transport.recv = CoalescingTransport_Recv;
+
+        /* Initialize MQTT library. */
+        mqttStatus = MQTTAgent_Init( &globalMqttAgentContext,
+                                     &messageInterface,
+                                     &fixedBuffer,
+                                     &transport,
+                                     getTimeMs,
+                                     incomingPublishCallback,
+                                     /* Context to pass into the callback. Passing the pointer to subscription list. */
+                                     &globalSubscriptionList );
+
+        if( mqttStatus == MQTTSuccess )
+        {
+            AgentSubscriptions_Init( &globalAgentSubscriptions,
+                                     &globalMqttAgentContext,
+                                     &globalSubscriptionList,
+                                     MQTTQoS1 );
+        }
+    }
 
     return mqttStatus;
 }
@@ -579,10 +667,20 @@ static MQTTStatus_t mqttConnect( bool cleanSession )
     {
         mqttStatus = MQTTAgent_ResumeSession( &globalMqttAgentContext, sessionPresent );
 
-        /* Resubscribe to all the subscribed topics. */
-        if( ( mqttStatus == MQTTSuccess ) && ( !sessionPresent ) )
+        /* Resubscribe to all the subscribed topics, unless the broker kept
+         * them. QoS1 is used for all the subscriptions in this demo. Any topic
+         * filter that fails to resubscribe is removed from the subscription
+         * list. */
+        if( mqttStatus == MQTTSuccess )
         {
-            mqttStatus = handleResubscribe();
+            mqttStatus = AgentResubscribe_Start( &resubscribe,
+                                                 &globalMqttAgentContext,
+                                                 &globalSubscriptionList,
+                                                 sessionPresent,
+                                                 MQTTQoS1,
+                                                 MQTT_AGENT_NETWORK_BUFFER_SIZE,
+                                                 NULL,
+                                                 NULL );
         }
     }
 
@@ -591,100 +689,6 @@ static MQTTStatus_t mqttConnect( bool cleanSession )
 
 /*-----------------------------------------------------------*/
 
-static MQTTStatus_t handleResubscribe( void )
-{
-    MQTTStatus_t mqttStatus = MQTTBadParameter;
-    uint32_t index = 0U;
-    uint16_t numSubscriptions = 0U;
-
-    /* These variables need to stay in scope until command completes. */
-    static MQTTAgentSubscribeArgs_t subArgs = { 0 };
-    static MQTTSubscribeInfo_t subInfo[ SUBSCRIPTION_MANAGER_MAX_SUBSCRIPTIONS ] = { 0 };
-    static MQTTAgentCommandInfo_t commandParams = { 0 };
-
-    /* Loop through each subscription in the subscription list and add a subscribe
-     * command to the command queue. */
-    for( index = 0U; index < SUBSCRIPTION_MANAGER_MAX_SUBSCRIPTIONS; index++ )
-    {
-        /* Check if there is a subscription in the subscription list. This demo
-         * doesn't check for duplicate subscriptions. */
-        if( globalSubscriptionList[ index ].filterStringLength != 0 )
-        {
-            subInfo[ numSubscriptions ].pTopicFilter = globalSubscriptionList[ index ].pSubscriptionFilterString;
-            subInfo[ numSubscriptions ].topicFilterLength = globalSubscriptionList[ index ].filterStringLength;
-
-            /* QoS1 is used for all the subscriptions in this demo. */
-            subInfo[ numSubscriptions ].qos = MQTTQoS1;
-
-            LogInfo( ( "Resubscribe to the topic %.*s will be attempted.",
-                       subInfo[ numSubscriptions ].topicFilterLength,
-                       subInfo[ numSubscriptions ].pTopicFilter ) );
-
-            numSubscriptions++;
-        }
-    }
-
-    if( numSubscriptions > 0U )
-    {
-        subArgs.pSubscribeInfo = subInfo;
-        subArgs.numSubscriptions = numSubscriptions;
-
-        /* The block time can be 0 as the command loop is not running at this point. */
-        commandParams.blockTimeMs = 0U;
-        commandParams.cmdCompleteCallback = subscriptionCommandCallback;
-        commandParams.pCmdCompleteCallbackContext = ( void * ) &subArgs;
-
-        /* Enqueue subscribe to the command queue. These commands will be processed only
-         * when command loop starts. */
-        mqttStatus = MQTTAgent_Subscribe( &globalMqttAgentContext, &subArgs, &commandParams );
-    }
-    else
-    {
-        /* Mark the resubscribe as success if there is nothing to be subscribed. */
-        mqttStatus = MQTTSuccess;
-    }
-
-    if( mqttStatus != MQTTSuccess )
-    {
-        LogError( ( "Failed to enqueue the MQTT subscribe command. mqttStatus=%s.",
-                    MQTT_Status_strerror( mqttStatus ) ) );
-    }
-
-    return mqttStatus;
-}
-
-/*-----------------------------------------------------------*/
-
-static void subscriptionCommandCallback( MQTTAgentCommandContext_t * pCommandContext,
-                                         MQTTAgentReturnInfo_t * pReturnInfo )
-{
-    size_t index = 0;
-    MQTTAgentSubscribeArgs_t * pSubscribeArgs = ( MQTTAgentSubscribeArgs_t * ) pCommandContext;
-
-    /* If the return code is success, no further action is required as all the topic filters
-     * are already part of the subscription list. */
-    if( pReturnInfo->returnCode != MQTTSuccess )
-    {
-        /* Check through each of the suback codes and determine if there are any failures. */
-        for( index = 0; index < pSubscribeArgs->numSubscriptions; index++ )
-        {
-            /* This demo doesn't attempt to resubscribe in the event that a SUBACK failed. */
-            if( pReturnInfo->pSubackCodes[ index ] == MQTTSubAckFailure )
-            {
-                LogError( ( "Failed to resubscribe to topic %.*s.",
-                            pSubscribeArgs->pSubscribeInfo[ index ].topicFilterLength,
-                            pSubscribeArgs->pSubscribeInfo[ index ].pTopicFilter ) );
-                /* Remove subscription callback for unsubscribe. */
-                removeSubscription( globalSubscriptionList,
-                                    pSubscribeArgs->pSubscribeInfo[ index ].pTopicFilter,
-                                    pSubscribeArgs->pSubscribeInfo[ index ].topicFilterLength );
-            }
-        }
-    }
-}
-
-/*-----------------------------------------------------------*/
-
 static bool backoffForRetry( BackoffAlgorithmContext_t * pRetryParams )
 {
     bool returnStatus = false;
@@ -754,7 +758,18 @@ static bool socketConnect( NetworkContext_t * pNetworkContext )
     /* Set the socket wakeup callback and ensure the read block time. */
     if( connected )
     {
-        zsock_setsockopt( pNetworkContext->pParams->tcpSocket,
+        /* Bytes coalesced for a previous connection are not to be sent. */
+        CoalescingTransport_Reset( &coalescingTransport );
+
+        #if ( MQTT_AGENT_ENABLE_SOCKET_WAKEUP == 1 )
+            /* Wake the agent up as soon as the broker sends a packet. */
+            ( void ) Agent_SetWakeupSocket( &commandQueue,
+                                            ( ( TlsTransportParams_t * ) pNetworkContext->pParams )->tcpSocket,
+                                            transportHasPendingData,
+                                            pNetworkContext );
+        #endif
+
+        zsock_setsockopt( ( ( TlsTransportParams_t * ) pNetworkContext->pParams )->tcpSocket,
                           0,
                           SO_RCVTIMEO,
                           &( K_TICKS( transportTimeout ) ),
@@ -769,6 +784,12 @@ static bool socketConnect( NetworkContext_t * pNetworkContext )
 static bool socketDisconnect( NetworkContext_t * pNetworkContext )
 {
     LogInfo( ( "Disconnecting TLS connection.\n" ) );
+
+    #if ( MQTT_AGENT_ENABLE_SOCKET_WAKEUP == 1 )
+        /* Stop watching the socket before closing it. */
+        ( void ) Agent_SetWakeupSocket( &commandQueue, -1, NULL, NULL );
+    #endif
+
     MbedTLS_Disconnect( pNetworkContext );
 
     return true;
@@ -776,6 +797,17 @@ static bool socketDisconnect( NetworkContext_t * pNetworkContext )
 
 /*-----------------------------------------------------------*/
 
+#if ( MQTT_AGENT_ENABLE_SOCKET_WAKEUP == 1 )
+
+    static bool transportHasPendingData( void * pContext )
+    {
+        return MbedTLS_GetPendingBytes( ( NetworkContext_t * ) pContext ) > 0U;
+    }
+
+/*-----------------------------------------------------------*/
+
+#endif
+
 static void incomingPublishCallback( MQTTAgentContext_t * pMqttAgentContext,
                                      uint16_t packetId,
                                      MQTTPublishInfo_t * pPublishInfo )
@@ -787,7 +819,7 @@ static void incomingPublishCallback( MQTTAgentContext_t * pMqttAgentContext,
 
     /* Fan out the incoming publishes to the callbacks registered using
      * subscription manager. */
-    publishHandled = handleIncomingPublishes( ( SubscriptionElement_t * ) pMqttAgentContext->pIncomingCallbackContext,
+    publishHandled = handleIncomingPublishes( ( SubscriptionList_t * ) pMqttAgentContext->pIncomingCallbackContext,
                                               pPublishInfo );
 
     /* If there are no callbacks to handle the incoming publishes,
@@ -1000,6 +1032,10 @@ static uint32_t getTimeMs( void )
 
 void main()
 {
+    /* Fill the entropy pool while the network comes up, so that the TLS
+     * handshake does not wait on the RNG. */
+    EntropyPool_Start();
+
     LogInfo( ( "Connecting to WiFi network: SSID=%.*s ...", strlen( WIFI_NETWORK_SSID ), WIFI_NETWORK_SSID ) );
 
     if( Wifi_Connect( WIFI_NETWORK_SSID, strlen( WIFI_NETWORK_SSID ), WIFI_NETWORK_PASSWORD, strlen( WIFI_NETWORK_PASSWORD ) ) )
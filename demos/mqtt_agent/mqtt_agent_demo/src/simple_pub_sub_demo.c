@@ -28,13 +28,13 @@
  * Each created task is a unique instance of the task implemented by
  * simpleSubscribePublishTask().  simpleSubscribePublishTask()
  * subscribes to a topic then periodically publishes a message to the same
- * topic to which it has subscribed.  The command context sent to
- * MQTTAgent_Publish() contains a unique number that is sent back to the task
- * as a task notification from the callback function that executes when the
- * PUBLISH operation is acknowledged (or just sent in the case of QoS 0).  The
- * task checks the number it receives from the callback equals the number it
- * previously set in the command context before printing out either a success
- * or failure message.
+ * topic to which it has subscribed.  Each payload is written in place in a
+ * buffer of a shared pool and handed to the agent, which returns the buffer
+ * to the pool once the PUBLISH operation is acknowledged (or just sent in the
+ * case of QoS 0).  Each publish completes its own completion handle, so the
+ * task does not wait for each publish; it waits for all of its publishes at
+ * once and counts those that completed successfully before printing out
+ * either a success or failure message.
  */
 
 /* Kernel include. */
@@ -57,6 +57,15 @@
 /* Subscription manager header include. */
 #include "subscription_manager.h"
 
+/* Publish buffer pool include. */
+#include "agent_publish_buffer.h"
+
+/* Completion handles include. */
+#include "agent_completion.h"
+
+/* Shared subscriptions include. */
+#include "agent_subscriptions.h"
+
 /**
  * @brief This demo uses task notifications to signal tasks from MQTT callback
  * functions.  MS_TO_WAIT_FOR_NOTIFICATION defines the time, in ticks,
@@ -94,19 +103,13 @@
  */
 #define QOS_MODULUS                            ( 2UL )
 
-/*-----------------------------------------------------------*/
-
 /**
- * @brief Defines the structure to use as the command callback context in this
- * demo.
+ * @brief Number of publish buffers of the pool for each task, that is the
+ * number of publishes of a task that may be in flight at once.
  */
-struct MQTTAgentCommandContext
-{
-    MQTTStatus_t returnStatus;
-    uint32_t taskNum;
-    uint32_t notificationValue;
-    void * pArgs;
-};
+#define PUBLISH_BUFFERS_PER_TASK               ( 2U )
+
+/*-----------------------------------------------------------*/
 
 /**
  * @brief Parameters for this task.
@@ -120,54 +123,7 @@ struct SimplePubSubDemoParams
 /*-----------------------------------------------------------*/
 
 /**
- * @brief Passed into MQTTAgent_Subscribe() as the callback to execute when the
- * broker ACKs the SUBSCRIBE message.  Its implementation sends a notification
- * to the task that called MQTTAgent_Subscribe() to let the task know the
- * SUBSCRIBE operation completed.  It also sets the returnStatus of the
- * structure passed in as the command's context to the value of the
- * returnStatus parameter - which enables the task to check the status of the
- * operation.
- *
- * See https://freertos.org/mqtt/mqtt-agent-demo.html#example_mqtt_api_call
- *
- * @param[in] pCommandContext Context of the initial command.
- * @param[in] pReturnInfo The result of the command.
- */
-static void subscribeCommandCallback( MQTTAgentCommandContext_t * pCommandContext,
-                                      MQTTAgentReturnInfo_t * pReturnInfo );
-
-/**
- * @brief Passed into MQTTAgent_Publish() as the callback to execute when the
- * broker ACKs the PUBLISH message.  Its implementation sends a notification
- * to the task that called MQTTAgent_Publish() to let the task know the
- * PUBLISH operation completed.  It also sets the returnStatus of the
- * structure passed in as the command's context to the value of the
- * returnStatus parameter - which enables the task to check the status of the
- * operation.
- *
- * See https://freertos.org/mqtt/mqtt-agent-demo.html#example_mqtt_api_call
- *
- * @param[in] pCommandContext Context of the initial command.
- * @param[in] pReturnInfo The result of the command.
- */
-static void publishCommandCallback( MQTTAgentCommandContext_t * pCommandContext,
-                                    MQTTAgentReturnInfo_t * pReturnInfo );
-
-/**
- * @brief Called by the task to wait for a notification from a callback function
- * after the task first executes either MQTTAgent_Publish()* or
- * MQTTAgent_Subscribe().
- *
- * See https://freertos.org/mqtt/mqtt-agent-demo.html#example_mqtt_api_call
- *
- * @param[in] pCommandContext Context of the initial command.
- *
- * @return true if the task received a notification, otherwise false.
- */
-static bool waitForCommandAcknowledgment( uint32_t taskNumber );
-
-/**
- * @brief Passed into MQTTAgent_Subscribe() as the callback to execute when
+ * @brief Subscribed with AgentSubscriptions_Subscribe() as the callback to execute when
  * there is an incoming publish on the topic being subscribed to.  Its
  * implementation just logs information about the incoming publish including
  * the publish messages source topic and payload.
@@ -183,16 +139,13 @@ static void incomingPublishCallback( void * pIncomingPublishCallbackContext,
 /**
  * @brief Subscribe to the topic the demo task will also publish to - that
  * results in all outgoing publishes being published back to the task
- * (effectively echoed back).
+ * (effectively echoed back). The subscription uses the QoS the shared
+ * subscriptions were initialized with.
  *
- * @param[in] QoS The quality of service (QoS) to use.  Can be zero or one
- * for all MQTT brokers.  Can also be QoS2 if supported by the broker.  AWS IoT
- * does not support QoS2.
  * @param[in] pTopicFilter Topic filter to subscribe to.
  * @param[in] taskNumber Identifier for the task performing the subscribe.
  */
-static bool subscribeToTopic( MQTTQoS_t QoS,
-                              char * pTopicFilter,
+static bool subscribeToTopic( char * pTopicFilter,
                               uint32_t taskNumber );
 
 /**
@@ -215,6 +168,11 @@ static void simpleSubscribePublishTask( void * pParameters,
  */
 extern MQTTAgentContext_t globalMqttAgentContext;
 
+/**
+ * @brief The subscriptions shared by the demo tasks.
+ */
+extern AgentSubscriptions_t globalAgentSubscriptions;
+
 /*-----------------------------------------------------------*/
 
 /**
@@ -223,12 +181,6 @@ extern MQTTAgentContext_t globalMqttAgentContext;
  */
 struct k_thread simpleSubPubThreads[ NUM_SIMPLE_SUB_PUB_TASKS_TO_CREATE ];
 
-/**
- * @brief Semaphore to block at certain points of each thread's running to wait for publishes
- * and subscribes to complete.
- */
-static struct k_sem subPubSems[ NUM_SIMPLE_SUB_PUB_TASKS_TO_CREATE ];
-
 /**
  * @brief The buffer to hold the topic filter. The topic is generated at runtime
  * by adding the task names.
@@ -237,6 +189,23 @@ static struct k_sem subPubSems[ NUM_SIMPLE_SUB_PUB_TASKS_TO_CREATE ];
  */
 static char topicBuf[ NUM_SIMPLE_SUB_PUB_TASKS_TO_CREATE ][ STRING_BUFFER_LENGTH ];
 
+/**
+ * @brief Storage of the pool of publish buffers shared by the tasks.
+ */
+AGENT_PUBLISH_BUFFER_STORAGE_DEFINE( publishBufferStorage,
+                                     NUM_SIMPLE_SUB_PUB_TASKS_TO_CREATE * PUBLISH_BUFFERS_PER_TASK,
+                                     STRING_BUFFER_LENGTH );
+
+/**
+ * @brief The pool of publish buffers shared by the tasks.
+ */
+static AgentPublishBufferPool_t publishBufferPool;
+
+/**
+ * @brief Completion handles of the publishes of each task.
+ */
+static AgentCompletion_t publishCompletions[ NUM_SIMPLE_SUB_PUB_TASKS_TO_CREATE ][ PUBLISH_COUNT ];
+
 /*-----------------------------------------------------------*/
 
 /**
@@ -252,6 +221,14 @@ void StartSimpleSubscribePublishTask( uint32_t numberToCreate,
                                       struct SimplePubSubDemoParams * pParams )
 {
     uint32_t taskNumber;
+    bool poolInitialized = false;
+
+    poolInitialized = AgentPublishBuffer_InitPool( &publishBufferPool,
+                                                   publishBufferStorage,
+                                                   STRING_BUFFER_LENGTH,
+                                                   NUM_SIMPLE_SUB_PUB_TASKS_TO_CREATE * PUBLISH_BUFFERS_PER_TASK );
+    assert( poolInitialized );
+    ( void ) poolInitialized;
 
     /* Each instance of simpleSubscribePublishTask() generates a unique name
      * and topic filter for itself from the number passed in as the task
@@ -259,8 +236,6 @@ void StartSimpleSubscribePublishTask( uint32_t numberToCreate,
     /* Create a few instances of simpleSubscribePublishTask(). */
     for( taskNumber = 0; taskNumber < numberToCreate; taskNumber++ )
     {
-        k_sem_init( &( subPubSems[ taskNumber ] ), 0, 1 );
-
         pParams[ taskNumber ].taskNumber = taskNumber;
         pParams[ taskNumber ].success = false;
         k_thread_create( &( simpleSubPubThreads[ taskNumber ] ),
@@ -278,64 +253,6 @@ void StartSimpleSubscribePublishTask( uint32_t numberToCreate,
 
 /*-----------------------------------------------------------*/
 
-static void publishCommandCallback( MQTTAgentCommandContext_t * pCommandContext,
-                                    MQTTAgentReturnInfo_t * pReturnInfo )
-{
-    /* Store the result in the application defined context so the task that
-     * initiated the publish can check the operation's status. */
-    pCommandContext->returnStatus = pReturnInfo->returnCode;
-
-    k_sem_give( &( subPubSems[ pCommandContext->taskNum ] ) );
-}
-
-/*-----------------------------------------------------------*/
-
-static void subscribeCommandCallback( MQTTAgentCommandContext_t * pCommandContext,
-                                      MQTTAgentReturnInfo_t * pReturnInfo )
-{
-    bool subscriptionAdded = false;
-    MQTTAgentSubscribeArgs_t * pxSubscribeArgs = ( MQTTAgentSubscribeArgs_t * ) pCommandContext->pArgs;
-
-    /* Store the result in the application defined context so the task that
-     * initiated the subscribe can check the operation's status. */
-    pCommandContext->returnStatus = pReturnInfo->returnCode;
-
-    /* Check if the subscribe operation is a success. Only one topic is
-     * subscribed by this demo. */
-    if( pReturnInfo->returnCode == MQTTSuccess )
-    {
-        /* Add subscription so that incoming publishes are routed to the application
-         * callback. */
-        subscriptionAdded = addSubscription( ( SubscriptionElement_t * ) globalMqttAgentContext.pIncomingCallbackContext,
-                                             pxSubscribeArgs->pSubscribeInfo->pTopicFilter,
-                                             pxSubscribeArgs->pSubscribeInfo->topicFilterLength,
-                                             incomingPublishCallback,
-                                             NULL );
-
-        if( !subscriptionAdded )
-        {
-            LogError( ( "Failed to register an incoming publish callback for topic %.*s.",
-                        pxSubscribeArgs->pSubscribeInfo->topicFilterLength,
-                        pxSubscribeArgs->pSubscribeInfo->pTopicFilter ) );
-        }
-    }
-
-    k_sem_give( &( subPubSems[ pCommandContext->taskNum ] ) );
-}
-
-/*-----------------------------------------------------------*/
-
-static bool waitForCommandAcknowledgment( uint32_t taskNumber )
-{
-    bool returnStatus;
-
-    returnStatus = ( 0 == k_sem_take( &( subPubSems[ taskNumber ] ), K_MSEC( MS_TO_WAIT_FOR_NOTIFICATION ) ) );
-
-    return returnStatus;
-}
-
-/*-----------------------------------------------------------*/
-
 static void incomingPublishCallback( void * pIncomingPublishCallbackContext,
                                      MQTTPublishInfo_t * pPublishInfo )
 {
@@ -361,79 +278,36 @@ static void incomingPublishCallback( void * pIncomingPublishCallbackContext,
 
 /*-----------------------------------------------------------*/
 
-static bool subscribeToTopic( MQTTQoS_t QoS,
-                              char * pTopicFilter,
+static bool subscribeToTopic( char * pTopicFilter,
                               uint32_t taskNumber )
 {
-    MQTTStatus_t commandAdded;
-    bool commandAcknowledged = false;
-    uint32_t subscribeMessageID;
-    MQTTAgentSubscribeArgs_t subscribeArgs;
-    MQTTSubscribeInfo_t subscribeInfo;
-    static int32_t nextSubscribeMessageID = 0;
-    MQTTAgentCommandContext_t applicationDefinedContext = { 0 };
-    MQTTAgentCommandInfo_t commandParams = { 0 };
-
-    nextSubscribeMessageID++;
-    subscribeMessageID = nextSubscribeMessageID;
-
-    /* Complete the subscribe information.  The topic string must persist for
-     * duration of subscription! */
-    subscribeInfo.pTopicFilter = pTopicFilter;
-    subscribeInfo.topicFilterLength = ( uint16_t ) strlen( pTopicFilter );
-    subscribeInfo.qos = QoS;
-    subscribeArgs.pSubscribeInfo = &subscribeInfo;
-    subscribeArgs.numSubscriptions = 1;
-
-    /* Complete an application defined context associated with this subscribe message.
-     * This gets updated in the callback function so the variable must persist until
-     * the callback executes. */
-    applicationDefinedContext.notificationValue = subscribeMessageID;
-    applicationDefinedContext.taskNum = taskNumber;
-    applicationDefinedContext.pArgs = ( void * ) &subscribeArgs;
-
-    commandParams.blockTimeMs = MAX_COMMAND_SEND_BLOCK_TIME_MS;
-    commandParams.cmdCompleteCallback = subscribeCommandCallback;
-    commandParams.pCmdCompleteCallbackContext = ( void * ) &applicationDefinedContext;
-
-    /* The queue will not become full if the priority of the MQTT agent task is
-     * higher than the priority of the task calling this function. */
-    LogInfo( ( "Sending subscribe request to agent for topic filter: %s with id %d",
-               pTopicFilter,
-               ( int ) subscribeMessageID ) );
-
-    commandAdded = MQTTAgent_Subscribe( &globalMqttAgentContext,
-                                        &subscribeArgs,
-                                        &commandParams );
-
-    if( commandAdded == MQTTSuccess )
-    {
-        /* Wait for acks to the subscribe message - this is optional but done here
-         * so the code below can check the notification sent by the callback matches
-         * the nextSubscribeMessageID value set in the context above. */
-        commandAcknowledged = waitForCommandAcknowledgment( taskNumber );
-    }
-    else
-    {
-        LogError( ( "Failed to enqueue subscribe command." ) );
-    }
-
-    /* Check all ways the status was passed back just for demonstration
-     * purposes. */
-    if( ( commandAcknowledged != true ) ||
-        ( applicationDefinedContext.returnStatus != MQTTSuccess ) )
+    MQTTStatus_t mqttStatus;
+
+    /* Only the first task subscribing to the topic filter waits for a SUBACK.
+     * The subscription manager copies the topic filter. */
+    LogInfo( ( "Task %d subscribing to topic filter: %s",
+               ( int ) taskNumber,
+               pTopicFilter ) );
+
+    mqttStatus = AgentSubscriptions_Subscribe( &globalAgentSubscriptions,
+                                               pTopicFilter,
+                                               ( uint16_t ) strlen( pTopicFilter ),
+                                               incomingPublishCallback,
+                                               NULL,
+                                               MS_TO_WAIT_FOR_NOTIFICATION );
+
+    if( mqttStatus != MQTTSuccess )
     {
-        LogWarn( ( "Error or timed out waiting for ack to subscribe message topic %s",
-                   pTopicFilter ) );
+        LogWarn( ( "Error or timed out subscribing to topic %s: %s",
+                   pTopicFilter,
+                   MQTT_Status_strerror( mqttStatus ) ) );
     }
     else
     {
-        LogInfo( ( "Received subscribe ack for topic %s containing ID %d",
-                   pTopicFilter,
-                   ( int ) applicationDefinedContext.notificationValue ) );
+        LogInfo( ( "Subscribed to topic %s", pTopicFilter ) );
     }
 
-    return commandAcknowledged;
+    return( mqttStatus == MQTTSuccess );
 }
 
 /*-----------------------------------------------------------*/
@@ -442,18 +316,17 @@ static void simpleSubscribePublishTask( void * pParameters,
                                         void * b,
                                         void * c )
 {
-    MQTTPublishInfo_t publishInfo = { 0 };
-    char payloadBuf[ STRING_BUFFER_LENGTH ];
+    AgentPublishBuffer_t * pPublishBuffer = NULL;
+    char * pPayload = NULL;
     char taskName[ STRING_BUFFER_LENGTH ];
-    MQTTAgentCommandContext_t commandContext;
-    uint32_t valueToNotify = 0UL;
+    uint32_t publishNumber = 0UL;
     MQTTStatus_t commandAdded;
     struct SimplePubSubDemoParams * pParams = ( struct SimplePubSubDemoParams * ) pParameters;
     uint32_t taskNumber = pParams->taskNumber;
     MQTTQoS_t QoS;
-    MQTTAgentCommandInfo_t commandParams = { 0 };
     char * pTopicBuffer = topicBuf[ taskNumber ];
-    uint32_t numSuccesses = 0U;
+    AgentCompletion_t * pCompletions = publishCompletions[ taskNumber ];
+    size_t numPublishesQueued = 0U, numPublishesSucceeded = 0U;
 
     /* Have different tasks use different QoS.  0 and 1.  2 can also be used
      * if supported by the broker. */
@@ -469,83 +342,109 @@ static void simpleSubscribePublishTask( void * pParameters,
     /* Subscribe to the same topic to which this task will publish.  That will
      * result in each published message being published from the server back to
      * the target. */
-    subscribeToTopic( QoS, pTopicBuffer, taskNumber );
-
-    /* Configure the publish operation. */
-    memset( ( void * ) &publishInfo, 0x00, sizeof( publishInfo ) );
-    publishInfo.qos = QoS;
-    publishInfo.pTopicName = pTopicBuffer;
-    publishInfo.topicNameLength = ( uint16_t ) strlen( pTopicBuffer );
-    publishInfo.pPayload = payloadBuf;
-
-    /* Store the handler to this task in the command context so the callback
-     * that executes when the command is acknowledged can send a notification
-     * back to this task. */
-    memset( ( void * ) &commandContext, 0x00, sizeof( commandContext ) );
-    commandContext.taskNum = taskNumber;
-
-    commandParams.blockTimeMs = MAX_COMMAND_SEND_BLOCK_TIME_MS;
-    commandParams.cmdCompleteCallback = publishCommandCallback;
-    commandParams.pCmdCompleteCallbackContext = &commandContext;
+    subscribeToTopic( pTopicBuffer, taskNumber );
 
     /* For a finite number of publishes... */
-    for( valueToNotify = 0UL; valueToNotify < PUBLISH_COUNT; valueToNotify++ )
+    for( publishNumber = 0UL; publishNumber < PUBLISH_COUNT; publishNumber++ )
     {
-        /* Create a payload to send with the publish message.  This contains
-         * the task name and an incrementing number. */
-        snprintf( payloadBuf,
-                  STRING_BUFFER_LENGTH,
-                  "%s publishing message %d",
-                  taskName,
-                  ( int ) valueToNotify );
-
-        publishInfo.payloadLength = ( uint16_t ) strlen( payloadBuf );
-
-        /* Also store the incrementing number in the command context so it can
-         * be accessed by the callback that executes when the publish operation
-         * is acknowledged. */
-        commandContext.notificationValue = valueToNotify;
-
-        LogInfo( ( "Sending publish request to agent with message \"%s\" on topic \"%s\"",
-                   payloadBuf,
-                   pTopicBuffer ) );
-
-        commandAdded = MQTTAgent_Publish( &globalMqttAgentContext,
-                                          &publishInfo,
-                                          &commandParams );
-
-        if( commandAdded == MQTTSuccess )
+        /* Wait for a buffer of a previous publish to be released if the pool
+         * is exhausted. */
+        pPublishBuffer = AgentPublishBuffer_Allocate( &publishBufferPool, MAX_COMMAND_SEND_BLOCK_TIME_MS );
+
+        if( pPublishBuffer == NULL )
         {
-            /* For QoS 1 and 2, wait for the publish acknowledgment.  For QoS0,
-             * wait for the publish to be sent. */
-            LogInfo( ( "Task %s waiting for publish %d to complete.",
-                       taskName,
-                       valueToNotify ) );
-            waitForCommandAcknowledgment( taskNumber );
+            LogError( ( "Task %s could not get a publish buffer.", taskName ) );
         }
         else
         {
-            LogError( ( "Failed to enqueue publish command. Error code=%s", MQTT_Status_strerror( commandAdded ) ) );
+            /* Create the payload in place in the buffer.  This contains the
+             * task name and an incrementing number. */
+            pPayload = ( char * ) AgentPublishBuffer_GetPayload( pPublishBuffer );
+            snprintf( pPayload,
+                      AgentPublishBuffer_GetCapacity( pPublishBuffer ),
+                      "%s publishing message %d",
+                      taskName,
+                      ( int ) publishNumber );
+
+            /* Configure the publish operation. */
+            pPublishBuffer->publishInfo.qos = QoS;
+            pPublishBuffer->publishInfo.pTopicName = pTopicBuffer;
+            pPublishBuffer->publishInfo.topicNameLength = ( uint16_t ) strlen( pTopicBuffer );
+            pPublishBuffer->publishInfo.payloadLength = ( uint16_t ) strlen( pPayload );
+
+            LogInfo( ( "Sending publish request to agent with message \"%s\" on topic \"%s\"",
+                       pPayload,
+                       pTopicBuffer ) );
+
+            AgentCompletion_Init( &pCompletions[ numPublishesQueued ] );
+
+            /* The buffer belongs to the agent from here, which returns it to
+             * the pool once the publish completes.  QoS0 publishes take the
+             * fast path, which needs no command structure from the agent's
+             * pool and reports no completion. */
+            if( QoS == MQTTQoS0 )
+            {
+                commandAdded = AgentPublishBuffer_PublishQoS0( &globalMqttAgentContext,
+                                                               pPublishBuffer,
+                                                               MAX_COMMAND_SEND_BLOCK_TIME_MS );
+
+                if( commandAdded == MQTTSuccess )
+                {
+                    AgentCompletion_Complete( &pCompletions[ numPublishesQueued ], MQTTSuccess );
+                }
+            }
+            else
+            {
+                commandAdded = AgentPublishBuffer_Publish( &globalMqttAgentContext,
+                                                           pPublishBuffer,
+                                                           MAX_COMMAND_SEND_BLOCK_TIME_MS,
+                                                           AgentCompletion_Complete,
+                                                           &pCompletions[ numPublishesQueued ] );
+            }
+
+            if( commandAdded == MQTTSuccess )
+            {
+                numPublishesQueued++;
+            }
+            else
+            {
+                LogError( ( "Failed to enqueue publish command. Error code=%s", MQTT_Status_strerror( commandAdded ) ) );
+            }
         }
 
-        /* The value received by the callback that executed when the publish was
-         * completed came from the context passed into MQTTAgent_Publish() above,
-         * so should match the value set in the context above. */
-        numSuccesses++;
-        /* Log statement to indicate successful reception of publish. */
-        LogInfo( ( "Publish %d completed successfully.\r\n", valueToNotify ) );
-
         LogInfo( ( "Short delay before next publish... \r\n\r\n" ) );
 
         k_sleep( K_MSEC( DELAY_BETWEEN_PUBLISH_OPERATIONS_MS ) );
     }
 
+    /* Wait for the publishes still in flight to complete. */
+    ( void ) AgentCompletion_WaitAll( pCompletions,
+                                      numPublishesQueued,
+                                      MS_TO_WAIT_FOR_NOTIFICATION,
+                                      &numPublishesSucceeded );
+
     /* Mark this task as successful if every publish was successfully completed. */
-    if( numSuccesses == PUBLISH_COUNT )
+    if( numPublishesSucceeded == PUBLISH_COUNT )
     {
         pParams->success = true;
         LogInfo( ( "Task %s successful.", taskName ) );
     }
+    else
+    {
+        LogError( ( "Task %s completed %d of %d publishes.",
+                    taskName,
+                    ( int ) numPublishesSucceeded,
+                    ( int ) PUBLISH_COUNT ) );
+    }
+
+    /* Leave the topic filter. The UNSUBSCRIBE is only sent once no other task
+     * is subscribed to it. */
+    ( void ) AgentSubscriptions_Unsubscribe( &globalAgentSubscriptions,
+                                             pTopicBuffer,
+                                             ( uint16_t ) strlen( pTopicBuffer ),
+                                             incomingPublishCallback,
+                                             NULL,
+                                             MS_TO_WAIT_FOR_NOTIFICATION );
 
     /* Task will terminate itself after returning from entry (this) function. */
 }
@@ -0,0 +1,773 @@
+/*
+ * AWS IoT Device Embedded C SDK for ZephyrRTOS
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Checks the topic matching of the subscription manager against a reference
+ * MQTT matcher. Random subscriptions are added and released, and random topics
+ * are matched against both. Every subscription must be reported exactly when
+ * the reference matcher matches its topic filter, and once per topic.
+ *
+ * The check then times the matching of topics against lists of 10 to 10,000
+ * subscriptions, and against the same topic filters scanned one after the
+ * other with the reference matcher, as an array of subscriptions would.
+ *
+ * No network is needed. Build and run it on the host with:
+ *
+ *     west build -b native_posix demos/mqtt_agent/subscription_manager_check
+ *     west build -t run
+ *
+ * The check logs the time of a match for each number of subscriptions, then
+ * "PASS", or the first mismatches and "FAIL".
+ */
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Kernel includes. */
+#include <zephyr.h>
+
+/* Logging configuration of the check. */
+#include "logging_levels.h"
+
+#ifndef LIBRARY_LOG_NAME
+    #define LIBRARY_LOG_NAME     "SubscriptionManagerCheck"
+#endif
+#ifndef LIBRARY_LOG_LEVEL
+    #define LIBRARY_LOG_LEVEL    LOG_INFO
+#endif
+
+#include "logging_stack.h"
+
+/* Subscription manager include. */
+#include "subscription_manager.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Size of the region the subscription list is stored in. Small enough
+ * for the list to fill up now and then, so full lists are checked as well.
+ */
+#define CHECK_STORAGE_SIZE          ( 2048U )
+
+/**
+ * @brief Number of subscriptions the model tracks.
+ */
+#define CHECK_MAX_SUBSCRIPTIONS     ( 64U )
+
+/**
+ * @brief Maximum number of levels of the random topics and topic filters.
+ */
+#define CHECK_MAX_LEVELS            ( 5U )
+
+/**
+ * @brief Size of the buffers of the random topics and topic filters.
+ */
+#define CHECK_MAX_STRING_LENGTH     ( 64U )
+
+/**
+ * @brief Number of random operations, each followed by a random topic.
+ */
+#define CHECK_ITERATIONS            ( 100000U )
+
+/**
+ * @brief Number of mismatches logged before the check gives up.
+ */
+#define CHECK_MAX_REPORTED_ERRORS   ( 8U )
+
+/**
+ * @brief Largest number of subscriptions of the matching benchmark.
+ */
+#define BENCHMARK_MAX_SUBSCRIPTIONS    ( 10000U )
+
+/**
+ * @brief Number of topics matched for each number of subscriptions.
+ */
+#define BENCHMARK_LOOKUPS              ( 10000U )
+
+/**
+ * @brief One subscription in this many has a wildcard.
+ */
+#define BENCHMARK_WILDCARD_INTERVAL    ( 8U )
+
+/**
+ * @brief Size of the buffers of the topics and topic filters of the benchmark.
+ */
+#define BENCHMARK_STRING_LENGTH        ( 24U )
+
+/**
+ * @brief Size of the region the subscription list of the benchmark is stored
+ * in. Its topic filters have two levels of up to 6 characters of their own,
+ * after the level they all share.
+ */
+#define BENCHMARK_STORAGE_SIZE         SUBSCRIPTION_MANAGER_STORAGE_SIZE( BENCHMARK_MAX_SUBSCRIPTIONS + 1U, 2U, 6U )
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief A subscription of the model. Its address is the context of its
+ * callback, so that it is reported on its own.
+ */
+typedef struct CheckSubscription
+{
+    char topicFilter[ CHECK_MAX_STRING_LENGTH ]; /**< @brief The topic filter. */
+    uint16_t topicFilterLength;                  /**< @brief Length of the topic filter. */
+    bool isSubscribed;                           /**< @brief Whether the subscription is in the list. */
+    uint32_t numReports;                         /**< @brief Times the subscription was reported for the topic. */
+} CheckSubscription_t;
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Get a pseudo-random number, the same sequence on every run.
+ *
+ * @param[in] bound Upper bound of the number.
+ *
+ * @return A number less than @p bound.
+ */
+static uint32_t getRandom( uint32_t bound );
+
+/**
+ * @brief Build a random topic or topic filter.
+ *
+ * Levels are drawn from a small set, so that topics and topic filters often
+ * share levels, and include empty levels and levels starting with `$`.
+ *
+ * @param[in] isFilter Build a topic filter, with wildcards, if `true`.
+ * @param[out] pBuffer Buffer of #CHECK_MAX_STRING_LENGTH bytes.
+ *
+ * @return Length of the topic or topic filter.
+ */
+static uint16_t buildRandomString( bool isFilter,
+                                   char * pBuffer );
+
+/**
+ * @brief Reference MQTT matcher, written straight from the MQTT 3.1.1
+ * specification.
+ *
+ * @param[in] pTopic The topic.
+ * @param[in] topicLength Length of the topic.
+ * @param[in] pTopicFilter The topic filter.
+ * @param[in] topicFilterLength Length of the topic filter.
+ *
+ * @return `true` if the topic filter matches the topic; `false` otherwise.
+ */
+static bool referenceMatch( const char * pTopic,
+                            uint16_t topicLength,
+                            const char * pTopicFilter,
+                            uint16_t topicFilterLength );
+
+/**
+ * @brief Match callback counting the reports of each subscription.
+ *
+ * @param[in] pMatchContext Unused.
+ * @param[in] pSubscription The matching subscription.
+ */
+static void countReport( void * pMatchContext,
+                         const SubscriptionElement_t * pSubscription );
+
+/**
+ * @brief Incoming publish callback of the subscriptions, never called.
+ *
+ * @param[in] pContext Unused.
+ * @param[in] pPublishInfo Unused.
+ */
+static void incomingPublishCallback( void * pContext,
+                                     MQTTPublishInfo_t * pPublishInfo );
+
+/**
+ * @brief Add or release a random subscription of the model.
+ *
+ * @return `true` if the subscription list behaved as expected; `false`
+ * otherwise.
+ */
+static bool changeRandomSubscription( void );
+
+/**
+ * @brief Match a random topic against the subscription list and the model.
+ *
+ * @return `true` if both match the same subscriptions; `false` otherwise.
+ */
+static bool checkRandomTopic( void );
+
+/**
+ * @brief Get the time in microseconds. Simulated time does not advance while
+ * code runs on native_posix, so the host clock is used there.
+ *
+ * @return The time.
+ */
+static uint64_t getTimeUs( void );
+
+/**
+ * @brief Match callback counting the matches of the benchmark.
+ *
+ * @param[in] pMatchContext Counter of the matches.
+ * @param[in] pSubscription Unused.
+ */
+static void countBenchmarkMatch( void * pMatchContext,
+                                 const SubscriptionElement_t * pSubscription );
+
+/**
+ * @brief Time the matching of topics against a number of subscriptions, in
+ * the subscription list and with a scan of their topic filters.
+ *
+ * Every topic matches exactly one subscription, which both count.
+ *
+ * @param[in] numSubscriptions Number of subscriptions.
+ *
+ * @return `true` if both found every match; `false` otherwise.
+ */
+static bool runMatchBenchmark( uint32_t numSubscriptions );
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Levels the random topics and topic filters are built from. The
+ * wildcards are only used in topic filters, and come last.
+ */
+static const char * const levels[] = { "a", "bc", "", "$sys", "d", "+", "#" };
+
+/**
+ * @brief Number of levels that are not wildcards.
+ */
+#define NUM_TOPIC_LEVELS    ( 5U )
+
+/**
+ * @brief State of the pseudo-random number generator.
+ */
+static uint32_t randomState = 1U;
+
+/**
+ * @brief The subscriptions of the model.
+ */
+static CheckSubscription_t subscriptions[ CHECK_MAX_SUBSCRIPTIONS ];
+
+/**
+ * @brief The subscription list checked.
+ */
+static SubscriptionList_t subscriptionList;
+
+/**
+ * @brief Region the subscription list is stored in.
+ */
+SUBSCRIPTION_MANAGER_STORAGE_DEFINE( subscriptionStorage, CHECK_STORAGE_SIZE );
+
+/**
+ * @brief The subscription list of the benchmark.
+ */
+static SubscriptionList_t benchmarkList;
+
+/**
+ * @brief Region the subscription list of the benchmark is stored in.
+ */
+SUBSCRIPTION_MANAGER_STORAGE_DEFINE( benchmarkStorage, BENCHMARK_STORAGE_SIZE );
+
+/**
+ * @brief The topic filters of the benchmark, as an array of subscriptions
+ * stores them.
+ */
+static char benchmarkFilters[ BENCHMARK_MAX_SUBSCRIPTIONS ][ BENCHMARK_STRING_LENGTH ];
+
+/**
+ * @brief Lengths of #benchmarkFilters.
+ */
+static uint16_t benchmarkFilterLengths[ BENCHMARK_MAX_SUBSCRIPTIONS ];
+
+/**
+ * @brief The topics matched by the benchmark.
+ */
+static char benchmarkTopics[ BENCHMARK_LOOKUPS ][ BENCHMARK_STRING_LENGTH ];
+
+/**
+ * @brief Lengths of #benchmarkTopics.
+ */
+static uint16_t benchmarkTopicLengths[ BENCHMARK_LOOKUPS ];
+
+#if defined( CONFIG_BOARD_NATIVE_POSIX )
+
+/**
+ * @brief Layout of the time value of the host C library, which native_posix
+ * executables are linked with.
+ */
+    struct HostTimespec
+    {
+        long seconds;     /**< @brief Seconds. */
+        long nanoseconds; /**< @brief Nanoseconds. */
+    };
+
+/**
+ * @brief clock_gettime of the host C library.
+ */
+    extern int clock_gettime( int clockId,
+                              struct HostTimespec * pTime );
+
+/**
+ * @brief CLOCK_MONOTONIC of the host.
+ */
+    #define HOST_CLOCK_MONOTONIC    ( 1 )
+#endif
+
+/*-----------------------------------------------------------*/
+
+static uint32_t getRandom( uint32_t bound )
+{
+    /* xorshift32. */
+    randomState ^= randomState << 13U;
+    randomState ^= randomState >> 17U;
+    randomState ^= randomState << 5U;
+
+    return randomState % bound;
+}
+/*-----------------------------------------------------------*/
+
+static uint16_t buildRandomString( bool isFilter,
+                                   char * pBuffer )
+{
+    uint32_t numLevels = 1U + getRandom( CHECK_MAX_LEVELS );
+    uint32_t level = 0U;
+    size_t levelIndex = 0U;
+    size_t levelLength = 0U;
+    uint16_t length = 0U;
+
+    for( level = 0U; level < numLevels; level++ )
+    {
+        levelIndex = getRandom( isFilter ? ( sizeof( levels ) / sizeof( levels[ 0 ] ) ) : NUM_TOPIC_LEVELS );
+
+        /* `#` is only valid as the last level. */
+        if( ( levels[ levelIndex ][ 0 ] == '#' ) && ( level + 1U < numLevels ) )
+        {
+            levelIndex = 0U;
+        }
+
+        if( level > 0U )
+        {
+            pBuffer[ length ] = '/';
+            length++;
+        }
+
+        levelLength = strlen( levels[ levelIndex ] );
+        memcpy( &( pBuffer[ length ] ), levels[ levelIndex ], levelLength );
+        length += ( uint16_t ) levelLength;
+    }
+
+    return length;
+}
+/*-----------------------------------------------------------*/
+
+static bool referenceMatch( const char * pTopic,
+                            uint16_t topicLength,
+                            const char * pTopicFilter,
+                            uint16_t topicFilterLength )
+{
+    uint16_t topicIndex = 0U;
+    uint16_t filterIndex = 0U;
+    uint16_t topicEnd = 0U;
+    uint16_t filterEnd = 0U;
+    bool isMatch = false;
+    bool isDone = false;
+
+    /* Wildcards at the first level do not match topics starting with `$`. */
+    if( ( topicLength > 0U ) &&
+        ( pTopic[ 0 ] == '$' ) &&
+        ( ( pTopicFilter[ 0 ] == '+' ) || ( pTopicFilter[ 0 ] == '#' ) ) )
+    {
+        isDone = true;
+    }
+
+    while( !isDone )
+    {
+        topicEnd = topicIndex;
+
+        while( ( topicEnd < topicLength ) && ( pTopic[ topicEnd ] != '/' ) )
+        {
+            topicEnd++;
+        }
+
+        filterEnd = filterIndex;
+
+        while( ( filterEnd < topicFilterLength ) && ( pTopicFilter[ filterEnd ] != '/' ) )
+        {
+            filterEnd++;
+        }
+
+        if( ( filterEnd - filterIndex == 1U ) && ( pTopicFilter[ filterIndex ] == '#' ) )
+        {
+            /* `#` matches the remaining levels. */
+            isMatch = true;
+            isDone = true;
+        }
+        else if( ( ( filterEnd - filterIndex != 1U ) || ( pTopicFilter[ filterIndex ] != '+' ) ) &&
+                 ( ( filterEnd - filterIndex != topicEnd - topicIndex ) ||
+                   ( memcmp( &( pTopicFilter[ filterIndex ] ), &( pTopic[ topicIndex ] ), filterEnd - filterIndex ) != 0 ) ) )
+        {
+            isDone = true;
+        }
+        else if( ( topicEnd == topicLength ) && ( filterEnd == topicFilterLength ) )
+        {
+            isMatch = true;
+            isDone = true;
+        }
+        else if( topicEnd == topicLength )
+        {
+            /* A topic filter ending with `/#` also matches the parent level. */
+            isMatch = ( topicFilterLength - filterEnd == 2U ) &&
+                      ( pTopicFilter[ filterEnd + 1U ] == '#' );
+            isDone = true;
+        }
+        else if( filterEnd == topicFilterLength )
+        {
+            isDone = true;
+        }
+        else
+        {
+            topicIndex = topicEnd + 1U;
+            filterIndex = filterEnd + 1U;
+        }
+    }
+
+    return isMatch;
+}
+/*-----------------------------------------------------------*/
+
+static void countReport( void * pMatchContext,
+                         const SubscriptionElement_t * pSubscription )
+{
+    CheckSubscription_t * pCheckSubscription = ( CheckSubscription_t * ) pSubscription->pIncomingPublishCallbackContext;
+
+    ( void ) pMatchContext;
+
+    pCheckSubscription->numReports++;
+}
+/*-----------------------------------------------------------*/
+
+static void incomingPublishCallback( void * pContext,
+                                     MQTTPublishInfo_t * pPublishInfo )
+{
+    ( void ) pContext;
+    ( void ) pPublishInfo;
+}
+/*-----------------------------------------------------------*/
+
+static bool changeRandomSubscription( void )
+{
+    CheckSubscription_t * pSubscription = &( subscriptions[ getRandom( CHECK_MAX_SUBSCRIPTIONS ) ] );
+    size_t index = 0U;
+    bool isFirst = false;
+    bool isLast = false;
+    bool isShared = false;
+    bool isExpected = true;
+
+    if( pSubscription->isSubscribed )
+    {
+        pSubscription->isSubscribed = false;
+
+        for( index = 0U; index < CHECK_MAX_SUBSCRIPTIONS; index++ )
+        {
+            isShared = isShared ||
+                       ( subscriptions[ index ].isSubscribed &&
+                         ( subscriptions[ index ].topicFilterLength == pSubscription->topicFilterLength ) &&
+                         ( memcmp( subscriptions[ index ].topicFilter, pSubscription->topicFilter, pSubscription->topicFilterLength ) == 0 ) );
+        }
+
+        isExpected = releaseSubscription( &subscriptionList,
+                                          pSubscription->topicFilter,
+                                          pSubscription->topicFilterLength,
+                                          incomingPublishCallback,
+                                          pSubscription,
+                                          &isLast ) &&
+                     ( isLast != isShared );
+    }
+    else
+    {
+        pSubscription->topicFilterLength = buildRandomString( true, pSubscription->topicFilter );
+
+        for( index = 0U; index < CHECK_MAX_SUBSCRIPTIONS; index++ )
+        {
+            isShared = isShared ||
+                       ( subscriptions[ index ].isSubscribed &&
+                         ( subscriptions[ index ].topicFilterLength == pSubscription->topicFilterLength ) &&
+                         ( memcmp( subscriptions[ index ].topicFilter, pSubscription->topicFilter, pSubscription->topicFilterLength ) == 0 ) );
+        }
+
+        /* A full list is expected now and then, and leaves the model as is. */
+        if( acquireSubscription( &subscriptionList,
+                                 pSubscription->topicFilter,
+                                 pSubscription->topicFilterLength,
+                                 incomingPublishCallback,
+                                 pSubscription,
+                                 &isFirst ) )
+        {
+            pSubscription->isSubscribed = true;
+            isExpected = ( isFirst != isShared );
+        }
+    }
+
+    if( !isExpected )
+    {
+        LogError( ( "Unexpected reference count of topic filter %.*s.",
+                    pSubscription->topicFilterLength,
+                    pSubscription->topicFilter ) );
+    }
+
+    return isExpected;
+}
+/*-----------------------------------------------------------*/
+
+static bool checkRandomTopic( void )
+{
+    MQTTPublishInfo_t publishInfo = { 0 };
+    char topic[ CHECK_MAX_STRING_LENGTH ];
+    size_t index = 0U;
+    size_t numExpected = 0U;
+    bool isExpected = false;
+    bool isReported = false;
+    bool isConsistent = true;
+
+    /* Topic names are never empty. */
+    do
+    {
+        publishInfo.topicNameLength = buildRandomString( false, topic );
+    } while( publishInfo.topicNameLength == 0U );
+
+    publishInfo.pTopicName = topic;
+
+    for( index = 0U; index < CHECK_MAX_SUBSCRIPTIONS; index++ )
+    {
+        subscriptions[ index ].numReports = 0U;
+    }
+
+    isReported = forEachMatchingSubscription( &subscriptionList, &publishInfo, countReport, NULL );
+
+    for( index = 0U; index < CHECK_MAX_SUBSCRIPTIONS; index++ )
+    {
+        if( subscriptions[ index ].isSubscribed &&
+            referenceMatch( topic,
+                            publishInfo.topicNameLength,
+                            subscriptions[ index ].topicFilter,
+                            subscriptions[ index ].topicFilterLength ) )
+        {
+            numExpected++;
+        }
+    }
+
+    /* Past the match limit, only the reported subscriptions can be checked. */
+    for( index = 0U; ( index < CHECK_MAX_SUBSCRIPTIONS ) && isConsistent; index++ )
+    {
+        isExpected = subscriptions[ index ].isSubscribed &&
+                     referenceMatch( topic,
+                                     publishInfo.topicNameLength,
+                                     subscriptions[ index ].topicFilter,
+                                     subscriptions[ index ].topicFilterLength );
+
+        if( isExpected && ( numExpected <= SUBSCRIPTION_MANAGER_MAX_MATCHES ) )
+        {
+            isConsistent = ( subscriptions[ index ].numReports == 1U );
+        }
+        else if( isExpected )
+        {
+            isConsistent = ( subscriptions[ index ].numReports <= 1U );
+        }
+        else
+        {
+            isConsistent = ( subscriptions[ index ].numReports == 0U );
+        }
+
+        if( !isConsistent )
+        {
+            LogError( ( "Topic %.*s reported topic filter %.*s %u times, expected %u.",
+                        publishInfo.topicNameLength,
+                        topic,
+                        subscriptions[ index ].topicFilterLength,
+                        subscriptions[ index ].topicFilter,
+                        ( unsigned int ) subscriptions[ index ].numReports,
+                        isExpected ? 1U : 0U ) );
+        }
+    }
+
+    if( isConsistent && ( isReported != ( numExpected > 0U ) ) )
+    {
+        LogError( ( "Topic %.*s matched %u topic filters, but reported %s.",
+                    publishInfo.topicNameLength,
+                    topic,
+                    ( unsigned int ) numExpected,
+                    isReported ? "a match" : "none" ) );
+        isConsistent = false;
+    }
+
+    return isConsistent;
+}
+/*-----------------------------------------------------------*/
+
+static uint64_t getTimeUs( void )
+{
+    uint64_t timeUs = 0U;
+
+    #if defined( CONFIG_BOARD_NATIVE_POSIX )
+        struct HostTimespec hostTime = { 0 };
+
+        ( void ) clock_gettime( HOST_CLOCK_MONOTONIC, &hostTime );
+        timeUs = ( ( uint64_t ) hostTime.seconds * 1000000U ) + ( ( uint64_t ) hostTime.nanoseconds / 1000U );
+    #else
+        timeUs = ( uint64_t ) k_uptime_get() * 1000U;
+    #endif
+
+    return timeUs;
+}
+/*-----------------------------------------------------------*/
+
+static void countBenchmarkMatch( void * pMatchContext,
+                                 const SubscriptionElement_t * pSubscription )
+{
+    ( void ) pSubscription;
+
+    ( *( ( uint32_t * ) pMatchContext ) )++;
+}
+/*-----------------------------------------------------------*/
+
+static bool runMatchBenchmark( uint32_t numSubscriptions )
+{
+    MQTTPublishInfo_t publishInfo = { 0 };
+    uint32_t index = 0U;
+    uint32_t lookup = 0U;
+    uint32_t numListMatches = 0U;
+    uint32_t numScanMatches = 0U;
+    uint64_t startTimeUs = 0U;
+    uint64_t listTimeUs = 0U;
+    uint64_t scanTimeUs = 0U;
+    bool isAdded = initSubscriptionList( &benchmarkList, benchmarkStorage, sizeof( benchmarkStorage ) );
+
+    for( index = 0U; ( index < numSubscriptions ) && isAdded; index++ )
+    {
+        benchmarkFilterLengths[ index ] = ( uint16_t ) snprintf( benchmarkFilters[ index ],
+                                                                 BENCHMARK_STRING_LENGTH,
+                                                                 ( ( index % BENCHMARK_WILDCARD_INTERVAL ) == 0U ) ? "device/%u/+" : "device/%u/status",
+                                                                 ( unsigned int ) index );
+        isAdded = addSubscription( &benchmarkList,
+                                   benchmarkFilters[ index ],
+                                   benchmarkFilterLengths[ index ],
+                                   incomingPublishCallback,
+                                   NULL );
+    }
+
+    if( !isAdded )
+    {
+        LogError( ( "Failed to add subscription %u of the benchmark.", ( unsigned int ) index ) );
+    }
+    else
+    {
+        for( lookup = 0U; lookup < BENCHMARK_LOOKUPS; lookup++ )
+        {
+            benchmarkTopicLengths[ lookup ] = ( uint16_t ) snprintf( benchmarkTopics[ lookup ],
+                                                                     BENCHMARK_STRING_LENGTH,
+                                                                     "device/%u/status",
+                                                                     ( unsigned int ) getRandom( numSubscriptions ) );
+        }
+
+        startTimeUs = getTimeUs();
+
+        for( lookup = 0U; lookup < BENCHMARK_LOOKUPS; lookup++ )
+        {
+            publishInfo.pTopicName = benchmarkTopics[ lookup ];
+            publishInfo.topicNameLength = benchmarkTopicLengths[ lookup ];
+            ( void ) forEachMatchingSubscription( &benchmarkList, &publishInfo, countBenchmarkMatch, &numListMatches );
+        }
+
+        listTimeUs = getTimeUs() - startTimeUs;
+        startTimeUs = getTimeUs();
+
+        for( lookup = 0U; lookup < BENCHMARK_LOOKUPS; lookup++ )
+        {
+            for( index = 0U; index < numSubscriptions; index++ )
+            {
+                if( referenceMatch( benchmarkTopics[ lookup ],
+                                    benchmarkTopicLengths[ lookup ],
+                                    benchmarkFilters[ index ],
+                                    benchmarkFilterLengths[ index ] ) )
+                {
+                    numScanMatches++;
+                }
+            }
+        }
+
+        scanTimeUs = getTimeUs() - startTimeUs;
+
+        LogInfo( ( "%u subscriptions: %u ns per match in the list, %u ns per match with a scan.",
+                   ( unsigned int ) numSubscriptions,
+                   ( unsigned int ) ( ( listTimeUs * 1000U ) / BENCHMARK_LOOKUPS ),
+                   ( unsigned int ) ( ( scanTimeUs * 1000U ) / BENCHMARK_LOOKUPS ) ) );
+
+        if( ( numListMatches != BENCHMARK_LOOKUPS ) || ( numScanMatches != BENCHMARK_LOOKUPS ) )
+        {
+            LogError( ( "The list matched %u topics and the scan %u, expected %u.",
+                        ( unsigned int ) numListMatches,
+                        ( unsigned int ) numScanMatches,
+                        ( unsigned int ) BENCHMARK_LOOKUPS ) );
+        }
+    }
+
+    return isAdded && ( numListMatches == BENCHMARK_LOOKUPS ) && ( numScanMatches == BENCHMARK_LOOKUPS );
+}
+/*-----------------------------------------------------------*/
+
+void main( void )
+{
+    uint32_t iteration = 0U;
+    uint32_t numErrors = 0U;
+    uint32_t numChecks = 0U;
+    uint32_t numSubscriptions = 0U;
+
+    if( !initSubscriptionList( &subscriptionList, subscriptionStorage, sizeof( subscriptionStorage ) ) )
+    {
+        LogError( ( "Failed to initialize the subscription list." ) );
+        numErrors++;
+    }
+
+    for( iteration = 0U; ( iteration < CHECK_ITERATIONS ) && ( numErrors < CHECK_MAX_REPORTED_ERRORS ); iteration++ )
+    {
+        if( !changeRandomSubscription() )
+        {
+            numErrors++;
+        }
+
+        if( !checkRandomTopic() )
+        {
+            numErrors++;
+        }
+
+        numChecks++;
+    }
+
+    for( numSubscriptions = 10U; ( numSubscriptions <= BENCHMARK_MAX_SUBSCRIPTIONS ) && ( numErrors == 0U ); numSubscriptions *= 10U )
+    {
+        if( !runMatchBenchmark( numSubscriptions ) )
+        {
+            numErrors++;
+        }
+    }
+
+    LogInfo( ( "%u topics checked, %u mismatches: %s",
+               ( unsigned int ) numChecks,
+               ( unsigned int ) numErrors,
+               ( numErrors == 0U ) ? "PASS" : "FAIL" ) );
+}
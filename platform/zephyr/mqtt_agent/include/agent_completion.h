@@ -0,0 +1,180 @@
+/*
+ * AWS IoT Device Embedded C SDK for ZephyrRTOS
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file agent_completion.h
+ * @brief Completion handles of commands sent to the MQTT agent, which a task
+ * can await one at a time or in groups. Requires CONFIG_POLL.
+ *
+ * A handle is given as the completion context of a command, with
+ * #AgentCompletion_CommandCallback as its callback, or of a publish buffer,
+ * with #AgentCompletion_Complete. A task may then keep many commands in
+ * flight and wait for any or all of them, instead of waiting after each one.
+ */
+#ifndef AGENT_COMPLETION_H
+#define AGENT_COMPLETION_H
+
+/**************************************************/
+/******* DO NOT CHANGE the following order ********/
+/**************************************************/
+
+/* Logging related header files are required to be included in the following order:
+ * 1. Include the header file "logging_levels.h".
+ * 2. Define LIBRARY_LOG_NAME and  LIBRARY_LOG_LEVEL.
+ * 3. Include the header file "logging_stack.h".
+ */
+
+/* Include header that defines log levels. */
+#include "logging_levels.h"
+
+/* Logging configuration for the Agent Completion module. */
+#ifndef LIBRARY_LOG_NAME
+    #define LIBRARY_LOG_NAME     "Agent Completion"
+#endif
+#ifndef LIBRARY_LOG_LEVEL
+    #define LIBRARY_LOG_LEVEL    LOG_ERROR
+#endif
+
+#include "logging_stack.h"
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Kernel Header */
+#include <zephyr.h>
+
+/* coreMQTT Agent include. */
+#include "core_mqtt_agent.h"
+
+/**
+ * @brief Largest number of handles #AgentCompletion_WaitAny waits for at once.
+ * Each costs a `struct k_poll_event` on the stack of the caller.
+ */
+#ifndef AGENT_COMPLETION_MAX_WAIT_ANY
+    #define AGENT_COMPLETION_MAX_WAIT_ANY    ( 8U )
+#endif
+
+/**
+ * @brief Returned by #AgentCompletion_WaitAny when no handle completed in time.
+ */
+#define AGENT_COMPLETION_NONE    ( SIZE_MAX )
+
+/**
+ * @brief Completion handle of a command.
+ */
+typedef struct AgentCompletion
+{
+    struct k_poll_signal signal; /**< @brief Raised with the status of the command when it completes. */
+} AgentCompletion_t;
+
+/**
+ * @brief Prepare a handle for a new command.
+ *
+ * @param[out] pCompletion The handle.
+ */
+void AgentCompletion_Init( AgentCompletion_t * pCompletion );
+
+/**
+ * @brief Set the completion callback of a command to complete a handle.
+ *
+ * @param[in] pCompletion The handle, initialized with #AgentCompletion_Init.
+ * @param[out] pCommandInfo The command information to set.
+ */
+void AgentCompletion_SetCommandInfo( AgentCompletion_t * pCompletion,
+                                     MQTTAgentCommandInfo_t * pCommandInfo );
+
+/**
+ * @brief Command complete callback completing the handle given as context.
+ *
+ * @param[in] pCmdCallbackContext The #AgentCompletion_t of the command.
+ * @param[in] pReturnInfo The result of the command.
+ */
+void AgentCompletion_CommandCallback( MQTTAgentCommandContext_t * pCmdCallbackContext,
+                                      MQTTAgentReturnInfo_t * pReturnInfo );
+
+/**
+ * @brief Complete a handle, for instance from the completion callback of a
+ * publish buffer. Safe to call from ISRs.
+ *
+ * @param[in] pCompletion The #AgentCompletion_t to complete.
+ * @param[in] returnCode The status of the command.
+ */
+void AgentCompletion_Complete( void * pCompletion,
+                               MQTTStatus_t returnCode );
+
+/**
+ * @brief Tell whether a handle completed, without waiting.
+ *
+ * @param[in] pCompletion The handle.
+ * @param[out] pReturnCode The status of the command, if completed. May be NULL.
+ *
+ * @return `true` if the command completed.
+ */
+bool AgentCompletion_IsComplete( AgentCompletion_t * pCompletion,
+                                 MQTTStatus_t * pReturnCode );
+
+/**
+ * @brief Wait for a handle to complete.
+ *
+ * @param[in] pCompletion The handle.
+ * @param[in] timeoutMs Time to wait.
+ * @param[out] pReturnCode The status of the command, if completed. May be NULL.
+ *
+ * @return `true` if the command completed in time.
+ */
+bool AgentCompletion_Wait( AgentCompletion_t * pCompletion,
+                           uint32_t timeoutMs,
+                           MQTTStatus_t * pReturnCode );
+
+/**
+ * @brief Wait for any of a group of handles to complete.
+ *
+ * @param[in] pCompletions The handles.
+ * @param[in] numCompletions Number of handles, at most #AGENT_COMPLETION_MAX_WAIT_ANY.
+ * @param[in] timeoutMs Time to wait.
+ *
+ * @return The index of a completed handle, or #AGENT_COMPLETION_NONE if none
+ * completed in time.
+ */
+size_t AgentCompletion_WaitAny( AgentCompletion_t * pCompletions,
+                                size_t numCompletions,
+                                uint32_t timeoutMs );
+
+/**
+ * @brief Wait for all of a group of handles to complete.
+ *
+ * @param[in] pCompletions The handles.
+ * @param[in] numCompletions Number of handles.
+ * @param[in] timeoutMs Time to wait for the whole group.
+ * @param[out] pNumSucceeded Number of commands that completed with
+ * #MQTTSuccess. May be NULL.
+ *
+ * @return `true` if every command completed in time.
+ */
+bool AgentCompletion_WaitAll( AgentCompletion_t * pCompletions,
+                              size_t numCompletions,
+                              uint32_t timeoutMs,
+                              size_t * pNumSucceeded );
+
+#endif /* ifndef AGENT_COMPLETION_H */
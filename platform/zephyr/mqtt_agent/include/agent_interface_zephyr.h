@@ -30,18 +30,609 @@
 #include "core_mqtt_agent_message_interface.h"
 #include "core_mqtt_agent.h"
 
+/**
+ * @brief Set to 1 to queue commands to the agent in a lock-free ring instead
+ * of a kernel message queue.
+ *
+ * The ring lets many threads, and ISRs, send commands without contending on a
+ * kernel lock. Its length must be a power of two. This must be set identically
+ * for every file that includes this header, for instance as a compile definition.
+ */
+#ifndef MQTT_AGENT_USE_LOCK_FREE_QUEUE
+    #define MQTT_AGENT_USE_LOCK_FREE_QUEUE    ( 0 )
+#endif
+
+/**
+ * @brief Number of priority lanes of a message context.
+ *
+ * With more than one lane, each command sent to the agent is placed in the
+ * lane given by the command attributes hook of the context, and the agent
+ * always receives from the highest-priority non-empty lane. A backlog of
+ * commands in a low lane therefore never delays commands in a higher one.
+ * This must be set identically for every file that includes this header.
+ */
+#ifndef MQTT_AGENT_NUM_PRIORITY_LANES
+    #define MQTT_AGENT_NUM_PRIORITY_LANES    ( 1U )
+#endif
+
+#if ( MQTT_AGENT_NUM_PRIORITY_LANES < 1U )
+    #error "MQTT_AGENT_NUM_PRIORITY_LANES must be at least 1."
+#endif
+
+#if ( MQTT_AGENT_USE_LOCK_FREE_QUEUE == 1 ) && ( MQTT_AGENT_NUM_PRIORITY_LANES > 1U )
+    #error "Priority lanes are only supported by the message queue backend."
+#endif
+
+/**
+ * @brief Set to 1 to keep statistics of the command pools and message
+ * contexts, to size them from data.
+ *
+ * This must be set identically for every file that includes this header.
+ */
+#ifndef MQTT_AGENT_ENABLE_STATISTICS
+    #define MQTT_AGENT_ENABLE_STATISTICS    ( 0 )
+#endif
+
+/**
+ * @brief Number of buckets of the statistics histograms.
+ *
+ * Bucket 0 counts values of 0, bucket i counts values from 2^(i-1) to
+ * 2^i - 1, and the last bucket counts every larger value.
+ */
+#ifndef MQTT_AGENT_STATISTICS_HISTOGRAM_BUCKETS
+    #define MQTT_AGENT_STATISTICS_HISTOGRAM_BUCKETS    ( 8U )
+#endif
+
+/**
+ * @brief Set to 1 to time each command of the command pools from the moment
+ * it is sent to the agent until it completes. Requires
+ * #MQTT_AGENT_ENABLE_STATISTICS.
+ *
+ * Each command is timestamped when it is sent, when the agent receives it,
+ * when its packet is written, which is when the agent asks for its next
+ * command, and when it completes, which is once it is acknowledged for a
+ * QoS 1 or 2 publish, a subscribe or an unsubscribe. The latency of each
+ * stage goes into a histogram of the statistics of the pool, and commands
+ * slower than #MQTT_AGENT_LATENCY_THRESHOLD_MS are logged.
+ */
+#ifndef MQTT_AGENT_ENABLE_LATENCY_TRACING
+    #define MQTT_AGENT_ENABLE_LATENCY_TRACING    ( 0 )
+#endif
+
+/**
+ * @brief Time from sending a command to its completion above which the
+ * timestamps of the command are logged as a warning.
+ */
+#ifndef MQTT_AGENT_LATENCY_THRESHOLD_MS
+    #define MQTT_AGENT_LATENCY_THRESHOLD_MS    ( 1000U )
+#endif
+
+/**
+ * @brief Largest number of command pools whose commands are traced.
+ */
+#ifndef MQTT_AGENT_MAX_TRACED_POOLS
+    #define MQTT_AGENT_MAX_TRACED_POOLS    ( 4U )
+#endif
+
+#if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 ) && ( MQTT_AGENT_ENABLE_STATISTICS == 0 )
+    #error "MQTT_AGENT_ENABLE_LATENCY_TRACING requires MQTT_AGENT_ENABLE_STATISTICS."
+#endif
+
+/**
+ * @brief Set to 1 to let the agent wait for both a command and data on its
+ * socket, see #Agent_SetWakeupSocket. Requires CONFIG_POLL and CONFIG_EVENTFD.
+ */
+#ifndef MQTT_AGENT_ENABLE_SOCKET_WAKEUP
+    #define MQTT_AGENT_ENABLE_SOCKET_WAKEUP    ( 0 )
+#endif
+
+/**
+ * @brief Largest number of message contexts whose sockets are watched at once.
+ */
+#ifndef MQTT_AGENT_MAX_WATCHED_SOCKETS
+    #define MQTT_AGENT_MAX_WATCHED_SOCKETS    ( 4U )
+#endif
+
+/**
+ * @brief Stack size of the thread that watches the sockets of the agents.
+ */
+#ifndef MQTT_AGENT_SOCKET_WATCHER_STACK_SIZE
+    #define MQTT_AGENT_SOCKET_WATCHER_STACK_SIZE    ( 1024U )
+#endif
+
+/**
+ * @brief Priority of the thread that watches the sockets of the agents.
+ *
+ * The thread only wakes an agent up, so it defaults to the lowest cooperative
+ * priority, above every preemptible thread, for the agent to be woken up even
+ * while the application is busy. Set it to the priority of the agents on
+ * builds without cooperative priorities.
+ */
+#ifndef MQTT_AGENT_SOCKET_WATCHER_PRIORITY
+    #define MQTT_AGENT_SOCKET_WATCHER_PRIORITY    ( K_PRIO_COOP( CONFIG_NUM_COOP_PRIORITIES - 1 ) )
+#endif
+
+/**
+ * @brief Set to 1 to let commands sent to the agent expire.
+ *
+ * Each command is then given a lifetime by the command attributes hook of the
+ * context. A command still queued when its lifetime ends is dropped by the
+ * agent: its completion callback is called with
+ * #MQTT_AGENT_EXPIRED_COMMAND_STATUS and the command is released without being
+ * sent. This must be set identically for every file that includes this header.
+ */
+#ifndef MQTT_AGENT_ENABLE_DEADLINES
+    #define MQTT_AGENT_ENABLE_DEADLINES    ( 0 )
+#endif
+
+/**
+ * @brief Set to 1 for the agent to receive the queued command with a
+ * lifetime that was sent last first, rather than the oldest one.
+ *
+ * Commands without a lifetime, such as QoS 1 publishes and subscribes, come
+ * before every command with one, in the order they were sent, so that a
+ * stream of short-lived publishes never holds them back. After an outage,
+ * the freshest short-lived data is then sent first, and the backlog is sent
+ * after it, or dropped as it expires. Requires #MQTT_AGENT_ENABLE_DEADLINES.
+ */
+#ifndef MQTT_AGENT_FRESHEST_FIRST
+    #define MQTT_AGENT_FRESHEST_FIRST    ( 0 )
+#endif
+
+/**
+ * @brief Status given to the completion callback of an expired command.
+ */
+#ifndef MQTT_AGENT_EXPIRED_COMMAND_STATUS
+    #define MQTT_AGENT_EXPIRED_COMMAND_STATUS    ( MQTTSendFailed )
+#endif
+
+/**
+ * @brief Lifetime given to QoS 0 publishes by #Agent_DefaultCommandAttributes,
+ * in ms, or #AGENT_COMMAND_NO_DEADLINE.
+ */
+#ifndef MQTT_AGENT_DEFAULT_QOS0_LIFETIME_MS
+    #define MQTT_AGENT_DEFAULT_QOS0_LIFETIME_MS    ( 0U )
+#endif
+
+#if ( MQTT_AGENT_USE_LOCK_FREE_QUEUE == 1 ) && ( MQTT_AGENT_ENABLE_DEADLINES == 1 )
+    #error "Deadlines are only supported by the message queue backend."
+#endif
+
+#if ( MQTT_AGENT_FRESHEST_FIRST == 1 ) && ( MQTT_AGENT_ENABLE_DEADLINES == 0 )
+    #error "MQTT_AGENT_FRESHEST_FIRST requires MQTT_AGENT_ENABLE_DEADLINES."
+#endif
+
+#if ( MQTT_AGENT_FRESHEST_FIRST == 1 ) && ( MQTT_AGENT_NUM_PRIORITY_LANES > 1U )
+    #error "Freshest first ordering is not supported with priority lanes."
+#endif
+
+/**
+ * @brief Whether the commands sent to the agent are given attributes.
+ */
+#if ( MQTT_AGENT_NUM_PRIORITY_LANES > 1U ) || ( MQTT_AGENT_ENABLE_DEADLINES == 1 )
+    #define MQTT_AGENT_USE_COMMAND_ATTRIBUTES    ( 1 )
+#else
+    #define MQTT_AGENT_USE_COMMAND_ATTRIBUTES    ( 0 )
+#endif
+
+#if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 )
+
+/**
+ * @brief Stages of the life of a command that are timed.
+ */
+    typedef enum AgentLatencyStage
+    {
+        AGENT_LATENCY_QUEUED = 0,   /**< @brief From the command being sent to the agent receiving it. */
+        AGENT_LATENCY_WRITTEN,      /**< @brief From the agent receiving the command to its packet being written. */
+        AGENT_LATENCY_ACKNOWLEDGED, /**< @brief From the packet being written to the command completing. */
+        AGENT_LATENCY_TOTAL,        /**< @brief From the command being sent to it completing. */
+        AGENT_LATENCY_NUM_STAGES    /**< @brief Number of stages. */
+    } AgentLatencyStage_t;
+
+/**
+ * @brief Timestamps of a command of a pool.
+ */
+    typedef struct AgentCommandTrace
+    {
+        uint32_t enqueueTimeMs; /**< @brief Uptime when the command was sent to the agent. */
+        uint32_t dequeueTimeMs; /**< @brief Uptime when the agent received the command. */
+        uint32_t writeTimeMs;   /**< @brief Uptime when the packet of the command was written. */
+        uint8_t recorded;       /**< @brief Bit mask of the timestamps recorded. */
+    } AgentCommandTrace_t;
+#endif /* if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 ) */
+
+#if ( MQTT_AGENT_ENABLE_STATISTICS == 1 )
+
+/**
+ * @brief Counters of a command pool, updated without locks.
+ */
+    typedef struct AgentCommandPoolCounters
+    {
+        atomic_t allocations;                                                   /**< @brief Structures obtained. */
+        atomic_t failedAllocations;                                             /**< @brief Requests that timed out. */
+        atomic_t inUse;                                                         /**< @brief Structures currently obtained. */
+        atomic_t highWaterMark;                                                 /**< @brief Most structures obtained at once. */
+        atomic_t waitTimeHistogram[ MQTT_AGENT_STATISTICS_HISTOGRAM_BUCKETS ];  /**< @brief Time waited for a structure, in ms. */
+        atomic_t residencyHistogram[ MQTT_AGENT_STATISTICS_HISTOGRAM_BUCKETS ]; /**< @brief Time a structure was used, in ms. */
+
+        #if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 )
+            atomic_t latencyHistograms[ AGENT_LATENCY_NUM_STAGES ][ MQTT_AGENT_STATISTICS_HISTOGRAM_BUCKETS ]; /**< @brief Latency of each stage, in ms. */
+        #endif
+    } AgentCommandPoolCounters_t;
+
+/**
+ * @brief Counters of a message context, updated without locks.
+ */
+    typedef struct AgentMessageContextCounters
+    {
+        atomic_t messagesSent;                                              /**< @brief Messages queued. */
+        atomic_t failedSends;                                               /**< @brief Messages that could not be queued. */
+        atomic_t depthHighWaterMark;                                        /**< @brief Most messages queued at once. */
+        atomic_t depthHistogram[ MQTT_AGENT_STATISTICS_HISTOGRAM_BUCKETS ]; /**< @brief Messages queued, sampled at each send. */
+    } AgentMessageContextCounters_t;
+
+/**
+ * @brief Snapshot of the statistics of a command pool.
+ */
+    typedef struct AgentCommandPoolStatistics
+    {
+        uint32_t numCommands;                                                   /**< @brief Size of the pool. */
+        uint32_t allocations;                                                   /**< @brief Structures obtained. */
+        uint32_t failedAllocations;                                             /**< @brief Requests that timed out. */
+        uint32_t inUse;                                                         /**< @brief Structures currently obtained. */
+        uint32_t highWaterMark;                                                 /**< @brief Most structures obtained at once. */
+        uint32_t waitTimeHistogram[ MQTT_AGENT_STATISTICS_HISTOGRAM_BUCKETS ];  /**< @brief Time waited for a structure, in ms. */
+        uint32_t residencyHistogram[ MQTT_AGENT_STATISTICS_HISTOGRAM_BUCKETS ]; /**< @brief Time a structure was used, in ms. */
+
+        #if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 )
+            uint32_t latencyHistograms[ AGENT_LATENCY_NUM_STAGES ][ MQTT_AGENT_STATISTICS_HISTOGRAM_BUCKETS ]; /**< @brief Latency of each stage, in ms. */
+        #endif
+    } AgentCommandPoolStatistics_t;
+
+/**
+ * @brief Snapshot of the statistics of a message context.
+ */
+    typedef struct AgentMessageContextStatistics
+    {
+        uint32_t messagesSent;                                              /**< @brief Messages queued. */
+        uint32_t failedSends;                                               /**< @brief Messages that could not be queued. */
+        uint32_t depth;                                                     /**< @brief Messages currently queued. */
+        uint32_t depthHighWaterMark;                                        /**< @brief Most messages queued at once. */
+        uint32_t depthHistogram[ MQTT_AGENT_STATISTICS_HISTOGRAM_BUCKETS ]; /**< @brief Messages queued, sampled at each send. */
+    } AgentMessageContextStatistics_t;
+#endif /* if ( MQTT_AGENT_ENABLE_STATISTICS == 1 ) */
+
+/**
+ * @brief Priority of the highest lane.
+ */
+#define AGENT_COMMAND_PRIORITY_HIGHEST    ( 0U )
+
+/**
+ * @brief Priority of the lowest lane.
+ */
+#define AGENT_COMMAND_PRIORITY_LOWEST     ( MQTT_AGENT_NUM_PRIORITY_LANES - 1U )
+
+/**
+ * @brief Lifetime of a command that never expires.
+ */
+#define AGENT_COMMAND_NO_DEADLINE         ( 0U )
+
+/**
+ * @brief Scheduling attributes of a command sent to the agent.
+ */
+typedef struct AgentCommandAttributes
+{
+    /**
+     * @brief Lane of the command, from #AGENT_COMMAND_PRIORITY_HIGHEST to
+     * #AGENT_COMMAND_PRIORITY_LOWEST.
+     */
+    uint8_t priority;
+
+    /**
+     * @brief Time in ms, from when the command is sent, after which it is
+     * dropped if still queued, or #AGENT_COMMAND_NO_DEADLINE. Only used with
+     * #MQTT_AGENT_ENABLE_DEADLINES.
+     */
+    uint32_t lifetimeMs;
+} AgentCommandAttributes_t;
+
+/**
+ * @brief Function that sets the attributes of a command sent to the agent.
+ *
+ * The command has been filled in by the coreMQTT-Agent API, so the hook can
+ * classify it by type, by its arguments, or by the command context given by
+ * the caller.
+ *
+ * @param[in] pCommand The command being sent.
+ * @param[out] pAttributes The attributes of the command, initialized to the
+ * highest priority and no deadline.
+ */
+typedef void ( * AgentCommandAttributesHook_t )( const MQTTAgentCommand_t * pCommand,
+                                                  AgentCommandAttributes_t * pAttributes );
+
+/**
+ * @brief Function called by the agent thread as it receives from a message context.
+ *
+ * @param[in] pHookContext Context given to #Agent_SetReceiveHook.
+ * @param[in] pCommand The command received, or NULL when no command is queued
+ * and the agent is about to wait for one.
+ */
+typedef void ( * AgentReceiveHook_t )( void * pHookContext,
+                                       const MQTTAgentCommand_t * pCommand );
+
+/**
+ * @brief Function telling whether the transport holds received data that is
+ * not readable from the socket anymore, such as decrypted TLS records.
+ *
+ * @param[in] pContext Context given to #Agent_SetWakeupSocket.
+ *
+ * @return `true` if received data is pending in the transport.
+ */
+typedef bool ( * AgentPendingDataHook_t )( void * pContext );
+
+/**
+ * @brief Number of elements of storage needed by a message context for queues
+ * of a given length.
+ *
+ * @param[in] queueLength The maximum number of messages queued in each lane.
+ */
+#if ( MQTT_AGENT_FRESHEST_FIRST == 1 )
+    #define AGENT_MESSAGE_STORAGE_LENGTH( queueLength )    ( ( queueLength ) * 2U )
+#else
+    #define AGENT_MESSAGE_STORAGE_LENGTH( queueLength )    ( ( queueLength ) * MQTT_AGENT_NUM_PRIORITY_LANES )
+#endif
+
+#if ( MQTT_AGENT_ENABLE_DEADLINES == 1 )
+
+/**
+ * @brief A command queued with its deadline.
+ */
+    typedef struct AgentQueuedCommand
+    {
+        MQTTAgentCommand_t * pCommand; /**< @brief The command. */
+        uint32_t sendTimeMs;           /**< @brief Uptime when the command was sent. */
+        uint32_t lifetimeMs;           /**< @brief Lifetime of the command, or #AGENT_COMMAND_NO_DEADLINE. */
+    } AgentQueuedCommand_t;
+#endif
+
+#if ( MQTT_AGENT_USE_LOCK_FREE_QUEUE == 1 )
+    #include "agent_message_ring.h"
+
+/**
+ * @brief Element of the storage of a message context.
+ */
+    typedef AgentMessageRingSlot_t AgentMessageStorage_t;
+#elif ( MQTT_AGENT_ENABLE_DEADLINES == 1 )
+
+/**
+ * @brief Element of the storage of a message context.
+ */
+    typedef AgentQueuedCommand_t AgentMessageStorage_t;
+#else
+
+/**
+ * @brief Element of the storage of a message context.
+ */
+    typedef MQTTAgentCommand_t * AgentMessageStorage_t;
+#endif
+
 /**
  * @ingroup mqtt_agent_struct_types
  * @brief Context with which tasks may deliver messages to the agent.
  */
 struct MQTTAgentMessageContext
 {
-    struct k_msgq queue;
+    #if ( MQTT_AGENT_USE_LOCK_FREE_QUEUE == 1 )
+        AgentMessageRing_t ring;
+    #else
+        struct k_msgq queue; /**< @brief Queue of the highest-priority lane. */
+    #endif
+
+    #if ( MQTT_AGENT_NUM_PRIORITY_LANES > 1U )
+        struct k_msgq lowerPriorityQueues[ MQTT_AGENT_NUM_PRIORITY_LANES - 1U ]; /**< @brief Queues of the other lanes. */
+        struct k_sem pendingMessages;                                           /**< @brief Number of messages in all lanes. */
+    #endif
+
+    #if ( MQTT_AGENT_USE_COMMAND_ATTRIBUTES == 1 )
+        AgentCommandAttributesHook_t attributesHook; /**< @brief Sets the lane and lifetime of each command. */
+    #endif
+
+    #if ( MQTT_AGENT_ENABLE_DEADLINES == 1 )
+        MQTTAgentCommandRelease_t releaseCommand; /**< @brief Releases the commands that expire. */
+    #endif
+
+    #if ( MQTT_AGENT_FRESHEST_FIRST == 1 )
+        AgentQueuedCommand_t * pStagedCommands; /**< @brief Commands taken from the queue to be ordered. */
+        size_t numStagedCommands;               /**< @brief Number of commands in #MQTTAgentMessageContext.pStagedCommands. */
+        size_t maxStagedCommands;               /**< @brief Capacity of #MQTTAgentMessageContext.pStagedCommands. */
+    #endif
+
+    AgentReceiveHook_t receiveHook; /**< @brief Called as the agent receives, if not NULL. */
+    void * pReceiveHookContext;     /**< @brief Context of #MQTTAgentMessageContext.receiveHook. */
+
+    #if ( MQTT_AGENT_ENABLE_SOCKET_WAKEUP == 1 )
+        struct k_poll_signal socketReadableSignal; /**< @brief Raised by the watcher when the socket is readable. */
+        struct k_sem socketReleased;               /**< @brief Given by the watcher when it stops polling a socket being changed. */
+        atomic_t watchedSocket;                    /**< @brief The socket watched, or a negative value. */
+        atomic_t isSocketArmed;                    /**< @brief Set by the agent for the watcher to poll the socket, cleared once it is readable. */
+        bool isSocketPolled;                       /**< @brief Whether the watcher polls the socket. */
+        bool isReleaseAwaited;                     /**< @brief Whether #Agent_SetWakeupSocket waits for #MQTTAgentMessageContext.socketReleased. */
+        AgentPendingDataHook_t pendingDataHook;    /**< @brief Tells whether data is pending in the transport, or NULL. */
+        void * pPendingDataContext;                /**< @brief Context of #MQTTAgentMessageContext.pendingDataHook. */
+    #endif
+
+    #if ( MQTT_AGENT_ENABLE_STATISTICS == 1 )
+        AgentMessageContextCounters_t counters; /**< @brief Statistics of the context. */
+    #endif
+
+    #if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 )
+        MQTTAgentCommand_t * pProcessedCommand; /**< @brief Last command received, until the agent asks for the next one. */
+    #endif
 };
 
+/**
+ * @brief Initialize a message context.
+ *
+ * With priority lanes or deadlines, the context uses
+ * #Agent_DefaultCommandAttributes until #Agent_SetCommandAttributesHook is
+ * called. With deadlines, expired commands are released with
+ * #Agent_FreeCommand until #Agent_SetExpiredCommandRelease is called.
+ *
+ * @param[out] pMsgCtx The #MQTTAgentMessageContext_t to initialize.
+ * @param[in] pStorage Storage of AGENT_MESSAGE_STORAGE_LENGTH( @p queueLength ) elements.
+ * @param[in] queueLength The maximum number of messages queued in each lane.
+ *
+ * @return `true` if the context was initialized, else `false`.
+ */
+bool Agent_InitializeMessageContext( MQTTAgentMessageContext_t * pMsgCtx,
+                                     AgentMessageStorage_t * pStorage,
+                                     size_t queueLength );
+
+/**
+ * @brief Set the function that gives the attributes of the commands sent to a
+ * message context. Has no effect without priority lanes or deadlines.
+ *
+ * @param[in] pMsgCtx An initialized #MQTTAgentMessageContext_t.
+ * @param[in] attributesHook The hook, or NULL for #Agent_DefaultCommandAttributes.
+ */
+void Agent_SetCommandAttributesHook( MQTTAgentMessageContext_t * pMsgCtx,
+                                     AgentCommandAttributesHook_t attributesHook );
+
+/**
+ * @brief Default command attributes hook.
+ *
+ * QoS 0 PUBLISH commands, typically bulk telemetry, are given the lowest
+ * priority. Every other command, such as acknowledged publishes, subscribes,
+ * unsubscribes and connection management, is given the highest priority.
+ * QoS 0 publishes live for #MQTT_AGENT_DEFAULT_QOS0_LIFETIME_MS; every other
+ * command never expires.
+ *
+ * @param[in] pCommand The command being sent.
+ * @param[out] pAttributes The attributes of the command.
+ */
+void Agent_DefaultCommandAttributes( const MQTTAgentCommand_t * pCommand,
+                                     AgentCommandAttributes_t * pAttributes );
+
+#if ( MQTT_AGENT_ENABLE_DEADLINES == 1 )
+
+/**
+ * @brief Set the function that releases the commands of a message context
+ * that expire, which must be the releaseCommand function of the agent.
+ *
+ * @param[in] pMsgCtx An initialized #MQTTAgentMessageContext_t.
+ * @param[in] releaseCommand The function, or NULL for #Agent_FreeCommand.
+ */
+    void Agent_SetExpiredCommandRelease( MQTTAgentMessageContext_t * pMsgCtx,
+                                         MQTTAgentCommandRelease_t releaseCommand );
+#endif
+
+/**
+ * @brief A pool of command structures.
+ *
+ * Each MQTT agent can be given its own pool, so that agents running
+ * connections side by side do not take commands from each other. Pools are
+ * defined with #AGENT_COMMAND_POOL_DEFINE.
+ */
+typedef struct AgentCommandPool
+{
+    MQTTAgentCommand_t * pCommands;        /**< @brief The command structures of the pool. */
+    size_t numCommands;                    /**< @brief Number of structures in #AgentCommandPool_t.pCommands. */
+    struct k_msgq freeCommands;            /**< @brief Queue of the structures not in use. */
+    MQTTAgentCommandRelease_t releaseHook; /**< @brief Releases the commands not from the pool, or NULL. */
+    bool initialized;                      /**< @brief Whether the pool was initialized. */
+
+    #if ( MQTT_AGENT_ENABLE_STATISTICS == 1 )
+        uint32_t * pAllocationTimes;         /**< @brief Time each structure was obtained, or NULL. */
+        AgentCommandPoolCounters_t counters; /**< @brief Statistics of the pool. */
+    #endif
+
+    #if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 )
+        AgentCommandTrace_t * pTraces; /**< @brief Timestamps of each structure, or NULL. */
+    #endif
+} AgentCommandPool_t;
+
+#if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 )
+
+/**
+ * @brief Define the timestamps of the commands of a pool defined with
+ * #AGENT_COMMAND_POOL_DEFINE.
+ */
+    #define AGENT_COMMAND_POOL_TRACES_DEFINE( name, numCommands ) \
+    static AgentCommandTrace_t name##Traces[ numCommands ];
+
+/**
+ * @brief Start tracing the commands of a pool defined with #AGENT_COMMAND_POOL_DEFINE.
+ */
+    #define AGENT_COMMAND_POOL_TRACES_INIT( name ) \
+    Agent_InitializeCommandPoolTracing( &name, name##Traces )
+#else
+    #define AGENT_COMMAND_POOL_TRACES_DEFINE( name, numCommands )
+    #define AGENT_COMMAND_POOL_TRACES_INIT( name )    do {} while( 0 )
+#endif
+
+#if ( MQTT_AGENT_ENABLE_STATISTICS == 1 )
+
+/**
+ * @brief Define the storage of the statistics of a pool defined with
+ * #AGENT_COMMAND_POOL_DEFINE.
+ */
+    #define AGENT_COMMAND_POOL_STATISTICS_DEFINE( name, numCommands ) \
+    static uint32_t name##AllocationTimes[ numCommands ];         \
+    AGENT_COMMAND_POOL_TRACES_DEFINE( name, numCommands )
+
+/**
+ * @brief Initialize the statistics of a pool defined with #AGENT_COMMAND_POOL_DEFINE.
+ */
+    #define AGENT_COMMAND_POOL_STATISTICS_INIT( name )                           \
+    do {                                                                     \
+        Agent_InitializeCommandPoolStatistics( &name, name##AllocationTimes ); \
+        AGENT_COMMAND_POOL_TRACES_INIT( name );                              \
+    } while( 0 )
+#else
+    #define AGENT_COMMAND_POOL_STATISTICS_DEFINE( name, numCommands )
+    #define AGENT_COMMAND_POOL_STATISTICS_INIT( name )    do {} while( 0 )
+#endif
+
+/**
+ * @brief Statically define a command pool and the functions to plug it into
+ * an #MQTTAgentMessageInterface_t.
+ *
+ * The message interface does not pass a context to its getCommand and
+ * releaseCommand functions, so this defines, for a pool named `name`:
+ * - `name##_Initialize()`, to call once before the pool is used;
+ * - `name##_GetCommand()`, for #MQTTAgentMessageInterface_t.getCommand;
+ * - `name##_FreeCommand()`, for #MQTTAgentMessageInterface_t.releaseCommand.
+ *
+ * @param[in] name Name of the pool.
+ * @param[in] numCommands Number of command structures in the pool.
+ */
+#define AGENT_COMMAND_POOL_DEFINE( name, numCommands )                                    \
+    static MQTTAgentCommand_t name##Commands[ numCommands ];                              \
+    static MQTTAgentCommand_t * name##FreeCommandsStorage[ numCommands ];                 \
+    AGENT_COMMAND_POOL_STATISTICS_DEFINE( name, numCommands )                             \
+    static AgentCommandPool_t name;                                                       \
+    static __unused bool name##_Initialize( void )                                        \
+    {                                                                                     \
+        bool initialized = Agent_InitializeCommandPool( &name,                            \
+                                                        name##Commands,                   \
+                                                        name##FreeCommandsStorage,        \
+                                                        numCommands );                    \
+        AGENT_COMMAND_POOL_STATISTICS_INIT( name );                                       \
+        return initialized;                                                               \
+    }                                                                                     \
+    static __unused MQTTAgentCommand_t * name##_GetCommand( uint32_t blockTimeMs )        \
+    {                                                                                     \
+        return Agent_GetCommandFromPool( &name, blockTimeMs );                            \
+    }                                                                                     \
+    static __unused bool name##_FreeCommand( MQTTAgentCommand_t * pCommandToRelease )     \
+    {                                                                                     \
+        return Agent_FreeCommandToPool( &name, pCommandToRelease );                       \
+    }
+
 /**
  * @brief Send a message to the specified context.
- * Must be thread safe.
+ * Must be thread safe. With #MQTT_AGENT_USE_LOCK_FREE_QUEUE, it may also be
+ * called from ISRs, in which case it does not block.
  *
  * @param[in] pMsgCtx An #MQTTAgentMessageContext_t.
  * @param[in] pCommandToSend Pointer to address to send to queue.
@@ -67,8 +658,183 @@ bool Agent_MessageReceive( MQTTAgentMessageContext_t * pMsgCtx,
                            MQTTAgentCommand_t ** pReceivedCommand,
                            uint32_t blockTimeMs );
 
+/**
+ * @brief Initialize a command pool. Not thread safe, but only called on one thread.
+ *
+ * @param[out] pPool The pool to initialize.
+ * @param[in] pCommands The command structures of the pool.
+ * @param[in] pFreeCommandsStorage Storage for @p numCommands pointers, used to
+ * keep track of the structures not in use.
+ * @param[in] numCommands Number of structures in @p pCommands.
+ *
+ * @return `true` if the pool was initialized or was already initialized, else `false`.
+ */
+bool Agent_InitializeCommandPool( AgentCommandPool_t * pPool,
+                                  MQTTAgentCommand_t * pCommands,
+                                  MQTTAgentCommand_t ** pFreeCommandsStorage,
+                                  size_t numCommands );
+
+/**
+ * @brief Obtain a MQTTAgentCommand_t structure from a given pool.
+ *
+ * @param[in] pPool The pool, initialized with #Agent_InitializeCommandPool.
+ * @param[in] blockTimeMs Time to wait for a structure to become available.
+ *
+ * @return A pointer to a MQTTAgentCommand_t structure if one becomes available before
+ * blockTimeMs time expired, otherwise NULL.
+ */
+MQTTAgentCommand_t * Agent_GetCommandFromPool( AgentCommandPool_t * pPool,
+                                               uint32_t blockTimeMs );
+
+/**
+ * @brief Return a MQTTAgentCommand_t structure to the pool it was obtained from.
+ *
+ * Structures not from the pool are handed to the release hook of the pool, if
+ * any, as the agent releases every command it concludes.
+ *
+ * @param[in] pPool The pool, initialized with #Agent_InitializeCommandPool.
+ * @param[in] pCommandToRelease The structure to free.
+ *
+ * @return true if the MQTTAgentCommand_t structure was freed, otherwise false.
+ */
+bool Agent_FreeCommandToPool( AgentCommandPool_t * pPool,
+                              MQTTAgentCommand_t * pCommandToRelease );
+
+/**
+ * @brief Set the function releasing the commands a pool is given back but did
+ * not hand out, such as commands embedded in the object they carry. Not
+ * thread safe: call it before the agent uses the pool.
+ *
+ * @param[in] pPool The pool, initialized with #Agent_InitializeCommandPool.
+ * @param[in] releaseHook The release hook, or NULL to reject such commands.
+ */
+void Agent_SetCommandPoolReleaseHook( AgentCommandPool_t * pPool,
+                                      MQTTAgentCommandRelease_t releaseHook );
+
+/**
+ * @brief Set the function called by the agent thread as it receives from a
+ * message context.
+ *
+ * The hook is told about each command before the agent processes it, and when
+ * the agent runs out of commands. #CoalescingTransport_AgentReceiveHook uses
+ * this to coalesce the packets written for a burst of commands.
+ *
+ * @param[in] pMsgCtx An initialized #MQTTAgentMessageContext_t.
+ * @param[in] receiveHook The hook, or NULL to remove it.
+ * @param[in] pReceiveHookContext Context passed to @p receiveHook.
+ */
+void Agent_SetReceiveHook( MQTTAgentMessageContext_t * pMsgCtx,
+                           AgentReceiveHook_t receiveHook,
+                           void * pReceiveHookContext );
+
+#if ( MQTT_AGENT_ENABLE_SOCKET_WAKEUP == 1 )
+
+/**
+ * @brief Make the agent wake up as soon as data is received on a socket, as
+ * well as when a command is sent to it.
+ *
+ * Otherwise, the agent only reads the socket when it stops waiting for
+ * commands, so the latency of incoming packets is up to the block time of the
+ * agent. One thread polls the sockets of up to #MQTT_AGENT_MAX_WATCHED_SOCKETS
+ * message contexts, along with an eventfd written to when an agent starts
+ * waiting or a socket changes, and wakes an agent up when its socket is
+ * readable.
+ *
+ * The socket must be removed, by passing a negative socket, before it is
+ * closed. This returns once the watcher no longer polls the previous socket.
+ *
+ * @param[in] pMsgCtx An initialized #MQTTAgentMessageContext_t.
+ * @param[in] socket The socket of the agent connection, or a negative value to
+ * stop watching the socket.
+ * @param[in] pendingDataHook Function telling whether data is pending in the
+ * transport, which wakes the agent up immediately. May be NULL.
+ * @param[in] pPendingDataContext Context passed to @p pendingDataHook.
+ *
+ * @return `true` if the socket was set, `false` if the sockets of
+ * #MQTT_AGENT_MAX_WATCHED_SOCKETS other contexts are watched or the watcher
+ * could not be started.
+ */
+    bool Agent_SetWakeupSocket( MQTTAgentMessageContext_t * pMsgCtx,
+                                int32_t socket,
+                                AgentPendingDataHook_t pendingDataHook,
+                                void * pPendingDataContext );
+#endif /* if ( MQTT_AGENT_ENABLE_SOCKET_WAKEUP == 1 ) */
+
+#if ( MQTT_AGENT_ENABLE_STATISTICS == 1 )
+
+/**
+ * @brief Give a pool the storage to measure how long each structure is used.
+ *
+ * @param[in] pPool An initialized pool.
+ * @param[in] pAllocationTimes Storage for one timestamp per structure of the pool.
+ */
+    void Agent_InitializeCommandPoolStatistics( AgentCommandPool_t * pPool,
+                                                uint32_t * pAllocationTimes );
+
+    #if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 )
+
+/**
+ * @brief Give a pool the storage to timestamp its commands, and start tracing
+ * them. Called once per pool, before its commands are sent to an agent.
+ *
+ * @param[in] pPool An initialized pool.
+ * @param[in] pTraces Storage for the timestamps of each structure of the pool.
+ *
+ * @return `true` if the pool is traced, `false` if
+ * #MQTT_AGENT_MAX_TRACED_POOLS pools are traced already.
+ */
+        bool Agent_InitializeCommandPoolTracing( AgentCommandPool_t * pPool,
+                                                 AgentCommandTrace_t * pTraces );
+    #endif
+
+/**
+ * @brief Get the statistics of a command pool.
+ *
+ * @param[in] pPool An initialized pool.
+ * @param[out] pStatistics The statistics.
+ */
+    void Agent_GetCommandPoolStatistics( const AgentCommandPool_t * pPool,
+                                         AgentCommandPoolStatistics_t * pStatistics );
+
+/**
+ * @brief Get the statistics of the common pool of #Agent_GetCommand.
+ *
+ * @param[out] pStatistics The statistics.
+ */
+    void Agent_GetCommonPoolStatistics( AgentCommandPoolStatistics_t * pStatistics );
+
+/**
+ * @brief Get the statistics of a message context.
+ *
+ * @param[in] pMsgCtx An initialized #MQTTAgentMessageContext_t.
+ * @param[out] pStatistics The statistics.
+ */
+    void Agent_GetMessageContextStatistics( MQTTAgentMessageContext_t * pMsgCtx,
+                                            AgentMessageContextStatistics_t * pStatistics );
+
+/**
+ * @brief Serialize statistics as a JSON document, for instance to publish
+ * them as telemetry.
+ *
+ * @param[in] pPoolStatistics Statistics of a command pool.
+ * @param[in] pContextStatistics Statistics of a message context.
+ * @param[out] pBuffer Buffer for the document.
+ * @param[in] bufferSize Size of @p pBuffer.
+ *
+ * @return The length of the document, or 0 if it does not fit in @p pBuffer.
+ */
+    size_t Agent_SerializeStatistics( const AgentCommandPoolStatistics_t * pPoolStatistics,
+                                      const AgentMessageContextStatistics_t * pContextStatistics,
+                                      char * pBuffer,
+                                      size_t bufferSize );
+#endif /* if ( MQTT_AGENT_ENABLE_STATISTICS == 1 ) */
+
 /**
  * @brief Initialize the common task pool. Not thread safe, but only called on one thread.
+ *
+ * The common pool is shared by every agent that uses #Agent_GetCommand and
+ * #Agent_FreeCommand. Agents that must not compete for commands should each
+ * use a pool from #AGENT_COMMAND_POOL_DEFINE instead.
  */
 void Agent_InitializePool( void );
 
@@ -105,4 +871,13 @@ MQTTAgentCommand_t * Agent_GetCommand( uint32_t blockTimeMs );
  */
 bool Agent_FreeCommand( MQTTAgentCommand_t * pCommandToRelease );
 
+/**
+ * @brief Set the release hook of the common pool of #Agent_GetCommand, as
+ * #Agent_SetCommandPoolReleaseHook does for other pools.
+ *
+ * @param[in] releaseHook The release hook, or NULL to reject the commands not
+ * from the pool.
+ */
+void Agent_SetCommonPoolReleaseHook( MQTTAgentCommandRelease_t releaseHook );
+
 #endif /* ifndef AGENT_INTERFACE_ZEPHYR_H_ */
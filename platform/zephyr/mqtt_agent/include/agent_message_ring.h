@@ -0,0 +1,172 @@
+/*
+ * AWS IoT Device Embedded C SDK for ZephyrRTOS
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file agent_message_ring.h
+ * @brief Lock-free multi-producer, single-consumer ring of pointers, used as
+ * the message queue of the MQTT agent when MQTT_AGENT_USE_LOCK_FREE_QUEUE is 1.
+ */
+#ifndef AGENT_MESSAGE_RING_H
+#define AGENT_MESSAGE_RING_H
+
+/**************************************************/
+/******* DO NOT CHANGE the following order ********/
+/**************************************************/
+
+/* Logging related header files are required to be included in the following order:
+ * 1. Include the header file "logging_levels.h".
+ * 2. Define LIBRARY_LOG_NAME and  LIBRARY_LOG_LEVEL.
+ * 3. Include the header file "logging_stack.h".
+ */
+
+/* Include header that defines log levels. */
+#include "logging_levels.h"
+
+/* Logging configuration for the Agent Message Ring module. */
+#ifndef LIBRARY_LOG_NAME
+    #define LIBRARY_LOG_NAME     "Agent Message Ring"
+#endif
+#ifndef LIBRARY_LOG_LEVEL
+    #define LIBRARY_LOG_LEVEL    LOG_ERROR
+#endif
+
+#include "logging_stack.h"
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Kernel Header */
+#include <zephyr.h>
+
+/**
+ * @brief Period at which a thread sending to a full ring checks it again.
+ */
+#ifndef AGENT_MESSAGE_RING_FULL_POLL_MS
+    #define AGENT_MESSAGE_RING_FULL_POLL_MS    ( 1U )
+#endif
+
+/**
+ * @brief A slot of the ring.
+ *
+ * The sequence number tells producers and the consumer whether the slot is
+ * free or holds an item for a given position, which is what lets producers
+ * claim slots with a single compare-and-swap and no lock.
+ */
+typedef struct AgentMessageRingSlot
+{
+    atomic_t sequence; /**< @brief Position for which the slot is free or full. */
+    void * pItem;      /**< @brief The item held by the slot. */
+} AgentMessageRingSlot_t;
+
+/**
+ * @brief Multi-producer, single-consumer ring.
+ *
+ * Producers never take a lock and may run in ISRs. The semaphore is only used
+ * to wake the consumer when it is waiting on an empty ring.
+ */
+typedef struct AgentMessageRing
+{
+    AgentMessageRingSlot_t * pSlots; /**< @brief Slots of the ring. */
+    size_t mask;                     /**< @brief Number of slots minus one. */
+    atomic_t enqueuePosition;        /**< @brief Next position claimed by producers. */
+    size_t dequeuePosition;          /**< @brief Next position read by the consumer. */
+    atomic_t consumerWaiting;        /**< @brief Set while the consumer is waiting for an item. */
+    struct k_sem wakeSemaphore;      /**< @brief Given to wake the waiting consumer. */
+} AgentMessageRing_t;
+
+/**
+ * @brief Initialize a ring.
+ *
+ * @param[out] pRing The ring to initialize.
+ * @param[in] pSlots Storage of the ring.
+ * @param[in] numSlots Number of slots in @p pSlots. Must be a power of two.
+ *
+ * @return `true` if the ring was initialized, `false` if a parameter was invalid.
+ */
+bool AgentMessageRing_Init( AgentMessageRing_t * pRing,
+                            AgentMessageRingSlot_t * pSlots,
+                            size_t numSlots );
+
+/**
+ * @brief Add an item to the ring. Safe to call from any number of threads and
+ * from ISRs.
+ *
+ * @param[in] pRing The ring.
+ * @param[in] pItem The item to add.
+ * @param[in] blockTimeMs Time to wait for a free slot when the ring is full.
+ * Ignored in ISRs, which never wait.
+ *
+ * @return `true` if the item was added, `false` if the ring stayed full.
+ */
+bool AgentMessageRing_Send( AgentMessageRing_t * pRing,
+                            void * pItem,
+                            uint32_t blockTimeMs );
+
+/**
+ * @brief Take the oldest item from the ring. Must only be called by the single
+ * consumer of the ring.
+ *
+ * @param[in] pRing The ring.
+ * @param[out] ppItem The item taken.
+ * @param[in] blockTimeMs Time to wait for an item when the ring is empty.
+ *
+ * @return `true` if an item was taken, `false` if the ring stayed empty.
+ */
+bool AgentMessageRing_Receive( AgentMessageRing_t * pRing,
+                               void ** ppItem,
+                               uint32_t blockTimeMs );
+
+/**
+ * @brief Announce that the consumer is about to wait for an item outside of
+ * #AgentMessageRing_Receive, for instance with `k_poll` along with other events.
+ *
+ * The consumer must check the ring after this call and before waiting, and
+ * call #AgentMessageRing_FinishWait once done waiting.
+ *
+ * @param[in] pRing The ring.
+ *
+ * @return The semaphore given when an item is added while the consumer waits.
+ * It may have been given for an item already taken, so the ring may still be
+ * empty once it is available.
+ */
+struct k_sem * AgentMessageRing_PrepareWait( AgentMessageRing_t * pRing );
+
+/**
+ * @brief End a wait started with #AgentMessageRing_PrepareWait.
+ *
+ * @param[in] pRing The ring.
+ */
+void AgentMessageRing_FinishWait( AgentMessageRing_t * pRing );
+
+/**
+ * @brief Get the number of items in the ring, including the items whose slot
+ * is claimed by a producer but not yet filled.
+ *
+ * @param[in] pRing The ring.
+ *
+ * @return The number of items in the ring at the time of the call.
+ */
+size_t AgentMessageRing_GetDepth( const AgentMessageRing_t * pRing );
+
+#endif /* ifndef AGENT_MESSAGE_RING_H */
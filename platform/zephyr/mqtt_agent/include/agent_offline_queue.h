@@ -0,0 +1,234 @@
+/*
+ * AWS IoT Device Embedded C SDK for ZephyrRTOS
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file agent_offline_queue.h
+ * @brief Store-and-forward queue of publishes, which buffers them while the
+ * agent is disconnected and forwards them once it is connected again.
+ *
+ * Publishes are copied into a bounded RAM ring. When the ring is full, its
+ * oldest records move to an optional spill store, such as a ring in flash,
+ * and when both are full the drop policy of the queue applies. Each record
+ * may be given a time to live, after which it is dropped instead of sent.
+ *
+ * Records are forwarded from the system work queue, one at a time and at
+ * most one per drain interval, oldest first: the spill store, then the RAM
+ * ring. A record is only discarded once its publish completed; it is retried
+ * otherwise, so a QoS 1 record survives a disconnection while in flight.
+ */
+#ifndef AGENT_OFFLINE_QUEUE_H
+#define AGENT_OFFLINE_QUEUE_H
+
+/**************************************************/
+/******* DO NOT CHANGE the following order ********/
+/**************************************************/
+
+/* Logging related header files are required to be included in the following order:
+ * 1. Include the header file "logging_levels.h".
+ * 2. Define LIBRARY_LOG_NAME and  LIBRARY_LOG_LEVEL.
+ * 3. Include the header file "logging_stack.h".
+ */
+
+/* Include header that defines log levels. */
+#include "logging_levels.h"
+
+/* Logging configuration for the Agent Offline Queue module. */
+#ifndef LIBRARY_LOG_NAME
+    #define LIBRARY_LOG_NAME     "Agent Offline Queue"
+#endif
+#ifndef LIBRARY_LOG_LEVEL
+    #define LIBRARY_LOG_LEVEL    LOG_ERROR
+#endif
+
+#include "logging_stack.h"
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Kernel Header */
+#include <zephyr.h>
+
+/* coreMQTT Agent include. */
+#include "core_mqtt_agent.h"
+
+/**
+ * @brief Largest record, that is a header of
+ * sizeof( #AgentOfflineRecordHeader_t ) bytes, the topic and the payload.
+ */
+#ifndef MQTT_AGENT_OFFLINE_MAX_RECORD_SIZE
+    #define MQTT_AGENT_OFFLINE_MAX_RECORD_SIZE    ( 512U )
+#endif
+
+/**
+ * @brief Time before a record whose publish failed is retried.
+ */
+#ifndef MQTT_AGENT_OFFLINE_RETRY_DELAY_MS
+    #define MQTT_AGENT_OFFLINE_RETRY_DELAY_MS    ( 500U )
+#endif
+
+/**
+ * @brief Time to live of a record that never expires.
+ */
+#define AGENT_OFFLINE_NO_TTL    ( 0U )
+
+/**
+ * @brief What a full queue does with a new publish.
+ */
+typedef enum AgentOfflineDropPolicy
+{
+    AGENT_OFFLINE_DROP_OLDEST = 0, /**< @brief Drop the oldest records to make room. */
+    AGENT_OFFLINE_DROP_NEWEST      /**< @brief Reject the new publish. */
+} AgentOfflineDropPolicy_t;
+
+/**
+ * @brief Header of a record, followed by the topic and the payload.
+ */
+typedef struct AgentOfflineRecordHeader
+{
+    uint32_t bootId;        /**< @brief Random identifier of the boot the publish was queued in. */
+    uint32_t enqueueTimeMs; /**< @brief Uptime when the publish was queued. */
+    uint32_t ttlMs;         /**< @brief Time to live, or #AGENT_OFFLINE_NO_TTL. */
+    uint32_t payloadLength; /**< @brief Length of the payload. */
+    uint16_t topicLength;   /**< @brief Length of the topic. */
+    uint8_t qos;            /**< @brief QoS of the publish. */
+    uint8_t retain;         /**< @brief Retain flag of the publish. */
+} AgentOfflineRecordHeader_t;
+
+/**
+ * @brief Store that takes the records the RAM ring has no room for, such as
+ * a ring in flash. It must keep its records in the order they are appended.
+ *
+ * Records from a previous boot carry the uptime of that boot, so their age is
+ * unknown: the ones with a time to live are dropped as expired, and the others
+ * are forwarded.
+ */
+typedef struct AgentOfflineSpillInterface
+{
+    void * pContext; /**< @brief Context passed to the functions. */
+
+    /**
+     * @brief Append a record.
+     *
+     * @param[in] pContext #AgentOfflineSpillInterface_t.pContext.
+     * @param[in] pRecord The record.
+     * @param[in] length Length of the record.
+     *
+     * @return `false` if the store is full.
+     */
+    bool ( * append )( void * pContext,
+                       const uint8_t * pRecord,
+                       size_t length );
+
+    /**
+     * @brief Remove the oldest record and copy it to a buffer.
+     *
+     * @param[in] pContext #AgentOfflineSpillInterface_t.pContext.
+     * @param[out] pBuffer The buffer.
+     * @param[in] bufferSize Size of @p pBuffer, #MQTT_AGENT_OFFLINE_MAX_RECORD_SIZE.
+     *
+     * @return The length of the record, or 0 if the store is empty.
+     */
+    size_t ( * takeOldest )( void * pContext,
+                             uint8_t * pBuffer,
+                             size_t bufferSize );
+} AgentOfflineSpillInterface_t;
+
+/**
+ * @brief A store-and-forward queue.
+ */
+typedef struct AgentOfflineQueue
+{
+    MQTTAgentContext_t * pAgentContext;                        /**< @brief The agent publishes are forwarded to. */
+    struct k_mutex lock;                                       /**< @brief Protects the queue. */
+    struct k_work_delayable drainWork;                         /**< @brief Forwards the next record. */
+    uint8_t * pRing;                                           /**< @brief Storage of the RAM ring. */
+    size_t ringSize;                                           /**< @brief Size of #AgentOfflineQueue_t.pRing. */
+    size_t ringHead;                                           /**< @brief Offset of the oldest record in the ring. */
+    size_t ringUsed;                                           /**< @brief Bytes used in the ring. */
+    const AgentOfflineSpillInterface_t * pSpill;               /**< @brief Spill store, or NULL. */
+    bool spillHasRecords;                                      /**< @brief Whether records may be in the spill store. */
+    AgentOfflineDropPolicy_t dropPolicy;                       /**< @brief Policy of a full queue. */
+    uint32_t drainIntervalMs;                                  /**< @brief Shortest time between two forwarded records. */
+    bool connected;                                            /**< @brief Whether the agent is connected. */
+    bool recordPending;                                        /**< @brief Whether #AgentOfflineQueue_t.drainBuffer holds a record to forward. */
+    bool publishInFlight;                                      /**< @brief Whether the pending record is being published. */
+    MQTTPublishInfo_t publishInfo;                             /**< @brief Publish of the pending record. */
+    uint8_t drainBuffer[ MQTT_AGENT_OFFLINE_MAX_RECORD_SIZE ]; /**< @brief The record being forwarded. */
+    uint8_t spillBuffer[ MQTT_AGENT_OFFLINE_MAX_RECORD_SIZE ]; /**< @brief A record moving to the spill store. */
+    uint32_t numAccepted;                                      /**< @brief Publishes queued. */
+    uint32_t numDropped;                                       /**< @brief Records dropped by the drop policy. */
+    uint32_t numExpired;                                       /**< @brief Records dropped as expired. */
+    uint32_t numForwarded;                                     /**< @brief Records published successfully. */
+} AgentOfflineQueue_t;
+
+/**
+ * @brief Initialize a queue, disconnected.
+ *
+ * @param[out] pQueue The queue to initialize.
+ * @param[in] pAgentContext The agent publishes are forwarded to.
+ * @param[in] pRingStorage Storage of the RAM ring.
+ * @param[in] ringSize Size of @p pRingStorage.
+ * @param[in] pSpill Spill store, or NULL to only use RAM. Must remain valid.
+ * @param[in] dropPolicy Policy of a full queue.
+ * @param[in] drainIntervalMs Shortest time between two forwarded records.
+ *
+ * @return `true` if the queue was initialized, `false` if a parameter was invalid.
+ */
+bool AgentOfflineQueue_Init( AgentOfflineQueue_t * pQueue,
+                             MQTTAgentContext_t * pAgentContext,
+                             uint8_t * pRingStorage,
+                             size_t ringSize,
+                             const AgentOfflineSpillInterface_t * pSpill,
+                             AgentOfflineDropPolicy_t dropPolicy,
+                             uint32_t drainIntervalMs );
+
+/**
+ * @brief Copy a publish into a queue. Thread safe.
+ *
+ * The publish is forwarded as soon as the agent is connected and the records
+ * queued before it are forwarded.
+ *
+ * @param[in] pQueue The queue.
+ * @param[in] pPublishInfo The publish. Its topic and payload are copied.
+ * @param[in] ttlMs Time after which the publish is dropped if not forwarded,
+ * or #AGENT_OFFLINE_NO_TTL.
+ *
+ * @return `true` if the publish was queued, `false` if it is larger than
+ * #MQTT_AGENT_OFFLINE_MAX_RECORD_SIZE or was rejected by the drop policy.
+ */
+bool AgentOfflineQueue_Publish( AgentOfflineQueue_t * pQueue,
+                                const MQTTPublishInfo_t * pPublishInfo,
+                                uint32_t ttlMs );
+
+/**
+ * @brief Tell a queue whether the agent is connected. Forwarding starts when
+ * the agent connects and stops when it disconnects.
+ *
+ * @param[in] pQueue The queue.
+ * @param[in] connected Whether the agent is connected.
+ */
+void AgentOfflineQueue_SetConnected( AgentOfflineQueue_t * pQueue,
+                                     bool connected );
+
+#endif /* ifndef AGENT_OFFLINE_QUEUE_H */
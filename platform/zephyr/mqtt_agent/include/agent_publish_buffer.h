@@ -0,0 +1,252 @@
+/*
+ * AWS IoT Device Embedded C SDK for ZephyrRTOS
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file agent_publish_buffer.h
+ * @brief Pool of reference-counted payload buffers for publishes sent through
+ * the MQTT agent without copying the payload.
+ *
+ * A producer allocates a buffer, writes its payload in place and hands it to
+ * the agent with #AgentPublishBuffer_Publish. The buffer then returns to its
+ * pool on its own once the publish completes, that is once it is sent for
+ * QoS 0 and once it is acknowledged for QoS 1 and 2, so the producer neither
+ * keeps a copy of the payload nor waits for the publish to complete.
+ *
+ * QoS 0 publishes can also skip the command pool of the agent altogether with
+ * #AgentPublishBuffer_PublishQoS0, as each buffer carries its own command.
+ */
+#ifndef AGENT_PUBLISH_BUFFER_H
+#define AGENT_PUBLISH_BUFFER_H
+
+/**************************************************/
+/******* DO NOT CHANGE the following order ********/
+/**************************************************/
+
+/* Logging related header files are required to be included in the following order:
+ * 1. Include the header file "logging_levels.h".
+ * 2. Define LIBRARY_LOG_NAME and  LIBRARY_LOG_LEVEL.
+ * 3. Include the header file "logging_stack.h".
+ */
+
+/* Include header that defines log levels. */
+#include "logging_levels.h"
+
+/* Logging configuration for the Agent Publish Buffer module. */
+#ifndef LIBRARY_LOG_NAME
+    #define LIBRARY_LOG_NAME     "Agent Publish Buffer"
+#endif
+#ifndef LIBRARY_LOG_LEVEL
+    #define LIBRARY_LOG_LEVEL    LOG_ERROR
+#endif
+
+#include "logging_stack.h"
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Kernel Header */
+#include <zephyr.h>
+
+/* coreMQTT Agent include. */
+#include "core_mqtt_agent.h"
+
+/**
+ * @brief Pool of publish buffers, backed by a memory slab.
+ */
+typedef struct AgentPublishBufferPool
+{
+    struct k_mem_slab slab; /**< @brief Slab of the buffers. */
+    size_t payloadSize;     /**< @brief Capacity of the payload of each buffer. */
+} AgentPublishBufferPool_t;
+
+/**
+ * @brief Function called when a publish made with #AgentPublishBuffer_Publish
+ * completes, before its buffer is released.
+ *
+ * @param[in] pContext Context given to #AgentPublishBuffer_Publish.
+ * @param[in] returnCode Result of the publish.
+ */
+typedef void ( * AgentPublishCompleteCallback_t )( void * pContext,
+                                                   MQTTStatus_t returnCode );
+
+/**
+ * @brief A publish buffer. The payload is stored right after this header.
+ */
+typedef struct AgentPublishBuffer
+{
+    /**
+     * @brief Information of the publish. The topic, QoS, retain flag and
+     * payload length are set by the producer; the payload is set by
+     * #AgentPublishBuffer_Publish. The topic must remain valid until the
+     * publish completes.
+     */
+    MQTTPublishInfo_t publishInfo;
+
+    MQTTAgentCommand_t command;                     /**< @brief Command of #AgentPublishBuffer_PublishQoS0. */
+    AgentPublishBufferPool_t * pPool;               /**< @brief Pool the buffer belongs to. */
+    atomic_t referenceCount;                        /**< @brief Number of holders of the buffer. */
+    AgentPublishCompleteCallback_t completeCallback; /**< @brief Called when the publish completes, if not NULL. */
+    void * pCompleteCallbackContext;                 /**< @brief Context of #AgentPublishBuffer_t.completeCallback. */
+} AgentPublishBuffer_t;
+
+/**
+ * @brief Size of a block of the pool, for a given payload size.
+ *
+ * @param[in] payloadSize Capacity of the payload of each buffer.
+ */
+#define AGENT_PUBLISH_BUFFER_BLOCK_SIZE( payloadSize ) \
+    ( ( ( sizeof( AgentPublishBuffer_t ) + ( payloadSize ) + sizeof( void * ) - 1U ) / sizeof( void * ) ) * sizeof( void * ) )
+
+/**
+ * @brief Define the storage of a pool of publish buffers.
+ *
+ * @param[in] name Name of the storage array.
+ * @param[in] numBuffers Number of buffers of the pool.
+ * @param[in] payloadSize Capacity of the payload of each buffer.
+ */
+#define AGENT_PUBLISH_BUFFER_STORAGE_DEFINE( name, numBuffers, payloadSize ) \
+    static uint8_t name[ ( numBuffers ) * AGENT_PUBLISH_BUFFER_BLOCK_SIZE( payloadSize ) ] __aligned( sizeof( void * ) )
+
+/**
+ * @brief Initialize a pool of publish buffers.
+ *
+ * @param[out] pPool The pool to initialize.
+ * @param[in] pStorage Storage defined with #AGENT_PUBLISH_BUFFER_STORAGE_DEFINE.
+ * @param[in] payloadSize Capacity of the payload of each buffer, as given to
+ * #AGENT_PUBLISH_BUFFER_STORAGE_DEFINE.
+ * @param[in] numBuffers Number of buffers, as given to #AGENT_PUBLISH_BUFFER_STORAGE_DEFINE.
+ *
+ * @return `true` if the pool was initialized, `false` if a parameter was invalid.
+ */
+bool AgentPublishBuffer_InitPool( AgentPublishBufferPool_t * pPool,
+                                  void * pStorage,
+                                  size_t payloadSize,
+                                  size_t numBuffers );
+
+/**
+ * @brief Allocate a buffer from a pool. Thread safe.
+ *
+ * The caller holds the only reference to the buffer, and its publish
+ * information is cleared.
+ *
+ * @param[in] pPool The pool.
+ * @param[in] blockTimeMs Time to wait for a buffer to become available.
+ *
+ * @return The buffer, or NULL if none became available in time.
+ */
+AgentPublishBuffer_t * AgentPublishBuffer_Allocate( AgentPublishBufferPool_t * pPool,
+                                                    uint32_t blockTimeMs );
+
+/**
+ * @brief Get the payload of a buffer, to write it in place.
+ *
+ * @param[in] pBuffer The buffer.
+ *
+ * @return The payload, of #AgentPublishBuffer_GetCapacity bytes.
+ */
+uint8_t * AgentPublishBuffer_GetPayload( AgentPublishBuffer_t * pBuffer );
+
+/**
+ * @brief Get the capacity of the payload of a buffer.
+ *
+ * @param[in] pBuffer The buffer.
+ *
+ * @return The capacity, in bytes.
+ */
+size_t AgentPublishBuffer_GetCapacity( const AgentPublishBuffer_t * pBuffer );
+
+/**
+ * @brief Take an additional reference to a buffer, for instance to keep
+ * reading the payload after handing the buffer to the agent.
+ *
+ * @param[in] pBuffer The buffer.
+ */
+void AgentPublishBuffer_Retain( AgentPublishBuffer_t * pBuffer );
+
+/**
+ * @brief Drop a reference to a buffer, returning it to its pool once the last
+ * reference is dropped.
+ *
+ * @param[in] pBuffer The buffer.
+ */
+void AgentPublishBuffer_Release( AgentPublishBuffer_t * pBuffer );
+
+/**
+ * @brief Publish the payload of a buffer through the agent.
+ *
+ * The reference of the caller is handed to the agent, which drops it once the
+ * publish completes, or right away if the publish could not be queued. The
+ * caller must not use the buffer afterwards unless it retained it.
+ *
+ * @param[in] pAgentContext The agent.
+ * @param[in] pBuffer The buffer, with its publish information set.
+ * @param[in] blockTimeMs Time to wait for the command to be queued.
+ * @param[in] completeCallback Called when the publish completes. May be NULL.
+ * @param[in] pCompleteCallbackContext Context passed to @p completeCallback.
+ *
+ * @return The status of #MQTTAgent_Publish.
+ */
+MQTTStatus_t AgentPublishBuffer_Publish( MQTTAgentContext_t * pAgentContext,
+                                         AgentPublishBuffer_t * pBuffer,
+                                         uint32_t blockTimeMs,
+                                         AgentPublishCompleteCallback_t completeCallback,
+                                         void * pCompleteCallbackContext );
+
+/**
+ * @brief Publish the payload of a buffer at QoS 0 without a command structure
+ * of the pool of the agent.
+ *
+ * The command embedded in the buffer is sent directly to the message context
+ * of the agent, and no completion is reported. With priority lanes, the
+ * default command attributes place the command in the lowest lane, so a
+ * stream of QoS 0 publishes never delays other commands. The reference of
+ * the caller is handed to the agent as with #AgentPublishBuffer_Publish.
+ *
+ * @param[in] pAgentContext The agent.
+ * @param[in] pBuffer The buffer, with its topic and payload length set. Its
+ * QoS is set to 0.
+ * @param[in] blockTimeMs Time to wait for the command to be queued.
+ *
+ * @return #MQTTSuccess, #MQTTBadParameter, or #MQTTSendFailed if the command
+ * could not be queued.
+ */
+MQTTStatus_t AgentPublishBuffer_PublishQoS0( MQTTAgentContext_t * pAgentContext,
+                                             AgentPublishBuffer_t * pBuffer,
+                                             uint32_t blockTimeMs );
+
+/**
+ * @brief Release the buffer of a command sent by #AgentPublishBuffer_PublishQoS0.
+ *
+ * The agent releases every command it concludes, so this is to be set as the
+ * release hook of the command pool of the agent, or called by its
+ * releaseCommand function for the commands that are not from a pool.
+ *
+ * @param[in] pCommand The command released by the agent.
+ *
+ * @return `true` if the command belonged to a publish buffer, else `false`,
+ * including for a command of a publish buffer already released.
+ */
+bool AgentPublishBuffer_ReleaseCommand( MQTTAgentCommand_t * pCommand );
+
+#endif /* ifndef AGENT_PUBLISH_BUFFER_H */
@@ -0,0 +1,266 @@
+/*
+ * AWS IoT Device Embedded C SDK for ZephyrRTOS
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file agent_publish_dispatch.h
+ * @brief Run the callbacks of incoming publishes on a pool of work queues
+ * instead of the agent thread.
+ *
+ * The agent thread matches an incoming publish against the subscription list,
+ * copies it once, and queues a delivery for each matching subscription. It
+ * never waits: when no copy or delivery is free, the delivery is dropped and
+ * counted.
+ *
+ * Deliveries of the same subscription run one at a time, in the order the
+ * publishes arrived. Subscriptions are spread over
+ * #AGENT_PUBLISH_DISPATCH_NUM_LANES lanes by a hash of their callback and
+ * context, and lanes ready to run are kept in a list shared by every work queue
+ * of the pool, so whichever worker is idle takes the next one. The deliveries
+ * of a lane run one at a time, so a slow callback also delays the unrelated
+ * subscriptions whose callback and context hash to the same lane. Raise
+ * #AGENT_PUBLISH_DISPATCH_NUM_LANES well above the number of subscriptions to
+ * make such collisions rare.
+ *
+ * A dropped delivery is lost. For a QoS 0 publish this is allowed by MQTT. A
+ * QoS 1 or 2 publish is acknowledged to the broker by coreMQTT once the
+ * incoming publish callback returns, so the broker does not send it again:
+ * such drops are logged as errors and counted apart, see
+ * #AgentPublishDispatch_GetDroppedAcknowledgedDeliveries. Size the storage of
+ * the dispatcher for the bursts of QoS 1 and 2 publishes expected.
+ */
+#ifndef AGENT_PUBLISH_DISPATCH_H
+#define AGENT_PUBLISH_DISPATCH_H
+
+/**************************************************/
+/******* DO NOT CHANGE the following order ********/
+/**************************************************/
+
+/* Logging related header files are required to be included in the following order:
+ * 1. Include the header file "logging_levels.h".
+ * 2. Define LIBRARY_LOG_NAME and  LIBRARY_LOG_LEVEL.
+ * 3. Include the header file "logging_stack.h".
+ */
+
+/* Include header that defines log levels. */
+#include "logging_levels.h"
+
+/* Logging configuration for the Agent Publish Dispatch module. */
+#ifndef LIBRARY_LOG_NAME
+    #define LIBRARY_LOG_NAME     "Agent Publish Dispatch"
+#endif
+#ifndef LIBRARY_LOG_LEVEL
+    #define LIBRARY_LOG_LEVEL    LOG_ERROR
+#endif
+
+#include "logging_stack.h"
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Kernel Header */
+#include <zephyr.h>
+
+/* core MQTT include. */
+#include "core_mqtt.h"
+
+/* Subscription manager include. */
+#include "subscription_manager.h"
+
+/**
+ * @brief Maximum number of work queues in the pool of a dispatcher.
+ */
+#ifndef AGENT_PUBLISH_DISPATCH_MAX_WORKERS
+    #define AGENT_PUBLISH_DISPATCH_MAX_WORKERS    ( 4U )
+#endif
+
+/**
+ * @brief Number of lanes of a dispatcher. Subscriptions sharing a lane have
+ * their deliveries run one at a time, so a slow callback delays the other
+ * subscriptions of its lane.
+ */
+#ifndef AGENT_PUBLISH_DISPATCH_NUM_LANES
+    #define AGENT_PUBLISH_DISPATCH_NUM_LANES    ( 16U )
+#endif
+
+/**
+ * @brief Copy of an incoming publish, shared by its deliveries.
+ */
+typedef struct AgentDispatchedPublish
+{
+    atomic_t references;           /**< @brief Deliveries not yet run, plus one while the publish is fanned out. */
+    MQTTPublishInfo_t publishInfo; /**< @brief The publish, pointing in the copy that follows. */
+} AgentDispatchedPublish_t;
+
+/**
+ * @brief A callback to run with a publish.
+ */
+typedef struct AgentPublishDelivery
+{
+    sys_snode_t node;                         /**< @brief Link in the list of its subscription. */
+    IncomingPubCallback_t callback;           /**< @brief Callback of the subscription. */
+    void * pCallbackContext;                  /**< @brief Context of the callback. */
+    AgentDispatchedPublish_t * pPublish;      /**< @brief The publish. */
+} AgentPublishDelivery_t;
+
+/**
+ * @brief Deliveries waiting for the subscriptions of a lane.
+ */
+typedef struct AgentPublishDispatchLane
+{
+    sys_slist_t deliveries; /**< @brief Deliveries, oldest first. */
+    sys_snode_t readyNode;  /**< @brief Link in the list of lanes ready to run. */
+    bool scheduled;         /**< @brief In the ready list, or being run by a worker. */
+} AgentPublishDispatchLane_t;
+
+struct AgentPublishDispatcher;
+
+/**
+ * @brief A work queue of the pool.
+ */
+typedef struct AgentPublishDispatchWorker
+{
+    struct k_work work;                           /**< @brief Runs ready subscriptions until none is left. */
+    struct k_work_q * pWorkQueue;                 /**< @brief The work queue. */
+    struct AgentPublishDispatcher * pDispatcher;  /**< @brief The dispatcher. */
+    bool busy;                                    /**< @brief Submitted and not yet out of ready subscriptions. */
+} AgentPublishDispatchWorker_t;
+
+/**
+ * @brief A dispatcher of incoming publishes.
+ */
+typedef struct AgentPublishDispatcher
+{
+    struct k_spinlock lock;                                                      /**< @brief Protects the lanes, the ready list and the workers. */
+    sys_slist_t readyLanes;                                                      /**< @brief Lanes ready to run, shared by the workers. */
+    AgentPublishDispatchLane_t lanes[ AGENT_PUBLISH_DISPATCH_NUM_LANES ];        /**< @brief Chosen by the callback and context of a subscription. */
+    AgentPublishDispatchWorker_t workers[ AGENT_PUBLISH_DISPATCH_MAX_WORKERS ];  /**< @brief The pool. */
+    size_t numWorkers;                                                           /**< @brief Work queues in the pool. */
+    struct k_mem_slab publishes;                                                 /**< @brief Copies of the publishes. */
+    struct k_mem_slab deliveries;                                                /**< @brief Deliveries. */
+    size_t maxPublishSize;                                                       /**< @brief Largest topic and payload of a copy. */
+    atomic_t droppedDeliveries;                                                  /**< @brief Deliveries dropped for lack of memory. */
+    atomic_t droppedAcknowledgedDeliveries;                                      /**< @brief Deliveries of QoS 1 and 2 publishes dropped. */
+} AgentPublishDispatcher_t;
+
+/**
+ * @brief Size of the storage of a copy of a publish.
+ *
+ * @param[in] maxPublishSize Largest topic name plus payload length.
+ */
+#define AGENT_PUBLISH_DISPATCH_BLOCK_SIZE( maxPublishSize ) \
+    ROUND_UP( sizeof( AgentDispatchedPublish_t ) + ( maxPublishSize ), sizeof( void * ) )
+
+/**
+ * @brief Define the storage of the copies of the publishes of a dispatcher.
+ *
+ * @param[in] name Name of the storage array.
+ * @param[in] numPublishes Number of publishes waiting for a callback at once.
+ * @param[in] maxPublishSize Largest topic name plus payload length.
+ */
+#define AGENT_PUBLISH_DISPATCH_PUBLISHES_DEFINE( name, numPublishes, maxPublishSize ) \
+    static uint8_t name[ ( numPublishes ) * AGENT_PUBLISH_DISPATCH_BLOCK_SIZE( maxPublishSize ) ] __aligned( sizeof( void * ) )
+
+/**
+ * @brief Define the storage of the deliveries of a dispatcher.
+ *
+ * @param[in] name Name of the storage array.
+ * @param[in] numDeliveries Number of callbacks waiting to run at once, over
+ * every subscription.
+ */
+#define AGENT_PUBLISH_DISPATCH_DELIVERIES_DEFINE( name, numDeliveries ) \
+    static AgentPublishDelivery_t name[ numDeliveries ] __aligned( sizeof( void * ) )
+
+/**
+ * @brief Initialize a dispatcher.
+ *
+ * The work queues must be started by the application, which chooses their
+ * priority, stack size and, on SMP, CPU affinity. They may be shared with
+ * other work.
+ *
+ * @param[out] pDispatcher The dispatcher to initialize.
+ * @param[in] pWorkQueues Work queues of the pool.
+ * @param[in] numWorkQueues Number of work queues, at most
+ * #AGENT_PUBLISH_DISPATCH_MAX_WORKERS.
+ * @param[in] pPublishStorage Storage defined with
+ * #AGENT_PUBLISH_DISPATCH_PUBLISHES_DEFINE.
+ * @param[in] numPublishes Number of publishes of @p pPublishStorage.
+ * @param[in] maxPublishSize Largest publish of @p pPublishStorage.
+ * @param[in] pDeliveryStorage Storage defined with
+ * #AGENT_PUBLISH_DISPATCH_DELIVERIES_DEFINE.
+ * @param[in] numDeliveries Number of deliveries of @p pDeliveryStorage.
+ *
+ * @return `true` if the dispatcher was initialized, `false` if a parameter was
+ * invalid.
+ */
+bool AgentPublishDispatch_Init( AgentPublishDispatcher_t * pDispatcher,
+                                struct k_work_q * const * pWorkQueues,
+                                size_t numWorkQueues,
+                                void * pPublishStorage,
+                                size_t numPublishes,
+                                size_t maxPublishSize,
+                                AgentPublishDelivery_t * pDeliveryStorage,
+                                size_t numDeliveries );
+
+/**
+ * @brief Queue the callbacks registered for the topic of an incoming publish.
+ *
+ * Used by the incoming publish callback of the agent in place of
+ * #handleIncomingPublishes. A callback that cannot be queued is dropped, even
+ * for a QoS 1 or 2 publish, which coreMQTT acknowledges regardless. The callbacks get a copy of the publish, shared by
+ * every subscription that matched, which they must not modify. As a callback
+ * may run after its subscription was removed, its context must stay valid
+ * until the deliveries queued for it ran.
+ *
+ * @param[in] pDispatcher The dispatcher.
+ * @param[in] pSubscriptionList The subscription list.
+ * @param[in] pPublishInfo Info of incoming publish.
+ *
+ * @return `true` if a subscription matched the publish, even if its callback
+ * was dropped; `false` otherwise.
+ */
+bool AgentPublishDispatch_HandleIncomingPublishes( AgentPublishDispatcher_t * pDispatcher,
+                                                   SubscriptionList_t * pSubscriptionList,
+                                                   MQTTPublishInfo_t * pPublishInfo );
+
+/**
+ * @brief Get the number of callbacks dropped for lack of memory.
+ *
+ * @param[in] pDispatcher The dispatcher.
+ *
+ * @return The number of deliveries dropped since initialization.
+ */
+uint32_t AgentPublishDispatch_GetDroppedDeliveries( AgentPublishDispatcher_t * pDispatcher );
+
+/**
+ * @brief Get the number of callbacks of QoS 1 and 2 publishes dropped for lack
+ * of memory. These publishes were acknowledged to the broker, so they are lost.
+ *
+ * @param[in] pDispatcher The dispatcher.
+ *
+ * @return The number of such deliveries dropped since initialization, also
+ * counted by #AgentPublishDispatch_GetDroppedDeliveries.
+ */
+uint32_t AgentPublishDispatch_GetDroppedAcknowledgedDeliveries( AgentPublishDispatcher_t * pDispatcher );
+
+#endif /* ifndef AGENT_PUBLISH_DISPATCH_H */
@@ -0,0 +1,194 @@
+/*
+ * AWS IoT Device Embedded C SDK for ZephyrRTOS
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file agent_publish_window.h
+ * @brief Credit windows bounding the publishes a producer has in flight
+ * through the MQTT agent.
+ *
+ * A window holds a number of credits. Each publish made with
+ * #AgentPublishWindow_Publish takes a credit, and gives it back when it
+ * completes: once it is sent for QoS 0, and once its PUBACK or PUBCOMP is
+ * received for QoS 1 and 2. A producer can therefore ask how many publishes
+ * it may submit, and be told as credits return, to adapt its sampling rate to
+ * the throughput of the connection instead of finding out from failed sends.
+ */
+#ifndef AGENT_PUBLISH_WINDOW_H
+#define AGENT_PUBLISH_WINDOW_H
+
+/**************************************************/
+/******* DO NOT CHANGE the following order ********/
+/**************************************************/
+
+/* Logging related header files are required to be included in the following order:
+ * 1. Include the header file "logging_levels.h".
+ * 2. Define LIBRARY_LOG_NAME and  LIBRARY_LOG_LEVEL.
+ * 3. Include the header file "logging_stack.h".
+ */
+
+/* Include header that defines log levels. */
+#include "logging_levels.h"
+
+/* Logging configuration for the Agent Publish Window module. */
+#ifndef LIBRARY_LOG_NAME
+    #define LIBRARY_LOG_NAME     "Agent Publish Window"
+#endif
+#ifndef LIBRARY_LOG_LEVEL
+    #define LIBRARY_LOG_LEVEL    LOG_ERROR
+#endif
+
+#include "logging_stack.h"
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Kernel Header */
+#include <zephyr.h>
+
+/* coreMQTT Agent include. */
+#include "core_mqtt_agent.h"
+
+/**
+ * @brief Function called when credits return to a window.
+ *
+ * It is called by the agent thread, as the publish that held the credit
+ * completes, so it must not block.
+ *
+ * @param[in] pContext Context given to #AgentPublishWindow_SetCreditsCallback.
+ * @param[in] credits Number of credits available.
+ */
+typedef void ( * AgentCreditsReturnedCallback_t )( void * pContext,
+                                                   uint32_t credits );
+
+struct AgentPublishWindow;
+
+/**
+ * @brief Tracks a publish in flight, to give its credit back on completion.
+ */
+typedef struct AgentPublishWindowSlot
+{
+    struct AgentPublishWindow * pWindow;                     /**< @brief Window the credit belongs to. */
+    MQTTAgentCommandCallback_t cmdCompleteCallback;          /**< @brief Callback of the caller, or NULL. */
+    MQTTAgentCommandContext_t * pCmdCompleteCallbackContext; /**< @brief Context of the callback of the caller. */
+} AgentPublishWindowSlot_t;
+
+/**
+ * @brief A credit window.
+ *
+ * Besides #AgentPublishWindow_SetCreditsCallback, a task may wait for a credit
+ * with k_poll, on the `credits` semaphore, along with other events.
+ */
+typedef struct AgentPublishWindow
+{
+    struct k_sem credits;                           /**< @brief Credits available. */
+    struct k_mem_slab slots;                        /**< @brief Slots of the publishes in flight. */
+    uint32_t windowSize;                            /**< @brief Total number of credits. */
+    AgentCreditsReturnedCallback_t creditsCallback; /**< @brief Called when credits return, if not NULL. */
+    void * pCreditsCallbackContext;                 /**< @brief Context of #AgentPublishWindow_t.creditsCallback. */
+} AgentPublishWindow_t;
+
+/**
+ * @brief Define the storage of the slots of a window.
+ *
+ * @param[in] name Name of the storage array.
+ * @param[in] windowSize Number of credits of the window.
+ */
+#define AGENT_PUBLISH_WINDOW_STORAGE_DEFINE( name, windowSize ) \
+    static AgentPublishWindowSlot_t name[ windowSize ] __aligned( sizeof( void * ) )
+
+/**
+ * @brief Initialize a window with all its credits available.
+ *
+ * @param[out] pWindow The window to initialize.
+ * @param[in] pSlotStorage Storage defined with #AGENT_PUBLISH_WINDOW_STORAGE_DEFINE.
+ * @param[in] windowSize Number of credits, as given to #AGENT_PUBLISH_WINDOW_STORAGE_DEFINE.
+ *
+ * @return `true` if the window was initialized, `false` if a parameter was invalid.
+ */
+bool AgentPublishWindow_Init( AgentPublishWindow_t * pWindow,
+                              AgentPublishWindowSlot_t * pSlotStorage,
+                              uint32_t windowSize );
+
+/**
+ * @brief Set the function called when credits return to a window.
+ *
+ * @param[in] pWindow The window.
+ * @param[in] creditsCallback The function, or NULL to remove it.
+ * @param[in] pCreditsCallbackContext Context passed to @p creditsCallback.
+ */
+void AgentPublishWindow_SetCreditsCallback( AgentPublishWindow_t * pWindow,
+                                            AgentCreditsReturnedCallback_t creditsCallback,
+                                            void * pCreditsCallbackContext );
+
+/**
+ * @brief Get the number of publishes that may be submitted without waiting.
+ *
+ * @param[in] pWindow The window.
+ *
+ * @return The number of credits available.
+ */
+uint32_t AgentPublishWindow_GetCredits( AgentPublishWindow_t * pWindow );
+
+/**
+ * @brief Take a credit, for a publish not made with #AgentPublishWindow_Publish.
+ *
+ * The credit must be given back with #AgentPublishWindow_Return, typically by
+ * the completion callback of the publish.
+ *
+ * @param[in] pWindow The window.
+ * @param[in] blockTimeMs Time to wait for a credit.
+ *
+ * @return `true` if a credit was taken, `false` if none returned in time.
+ */
+bool AgentPublishWindow_Acquire( AgentPublishWindow_t * pWindow,
+                                 uint32_t blockTimeMs );
+
+/**
+ * @brief Give back a credit taken with #AgentPublishWindow_Acquire.
+ *
+ * @param[in] pWindow The window.
+ */
+void AgentPublishWindow_Return( AgentPublishWindow_t * pWindow );
+
+/**
+ * @brief Publish through the agent under a credit of a window.
+ *
+ * The credit is taken before the publish is queued, waiting up to the block
+ * time of @p pCommandInfo, and given back after the callback of
+ * @p pCommandInfo is called.
+ *
+ * @param[in] pWindow The window.
+ * @param[in] pAgentContext The agent.
+ * @param[in] pPublishInfo The publish, as for #MQTTAgent_Publish.
+ * @param[in] pCommandInfo The command information, as for #MQTTAgent_Publish.
+ *
+ * @return #MQTTNoMemory if no credit returned in time, else the status of
+ * #MQTTAgent_Publish.
+ */
+MQTTStatus_t AgentPublishWindow_Publish( AgentPublishWindow_t * pWindow,
+                                         const MQTTAgentContext_t * pAgentContext,
+                                         MQTTPublishInfo_t * pPublishInfo,
+                                         const MQTTAgentCommandInfo_t * pCommandInfo );
+
+#endif /* ifndef AGENT_PUBLISH_WINDOW_H */
@@ -0,0 +1,198 @@
+/*
+ * AWS IoT Device Embedded C SDK for ZephyrRTOS
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file agent_resubscribe.h
+ * @brief Restore the subscriptions of a subscription list through the MQTT
+ * agent after a reconnection.
+ *
+ * Nothing is sent when the broker kept the session. Otherwise, the distinct
+ * topic filters of the list are packed into as few SUBSCRIBE packets as fit
+ * in the network buffer of the agent. Up to #AGENT_RESUBSCRIBE_MAX_IN_FLIGHT
+ * packets await their SUBACK at once, and each completion queues the next
+ * one, so that a resubscribe takes a bounded number of commands of the agent
+ * whatever its size.
+ *
+ * Only the topic filters no other one covers are sent. If the broker refuses
+ * a topic filter, those it covered and that no other sent filter covers are
+ * sent in a following round, as AgentSubscriptions_Unsubscribe does when a
+ * covering filter is left.
+ */
+#ifndef AGENT_RESUBSCRIBE_H
+#define AGENT_RESUBSCRIBE_H
+
+/**************************************************/
+/******* DO NOT CHANGE the following order ********/
+/**************************************************/
+
+/* Logging related header files are required to be included in the following order:
+ * 1. Include the header file "logging_levels.h".
+ * 2. Define LIBRARY_LOG_NAME and  LIBRARY_LOG_LEVEL.
+ * 3. Include the header file "logging_stack.h".
+ */
+
+/* Include header that defines log levels. */
+#include "logging_levels.h"
+
+/* Logging configuration for the Agent Resubscribe module. */
+#ifndef LIBRARY_LOG_NAME
+    #define LIBRARY_LOG_NAME     "Agent Resubscribe"
+#endif
+#ifndef LIBRARY_LOG_LEVEL
+    #define LIBRARY_LOG_LEVEL    LOG_ERROR
+#endif
+
+#include "logging_stack.h"
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Kernel Header */
+#include <zephyr.h>
+
+/* coreMQTT Agent include. */
+#include "core_mqtt_agent.h"
+
+/* Subscription manager include. */
+#include "subscription_manager.h"
+
+/**
+ * @brief Maximum number of distinct topic filters resubscribed to. Those of a
+ * larger list are counted as failed, but kept in the list.
+ */
+#ifndef AGENT_RESUBSCRIBE_MAX_FILTERS
+    #define AGENT_RESUBSCRIBE_MAX_FILTERS    ( 32U )
+#endif
+
+/**
+ * @brief Size of the buffer the topic filters resubscribed to are copied to.
+ */
+#ifndef AGENT_RESUBSCRIBE_FILTER_BUFFER_SIZE
+    #define AGENT_RESUBSCRIBE_FILTER_BUFFER_SIZE    ( 1024U )
+#endif
+
+/**
+ * @brief Maximum number of SUBSCRIBE packets of a resubscribe awaiting their
+ * acknowledgement at once.
+ */
+#ifndef AGENT_RESUBSCRIBE_MAX_IN_FLIGHT
+    #define AGENT_RESUBSCRIBE_MAX_IN_FLIGHT    ( 4U )
+#endif
+
+/**
+ * @brief Function called once every SUBSCRIBE of a resubscribe completed.
+ *
+ * @param[in] pContext Context given to #AgentResubscribe_Start.
+ * @param[in] numFailed Number of topic filters not subscribed to at the
+ * broker, either directly or through a topic filter covering them: those the
+ * broker refused, which are removed from the subscription list, and those that
+ * could not be sent.
+ */
+typedef void ( * AgentResubscribeCompleteCallback_t )( void * pContext,
+                                                       size_t numFailed );
+
+/**
+ * @brief State of a topic filter of a resubscribe.
+ */
+typedef enum AgentResubscribeFilterState
+{
+    AgentResubscribeFilterCovered = 0, /**< @brief Not sent, as another topic filter covers it. */
+    AgentResubscribeFilterSent,        /**< @brief Sent, awaiting its acknowledgement. */
+    AgentResubscribeFilterAccepted,    /**< @brief Accepted by the broker. */
+    AgentResubscribeFilterRefused,     /**< @brief Refused by the broker, and removed from the list. */
+    AgentResubscribeFilterFailed       /**< @brief Not acknowledged, and kept in the list. */
+} AgentResubscribeFilterState_t;
+
+struct AgentResubscribe;
+
+/**
+ * @brief A SUBSCRIBE packet of a resubscribe.
+ */
+typedef struct AgentResubscribeBatch
+{
+    MQTTAgentSubscribeArgs_t subscribeArgs;  /**< @brief Topic filters of the packet. */
+    struct AgentResubscribe * pResubscribe; /**< @brief The resubscribe. */
+} AgentResubscribeBatch_t;
+
+/**
+ * @brief State of a resubscribe, which must remain valid until it completes.
+ */
+typedef struct AgentResubscribe
+{
+    char filterBuffer[ AGENT_RESUBSCRIBE_FILTER_BUFFER_SIZE ];                      /**< @brief Copies of the topic filters. */
+    MQTTSubscribeInfo_t subscribeInfo[ AGENT_RESUBSCRIBE_MAX_FILTERS ];            /**< @brief Distinct topic filters of the list, the sent ones first. */
+    AgentResubscribeFilterState_t filterStates[ AGENT_RESUBSCRIBE_MAX_FILTERS ];   /**< @brief State of each topic filter. */
+    AgentResubscribeBatch_t batches[ AGENT_RESUBSCRIBE_MAX_FILTERS ];              /**< @brief SUBSCRIBE packets of the round. */
+    MQTTAgentContext_t * pAgentContext;                                            /**< @brief The agent. */
+    SubscriptionList_t * pSubscriptionList;                                        /**< @brief The subscription list. */
+    MQTTQoS_t qos;                                                                 /**< @brief QoS of the subscriptions. */
+    size_t maxPacketSize;                                                          /**< @brief Largest SUBSCRIBE packet. */
+    size_t numListed;                                                              /**< @brief Distinct topic filters of the list. */
+    size_t numFilters;                                                             /**< @brief Topic filters copied. */
+    size_t numSent;                                                                /**< @brief Topic filters sent. */
+    size_t numBatches;                                                             /**< @brief Number of packets of the round. */
+    size_t nextBatch;                                                              /**< @brief Index of the next packet of the round to queue. */
+    size_t numInFlight;                                                            /**< @brief Packets queued and not completed yet. */
+    bool isStopped;                                                                /**< @brief Whether a packet was not acknowledged. */
+    AgentResubscribeCompleteCallback_t completeCallback;                           /**< @brief Called on completion, if not NULL. */
+    void * pCompleteCallbackContext;                                               /**< @brief Context of #AgentResubscribe_t.completeCallback. */
+} AgentResubscribe_t;
+
+/**
+ * @brief Restore the subscriptions of a list after the agent connected.
+ *
+ * Called once MQTTAgent_ResumeSession succeeded, before the command loop of
+ * the agent runs again. Up to #AGENT_RESUBSCRIBE_MAX_IN_FLIGHT SUBSCRIBE
+ * packets are queued without waiting, and the following ones without waiting
+ * from the completions of the previous ones. A packet that finds no free
+ * command or queue slot is tried again on the next completion. A packet that
+ * cannot be queued with none in flight, or fails otherwise, is counted as
+ * failed, and its topic filters are kept in the list for the next
+ * resubscribe. The packets left are not sent if one is not acknowledged, for
+ * example because the connection was lost.
+ *
+ * @param[in] pResubscribe State of the resubscribe. Must not be in use by a
+ * resubscribe that has not completed.
+ * @param[in] pAgentContext The agent.
+ * @param[in] pSubscriptionList The subscription list.
+ * @param[in] sessionPresent Session present flag of the CONNACK.
+ * @param[in] qos QoS of the subscriptions.
+ * @param[in] maxPacketSize Largest SUBSCRIBE packet, the size of the network
+ * buffer of the agent.
+ * @param[in] completeCallback Called once every packet completed. May be NULL.
+ * @param[in] pCompleteCallbackContext Context passed to @p completeCallback.
+ *
+ * @return #MQTTSuccess if nothing needed to be sent or no packet failed to be
+ * queued, else the status of the last MQTTAgent_Subscribe that failed.
+ */
+MQTTStatus_t AgentResubscribe_Start( AgentResubscribe_t * pResubscribe,
+                                     MQTTAgentContext_t * pAgentContext,
+                                     SubscriptionList_t * pSubscriptionList,
+                                     bool sessionPresent,
+                                     MQTTQoS_t qos,
+                                     size_t maxPacketSize,
+                                     AgentResubscribeCompleteCallback_t completeCallback,
+                                     void * pCompleteCallbackContext );
+
+#endif /* ifndef AGENT_RESUBSCRIBE_H */
@@ -0,0 +1,199 @@
+/*
+ * AWS IoT Device Embedded C SDK for ZephyrRTOS
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file agent_subscriptions.h
+ * @brief Subscribe and unsubscribe through the MQTT agent on behalf of several
+ * local subscribers sharing a subscription list.
+ *
+ * Each context-callback pair holds a reference to the topic filters it
+ * subscribed to. Only the first subscriber of a topic filter sends a SUBSCRIBE
+ * and waits for its SUBACK, and only the last one to leave sends an
+ * UNSUBSCRIBE. The others only update the subscription list, so a task
+ * leaving a topic filter never unsubscribes the tasks still using it.
+ *
+ * Only the topic filters not covered by another one of the list are subscribed
+ * to at the broker, as a publish matching both would otherwise be sent twice.
+ * A topic filter covered by another one is subscribed to at the broker when
+ * the covering filter is left, before the covering filter is unsubscribed.
+ */
+#ifndef AGENT_SUBSCRIPTIONS_H
+#define AGENT_SUBSCRIPTIONS_H
+
+/**************************************************/
+/******* DO NOT CHANGE the following order ********/
+/**************************************************/
+
+/* Logging related header files are required to be included in the following order:
+ * 1. Include the header file "logging_levels.h".
+ * 2. Define LIBRARY_LOG_NAME and  LIBRARY_LOG_LEVEL.
+ * 3. Include the header file "logging_stack.h".
+ */
+
+/* Include header that defines log levels. */
+#include "logging_levels.h"
+
+/* Logging configuration for the Agent Subscriptions module. */
+#ifndef LIBRARY_LOG_NAME
+    #define LIBRARY_LOG_NAME     "Agent Subscriptions"
+#endif
+#ifndef LIBRARY_LOG_LEVEL
+    #define LIBRARY_LOG_LEVEL    LOG_ERROR
+#endif
+
+#include "logging_stack.h"
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Kernel Header */
+#include <zephyr.h>
+
+/* coreMQTT Agent include. */
+#include "core_mqtt_agent.h"
+
+/* Completion handle include. */
+#include "agent_completion.h"
+
+/* Subscription manager include. */
+#include "subscription_manager.h"
+
+/**
+ * @brief Longest topic filter sent to the broker.
+ */
+#ifndef AGENT_SUBSCRIPTIONS_MAX_FILTER_LENGTH
+    #define AGENT_SUBSCRIPTIONS_MAX_FILTER_LENGTH    ( 128U )
+#endif
+
+/**
+ * @brief Maximum number of distinct topic filters of the subscription list
+ * compared when a topic filter is subscribed to or left.
+ */
+#ifndef AGENT_SUBSCRIPTIONS_MAX_FILTERS
+    #define AGENT_SUBSCRIPTIONS_MAX_FILTERS    ( 32U )
+#endif
+
+/**
+ * @brief Size of the buffer the topic filters of the subscription list are
+ * copied to.
+ */
+#ifndef AGENT_SUBSCRIPTIONS_FILTER_BUFFER_SIZE
+    #define AGENT_SUBSCRIPTIONS_FILTER_BUFFER_SIZE    ( 1024U )
+#endif
+
+/**
+ * @brief Subscriptions shared by the tasks using an agent.
+ *
+ * Subscribes and unsubscribes are sent one at a time, so that a subscriber
+ * joining a topic filter whose SUBSCRIBE is in flight waits for its SUBACK.
+ */
+typedef struct AgentSubscriptions
+{
+    MQTTAgentContext_t * pAgentContext;                                   /**< @brief The agent. */
+    SubscriptionList_t * pSubscriptionList;                               /**< @brief The subscription list. */
+    MQTTQoS_t qos;                                                        /**< @brief QoS of the subscriptions at the broker. */
+    struct k_mutex lock;                                                  /**< @brief Serializes the subscribes and unsubscribes. */
+    AgentCompletion_t completion;                                         /**< @brief Completion of the command in flight. */
+    bool isCommandPending;                                                /**< @brief Whether a command timed out before it completed. */
+    char topicFilter[ AGENT_SUBSCRIPTIONS_MAX_FILTER_LENGTH ];            /**< @brief Copy of the topic filter subscribed to or left. */
+    char filterBuffer[ AGENT_SUBSCRIPTIONS_FILTER_BUFFER_SIZE ];          /**< @brief Copies of the topic filters of the list. */
+    MQTTSubscribeInfo_t filters[ AGENT_SUBSCRIPTIONS_MAX_FILTERS ];       /**< @brief Distinct topic filters of the list. */
+    MQTTSubscribeInfo_t subscribeInfo[ AGENT_SUBSCRIPTIONS_MAX_FILTERS ]; /**< @brief Topic filters of the command. */
+    MQTTAgentSubscribeArgs_t subscribeArgs;                               /**< @brief Arguments of the command. */
+} AgentSubscriptions_t;
+
+/**
+ * @brief Initialize the shared subscriptions of an agent.
+ *
+ * @param[out] pSubscriptions The shared subscriptions.
+ * @param[in] pAgentContext The agent, initialized.
+ * @param[in] pSubscriptionList The subscription list the agent matches its
+ * incoming publishes against.
+ * @param[in] qos QoS of the subscriptions at the broker, which covering
+ * filters deliver for the filters they cover.
+ */
+void AgentSubscriptions_Init( AgentSubscriptions_t * pSubscriptions,
+                              MQTTAgentContext_t * pAgentContext,
+                              SubscriptionList_t * pSubscriptionList,
+                              MQTTQoS_t qos );
+
+/**
+ * @brief Subscribe a context-callback pair to a topic filter.
+ *
+ * The callback is added to the subscription list before the SUBSCRIBE is
+ * sent, so that no publish following the SUBACK is missed, and removed again
+ * if the subscribe fails. No SUBSCRIBE is sent if the topic filter is covered
+ * by another one of the list. Otherwise, the topic filters it covers are
+ * unsubscribed from at the broker once it is subscribed to.
+ *
+ * @param[in] pSubscriptions The shared subscriptions.
+ * @param[in] pTopicFilter The topic filter, which may be freed once this
+ * function returns.
+ * @param[in] topicFilterLength Length of the topic filter.
+ * @param[in] incomingPublishCallback Callback function for the subscription.
+ * @param[in] pIncomingPublishCallbackContext Context for the subscription callback.
+ * @param[in] timeoutMs Time to wait to queue each command and for its
+ * acknowledgement.
+ *
+ * @return #MQTTSuccess if the topic filter is subscribed to, #MQTTNoMemory if
+ * the subscription list is full, #MQTTRecvFailed if the SUBACK did not arrive
+ * in time, else the status of the SUBSCRIBE.
+ */
+MQTTStatus_t AgentSubscriptions_Subscribe( AgentSubscriptions_t * pSubscriptions,
+                                           const char * pTopicFilter,
+                                           uint16_t topicFilterLength,
+                                           IncomingPubCallback_t incomingPublishCallback,
+                                           void * pIncomingPublishCallbackContext,
+                                           uint32_t timeoutMs );
+
+/**
+ * @brief Unsubscribe a context-callback pair from a topic filter.
+ *
+ * The callback is removed from the subscription list before the UNSUBSCRIBE,
+ * if any, is sent. The topic filters the left filter covered, and that no
+ * other filter covers, are subscribed to at the broker first. If that fails,
+ * or not every topic filter of the list could be compared, the left filter is
+ * kept at the broker. If the UNSUBSCRIBE fails, the broker may keep sending
+ * publishes of the topic filter, which no longer match a subscription.
+ *
+ * @param[in] pSubscriptions The shared subscriptions.
+ * @param[in] pTopicFilter The topic filter.
+ * @param[in] topicFilterLength Length of the topic filter.
+ * @param[in] incomingPublishCallback Callback function of the subscription.
+ * @param[in] pIncomingPublishCallbackContext Context of the subscription callback.
+ * @param[in] timeoutMs Time to wait to queue each command and for its
+ * acknowledgement.
+ *
+ * @return #MQTTSuccess if the pair no longer is subscribed to the topic
+ * filter, #MQTTRecvFailed if an acknowledgement did not arrive in time, else
+ * the status of the command that failed.
+ */
+MQTTStatus_t AgentSubscriptions_Unsubscribe( AgentSubscriptions_t * pSubscriptions,
+                                             const char * pTopicFilter,
+                                             uint16_t topicFilterLength,
+                                             IncomingPubCallback_t incomingPublishCallback,
+                                             void * pIncomingPublishCallbackContext,
+                                             uint32_t timeoutMs );
+
+#endif /* ifndef AGENT_SUBSCRIPTIONS_H */
@@ -0,0 +1,177 @@
+/*
+ * AWS IoT Device Embedded C SDK for ZephyrRTOS
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file coalescing_transport.h
+ * @brief Transport interface wrapper that coalesces the packets written by the
+ * MQTT agent while it works through its queued commands, so that a burst of
+ * commands is written to the network, and encrypted, at once.
+ */
+#ifndef COALESCING_TRANSPORT_H
+#define COALESCING_TRANSPORT_H
+
+/**************************************************/
+/******* DO NOT CHANGE the following order ********/
+/**************************************************/
+
+/* Logging related header files are required to be included in the following order:
+ * 1. Include the header file "logging_levels.h".
+ * 2. Define LIBRARY_LOG_NAME and  LIBRARY_LOG_LEVEL.
+ * 3. Include the header file "logging_stack.h".
+ */
+
+/* Include header that defines log levels. */
+#include "logging_levels.h"
+
+/* Logging configuration for the Coalescing Transport module. */
+#ifndef LIBRARY_LOG_NAME
+    #define LIBRARY_LOG_NAME     "Coalescing Transport"
+#endif
+#ifndef LIBRARY_LOG_LEVEL
+    #define LIBRARY_LOG_LEVEL    LOG_ERROR
+#endif
+
+#include "logging_stack.h"
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Transport includes. */
+#include "transport_interface.h"
+
+/* coreMQTT Agent include. */
+#include "core_mqtt_agent.h"
+
+/**
+ * @brief Time allowed to write the coalesced bytes to the underlying transport.
+ */
+#ifndef COALESCING_TRANSPORT_FLUSH_TIMEOUT_MS
+    #define COALESCING_TRANSPORT_FLUSH_TIMEOUT_MS    ( 1000U )
+#endif
+
+/**
+ * @brief State of a coalescing transport.
+ *
+ * When it is not corked, the transport writes through to the underlying
+ * transport. When it is corked, writes are appended to the buffer, which is
+ * written to the underlying transport when it is full or flushed.
+ */
+typedef struct CoalescingTransport
+{
+    TransportInterface_t transport; /**< @brief The underlying transport. */
+    uint8_t * pBuffer;              /**< @brief Buffer of the coalesced bytes. */
+    size_t bufferSize;              /**< @brief Size of #CoalescingTransport_t.pBuffer. */
+    size_t bufferedBytes;           /**< @brief Number of bytes in #CoalescingTransport_t.pBuffer. */
+    bool corked;                    /**< @brief Whether writes are coalesced. */
+    bool failed;                    /**< @brief Set when coalesced bytes could not be written. */
+} CoalescingTransport_t;
+
+/**
+ * @brief Initialize a coalescing transport.
+ *
+ * The transport interface given to the MQTT agent then uses
+ * #CoalescingTransport_Send and #CoalescingTransport_Recv, with a network
+ * context whose pParams member points to @p pCoalescingTransport.
+ *
+ * @param[out] pCoalescingTransport The transport to initialize.
+ * @param[in] pTransport The underlying transport.
+ * @param[in] pBuffer Buffer for the coalesced bytes.
+ * @param[in] bufferSize Size of @p pBuffer.
+ *
+ * @return `true` if the transport was initialized, `false` if a parameter was invalid.
+ */
+bool CoalescingTransport_Init( CoalescingTransport_t * pCoalescingTransport,
+                               const TransportInterface_t * pTransport,
+                               uint8_t * pBuffer,
+                               size_t bufferSize );
+
+/**
+ * @brief Discard the coalesced bytes and stop coalescing, for instance when
+ * the underlying connection is re-established.
+ *
+ * @param[in] pCoalescingTransport The transport.
+ */
+void CoalescingTransport_Reset( CoalescingTransport_t * pCoalescingTransport );
+
+/**
+ * @brief Start coalescing writes.
+ *
+ * @param[in] pCoalescingTransport The transport.
+ */
+void CoalescingTransport_Cork( CoalescingTransport_t * pCoalescingTransport );
+
+/**
+ * @brief Write the coalesced bytes to the underlying transport and stop
+ * coalescing writes.
+ *
+ * @param[in] pCoalescingTransport The transport.
+ *
+ * @return `true` if every coalesced byte was written, else `false`.
+ */
+bool CoalescingTransport_Flush( CoalescingTransport_t * pCoalescingTransport );
+
+/**
+ * @brief Receive hook of a message context that corks the transport while the
+ * agent processes commands that only write to the network, and flushes it
+ * before the agent waits for more commands.
+ *
+ * Commands that wait for a response from the broker, such as CONNECT, flush
+ * the transport first, so that the broker receives what they wait on.
+ *
+ * @param[in] pHookContext The #CoalescingTransport_t of the agent.
+ * @param[in] pCommand The command received by the agent, or NULL if the agent
+ * is about to wait for a command.
+ */
+void CoalescingTransport_AgentReceiveHook( void * pHookContext,
+                                           const MQTTAgentCommand_t * pCommand );
+
+/**
+ * @brief Send data, either to the coalescing buffer or to the underlying transport.
+ *
+ * @param[in] pNetworkContext Network context whose pParams is a #CoalescingTransport_t.
+ * @param[in] pBuffer Buffer containing the bytes to send.
+ * @param[in] bytesToSend Number of bytes to send from the buffer.
+ *
+ * @return Number of bytes sent or buffered; 0 if the underlying transport
+ * timed out; a negative value on error, including an earlier failure to write
+ * coalesced bytes.
+ */
+int32_t CoalescingTransport_Send( NetworkContext_t * pNetworkContext,
+                                  const void * pBuffer,
+                                  size_t bytesToSend );
+
+/**
+ * @brief Receive data from the underlying transport.
+ *
+ * @param[in] pNetworkContext Network context whose pParams is a #CoalescingTransport_t.
+ * @param[out] pBuffer Buffer to receive bytes into.
+ * @param[in] bytesToRecv Number of bytes to receive from the network.
+ *
+ * @return The value returned by the underlying transport.
+ */
+int32_t CoalescingTransport_Recv( NetworkContext_t * pNetworkContext,
+                                  void * pBuffer,
+                                  size_t bytesToRecv );
+
+#endif /* ifndef COALESCING_TRANSPORT_H */
@@ -23,6 +23,14 @@
 /**
  * @file subscription_manager.h
  * @brief Functions for managing MQTT subscriptions.
+ *
+ * @note The subscriptions are no longer kept in an array of
+ * #SubscriptionElement_t owned by the application. #addSubscription,
+ * #removeSubscription and #handleIncomingPublishes take a #SubscriptionList_t
+ * instead, whose storage is defined with #SUBSCRIPTION_MANAGER_STORAGE_DEFINE
+ * and given to #initSubscriptionList. The topic filters are copied into that
+ * storage, so #SubscriptionElement_t no longer holds them, and code written for
+ * the array must be ported to the list.
  */
 #ifndef SUBSCRIPTION_MANAGER_H
 #define SUBSCRIPTION_MANAGER_H
@@ -50,17 +58,100 @@
 
 #include "logging_stack.h"
 
+/* Kernel includes. */
+#include <zephyr.h>
+
 /* core MQTT include. */
 #include "core_mqtt.h"
 
 /**
- * @brief Maximum number of subscriptions maintained by the subscription manager
- * simultaneously in a list.
+ * @brief Size of the blocks the storage of a list is divided in. Subscriptions,
+ * topic levels and their text take whole blocks. Must be a multiple of the size
+ * of a pointer.
+ */
+#ifndef SUBSCRIPTION_MANAGER_BLOCK_SIZE
+    #define SUBSCRIPTION_MANAGER_BLOCK_SIZE    8U
+#endif
+
+/**
+ * @brief Number of buckets of the hash table of the topic filters without
+ * wildcards, taken from the storage of a list. Lookups slow down once there
+ * are many more topic filters than buckets.
+ */
+#ifndef SUBSCRIPTION_MANAGER_HASH_BUCKETS
+    #define SUBSCRIPTION_MANAGER_HASH_BUCKETS    32U
+#endif
+
+/**
+ * @brief Maximum number of topic levels of a topic filter.
+ */
+#ifndef SUBSCRIPTION_MANAGER_MAX_TOPIC_LEVELS
+    #define SUBSCRIPTION_MANAGER_MAX_TOPIC_LEVELS    16U
+#endif
+
+/**
+ * @brief Maximum number of subscriptions matching a publish whose callbacks are
+ * invoked. The matches are copied on the stack of the receiving thread.
  */
-#ifndef SUBSCRIPTION_MANAGER_MAX_SUBSCRIPTIONS
-    #define SUBSCRIPTION_MANAGER_MAX_SUBSCRIPTIONS    10U
+#ifndef SUBSCRIPTION_MANAGER_MAX_MATCHES
+    #define SUBSCRIPTION_MANAGER_MAX_MATCHES    16U
 #endif
 
+/**
+ * @brief Number of blocks taken by an object of a given size.
+ */
+#define SUBSCRIPTION_MANAGER_BLOCKS_FOR( size ) \
+    ( ( ( size ) + SUBSCRIPTION_MANAGER_BLOCK_SIZE - 1U ) / SUBSCRIPTION_MANAGER_BLOCK_SIZE )
+
+/**
+ * @brief Number of blocks a list needs for its subscriptions.
+ *
+ * A subscription takes the blocks of a #SubscriptionElement_t, plus, for each
+ * topic level it does not share with an earlier topic filter, the blocks of a
+ * #SubscriptionTrieNode_t followed by the text of the level. The roots of the
+ * two tries take the blocks of a node each.
+ *
+ * @param[in] numSubscriptions Number of subscriptions.
+ * @param[in] levelsPerFilter Maximum number of topic levels of a topic filter.
+ * @param[in] levelLength Maximum length of a topic level.
+ */
+#define SUBSCRIPTION_MANAGER_STORAGE_BLOCKS( numSubscriptions, levelsPerFilter, levelLength ) \
+    ( ( 2U * SUBSCRIPTION_MANAGER_BLOCKS_FOR( sizeof( SubscriptionTrieNode_t ) ) ) +          \
+      ( ( numSubscriptions ) *                                                                \
+        ( SUBSCRIPTION_MANAGER_BLOCKS_FOR( sizeof( SubscriptionElement_t ) ) +                \
+          ( ( levelsPerFilter ) *                                                             \
+            SUBSCRIPTION_MANAGER_BLOCKS_FOR( sizeof( SubscriptionTrieNode_t ) + ( levelLength ) ) ) ) ) )
+
+/**
+ * @brief Size of the storage of a list holding a number of subscriptions,
+ * none of which share a topic level.
+ *
+ * Besides the blocks of #SUBSCRIPTION_MANAGER_STORAGE_BLOCKS, the storage holds
+ * a bit per block marking the blocks in use, and the buckets of the hash table
+ * of the topic filters without wildcards, aligned to a block. A list has no
+ * more than 0xFFFF blocks.
+ *
+ * @param[in] numSubscriptions Number of subscriptions.
+ * @param[in] levelsPerFilter Maximum number of topic levels of a topic filter.
+ * @param[in] levelLength Maximum length of a topic level.
+ */
+#define SUBSCRIPTION_MANAGER_STORAGE_SIZE( numSubscriptions, levelsPerFilter, levelLength )                               \
+    ( ( SUBSCRIPTION_MANAGER_STORAGE_BLOCKS( numSubscriptions, levelsPerFilter, levelLength ) *                           \
+        SUBSCRIPTION_MANAGER_BLOCK_SIZE ) +                                                                               \
+      ( ( ( SUBSCRIPTION_MANAGER_STORAGE_BLOCKS( numSubscriptions, levelsPerFilter, levelLength ) / 32U ) + 2U ) * 4U ) + \
+      ( SUBSCRIPTION_MANAGER_HASH_BUCKETS * sizeof( uint16_t ) ) +                                                        \
+      SUBSCRIPTION_MANAGER_BLOCK_SIZE )
+
+/**
+ * @brief Define the storage of a subscription list.
+ *
+ * @param[in] name Name of the storage array.
+ * @param[in] size Size of the storage, in bytes, which
+ * #SUBSCRIPTION_MANAGER_STORAGE_SIZE gives for a number of subscriptions.
+ */
+#define SUBSCRIPTION_MANAGER_STORAGE_DEFINE( name, size ) \
+    static uint8_t name[ size ] __aligned( SUBSCRIPTION_MANAGER_BLOCK_SIZE )
+
 /**
  * @brief Callback function called when receiving a publish.
  *
@@ -73,23 +164,112 @@ typedef void (* IncomingPubCallback_t )( void * pIncomingPublishCallbackContext,
 /**
  * @brief An element in the list of subscriptions.
  *
- * This subscription manager implementation expects that the array of the
- * subscription elements used for storing subscriptions to be initialized to 0.
- *
  * @note This implementation allows multiple tasks to subscribe to the same topic.
  * In this case, another element is added to the subscription list, differing
- * in the intended publish callback. Also note that the topic filters are not
- * copied in the subscription manager and hence the topic filter strings need to
- * stay in scope until unsubscribed.
+ * in the intended publish callback. The topic filter is copied in the storage
+ * of the list, where it is shared with the elements of the same topic filter.
  */
 typedef struct subscriptionElement
 {
     IncomingPubCallback_t incomingPublishCallback;
     void * pIncomingPublishCallbackContext;
-    uint16_t filterStringLength;
-    const char * pSubscriptionFilterString;
+    uint16_t nextElement; /**< @brief Next element with the same topic filter, as its block, or 0. */
 } SubscriptionElement_t;
 
+/**
+ * @brief Kinds of topic levels of a topic filter.
+ */
+typedef enum SubscriptionLevelType
+{
+    SUBSCRIPTION_LEVEL_LITERAL = 0,      /**< @brief A level matched by its text. */
+    SUBSCRIPTION_LEVEL_SINGLE_WILDCARD,  /**< @brief `+`, matching any one level. */
+    SUBSCRIPTION_LEVEL_MULTI_WILDCARD    /**< @brief `#`, matching the remaining levels. */
+} SubscriptionLevelType_t;
+
+/**
+ * @brief A topic level of a trie of the topic filters of a list, followed by
+ * its text in the same blocks.
+ *
+ * The children of a node are the levels that follow it in some topic filter,
+ * including the `+` and `#` wildcards, so topic filters with a common prefix
+ * store it once. A node in use is part of at least one topic filter. The hash
+ * and kind of the level are computed when the node is added, so that matching
+ * rejects most levels without reading their text.
+ */
+typedef struct SubscriptionTrieNode
+{
+    uint32_t levelHash;    /**< @brief Hash of the level. */
+    uint32_t filterHash;   /**< @brief Hash of the topic filter ending with the level, if it has no wildcards. */
+    uint16_t levelLength;  /**< @brief Length of the level. */
+    uint16_t levelType;    /**< @brief A #SubscriptionLevelType_t. */
+    uint16_t parent;       /**< @brief Block of the parent node. */
+    uint16_t firstChild;   /**< @brief Block of the first child node, or 0. */
+    uint16_t nextSibling;  /**< @brief Block of the next child node of the parent, or 0. */
+    uint16_t refCount;     /**< @brief Elements whose topic filter contains the level. */
+    uint16_t firstElement; /**< @brief Block of the first element whose topic filter ends with the level, or 0. */
+    uint16_t nextInBucket; /**< @brief Block of the next node of the same hash bucket, or 0. */
+} SubscriptionTrieNode_t;
+
+/**
+ * @brief A list of subscriptions, stored in a memory region given to
+ * #initSubscriptionList, and indexed so that matching a publish costs the
+ * number of levels of its topic rather than the number of subscriptions.
+ *
+ * The region is divided in blocks, taken and given back as subscriptions are
+ * added and removed, so that it holds as many subscriptions as their topic
+ * filters allow. Topic filters with wildcards are found by walking a trie of
+ * their levels. Topic filters without wildcards are stored in a second trie,
+ * and found from a hash table of the tries' nodes by the hash of the topic.
+ *
+ * Tasks may add and remove subscriptions while the agent thread matches
+ * publishes. Writers are serialized by a mutex, and bump a sequence count
+ * before and after each change, so that it is odd while the list changes.
+ * Readers take no lock: they read the list between two reads of the sequence
+ * count, and read it again if the count changed. A reader finding the count
+ * odd sleeps a tick until the writer is done, so the list is only read from
+ * threads. Blocks are only ever read inside the region, so a reader racing a
+ * writer reads stale data at worst.
+ *
+ * A list initialized to 0 holds no subscription until #initSubscriptionList.
+ */
+typedef struct SubscriptionList
+{
+    uint8_t * pBlocks;           /**< @brief The blocks. The first is the root of the trie of the topic filters with wildcards. */
+    uint32_t * pUsedBlocks;      /**< @brief Bitmap of the blocks in use. */
+    uint16_t * pBuckets;         /**< @brief Hash table of the topic filters without wildcards: the first node of each bucket, or 0. */
+    uint16_t numBlocks;          /**< @brief Number of blocks. */
+    uint16_t numFreeBlocks;      /**< @brief Number of blocks not in use. */
+    uint16_t exactRoot;          /**< @brief Block of the root of the trie of the topic filters without wildcards. */
+    struct k_mutex writeLock;    /**< @brief Serializes the writers. */
+    atomic_t sequence;           /**< @brief Bumped before and after each change. */
+} SubscriptionList_t;
+
+/**
+ * @brief Function called for each subscription matching a publish.
+ *
+ * @param[in] pMatchContext Context given to #forEachMatchingSubscription.
+ * @param[in] pSubscription A copy of the subscription, taken when the publish
+ * was matched.
+ */
+typedef void (* SubscriptionMatchCallback_t )( void * pMatchContext,
+                                               const SubscriptionElement_t * pSubscription );
+
+/**
+ * @brief Initialize a subscription list, emptying it.
+ *
+ * @param[out] pSubscriptionList The pointer to the subscription list.
+ * @param[in] pStorage Storage of the list, defined with
+ * #SUBSCRIPTION_MANAGER_STORAGE_DEFINE, which must remain valid while the list
+ * is in use.
+ * @param[in] storageSize Size of @p pStorage.
+ *
+ * @return `true` if the list was initialized, `false` if the storage is too
+ * small.
+ */
+bool initSubscriptionList( SubscriptionList_t * pSubscriptionList,
+                           void * pStorage,
+                           size_t storageSize );
+
 /**
  * @brief Add a subscription to the subscription list.
  *
@@ -97,45 +277,164 @@ typedef struct subscriptionElement
  * context-callback pairs. However, a single context-callback pair may only be
  * associated to the same topic filter once.
  *
- * @param[in] pSubscriptionList  The pointer to the subscription list array.
+ * @param[in] pSubscriptionList  The pointer to the subscription list.
  * @param[in] pTopicFilterString Topic filter string of subscription.
  * @param[in] topicFilterLength Length of topic filter string.
  * @param[in] incomingPublishCallback Callback function for the subscription.
  * @param[in] pIncomingPublishCallbackContext Context for the subscription callback.
  *
- * @return `true` if subscription added or exists, `false` if insufficient memory.
+ * @return `true` if subscription added or exists, `false` if the storage of the
+ * list is full or the topic filter is invalid.
  */
-bool addSubscription( SubscriptionElement_t * pSubscriptionList,
+bool addSubscription( SubscriptionList_t * pSubscriptionList,
                       const char * pTopicFilterString,
                       uint16_t topicFilterLength,
                       IncomingPubCallback_t incomingPublishCallback,
                       void * pIncomingPublishCallbackContext );
 
+/**
+ * @brief Add a subscription to the subscription list, and tell whether it is
+ * the first of its topic filter.
+ *
+ * Each context-callback pair holds one reference to a topic filter, so that
+ * the filter only needs to be subscribed to at the broker while it has a
+ * subscription.
+ *
+ * @param[in] pSubscriptionList  The pointer to the subscription list.
+ * @param[in] pTopicFilterString Topic filter string of subscription.
+ * @param[in] topicFilterLength Length of topic filter string.
+ * @param[in] incomingPublishCallback Callback function for the subscription.
+ * @param[in] pIncomingPublishCallbackContext Context for the subscription callback.
+ * @param[out] pIsFirst Set to `true` if the list held no subscription with the
+ * topic filter before; `false` otherwise.
+ *
+ * @return `true` if subscription added or exists, `false` if the storage of the
+ * list is full or the topic filter is invalid.
+ */
+bool acquireSubscription( SubscriptionList_t * pSubscriptionList,
+                          const char * pTopicFilterString,
+                          uint16_t topicFilterLength,
+                          IncomingPubCallback_t incomingPublishCallback,
+                          void * pIncomingPublishCallbackContext,
+                          bool * pIsFirst );
+
+/**
+ * @brief Remove the subscription of a context-callback pair from the
+ * subscription list, keeping the other subscriptions of its topic filter.
+ *
+ * @note The callbacks of a publish matched just before the removal may still
+ * be running once this function returns.
+ *
+ * @param[in] pSubscriptionList  The pointer to the subscription list.
+ * @param[in] pTopicFilterString Topic filter of subscription.
+ * @param[in] topicFilterLength Length of topic filter.
+ * @param[in] incomingPublishCallback Callback function for the subscription.
+ * @param[in] pIncomingPublishCallbackContext Context for the subscription callback.
+ * @param[out] pIsLast Set to `true` if the subscription was the last of its
+ * topic filter; `false` otherwise.
+ *
+ * @return `true` if the subscription was removed, `false` if it was not in the
+ * list.
+ */
+bool releaseSubscription( SubscriptionList_t * pSubscriptionList,
+                          const char * pTopicFilterString,
+                          uint16_t topicFilterLength,
+                          IncomingPubCallback_t incomingPublishCallback,
+                          void * pIncomingPublishCallbackContext,
+                          bool * pIsLast );
+
 /**
  * @brief Remove a subscription from the subscription list.
  *
  * @note If the topic filter exists multiple times in the subscription list,
- * then every instance of the subscription will be removed.
+ * then every instance of the subscription will be removed. Use
+ * #releaseSubscription to remove a single one.
+ *
+ * @note The callbacks of a publish matched just before the removal may still
+ * be running once this function returns.
  *
- * @param[in] pSubscriptionList  The pointer to the subscription list array.
+ * @param[in] pSubscriptionList  The pointer to the subscription list.
  * @param[in] pTopicFilterString Topic filter of subscription.
  * @param[in] topicFilterLength Length of topic filter.
  */
-void removeSubscription( SubscriptionElement_t * pSubscriptionList,
+void removeSubscription( SubscriptionList_t * pSubscriptionList,
                          const char * pTopicFilterString,
                          uint16_t topicFilterLength );
 
+/**
+ * @brief Call a function for each subscription whose topic filter matches the
+ * topic of a publish.
+ *
+ * The list is matched without taking a lock, and the function is called once
+ * the matches are known to be consistent, with copies of the subscriptions. It
+ * may thus add or remove subscriptions. A context-callback pair subscribed to
+ * several matching topic filters is only called once.
+ *
+ * @param[in] pSubscriptionList  The pointer to the subscription list.
+ * @param[in] pPublishInfo Info of incoming publish.
+ * @param[in] matchCallback Function called for each matching subscription.
+ * @param[in] pMatchContext Context passed to @p matchCallback.
+ *
+ * @return `true` if a subscription matched; `false` otherwise.
+ */
+bool forEachMatchingSubscription( SubscriptionList_t * pSubscriptionList,
+                                  const MQTTPublishInfo_t * pPublishInfo,
+                                  SubscriptionMatchCallback_t matchCallback,
+                                  void * pMatchContext );
+
 /**
  * @brief Handle incoming publishes by invoking the callbacks registered
  * for the incoming publish's topic filter.
  *
- * @param[in] pSubscriptionList  The pointer to the subscription list array.
+ * @param[in] pSubscriptionList  The pointer to the subscription list.
  * @param[in] pPublishInfo Info of incoming publish.
  *
  * @return `true` if an application callback could be invoked;
  *  `false` otherwise.
  */
-bool handleIncomingPublishes( SubscriptionElement_t * pSubscriptionList,
+bool handleIncomingPublishes( SubscriptionList_t * pSubscriptionList,
                               MQTTPublishInfo_t * pPublishInfo );
 
+/**
+ * @brief Copy the distinct topic filters of a subscription list.
+ *
+ * @param[in] pSubscriptionList The pointer to the subscription list.
+ * @param[out] pBuffer Buffer the topic filters are copied to.
+ * @param[in] bufferSize Size of @p pBuffer.
+ * @param[out] pSubscribeInfo Set to point to the copies. Their QoS is left
+ * unchanged.
+ * @param[in] maxFilters Number of entries of @p pSubscribeInfo.
+ * @param[out] pNumFilters Set to the number of topic filters of the list, which
+ * exceeds the return value if some did not fit.
+ *
+ * @return Number of topic filters copied.
+ */
+size_t copySubscriptionFilters( SubscriptionList_t * pSubscriptionList,
+                                char * pBuffer,
+                                size_t bufferSize,
+                                MQTTSubscribeInfo_t * pSubscribeInfo,
+                                size_t maxFilters,
+                                size_t * pNumFilters );
+
+/**
+ * @brief Check whether a topic filter covers another one, that is whether
+ * every topic matching the topic filter also matches the covering filter.
+ *
+ * A subscription to the covering filter then delivers every publish of the
+ * topic filter, so only the covering filter needs to be subscribed to at the
+ * broker.
+ *
+ * @param[in] pTopicFilter The topic filter, which must be valid.
+ * @param[in] topicFilterLength Length of the topic filter.
+ * @param[in] pCoveringFilter The covering filter, which must be valid.
+ * @param[in] coveringFilterLength Length of the covering filter.
+ *
+ * @return `true` if @p pCoveringFilter covers @p pTopicFilter, including when
+ * they are the same; `false` otherwise.
+ */
+bool isTopicFilterCovered( const char * pTopicFilter,
+                           uint16_t topicFilterLength,
+                           const char * pCoveringFilter,
+                           uint16_t coveringFilterLength );
+
 #endif /* SUBSCRIPTION_MANAGER_H */
@@ -0,0 +1,190 @@
+/*
+ * AWS IoT Device Embedded C SDK for ZephyrRTOS
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file agent_completion.c
+ * @brief Implementation of the completion handles of agent commands.
+ */
+
+/* Standard includes. */
+#include <assert.h>
+
+#include "agent_completion.h"
+
+/*-----------------------------------------------------------*/
+
+void AgentCompletion_Init( AgentCompletion_t * pCompletion )
+{
+    assert( pCompletion != NULL );
+
+    k_poll_signal_init( &( pCompletion->signal ) );
+}
+/*-----------------------------------------------------------*/
+
+void AgentCompletion_SetCommandInfo( AgentCompletion_t * pCompletion,
+                                     MQTTAgentCommandInfo_t * pCommandInfo )
+{
+    assert( pCompletion != NULL );
+    assert( pCommandInfo != NULL );
+
+    pCommandInfo->cmdCompleteCallback = AgentCompletion_CommandCallback;
+    pCommandInfo->pCmdCompleteCallbackContext = ( MQTTAgentCommandContext_t * ) pCompletion;
+}
+/*-----------------------------------------------------------*/
+
+void AgentCompletion_CommandCallback( MQTTAgentCommandContext_t * pCmdCallbackContext,
+                                      MQTTAgentReturnInfo_t * pReturnInfo )
+{
+    assert( pReturnInfo != NULL );
+
+    AgentCompletion_Complete( pCmdCallbackContext, pReturnInfo->returnCode );
+}
+/*-----------------------------------------------------------*/
+
+void AgentCompletion_Complete( void * pCompletion,
+                               MQTTStatus_t returnCode )
+{
+    AgentCompletion_t * pAgentCompletion = ( AgentCompletion_t * ) pCompletion;
+
+    assert( pAgentCompletion != NULL );
+
+    ( void ) k_poll_signal_raise( &( pAgentCompletion->signal ), ( int ) returnCode );
+}
+/*-----------------------------------------------------------*/
+
+bool AgentCompletion_IsComplete( AgentCompletion_t * pCompletion,
+                                 MQTTStatus_t * pReturnCode )
+{
+    unsigned int signaled = 0U;
+    int result = 0;
+
+    assert( pCompletion != NULL );
+
+    k_poll_signal_check( &( pCompletion->signal ), &signaled, &result );
+
+    if( ( signaled != 0U ) && ( pReturnCode != NULL ) )
+    {
+        *pReturnCode = ( MQTTStatus_t ) result;
+    }
+
+    return( signaled != 0U );
+}
+/*-----------------------------------------------------------*/
+
+bool AgentCompletion_Wait( AgentCompletion_t * pCompletion,
+                           uint32_t timeoutMs,
+                           MQTTStatus_t * pReturnCode )
+{
+    struct k_poll_event event;
+
+    assert( pCompletion != NULL );
+
+    k_poll_event_init( &event, K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY, &( pCompletion->signal ) );
+    ( void ) k_poll( &event, 1, K_MSEC( timeoutMs ) );
+
+    return AgentCompletion_IsComplete( pCompletion, pReturnCode );
+}
+/*-----------------------------------------------------------*/
+
+size_t AgentCompletion_WaitAny( AgentCompletion_t * pCompletions,
+                                size_t numCompletions,
+                                uint32_t timeoutMs )
+{
+    struct k_poll_event events[ AGENT_COMPLETION_MAX_WAIT_ANY ];
+    size_t completedIndex = AGENT_COMPLETION_NONE;
+    size_t index = 0U;
+
+    if( ( pCompletions == NULL ) || ( numCompletions == 0U ) || ( numCompletions > AGENT_COMPLETION_MAX_WAIT_ANY ) )
+    {
+        LogError( ( "Invalid completion group: At most %u handles can be awaited.",
+                    ( unsigned int ) AGENT_COMPLETION_MAX_WAIT_ANY ) );
+    }
+    else
+    {
+        for( index = 0U; index < numCompletions; index++ )
+        {
+            k_poll_event_init( &events[ index ], K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY, &( pCompletions[ index ].signal ) );
+        }
+
+        ( void ) k_poll( events, ( int ) numCompletions, K_MSEC( timeoutMs ) );
+
+        /* The signals are checked rather than the event states, so that a
+         * handle completed before the call is also found. */
+        for( index = 0U; ( index < numCompletions ) && ( completedIndex == AGENT_COMPLETION_NONE ); index++ )
+        {
+            if( AgentCompletion_IsComplete( &pCompletions[ index ], NULL ) )
+            {
+                completedIndex = index;
+            }
+        }
+    }
+
+    return completedIndex;
+}
+/*-----------------------------------------------------------*/
+
+bool AgentCompletion_WaitAll( AgentCompletion_t * pCompletions,
+                              size_t numCompletions,
+                              uint32_t timeoutMs,
+                              size_t * pNumSucceeded )
+{
+    bool allCompleted = true;
+    size_t numSucceeded = 0U;
+    MQTTStatus_t returnCode = MQTTSuccess;
+    uint32_t startTimeMs = 0U;
+    uint32_t elapsedTimeMs = 0U;
+    size_t index = 0U;
+
+    assert( ( pCompletions != NULL ) || ( numCompletions == 0U ) );
+
+    startTimeMs = k_uptime_get_32();
+
+    /* Waiting on each handle in turn completes as soon as the last one does,
+     * and needs no events for the whole group. */
+    for( index = 0U; index < numCompletions; index++ )
+    {
+        elapsedTimeMs = k_uptime_get_32() - startTimeMs;
+
+        if( !AgentCompletion_Wait( &pCompletions[ index ],
+                                   ( elapsedTimeMs < timeoutMs ) ? ( timeoutMs - elapsedTimeMs ) : 0U,
+                                   &returnCode ) )
+        {
+            allCompleted = false;
+        }
+        else if( returnCode == MQTTSuccess )
+        {
+            numSucceeded++;
+        }
+        else
+        {
+            /* Empty else marker. */
+        }
+    }
+
+    if( pNumSucceeded != NULL )
+    {
+        *pNumSucceeded = numSucceeded;
+    }
+
+    return allCompleted;
+}
+/*-----------------------------------------------------------*/
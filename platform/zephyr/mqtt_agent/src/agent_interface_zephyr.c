@@ -24,51 +24,1174 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
 
 /* Agent interface header */
 #include "agent_interface_zephyr.h"
 
+#if ( MQTT_AGENT_ENABLE_SOCKET_WAKEUP == 1 )
+    /* Zephyr sockets include. */
+    #include <net/socket.h>
+    #include <posix/sys/eventfd.h>
+#endif
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief The number of structures to allocate in the command pool.
+ */
+#ifndef NUM_COMMANDS_IN_POOL
+    #define NUM_COMMANDS_IN_POOL    ( 10U )
+#endif
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief The command structures of the common pool, used to hold information on
+ * commands (such as PUBLISH or SUBSCRIBE) between the command being created by an
+ * API call and completion of the command by the execution of the command's callback.
+ */
+static MQTTAgentCommand_t commandStructurePool[ NUM_COMMANDS_IN_POOL ];
+
+/**
+ * @brief Storage of the queue of free command structures of the common pool.
+ */
+static MQTTAgentCommand_t * freeCommandStructures[ NUM_COMMANDS_IN_POOL ];
+
+/**
+ * @brief The common pool, used by #Agent_GetCommand and #Agent_FreeCommand.
+ */
+static AgentCommandPool_t commonCommandPool;
+
+#if ( MQTT_AGENT_ENABLE_STATISTICS == 1 )
+
+/**
+ * @brief Time each structure of the common pool was obtained.
+ */
+    static uint32_t commonPoolAllocationTimes[ NUM_COMMANDS_IN_POOL ];
+#endif
+
+#if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 )
+
+/**
+ * @brief Set in #AgentCommandTrace_t.recorded once the command is sent.
+ */
+    #define TRACE_ENQUEUED    ( 1U << 0 )
+
+/**
+ * @brief Set in #AgentCommandTrace_t.recorded once the agent received the command.
+ */
+    #define TRACE_DEQUEUED    ( 1U << 1 )
+
+/**
+ * @brief Set in #AgentCommandTrace_t.recorded once the packet of the command is written.
+ */
+    #define TRACE_WRITTEN     ( 1U << 2 )
+
+/**
+ * @brief Timestamps of the commands of the common pool.
+ */
+    static AgentCommandTrace_t commonPoolTraces[ NUM_COMMANDS_IN_POOL ];
+
+/**
+ * @brief Names of the latency histograms in serialized statistics.
+ */
+    static const char * const latencyHistogramNames[ AGENT_LATENCY_NUM_STAGES ] =
+    {
+        "queuedMs",
+        "writtenMs",
+        "acknowledgedMs",
+        "totalMs"
+    };
+
+/**
+ * @brief The pools whose commands are traced.
+ */
+    static AgentCommandPool_t * tracedPools[ MQTT_AGENT_MAX_TRACED_POOLS ];
+
+/**
+ * @brief Number of slots of #tracedPools given to pools, set or not yet.
+ */
+    static atomic_t numReservedPools = ATOMIC_INIT( 0 );
+
+/**
+ * @brief Number of pools set in #tracedPools, which only grows once the
+ * slot below it is set.
+ */
+    static atomic_t numTracedPools = ATOMIC_INIT( 0 );
+#endif /* if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 ) */
+
+#if ( MQTT_AGENT_ENABLE_SOCKET_WAKEUP == 1 )
+
+/**
+ * @brief Stack of the thread that watches the sockets of the agents.
+ */
+    static K_THREAD_STACK_DEFINE( socketWatcherStack, MQTT_AGENT_SOCKET_WATCHER_STACK_SIZE );
+
+/**
+ * @brief The thread that watches the sockets of the agents.
+ */
+    static struct k_thread socketWatcherThread;
+
+/**
+ * @brief Protects #watchingContexts and the socket fields of the contexts
+ * shared with the watcher.
+ */
+    static K_MUTEX_DEFINE( socketWatcherLock );
+
+/**
+ * @brief Whether the watcher thread is started.
+ */
+    static bool socketWatcherStarted = false;
+
+/**
+ * @brief Eventfd the watcher polls along with the sockets, written to for it
+ * to poll the sockets again.
+ */
+    static int socketWatcherEventFd = -1;
+
+/**
+ * @brief The message contexts whose sockets are watched, or NULL.
+ */
+    static MQTTAgentMessageContext_t * watchingContexts[ MQTT_AGENT_MAX_WATCHED_SOCKETS ];
+#endif /* if ( MQTT_AGENT_ENABLE_SOCKET_WAKEUP == 1 ) */
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Receive an element from the backend of a message context.
+ *
+ * @param[in] pMsgCtx The message context.
+ * @param[out] pElement The element received: a command pointer, or an
+ * #AgentQueuedCommand_t with deadlines.
+ * @param[in] blockTimeMs Time to wait for an element.
+ *
+ * @return `true` if an element was received, else `false`.
+ */
+static bool receiveFromQueue( MQTTAgentMessageContext_t * pMsgCtx,
+                              void * pElement,
+                              uint32_t blockTimeMs );
+
+/**
+ * @brief Receive a message from a message context, dropping the expired ones.
+ *
+ * @param[in] pMsgCtx The message context.
+ * @param[out] pReceivedCommand The command received.
+ * @param[in] blockTimeMs Time to wait for a message.
+ *
+ * @return `true` if a message was received, else `false`.
+ */
+static bool receiveMessage( MQTTAgentMessageContext_t * pMsgCtx,
+                            MQTTAgentCommand_t ** pReceivedCommand,
+                            uint32_t blockTimeMs );
+
+/**
+ * @brief Wait for a message of a message context, or for data on the socket
+ * of the agent when it is watched.
+ *
+ * @param[in] pMsgCtx The message context.
+ * @param[out] pReceivedCommand The command received.
+ * @param[in] blockTimeMs Time to wait for a message.
+ *
+ * @return `true` if a message was received, else `false`.
+ */
+static bool waitForMessage( MQTTAgentMessageContext_t * pMsgCtx,
+                            MQTTAgentCommand_t ** pReceivedCommand,
+                            uint32_t blockTimeMs );
+
+#if ( MQTT_AGENT_ENABLE_DEADLINES == 1 )
+
+/**
+ * @brief Receive a queued command with its deadline, in the order of the
+ * context.
+ *
+ * @param[in] pMsgCtx The message context.
+ * @param[out] pQueuedCommand The command received.
+ * @param[in] blockTimeMs Time to wait for a command.
+ *
+ * @return `true` if a command was received, else `false`.
+ */
+    static bool receiveQueuedCommand( MQTTAgentMessageContext_t * pMsgCtx,
+                                      AgentQueuedCommand_t * pQueuedCommand,
+                                      uint32_t blockTimeMs );
+
+/**
+ * @brief Get the time left before a queued command expires.
+ *
+ * @param[in] pQueuedCommand The command.
+ * @param[in] nowMs The current uptime.
+ *
+ * @return The time left in ms, 0 if the command expired, or UINT32_MAX if it
+ * has no deadline.
+ */
+    static uint32_t getTimeToDeadline( const AgentQueuedCommand_t * pQueuedCommand,
+                                       uint32_t nowMs );
+
+/**
+ * @brief Conclude an expired command without sending it.
+ *
+ * @param[in] pMsgCtx The message context the command was queued in.
+ * @param[in] pCommand The command.
+ */
+    static void expireCommand( MQTTAgentMessageContext_t * pMsgCtx,
+                               MQTTAgentCommand_t * pCommand );
+#endif /* if ( MQTT_AGENT_ENABLE_DEADLINES == 1 ) */
+
+#if ( MQTT_AGENT_ENABLE_SOCKET_WAKEUP == 1 )
+
+/**
+ * @brief Wait for a message of a message context, or for the watched socket
+ * to be readable.
+ *
+ * @param[in] pMsgCtx The message context.
+ * @param[out] pReceivedCommand The command received.
+ * @param[in] blockTimeMs Time to wait.
+ *
+ * @return `true` if a message was received, `false` on timeout or when the
+ * socket is readable.
+ */
+    static bool waitForMessageOrSocket( MQTTAgentMessageContext_t * pMsgCtx,
+                                        MQTTAgentCommand_t ** pReceivedCommand,
+                                        uint32_t blockTimeMs );
+
+/**
+ * @brief Start the watcher thread and its eventfd, if not started yet. Called
+ * with #socketWatcherLock held.
+ *
+ * @return `true` if the watcher is started, `false` if its eventfd could not
+ * be created.
+ */
+    static bool startSocketWatcher( void );
+
+/**
+ * @brief Make the watcher poll the sockets again, with the latest sockets and
+ * the agents waiting.
+ */
+    static void wakeSocketWatcher( void );
+
+/**
+ * @brief Entry point of the thread that polls the sockets of the agents
+ * waiting, along with its eventfd.
+ *
+ * @param[in] pParameters Unused.
+ * @param[in] b Unused.
+ * @param[in] c Unused.
+ */
+    static void socketWatcherTask( void * pParameters,
+                                   void * b,
+                                   void * c );
+#endif /* if ( MQTT_AGENT_ENABLE_SOCKET_WAKEUP == 1 ) */
+
+#if ( MQTT_AGENT_ENABLE_STATISTICS == 1 )
+
+/**
+ * @brief Get the histogram bucket of a value.
+ *
+ * @param[in] value The value.
+ *
+ * @return Index of the bucket.
+ */
+    static size_t getHistogramBucket( uint32_t value );
+
+/**
+ * @brief Raise a high-water mark to a value.
+ *
+ * @param[in] pHighWaterMark The high-water mark.
+ * @param[in] value The value.
+ */
+    static void updateHighWaterMark( atomic_t * pHighWaterMark,
+                                     atomic_val_t value );
+
+/**
+ * @brief Get the number of messages queued in a message context.
+ *
+ * @param[in] pMsgCtx The message context.
+ *
+ * @return The number of messages queued.
+ */
+    static uint32_t getQueueDepth( MQTTAgentMessageContext_t * pMsgCtx );
+
+/**
+ * @brief Copy a histogram of atomic counters.
+ *
+ * @param[out] pDestination The copy.
+ * @param[in] pSource The histogram.
+ */
+    static void copyHistogram( uint32_t * pDestination,
+                               const atomic_t * pSource );
+
+/**
+ * @brief Append a histogram to a JSON document as an array.
+ *
+ * @param[in] pBuffer The document.
+ * @param[in] bufferSize Size of @p pBuffer.
+ * @param[in] length Length of the document.
+ * @param[in] pName Name of the array.
+ * @param[in] pHistogram The histogram.
+ *
+ * @return The length of the document, or @p bufferSize if it does not fit.
+ */
+    static size_t appendHistogram( char * pBuffer,
+                                   size_t bufferSize,
+                                   size_t length,
+                                   const char * pName,
+                                   const uint32_t * pHistogram );
+
+/*-----------------------------------------------------------*/
+
+    static size_t getHistogramBucket( uint32_t value )
+    {
+        size_t bucket = 0U;
+
+        while( ( value > 0U ) && ( bucket < ( MQTT_AGENT_STATISTICS_HISTOGRAM_BUCKETS - 1U ) ) )
+        {
+            bucket++;
+            value >>= 1;
+        }
+
+        return bucket;
+    }
+/*-----------------------------------------------------------*/
+
+    static void updateHighWaterMark( atomic_t * pHighWaterMark,
+                                     atomic_val_t value )
+    {
+        atomic_val_t highWaterMark = atomic_get( pHighWaterMark );
+
+        while( ( value > highWaterMark ) && !atomic_cas( pHighWaterMark, highWaterMark, value ) )
+        {
+            highWaterMark = atomic_get( pHighWaterMark );
+        }
+    }
+/*-----------------------------------------------------------*/
+
+    static uint32_t getQueueDepth( MQTTAgentMessageContext_t * pMsgCtx )
+    {
+        uint32_t depth = 0U;
+
+        #if ( MQTT_AGENT_USE_LOCK_FREE_QUEUE == 1 )
+            depth = ( uint32_t ) AgentMessageRing_GetDepth( &( pMsgCtx->ring ) );
+        #elif ( MQTT_AGENT_NUM_PRIORITY_LANES > 1U )
+            depth = k_sem_count_get( &( pMsgCtx->pendingMessages ) );
+        #else
+            depth = k_msgq_num_used_get( &( pMsgCtx->queue ) );
+        #endif
+
+        #if ( MQTT_AGENT_FRESHEST_FIRST == 1 )
+            depth += ( uint32_t ) pMsgCtx->numStagedCommands;
+        #endif
+
+        return depth;
+    }
+/*-----------------------------------------------------------*/
+
+    static void copyHistogram( uint32_t * pDestination,
+                               const atomic_t * pSource )
+    {
+        size_t i = 0U;
+
+        for( i = 0U; i < MQTT_AGENT_STATISTICS_HISTOGRAM_BUCKETS; i++ )
+        {
+            pDestination[ i ] = ( uint32_t ) atomic_get( &pSource[ i ] );
+        }
+    }
+/*-----------------------------------------------------------*/
+
+    static size_t appendHistogram( char * pBuffer,
+                                   size_t bufferSize,
+                                   size_t length,
+                                   const char * pName,
+                                   const uint32_t * pHistogram )
+    {
+        int written = 0;
+        size_t i = 0U;
+
+        written = snprintf( &pBuffer[ length ], bufferSize - length, ",\"%s\":[", pName );
+        length = ( ( written < 0 ) || ( ( size_t ) written >= ( bufferSize - length ) ) ) ? bufferSize : length + ( size_t ) written;
+
+        for( i = 0U; ( i < MQTT_AGENT_STATISTICS_HISTOGRAM_BUCKETS ) && ( length < bufferSize ); i++ )
+        {
+            written = snprintf( &pBuffer[ length ], bufferSize - length, "%s%u",
+                                ( i == 0U ) ? "" : ",", ( unsigned int ) pHistogram[ i ] );
+            length = ( ( written < 0 ) || ( ( size_t ) written >= ( bufferSize - length ) ) ) ? bufferSize : length + ( size_t ) written;
+        }
+
+        if( length < bufferSize )
+        {
+            written = snprintf( &pBuffer[ length ], bufferSize - length, "]" );
+            length = ( ( written < 0 ) || ( ( size_t ) written >= ( bufferSize - length ) ) ) ? bufferSize : length + ( size_t ) written;
+        }
+
+        return length;
+    }
+/*-----------------------------------------------------------*/
+
+#endif /* if ( MQTT_AGENT_ENABLE_STATISTICS == 1 ) */
+
+#if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 )
+
+/**
+ * @brief Get the timestamps of a command.
+ *
+ * @param[in] pCommand The command.
+ *
+ * @return The timestamps, or NULL if the command is not from a traced pool.
+ */
+    static AgentCommandTrace_t * getCommandTrace( const MQTTAgentCommand_t * pCommand );
+
+/**
+ * @brief Record that the packet of the last command received by the agent is
+ * written, as the agent asks for its next command.
+ *
+ * @param[in] pMsgCtx The message context of the agent.
+ */
+    static void traceWrittenCommand( MQTTAgentMessageContext_t * pMsgCtx );
+
+/**
+ * @brief Record the completion of a command of a pool, and account for the
+ * latency of each of its stages.
+ *
+ * @param[in] pPool The pool of the command.
+ * @param[in] pCommand The command.
+ */
+    static void traceCompletedCommand( AgentCommandPool_t * pPool,
+                                       const MQTTAgentCommand_t * pCommand );
+
+/*-----------------------------------------------------------*/
+
+    static AgentCommandTrace_t * getCommandTrace( const MQTTAgentCommand_t * pCommand )
+    {
+        AgentCommandTrace_t * pTrace = NULL;
+        AgentCommandPool_t * pPool = NULL;
+        size_t numPools = ( size_t ) atomic_get( &numTracedPools );
+        size_t i = 0U;
+
+        for( i = 0U; ( i < numPools ) && ( pTrace == NULL ); i++ )
+        {
+            pPool = tracedPools[ i ];
+
+            if( ( pCommand >= pPool->pCommands ) &&
+                ( pCommand < ( pPool->pCommands + pPool->numCommands ) ) )
+            {
+                pTrace = &( pPool->pTraces[ pCommand - pPool->pCommands ] );
+            }
+        }
+
+        return pTrace;
+    }
+/*-----------------------------------------------------------*/
+
+    static void traceWrittenCommand( MQTTAgentMessageContext_t * pMsgCtx )
+    {
+        AgentCommandTrace_t * pTrace = NULL;
+
+        if( pMsgCtx->pProcessedCommand != NULL )
+        {
+            pTrace = getCommandTrace( pMsgCtx->pProcessedCommand );
+
+            /* A command that already completed, such as a QoS 0 publish, may
+             * have been reused since, and is then left alone. */
+            if( ( pTrace != NULL ) && ( pTrace->recorded == ( TRACE_ENQUEUED | TRACE_DEQUEUED ) ) )
+            {
+                pTrace->writeTimeMs = k_uptime_get_32();
+                pTrace->recorded |= TRACE_WRITTEN;
+            }
+
+            pMsgCtx->pProcessedCommand = NULL;
+        }
+    }
+/*-----------------------------------------------------------*/
+
+    static void traceCompletedCommand( AgentCommandPool_t * pPool,
+                                       const MQTTAgentCommand_t * pCommand )
+    {
+        AgentCommandTrace_t * pTrace = NULL;
+        uint32_t latencies[ AGENT_LATENCY_NUM_STAGES ] = { 0 };
+        uint32_t nowMs = k_uptime_get_32();
+        size_t stage = 0U;
+
+        if( pPool->pTraces != NULL )
+        {
+            pTrace = &( pPool->pTraces[ pCommand - pPool->pCommands ] );
+
+            /* Commands that never reached the agent have no latency to report. */
+            if( ( pTrace->recorded & TRACE_DEQUEUED ) != 0U )
+            {
+                /* A command completed as it is processed, such as a QoS 0
+                 * publish, completes when its packet is written. */
+                if( ( pTrace->recorded & TRACE_WRITTEN ) == 0U )
+                {
+                    pTrace->writeTimeMs = nowMs;
+                }
+
+                latencies[ AGENT_LATENCY_QUEUED ] = pTrace->dequeueTimeMs - pTrace->enqueueTimeMs;
+                latencies[ AGENT_LATENCY_WRITTEN ] = pTrace->writeTimeMs - pTrace->dequeueTimeMs;
+                latencies[ AGENT_LATENCY_ACKNOWLEDGED ] = nowMs - pTrace->writeTimeMs;
+                latencies[ AGENT_LATENCY_TOTAL ] = nowMs - pTrace->enqueueTimeMs;
+
+                for( stage = 0U; stage < AGENT_LATENCY_NUM_STAGES; stage++ )
+                {
+                    ( void ) atomic_inc( &( pPool->counters.latencyHistograms[ stage ][ getHistogramBucket( latencies[ stage ] ) ] ) );
+                }
+
+                if( latencies[ AGENT_LATENCY_TOTAL ] > MQTT_AGENT_LATENCY_THRESHOLD_MS )
+                {
+                    LogWarn( ( "Command of type %d took %u ms: queued %u ms, written %u ms, acknowledged %u ms.",
+                               ( int ) pCommand->commandType,
+                               ( unsigned int ) latencies[ AGENT_LATENCY_TOTAL ],
+                               ( unsigned int ) latencies[ AGENT_LATENCY_QUEUED ],
+                               ( unsigned int ) latencies[ AGENT_LATENCY_WRITTEN ],
+                               ( unsigned int ) latencies[ AGENT_LATENCY_ACKNOWLEDGED ] ) );
+                }
+            }
+
+            pTrace->recorded = 0U;
+        }
+    }
+/*-----------------------------------------------------------*/
+
+#endif /* if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 ) */
+
+#if ( MQTT_AGENT_NUM_PRIORITY_LANES > 1U )
+
+/**
+ * @brief Get the queue of a lane of a message context.
+ *
+ * @param[in] pMsgCtx The message context.
+ * @param[in] priority The priority of the lane.
+ *
+ * @return The queue of the lane.
+ */
+    static struct k_msgq * getLaneQueue( MQTTAgentMessageContext_t * pMsgCtx,
+                                         uint8_t priority );
+
+/*-----------------------------------------------------------*/
+
+    static struct k_msgq * getLaneQueue( MQTTAgentMessageContext_t * pMsgCtx,
+                                         uint8_t priority )
+    {
+        struct k_msgq * pQueue = &( pMsgCtx->queue );
+
+        if( priority > AGENT_COMMAND_PRIORITY_HIGHEST )
+        {
+            pQueue = &( pMsgCtx->lowerPriorityQueues[ priority - 1U ] );
+        }
+
+        return pQueue;
+    }
+/*-----------------------------------------------------------*/
+
+#endif /* if ( MQTT_AGENT_NUM_PRIORITY_LANES > 1U ) */
+
+static bool receiveFromQueue( MQTTAgentMessageContext_t * pMsgCtx,
+                              void * pElement,
+                              uint32_t blockTimeMs )
+{
+    bool ret = false;
+
+    #if ( MQTT_AGENT_NUM_PRIORITY_LANES > 1U )
+        uint8_t priority = 0U;
+    #endif
+
+    #if ( MQTT_AGENT_USE_LOCK_FREE_QUEUE == 1 )
+        ret = AgentMessageRing_Receive( &( pMsgCtx->ring ), ( void ** ) pElement, blockTimeMs );
+    #elif ( MQTT_AGENT_NUM_PRIORITY_LANES > 1U )
+        /* Each message sent gives the semaphore once it is queued, and the
+         * agent is the only receiver, so a message is queued in some lane
+         * whenever the semaphore is taken. */
+        if( k_sem_take( &( pMsgCtx->pendingMessages ), K_MSEC( blockTimeMs ) ) == 0 )
+        {
+            for( priority = AGENT_COMMAND_PRIORITY_HIGHEST; ( priority <= AGENT_COMMAND_PRIORITY_LOWEST ) && !ret; priority++ )
+            {
+                ret = ( k_msgq_get( getLaneQueue( pMsgCtx, priority ), pElement, K_NO_WAIT ) == 0 );
+            }
+
+            assert( ret );
+        }
+    #else
+        ret = ( k_msgq_get( &( pMsgCtx->queue ), pElement, K_MSEC( blockTimeMs ) ) == 0 );
+    #endif
+
+    return ret;
+}
+/*-----------------------------------------------------------*/
+
+#if ( MQTT_AGENT_ENABLE_DEADLINES == 1 )
+
+    static uint32_t getTimeToDeadline( const AgentQueuedCommand_t * pQueuedCommand,
+                                       uint32_t nowMs )
+    {
+        uint32_t timeToDeadline = UINT32_MAX;
+        uint32_t elapsedMs = nowMs - pQueuedCommand->sendTimeMs;
+
+        if( pQueuedCommand->lifetimeMs != AGENT_COMMAND_NO_DEADLINE )
+        {
+            timeToDeadline = ( elapsedMs < pQueuedCommand->lifetimeMs ) ? ( pQueuedCommand->lifetimeMs - elapsedMs ) : 0U;
+        }
+
+        return timeToDeadline;
+    }
+/*-----------------------------------------------------------*/
+
+    static bool receiveQueuedCommand( MQTTAgentMessageContext_t * pMsgCtx,
+                                      AgentQueuedCommand_t * pQueuedCommand,
+                                      uint32_t blockTimeMs )
+    {
+        bool ret = false;
+
+        #if ( MQTT_AGENT_FRESHEST_FIRST == 1 )
+            size_t next = 0U;
+            size_t i = 0U;
+            uint32_t nextElapsedMs = UINT32_MAX;
+            uint32_t elapsedMs = 0U;
+            uint32_t nowMs = 0U;
+            bool isNextFound = false;
+
+            /* Only wait when nothing is staged. */
+            if( pMsgCtx->numStagedCommands == 0U )
+            {
+                if( receiveFromQueue( pMsgCtx, &( pMsgCtx->pStagedCommands[ 0 ] ), blockTimeMs ) )
+                {
+                    pMsgCtx->numStagedCommands = 1U;
+                }
+            }
+
+            /* Stage everything queued, so that a command sent last may be
+             * received first. */
+            while( ( pMsgCtx->numStagedCommands > 0U ) &&
+                   ( pMsgCtx->numStagedCommands < pMsgCtx->maxStagedCommands ) &&
+                   receiveFromQueue( pMsgCtx, &( pMsgCtx->pStagedCommands[ pMsgCtx->numStagedCommands ] ), 0U ) )
+            {
+                pMsgCtx->numStagedCommands++;
+            }
+
+            if( pMsgCtx->numStagedCommands > 0U )
+            {
+                nowMs = k_uptime_get_32();
+
+                /* The oldest command without a lifetime, or expired, goes
+                 * first, so that expired commands are dropped at once. */
+                for( i = 0U; ( i < pMsgCtx->numStagedCommands ) && !isNextFound; i++ )
+                {
+                    if( ( pMsgCtx->pStagedCommands[ i ].lifetimeMs == AGENT_COMMAND_NO_DEADLINE ) ||
+                        ( getTimeToDeadline( &( pMsgCtx->pStagedCommands[ i ] ), nowMs ) == 0U ) )
+                    {
+                        next = i;
+                        isNextFound = true;
+                    }
+                }
+
+                /* Otherwise, the command sent last. The staged commands are
+                 * in the order they were sent, so the last of those sent in
+                 * the same ms wins. */
+                for( i = 0U; ( i < pMsgCtx->numStagedCommands ) && !isNextFound; i++ )
+                {
+                    elapsedMs = nowMs - pMsgCtx->pStagedCommands[ i ].sendTimeMs;
+
+                    if( elapsedMs <= nextElapsedMs )
+                    {
+                        next = i;
+                        nextElapsedMs = elapsedMs;
+                    }
+                }
+
+                *pQueuedCommand = pMsgCtx->pStagedCommands[ next ];
+                pMsgCtx->numStagedCommands--;
+                ( void ) memmove( &( pMsgCtx->pStagedCommands[ next ] ),
+                                  &( pMsgCtx->pStagedCommands[ next + 1U ] ),
+                                  ( pMsgCtx->numStagedCommands - next ) * sizeof( AgentQueuedCommand_t ) );
+                ret = true;
+            }
+        #else /* if ( MQTT_AGENT_FRESHEST_FIRST == 1 ) */
+            ret = receiveFromQueue( pMsgCtx, pQueuedCommand, blockTimeMs );
+        #endif /* if ( MQTT_AGENT_FRESHEST_FIRST == 1 ) */
+
+        return ret;
+    }
+/*-----------------------------------------------------------*/
+
+    static void expireCommand( MQTTAgentMessageContext_t * pMsgCtx,
+                               MQTTAgentCommand_t * pCommand )
+    {
+        MQTTAgentReturnInfo_t returnInfo = { 0 };
+
+        returnInfo.returnCode = MQTT_AGENT_EXPIRED_COMMAND_STATUS;
+
+        LogDebug( ( "Dropping an expired command of type %d.", ( int ) pCommand->commandType ) );
+
+        if( pCommand->pCommandCompleteCallback != NULL )
+        {
+            pCommand->pCommandCompleteCallback( pCommand->pCmdContext, &returnInfo );
+        }
+
+        if( !pMsgCtx->releaseCommand( pCommand ) )
+        {
+            LogError( ( "Failed to release an expired command." ) );
+        }
+    }
+/*-----------------------------------------------------------*/
+
+#endif /* if ( MQTT_AGENT_ENABLE_DEADLINES == 1 ) */
+
+static bool receiveMessage( MQTTAgentMessageContext_t * pMsgCtx,
+                            MQTTAgentCommand_t ** pReceivedCommand,
+                            uint32_t blockTimeMs )
+{
+    bool ret = false;
+
+    #if ( MQTT_AGENT_ENABLE_DEADLINES == 1 )
+        AgentQueuedCommand_t queuedCommand = { 0 };
+
+        ret = receiveQueuedCommand( pMsgCtx, &queuedCommand, blockTimeMs );
+
+        /* Drop expired commands without waiting again, so that the agent
+         * still runs its process loop on time. */
+        while( ret && ( getTimeToDeadline( &queuedCommand, k_uptime_get_32() ) == 0U ) )
+        {
+            expireCommand( pMsgCtx, queuedCommand.pCommand );
+            ret = receiveQueuedCommand( pMsgCtx, &queuedCommand, 0U );
+        }
+
+        if( ret )
+        {
+            *pReceivedCommand = queuedCommand.pCommand;
+        }
+    #else
+        ret = receiveFromQueue( pMsgCtx, pReceivedCommand, blockTimeMs );
+    #endif
+
+    return ret;
+}
+/*-----------------------------------------------------------*/
+
+#if ( MQTT_AGENT_ENABLE_SOCKET_WAKEUP == 1 )
+
+    static bool waitForMessageOrSocket( MQTTAgentMessageContext_t * pMsgCtx,
+                                        MQTTAgentCommand_t ** pReceivedCommand,
+                                        uint32_t blockTimeMs )
+    {
+        bool ret = false;
+        struct k_poll_event events[ 2 ];
+
+        #if ( MQTT_AGENT_USE_LOCK_FREE_QUEUE == 1 )
+            struct k_sem * pWakeSemaphore = AgentMessageRing_PrepareWait( &( pMsgCtx->ring ) );
+
+            k_poll_event_init( &events[ 0 ], K_POLL_TYPE_SEM_AVAILABLE, K_POLL_MODE_NOTIFY_ONLY, pWakeSemaphore );
+        #elif ( MQTT_AGENT_NUM_PRIORITY_LANES > 1U )
+            k_poll_event_init( &events[ 0 ], K_POLL_TYPE_SEM_AVAILABLE, K_POLL_MODE_NOTIFY_ONLY, &( pMsgCtx->pendingMessages ) );
+        #else
+            k_poll_event_init( &events[ 0 ], K_POLL_TYPE_MSGQ_DATA_AVAILABLE, K_POLL_MODE_NOTIFY_ONLY, &( pMsgCtx->queue ) );
+        #endif
+
+        k_poll_event_init( &events[ 1 ], K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY, &( pMsgCtx->socketReadableSignal ) );
+
+        /* Arm the watcher. It keeps polling the socket until it is readable,
+         * so it only needs waking if it disarmed since the last wait. The
+         * socket is polled level-triggered, so resetting a signal raised for
+         * data the agent has read since loses nothing. */
+        k_poll_signal_reset( &( pMsgCtx->socketReadableSignal ) );
+
+        if( atomic_cas( &( pMsgCtx->isSocketArmed ), 0, 1 ) )
+        {
+            wakeSocketWatcher();
+        }
+
+        /* The ring must be checked once the wait is announced. */
+        ret = receiveMessage( pMsgCtx, pReceivedCommand, 0U );
+
+        if( !ret )
+        {
+            ( void ) k_poll( events, ARRAY_SIZE( events ), K_MSEC( blockTimeMs ) );
+
+            if( events[ 0 ].state != K_POLL_STATE_NOT_READY )
+            {
+                #if ( MQTT_AGENT_USE_LOCK_FREE_QUEUE == 1 )
+                    ( void ) k_sem_take( pWakeSemaphore, K_NO_WAIT );
+                #endif
+
+                ret = receiveMessage( pMsgCtx, pReceivedCommand, 0U );
+            }
+        }
+
+        #if ( MQTT_AGENT_USE_LOCK_FREE_QUEUE == 1 )
+            AgentMessageRing_FinishWait( &( pMsgCtx->ring ) );
+        #endif
+
+        return ret;
+    }
+/*-----------------------------------------------------------*/
+
+    static bool startSocketWatcher( void )
+    {
+        if( !socketWatcherStarted )
+        {
+            socketWatcherEventFd = eventfd( 0, EFD_NONBLOCK );
+
+            if( socketWatcherEventFd < 0 )
+            {
+                LogError( ( "Failed to create the eventfd of the socket watcher." ) );
+            }
+            else
+            {
+                ( void ) k_thread_create( &socketWatcherThread,
+                                          socketWatcherStack,
+                                          K_THREAD_STACK_SIZEOF( socketWatcherStack ),
+                                          socketWatcherTask,
+                                          NULL, NULL, NULL,
+                                          MQTT_AGENT_SOCKET_WATCHER_PRIORITY,
+                                          0,
+                                          K_NO_WAIT );
+                socketWatcherStarted = true;
+            }
+        }
+
+        return socketWatcherStarted;
+    }
+/*-----------------------------------------------------------*/
+
+    static void wakeSocketWatcher( void )
+    {
+        if( eventfd_write( socketWatcherEventFd, 1 ) != 0 )
+        {
+            LogError( ( "Failed to wake the socket watcher." ) );
+        }
+    }
 /*-----------------------------------------------------------*/
 
-/**
- * @brief The number of structures to allocate in the command pool.
- */
-#ifndef NUM_COMMANDS_IN_POOL
-    #define NUM_COMMANDS_IN_POOL    ( 10U )
-#endif
+    static void socketWatcherTask( void * pParameters,
+                                   void * b,
+                                   void * c )
+    {
+        struct zsock_pollfd pollFds[ MQTT_AGENT_MAX_WATCHED_SOCKETS + 1U ];
+        MQTTAgentMessageContext_t * polledContexts[ MQTT_AGENT_MAX_WATCHED_SOCKETS ];
+        MQTTAgentMessageContext_t * pMsgCtx = NULL;
+        size_t numPolled = 0U;
+        size_t i = 0U;
+        eventfd_t wakeups = 0;
+        int pollStatus = 0;
+
+        ( void ) pParameters;
+        ( void ) b;
+        ( void ) c;
+
+        for( ; ; )
+        {
+            /* Poll the sockets of the agents waiting. The eventfd comes first,
+             * so that a new socket or a new wait is polled right away. */
+            pollFds[ 0 ].fd = socketWatcherEventFd;
+            pollFds[ 0 ].events = ZSOCK_POLLIN;
+            pollFds[ 0 ].revents = 0;
+            numPolled = 0U;
+
+            ( void ) k_mutex_lock( &socketWatcherLock, K_FOREVER );
+
+            for( i = 0U; i < MQTT_AGENT_MAX_WATCHED_SOCKETS; i++ )
+            {
+                pMsgCtx = watchingContexts[ i ];
 
+                if( ( pMsgCtx != NULL ) && ( atomic_get( &( pMsgCtx->isSocketArmed ) ) == 1 ) )
+                {
+                    pMsgCtx->isSocketPolled = true;
+                    polledContexts[ numPolled ] = pMsgCtx;
+                    numPolled++;
+                    pollFds[ numPolled ].fd = ( int ) atomic_get( &( pMsgCtx->watchedSocket ) );
+                    pollFds[ numPolled ].events = ZSOCK_POLLIN;
+                    pollFds[ numPolled ].revents = 0;
+                }
+            }
+
+            ( void ) k_mutex_unlock( &socketWatcherLock );
+
+            pollStatus = zsock_poll( pollFds, ( int ) ( numPolled + 1U ), -1 );
+
+            if( ( pollFds[ 0 ].revents & ZSOCK_POLLIN ) != 0 )
+            {
+                ( void ) eventfd_read( socketWatcherEventFd, &wakeups );
+            }
+
+            ( void ) k_mutex_lock( &socketWatcherLock, K_FOREVER );
+
+            for( i = 0U; i < numPolled; i++ )
+            {
+                pMsgCtx = polledContexts[ i ];
+                pMsgCtx->isSocketPolled = false;
+
+                /* Errors also wake the agent up, for it to find them when
+                 * reading. The socket is polled again once the agent waits. */
+                if( ( ( pollStatus < 0 ) || ( pollFds[ i + 1U ].revents != 0 ) ) &&
+                    atomic_cas( &( pMsgCtx->isSocketArmed ), 1, 0 ) )
+                {
+                    ( void ) k_poll_signal_raise( &( pMsgCtx->socketReadableSignal ), pollFds[ i + 1U ].revents );
+                }
+
+                if( pMsgCtx->isReleaseAwaited )
+                {
+                    pMsgCtx->isReleaseAwaited = false;
+                    k_sem_give( &( pMsgCtx->socketReleased ) );
+                }
+            }
+
+            ( void ) k_mutex_unlock( &socketWatcherLock );
+        }
+    }
 /*-----------------------------------------------------------*/
 
-/**
- * @brief The pool of command structures used to hold information on commands (such
- * as PUBLISH or SUBSCRIBE) between the command being created by an API call and
- * completion of the command by the execution of the command's callback.
- */
-static MQTTAgentCommand_t commandStructurePool[ NUM_COMMANDS_IN_POOL ];
+#endif /* if ( MQTT_AGENT_ENABLE_SOCKET_WAKEUP == 1 ) */
 
-/**
- * @brief Statically create a message queue to handle the command structures.
- * The message queue is used for managing the memory blocks of command objects in the
- * command pool in a thread-safe manner.
- */
-K_MSGQ_DEFINE( commandStructureQueue, sizeof( MQTTAgentCommand_t * ), NUM_COMMANDS_IN_POOL, sizeof( MQTTAgentCommand_t * ) );
+static bool waitForMessage( MQTTAgentMessageContext_t * pMsgCtx,
+                            MQTTAgentCommand_t ** pReceivedCommand,
+                            uint32_t blockTimeMs )
+{
+    bool ret = false;
 
-/**
- * @brief Initialization status of the queue.
- */
-static volatile uint8_t queueInit = false;
+    #if ( MQTT_AGENT_ENABLE_SOCKET_WAKEUP == 1 )
+        if( ( blockTimeMs > 0U ) && ( atomic_get( &( pMsgCtx->watchedSocket ) ) >= 0 ) )
+        {
+            /* Data already received by the transport must be processed
+             * without waiting for the socket. */
+            if( ( pMsgCtx->pendingDataHook == NULL ) || !pMsgCtx->pendingDataHook( pMsgCtx->pPendingDataContext ) )
+            {
+                ret = waitForMessageOrSocket( pMsgCtx, pReceivedCommand, blockTimeMs );
+            }
+            else
+            {
+                ret = receiveMessage( pMsgCtx, pReceivedCommand, 0U );
+            }
+        }
+        else
+        {
+            ret = receiveMessage( pMsgCtx, pReceivedCommand, blockTimeMs );
+        }
+    #else
+        ret = receiveMessage( pMsgCtx, pReceivedCommand, blockTimeMs );
+    #endif
+
+    return ret;
+}
+/*-----------------------------------------------------------*/
+
+bool Agent_InitializeMessageContext( MQTTAgentMessageContext_t * pMsgCtx,
+                                     AgentMessageStorage_t * pStorage,
+                                     size_t queueLength )
+{
+    bool ret = false;
+
+    #if ( MQTT_AGENT_NUM_PRIORITY_LANES > 1U )
+        size_t i = 0U;
+    #endif
+
+    if( ( pMsgCtx != NULL ) && ( pStorage != NULL ) && ( queueLength > 0U ) )
+    {
+        #if ( MQTT_AGENT_USE_LOCK_FREE_QUEUE == 1 )
+            ret = AgentMessageRing_Init( &( pMsgCtx->ring ), pStorage, queueLength );
+        #else
+            k_msgq_init( &( pMsgCtx->queue ),
+                         ( char * ) pStorage,
+                         sizeof( AgentMessageStorage_t ),
+                         ( uint32_t ) queueLength );
+            ret = true;
+        #endif
+
+        #if ( MQTT_AGENT_NUM_PRIORITY_LANES > 1U )
+            for( i = 1U; i < MQTT_AGENT_NUM_PRIORITY_LANES; i++ )
+            {
+                k_msgq_init( &( pMsgCtx->lowerPriorityQueues[ i - 1U ] ),
+                             ( char * ) &pStorage[ i * queueLength ],
+                             sizeof( AgentMessageStorage_t ),
+                             ( uint32_t ) queueLength );
+            }
+
+            ( void ) k_sem_init( &( pMsgCtx->pendingMessages ), 0, K_SEM_MAX_LIMIT );
+        #endif
+
+        #if ( MQTT_AGENT_USE_COMMAND_ATTRIBUTES == 1 )
+            pMsgCtx->attributesHook = Agent_DefaultCommandAttributes;
+        #endif
+
+        #if ( MQTT_AGENT_ENABLE_DEADLINES == 1 )
+            pMsgCtx->releaseCommand = Agent_FreeCommand;
+        #endif
+
+        #if ( MQTT_AGENT_FRESHEST_FIRST == 1 )
+            /* The second half of the storage holds the staged commands. */
+            pMsgCtx->pStagedCommands = &pStorage[ queueLength ];
+            pMsgCtx->numStagedCommands = 0U;
+            pMsgCtx->maxStagedCommands = queueLength;
+        #endif
+
+        pMsgCtx->receiveHook = NULL;
+        pMsgCtx->pReceiveHookContext = NULL;
+
+        #if ( MQTT_AGENT_ENABLE_SOCKET_WAKEUP == 1 )
+            k_poll_signal_init( &( pMsgCtx->socketReadableSignal ) );
+            ( void ) k_sem_init( &( pMsgCtx->socketReleased ), 0, 1 );
+            ( void ) atomic_set( &( pMsgCtx->watchedSocket ), -1 );
+            ( void ) atomic_set( &( pMsgCtx->isSocketArmed ), 0 );
+            pMsgCtx->isSocketPolled = false;
+            pMsgCtx->isReleaseAwaited = false;
+            pMsgCtx->pendingDataHook = NULL;
+            pMsgCtx->pPendingDataContext = NULL;
+        #endif
+
+        #if ( MQTT_AGENT_ENABLE_STATISTICS == 1 )
+            ( void ) memset( &( pMsgCtx->counters ), 0x00, sizeof( pMsgCtx->counters ) );
+        #endif
+
+        #if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 )
+            pMsgCtx->pProcessedCommand = NULL;
+        #endif
+    }
+
+    return ret;
+}
+/*-----------------------------------------------------------*/
+
+void Agent_SetCommandAttributesHook( MQTTAgentMessageContext_t * pMsgCtx,
+                                     AgentCommandAttributesHook_t attributesHook )
+{
+    assert( pMsgCtx != NULL );
+
+    #if ( MQTT_AGENT_USE_COMMAND_ATTRIBUTES == 1 )
+        pMsgCtx->attributesHook = ( attributesHook != NULL ) ? attributesHook : Agent_DefaultCommandAttributes;
+    #else
+        ( void ) pMsgCtx;
+        ( void ) attributesHook;
+    #endif
+}
+/*-----------------------------------------------------------*/
+
+void Agent_DefaultCommandAttributes( const MQTTAgentCommand_t * pCommand,
+                                     AgentCommandAttributes_t * pAttributes )
+{
+    const MQTTPublishInfo_t * pPublishInfo = NULL;
+
+    assert( pCommand != NULL );
+    assert( pAttributes != NULL );
+
+    pAttributes->priority = AGENT_COMMAND_PRIORITY_HIGHEST;
+    pAttributes->lifetimeMs = AGENT_COMMAND_NO_DEADLINE;
+
+    if( ( pCommand->commandType == PUBLISH ) && ( pCommand->pArgs != NULL ) )
+    {
+        pPublishInfo = ( const MQTTPublishInfo_t * ) pCommand->pArgs;
+
+        if( pPublishInfo->qos == MQTTQoS0 )
+        {
+            pAttributes->priority = AGENT_COMMAND_PRIORITY_LOWEST;
+            pAttributes->lifetimeMs = MQTT_AGENT_DEFAULT_QOS0_LIFETIME_MS;
+        }
+    }
+}
+/*-----------------------------------------------------------*/
 
+#if ( MQTT_AGENT_ENABLE_DEADLINES == 1 )
+
+    void Agent_SetExpiredCommandRelease( MQTTAgentMessageContext_t * pMsgCtx,
+                                         MQTTAgentCommandRelease_t releaseCommand )
+    {
+        assert( pMsgCtx != NULL );
+
+        pMsgCtx->releaseCommand = ( releaseCommand != NULL ) ? releaseCommand : Agent_FreeCommand;
+    }
 /*-----------------------------------------------------------*/
 
+#endif /* if ( MQTT_AGENT_ENABLE_DEADLINES == 1 ) */
+
 bool Agent_MessageSend( MQTTAgentMessageContext_t * pMsgCtx,
                         MQTTAgentCommand_t * const * pCommandToSend,
                         uint32_t blockTimeMs )
 {
     bool ret = false;
 
+    #if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 )
+        AgentCommandTrace_t * pTrace = NULL;
+    #endif
+
+    #if ( MQTT_AGENT_USE_COMMAND_ATTRIBUTES == 1 )
+        AgentCommandAttributes_t attributes =
+        {
+            .priority   = AGENT_COMMAND_PRIORITY_HIGHEST,
+            .lifetimeMs = AGENT_COMMAND_NO_DEADLINE
+        };
+    #endif
+
+    #if ( MQTT_AGENT_USE_LOCK_FREE_QUEUE == 0 )
+        const void * pElement = pCommandToSend;
+        struct k_msgq * pQueue = NULL;
+    #endif
+
+    #if ( MQTT_AGENT_ENABLE_DEADLINES == 1 )
+        AgentQueuedCommand_t queuedCommand = { 0 };
+    #endif
+
+    #if ( MQTT_AGENT_ENABLE_STATISTICS == 1 )
+        uint32_t depth = 0U;
+    #endif
+
     if( ( pMsgCtx != NULL ) && ( pCommandToSend != NULL ) )
     {
-        ret = ( k_msgq_put( &( pMsgCtx->queue ), pCommandToSend, K_MSEC( blockTimeMs ) ) == 0 );
+        #if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 )
+            /* Stamped before queuing, as the agent may receive the command
+             * right away. */
+            pTrace = getCommandTrace( *pCommandToSend );
+
+            if( pTrace != NULL )
+            {
+                pTrace->enqueueTimeMs = k_uptime_get_32();
+                pTrace->recorded = TRACE_ENQUEUED;
+            }
+        #endif
+
+        #if ( MQTT_AGENT_USE_LOCK_FREE_QUEUE == 1 )
+            ret = AgentMessageRing_Send( &( pMsgCtx->ring ), *pCommandToSend, blockTimeMs );
+        #else
+            pQueue = &( pMsgCtx->queue );
+
+            #if ( MQTT_AGENT_USE_COMMAND_ATTRIBUTES == 1 )
+                pMsgCtx->attributesHook( *pCommandToSend, &attributes );
+            #endif
+
+            #if ( MQTT_AGENT_NUM_PRIORITY_LANES > 1U )
+                if( attributes.priority > AGENT_COMMAND_PRIORITY_LOWEST )
+                {
+                    attributes.priority = AGENT_COMMAND_PRIORITY_LOWEST;
+                }
+
+                pQueue = getLaneQueue( pMsgCtx, attributes.priority );
+            #endif
+
+            #if ( MQTT_AGENT_ENABLE_DEADLINES == 1 )
+                queuedCommand.pCommand = *pCommandToSend;
+                queuedCommand.sendTimeMs = k_uptime_get_32();
+                queuedCommand.lifetimeMs = attributes.lifetimeMs;
+                pElement = &queuedCommand;
+            #endif
+
+            ret = ( k_msgq_put( pQueue, pElement, K_MSEC( blockTimeMs ) ) == 0 );
+
+            #if ( MQTT_AGENT_NUM_PRIORITY_LANES > 1U )
+                if( ret )
+                {
+                    k_sem_give( &( pMsgCtx->pendingMessages ) );
+                }
+            #endif
+        #endif /* if ( MQTT_AGENT_USE_LOCK_FREE_QUEUE == 1 ) */
+
+        #if ( MQTT_AGENT_ENABLE_STATISTICS == 1 )
+            if( ret )
+            {
+                depth = getQueueDepth( pMsgCtx );
+
+                ( void ) atomic_inc( &( pMsgCtx->counters.messagesSent ) );
+                ( void ) atomic_inc( &( pMsgCtx->counters.depthHistogram[ getHistogramBucket( depth ) ] ) );
+                updateHighWaterMark( &( pMsgCtx->counters.depthHighWaterMark ), ( atomic_val_t ) depth );
+            }
+            else
+            {
+                ( void ) atomic_inc( &( pMsgCtx->counters.failedSends ) );
+            }
+        #endif
     }
 
     return ret;
@@ -81,73 +1204,557 @@ bool Agent_MessageReceive( MQTTAgentMessageContext_t * pMsgCtx,
 {
     bool ret = false;
 
+    #if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 )
+        AgentCommandTrace_t * pTrace = NULL;
+    #endif
+
     if( ( pMsgCtx != NULL ) && ( pReceivedCommand != NULL ) )
     {
-        ret = ( k_msgq_get( &( pMsgCtx->queue ), pReceivedCommand, K_MSEC( blockTimeMs ) ) == 0 );
+        #if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 )
+            traceWrittenCommand( pMsgCtx );
+        #endif
+
+        if( pMsgCtx->receiveHook == NULL )
+        {
+            ret = waitForMessage( pMsgCtx, pReceivedCommand, blockTimeMs );
+        }
+        else
+        {
+            ret = receiveMessage( pMsgCtx, pReceivedCommand, 0U );
+
+            if( !ret )
+            {
+                /* Let the hook know the agent is about to wait. */
+                pMsgCtx->receiveHook( pMsgCtx->pReceiveHookContext, NULL );
+                ret = waitForMessage( pMsgCtx, pReceivedCommand, blockTimeMs );
+            }
+
+            if( ret )
+            {
+                pMsgCtx->receiveHook( pMsgCtx->pReceiveHookContext, *pReceivedCommand );
+            }
+        }
+
+        #if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 )
+            if( ret )
+            {
+                pTrace = getCommandTrace( *pReceivedCommand );
+
+                if( ( pTrace != NULL ) && ( pTrace->recorded == TRACE_ENQUEUED ) )
+                {
+                    pTrace->dequeueTimeMs = k_uptime_get_32();
+                    pTrace->recorded |= TRACE_DEQUEUED;
+                }
+
+                pMsgCtx->pProcessedCommand = *pReceivedCommand;
+            }
+        #endif
     }
 
     return ret;
 }
 /*-----------------------------------------------------------*/
 
-void Agent_InitializePool( void )
+void Agent_SetReceiveHook( MQTTAgentMessageContext_t * pMsgCtx,
+                           AgentReceiveHook_t receiveHook,
+                           void * pReceiveHookContext )
+{
+    assert( pMsgCtx != NULL );
+
+    pMsgCtx->receiveHook = receiveHook;
+    pMsgCtx->pReceiveHookContext = pReceiveHookContext;
+}
+/*-----------------------------------------------------------*/
+
+#if ( MQTT_AGENT_ENABLE_SOCKET_WAKEUP == 1 )
+
+    bool Agent_SetWakeupSocket( MQTTAgentMessageContext_t * pMsgCtx,
+                                int32_t socket,
+                                AgentPendingDataHook_t pendingDataHook,
+                                void * pPendingDataContext )
+    {
+        size_t slot = MQTT_AGENT_MAX_WATCHED_SOCKETS;
+        size_t i = 0U;
+        bool isReleaseAwaited = false;
+        bool ret = false;
+
+        if( pMsgCtx == NULL )
+        {
+            LogError( ( "Invalid message context." ) );
+        }
+        else
+        {
+            ( void ) k_mutex_lock( &socketWatcherLock, K_FOREVER );
+
+            /* Find the slot of the context, else a free slot. */
+            for( i = 0U; i < MQTT_AGENT_MAX_WATCHED_SOCKETS; i++ )
+            {
+                if( watchingContexts[ i ] == pMsgCtx )
+                {
+                    slot = i;
+                }
+                else if( ( watchingContexts[ i ] == NULL ) && ( slot == MQTT_AGENT_MAX_WATCHED_SOCKETS ) )
+                {
+                    slot = i;
+                }
+                else
+                {
+                    /* Empty else marker. */
+                }
+            }
+
+            if( ( socket >= 0 ) && ( slot == MQTT_AGENT_MAX_WATCHED_SOCKETS ) )
+            {
+                LogError( ( "The sockets of %u other agents are already watched.",
+                            ( unsigned int ) MQTT_AGENT_MAX_WATCHED_SOCKETS ) );
+            }
+            else if( startSocketWatcher() )
+            {
+                if( slot < MQTT_AGENT_MAX_WATCHED_SOCKETS )
+                {
+                    watchingContexts[ slot ] = ( socket >= 0 ) ? pMsgCtx : NULL;
+                }
+
+                ( void ) atomic_set( &( pMsgCtx->watchedSocket ), ( atomic_val_t ) socket );
+                pMsgCtx->pendingDataHook = pendingDataHook;
+                pMsgCtx->pPendingDataContext = pPendingDataContext;
+
+                /* The watcher may be polling the previous socket, which must
+                 * not be closed before it stops. */
+                isReleaseAwaited = pMsgCtx->isSocketPolled;
+                pMsgCtx->isReleaseAwaited = isReleaseAwaited;
+                ret = true;
+            }
+            else
+            {
+                /* Empty else marker. */
+            }
+
+            ( void ) k_mutex_unlock( &socketWatcherLock );
+
+            if( ret )
+            {
+                wakeSocketWatcher();
+            }
+
+            if( isReleaseAwaited )
+            {
+                ( void ) k_sem_take( &( pMsgCtx->socketReleased ), K_FOREVER );
+            }
+        }
+
+        return ret;
+    }
+/*-----------------------------------------------------------*/
+
+#endif /* if ( MQTT_AGENT_ENABLE_SOCKET_WAKEUP == 1 ) */
+
+bool Agent_InitializeCommandPool( AgentCommandPool_t * pPool,
+                                  MQTTAgentCommand_t * pCommands,
+                                  MQTTAgentCommand_t ** pFreeCommandsStorage,
+                                  size_t numCommands )
 {
     size_t i;
     MQTTAgentCommand_t * pCommand;
     bool commandAdded = false;
+    bool ret = false;
 
-    if( !queueInit )
+    if( ( pPool == NULL ) || ( pCommands == NULL ) || ( pFreeCommandsStorage == NULL ) || ( numCommands == 0U ) )
+    {
+        LogError( ( "Invalid command pool parameters." ) );
+    }
+    else if( pPool->initialized )
     {
+        ret = true;
+    }
+    else
+    {
+        pPool->pCommands = pCommands;
+        pPool->numCommands = numCommands;
+        k_msgq_init( &( pPool->freeCommands ),
+                     ( char * ) pFreeCommandsStorage,
+                     sizeof( MQTTAgentCommand_t * ),
+                     ( uint32_t ) numCommands );
+
         /* Populate the queue. */
-        for( i = 0; i < NUM_COMMANDS_IN_POOL; i++ )
+        for( i = 0; i < numCommands; i++ )
         {
             /* Store the address as a variable. */
-            pCommand = &commandStructurePool[ i ];
+            pCommand = &pCommands[ i ];
             /* Send the pointer to the queue. */
-            commandAdded = ( k_msgq_put( &commandStructureQueue, &pCommand, K_NO_WAIT ) == 0 );
+            commandAdded = ( k_msgq_put( &( pPool->freeCommands ), &pCommand, K_NO_WAIT ) == 0 );
             assert( commandAdded );
         }
 
-        queueInit = true;
+        #if ( MQTT_AGENT_ENABLE_STATISTICS == 1 )
+            pPool->pAllocationTimes = NULL;
+            ( void ) memset( &( pPool->counters ), 0x00, sizeof( pPool->counters ) );
+        #endif
+
+        #if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 )
+            pPool->pTraces = NULL;
+        #endif
+
+        pPool->initialized = true;
+        ret = true;
     }
+
+    return ret;
 }
 /*-----------------------------------------------------------*/
 
-MQTTAgentCommand_t * Agent_GetCommand( uint32_t blockTimeMs )
+MQTTAgentCommand_t * Agent_GetCommandFromPool( AgentCommandPool_t * pPool,
+                                               uint32_t blockTimeMs )
 {
     MQTTAgentCommand_t * structToUse = NULL;
     bool commandRetrieved = false;
 
+    #if ( MQTT_AGENT_ENABLE_STATISTICS == 1 )
+        uint32_t startTimeMs = k_uptime_get_32();
+        uint32_t nowMs = 0U;
+    #endif
+
     /* Check queue has been created. */
-    assert( queueInit );
+    assert( pPool != NULL );
+    assert( pPool->initialized );
 
-    commandRetrieved = ( k_msgq_get( &commandStructureQueue, &structToUse, K_MSEC( blockTimeMs ) ) == 0 );
+    commandRetrieved = ( k_msgq_get( &( pPool->freeCommands ), &structToUse, K_MSEC( blockTimeMs ) ) == 0 );
 
     if( !commandRetrieved )
     {
         LogError( ( "No command structure available. Maximum number of commands statically allocated in the pool is: %d",
-                    NUM_COMMANDS_IN_POOL ) );
+                    ( int ) pPool->numCommands ) );
+
+        #if ( MQTT_AGENT_ENABLE_STATISTICS == 1 )
+            ( void ) atomic_inc( &( pPool->counters.failedAllocations ) );
+        #endif
     }
 
+    #if ( MQTT_AGENT_ENABLE_STATISTICS == 1 )
+        else
+        {
+            nowMs = k_uptime_get_32();
+
+            ( void ) atomic_inc( &( pPool->counters.allocations ) );
+            ( void ) atomic_inc( &( pPool->counters.waitTimeHistogram[ getHistogramBucket( nowMs - startTimeMs ) ] ) );
+            updateHighWaterMark( &( pPool->counters.highWaterMark ),
+                                 atomic_inc( &( pPool->counters.inUse ) ) + 1 );
+
+            if( pPool->pAllocationTimes != NULL )
+            {
+                pPool->pAllocationTimes[ structToUse - pPool->pCommands ] = nowMs;
+            }
+        }
+    #endif
+
     return structToUse;
 }
 /*-----------------------------------------------------------*/
 
-bool Agent_FreeCommand( MQTTAgentCommand_t * pCommandToRelease )
+bool Agent_FreeCommandToPool( AgentCommandPool_t * pPool,
+                              MQTTAgentCommand_t * pCommandToRelease )
 {
     bool structReturned = false;
 
+    #if ( MQTT_AGENT_ENABLE_STATISTICS == 1 )
+        uint32_t residencyTimeMs = 0U;
+    #endif
+
     /* Check queue has been created. */
-    assert( queueInit );
+    assert( pPool != NULL );
+    assert( pPool->initialized );
 
     /* See if the structure being returned is actually from the pool. */
-    if( ( pCommandToRelease >= commandStructurePool ) &&
-        ( pCommandToRelease < ( commandStructurePool + NUM_COMMANDS_IN_POOL ) ) )
+    if( ( pCommandToRelease >= pPool->pCommands ) &&
+        ( pCommandToRelease < ( pPool->pCommands + pPool->numCommands ) ) )
     {
-        structReturned = ( k_msgq_put( &commandStructureQueue, &pCommandToRelease, K_NO_WAIT ) == 0 );
+        #if ( MQTT_AGENT_ENABLE_STATISTICS == 1 )
+            if( pPool->pAllocationTimes != NULL )
+            {
+                residencyTimeMs = k_uptime_get_32() - pPool->pAllocationTimes[ pCommandToRelease - pPool->pCommands ];
+
+                ( void ) atomic_inc( &( pPool->counters.residencyHistogram[ getHistogramBucket( residencyTimeMs ) ] ) );
+            }
+
+            ( void ) atomic_dec( &( pPool->counters.inUse ) );
+        #endif
+
+        #if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 )
+            traceCompletedCommand( pPool, pCommandToRelease );
+        #endif
+
+        structReturned = ( k_msgq_put( &( pPool->freeCommands ), &pCommandToRelease, K_NO_WAIT ) == 0 );
 
         assert( structReturned );
     }
+    else if( pPool->releaseHook != NULL )
+    {
+        structReturned = pPool->releaseHook( pCommandToRelease );
+    }
+    else
+    {
+        /* Empty else marker. */
+    }
+
+    if( !structReturned )
+    {
+        LogError( ( "Command %p is not from the pool, or was already released.",
+                    ( void * ) pCommandToRelease ) );
+    }
 
     return structReturned;
 }
+/*-----------------------------------------------------------*/
+
+void Agent_SetCommandPoolReleaseHook( AgentCommandPool_t * pPool,
+                                      MQTTAgentCommandRelease_t releaseHook )
+{
+    assert( pPool != NULL );
+    assert( pPool->initialized );
+
+    pPool->releaseHook = releaseHook;
+}
+/*-----------------------------------------------------------*/
+
+void Agent_InitializePool( void )
+{
+    bool poolInitialized = false;
+
+    poolInitialized = Agent_InitializeCommandPool( &commonCommandPool,
+                                                   commandStructurePool,
+                                                   freeCommandStructures,
+                                                   NUM_COMMANDS_IN_POOL );
+    assert( poolInitialized );
+    ( void ) poolInitialized;
+
+    #if ( MQTT_AGENT_ENABLE_STATISTICS == 1 )
+        Agent_InitializeCommandPoolStatistics( &commonCommandPool, commonPoolAllocationTimes );
+    #endif
+
+    #if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 )
+        /* The common pool may be initialized more than once, but is traced once. */
+        if( commonCommandPool.pTraces == NULL )
+        {
+            ( void ) Agent_InitializeCommandPoolTracing( &commonCommandPool, commonPoolTraces );
+        }
+    #endif
+}
+/*-----------------------------------------------------------*/
+
+MQTTAgentCommand_t * Agent_GetCommand( uint32_t blockTimeMs )
+{
+    return Agent_GetCommandFromPool( &commonCommandPool, blockTimeMs );
+}
+/*-----------------------------------------------------------*/
+
+bool Agent_FreeCommand( MQTTAgentCommand_t * pCommandToRelease )
+{
+    return Agent_FreeCommandToPool( &commonCommandPool, pCommandToRelease );
+}
+/*-----------------------------------------------------------*/
+
+void Agent_SetCommonPoolReleaseHook( MQTTAgentCommandRelease_t releaseHook )
+{
+    Agent_SetCommandPoolReleaseHook( &commonCommandPool, releaseHook );
+}
+/*-----------------------------------------------------------*/
+
+#if ( MQTT_AGENT_ENABLE_STATISTICS == 1 )
+
+    void Agent_InitializeCommandPoolStatistics( AgentCommandPool_t * pPool,
+                                                uint32_t * pAllocationTimes )
+    {
+        size_t i = 0U;
+
+        assert( pPool != NULL );
+        assert( pPool->initialized );
+
+        /* Structures obtained before are not timed, as their time is unknown. */
+        if( pAllocationTimes != NULL )
+        {
+            for( i = 0U; i < pPool->numCommands; i++ )
+            {
+                pAllocationTimes[ i ] = k_uptime_get_32();
+            }
+        }
+
+        pPool->pAllocationTimes = pAllocationTimes;
+    }
+/*-----------------------------------------------------------*/
+
+    #if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 )
+
+        bool Agent_InitializeCommandPoolTracing( AgentCommandPool_t * pPool,
+                                                 AgentCommandTrace_t * pTraces )
+        {
+            bool ret = false;
+            bool isReserved = false;
+            atomic_val_t index = 0;
+
+            assert( pPool != NULL );
+            assert( pPool->initialized );
+            assert( pTraces != NULL );
+
+            ( void ) memset( pTraces, 0x00, pPool->numCommands * sizeof( AgentCommandTrace_t ) );
+            pPool->pTraces = pTraces;
+
+            /* Reserve a slot without ever counting past the last one. */
+            do
+            {
+                index = atomic_get( &numReservedPools );
+                isReserved = ( index < ( atomic_val_t ) MQTT_AGENT_MAX_TRACED_POOLS ) &&
+                             atomic_cas( &numReservedPools, index, index + 1 );
+            } while( !isReserved && ( index < ( atomic_val_t ) MQTT_AGENT_MAX_TRACED_POOLS ) );
+
+            if( isReserved )
+            {
+                tracedPools[ index ] = pPool;
+
+                /* Publish the slot once it is set, after the slots reserved
+                 * before it, so that readers only see set slots. */
+                while( !atomic_cas( &numTracedPools, index, index + 1 ) )
+                {
+                    k_yield();
+                }
+
+                ret = true;
+            }
+            else
+            {
+                LogError( ( "Only %u command pools can be traced.", ( unsigned int ) MQTT_AGENT_MAX_TRACED_POOLS ) );
+            }
+
+            return ret;
+        }
+/*-----------------------------------------------------------*/
+
+    #endif /* if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 ) */
+
+    void Agent_GetCommandPoolStatistics( const AgentCommandPool_t * pPool,
+                                         AgentCommandPoolStatistics_t * pStatistics )
+    {
+        #if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 )
+            size_t stage = 0U;
+        #endif
+
+        assert( pPool != NULL );
+        assert( pStatistics != NULL );
+
+        pStatistics->numCommands = ( uint32_t ) pPool->numCommands;
+        pStatistics->allocations = ( uint32_t ) atomic_get( &( pPool->counters.allocations ) );
+        pStatistics->failedAllocations = ( uint32_t ) atomic_get( &( pPool->counters.failedAllocations ) );
+        pStatistics->inUse = ( uint32_t ) atomic_get( &( pPool->counters.inUse ) );
+        pStatistics->highWaterMark = ( uint32_t ) atomic_get( &( pPool->counters.highWaterMark ) );
+        copyHistogram( pStatistics->waitTimeHistogram, pPool->counters.waitTimeHistogram );
+        copyHistogram( pStatistics->residencyHistogram, pPool->counters.residencyHistogram );
+
+        #if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 )
+            for( stage = 0U; stage < AGENT_LATENCY_NUM_STAGES; stage++ )
+            {
+                copyHistogram( pStatistics->latencyHistograms[ stage ], pPool->counters.latencyHistograms[ stage ] );
+            }
+        #endif
+    }
+/*-----------------------------------------------------------*/
+
+    void Agent_GetCommonPoolStatistics( AgentCommandPoolStatistics_t * pStatistics )
+    {
+        Agent_GetCommandPoolStatistics( &commonCommandPool, pStatistics );
+    }
+/*-----------------------------------------------------------*/
+
+    void Agent_GetMessageContextStatistics( MQTTAgentMessageContext_t * pMsgCtx,
+                                            AgentMessageContextStatistics_t * pStatistics )
+    {
+        assert( pMsgCtx != NULL );
+        assert( pStatistics != NULL );
+
+        pStatistics->messagesSent = ( uint32_t ) atomic_get( &( pMsgCtx->counters.messagesSent ) );
+        pStatistics->failedSends = ( uint32_t ) atomic_get( &( pMsgCtx->counters.failedSends ) );
+        pStatistics->depth = getQueueDepth( pMsgCtx );
+        pStatistics->depthHighWaterMark = ( uint32_t ) atomic_get( &( pMsgCtx->counters.depthHighWaterMark ) );
+        copyHistogram( pStatistics->depthHistogram, pMsgCtx->counters.depthHistogram );
+    }
+/*-----------------------------------------------------------*/
+
+    size_t Agent_SerializeStatistics( const AgentCommandPoolStatistics_t * pPoolStatistics,
+                                      const AgentMessageContextStatistics_t * pContextStatistics,
+                                      char * pBuffer,
+                                      size_t bufferSize )
+    {
+        size_t length = bufferSize;
+        int written = 0;
+
+        #if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 )
+            size_t stage = 0U;
+        #endif
+
+        if( ( pPoolStatistics == NULL ) || ( pContextStatistics == NULL ) || ( pBuffer == NULL ) || ( bufferSize == 0U ) )
+        {
+            LogError( ( "Invalid statistics parameters." ) );
+        }
+        else
+        {
+            written = snprintf( pBuffer, bufferSize,
+                                "{\"pool\":{\"size\":%u,\"allocations\":%u,\"failed\":%u,\"inUse\":%u,\"highWaterMark\":%u",
+                                ( unsigned int ) pPoolStatistics->numCommands,
+                                ( unsigned int ) pPoolStatistics->allocations,
+                                ( unsigned int ) pPoolStatistics->failedAllocations,
+                                ( unsigned int ) pPoolStatistics->inUse,
+                                ( unsigned int ) pPoolStatistics->highWaterMark );
+            length = ( ( written < 0 ) || ( ( size_t ) written >= bufferSize ) ) ? bufferSize : ( size_t ) written;
+
+            if( length < bufferSize )
+            {
+                length = appendHistogram( pBuffer, bufferSize, length, "waitMs", pPoolStatistics->waitTimeHistogram );
+            }
+
+            if( length < bufferSize )
+            {
+                length = appendHistogram( pBuffer, bufferSize, length, "residencyMs", pPoolStatistics->residencyHistogram );
+            }
+
+            #if ( MQTT_AGENT_ENABLE_LATENCY_TRACING == 1 )
+                for( stage = 0U; stage < AGENT_LATENCY_NUM_STAGES; stage++ )
+                {
+                    if( length < bufferSize )
+                    {
+                        length = appendHistogram( pBuffer, bufferSize, length, latencyHistogramNames[ stage ],
+                                                  pPoolStatistics->latencyHistograms[ stage ] );
+                    }
+                }
+            #endif
+
+            if( length < bufferSize )
+            {
+                written = snprintf( &pBuffer[ length ], bufferSize - length,
+                                    "},\"queue\":{\"sent\":%u,\"failed\":%u,\"depth\":%u,\"highWaterMark\":%u",
+                                    ( unsigned int ) pContextStatistics->messagesSent,
+                                    ( unsigned int ) pContextStatistics->failedSends,
+                                    ( unsigned int ) pContextStatistics->depth,
+                                    ( unsigned int ) pContextStatistics->depthHighWaterMark );
+                length = ( ( written < 0 ) || ( ( size_t ) written >= ( bufferSize - length ) ) ) ? bufferSize : length + ( size_t ) written;
+            }
+
+            if( length < bufferSize )
+            {
+                length = appendHistogram( pBuffer, bufferSize, length, "depthHistogram", pContextStatistics->depthHistogram );
+            }
+
+            if( length < bufferSize )
+            {
+                written = snprintf( &pBuffer[ length ], bufferSize - length, "}}" );
+                length = ( ( written < 0 ) || ( ( size_t ) written >= ( bufferSize - length ) ) ) ? bufferSize : length + ( size_t ) written;
+            }
+
+            if( length >= bufferSize )
+            {
+                LogError( ( "Statistics do not fit in a buffer of %u bytes.", ( unsigned int ) bufferSize ) );
+            }
+        }
+
+        return ( length < bufferSize ) ? length : 0U;
+    }
+/*-----------------------------------------------------------*/
+
+#endif /* if ( MQTT_AGENT_ENABLE_STATISTICS == 1 ) */
@@ -0,0 +1,283 @@
+/*
+ * AWS IoT Device Embedded C SDK for ZephyrRTOS
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file agent_message_ring.c
+ * @brief Implementation of the lock-free multi-producer, single-consumer ring.
+ *
+ * Each slot carries a sequence number. A slot at position `pos` is free for
+ * producers when its sequence equals `pos`, and holds an item for the consumer
+ * when its sequence equals `pos + 1`. Producers claim a position by advancing
+ * the enqueue position with a compare-and-swap, then publish the item by
+ * updating the sequence of the slot.
+ */
+
+/* Standard includes. */
+#include <assert.h>
+
+#include "agent_message_ring.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Try to add an item to the ring without waiting.
+ *
+ * @param[in] pRing The ring.
+ * @param[in] pItem The item to add.
+ *
+ * @return `true` if the item was added, `false` if the ring is full.
+ */
+static bool tryPush( AgentMessageRing_t * pRing,
+                     void * pItem );
+
+/**
+ * @brief Try to take an item from the ring without waiting.
+ *
+ * @param[in] pRing The ring.
+ * @param[out] ppItem The item taken.
+ *
+ * @return `true` if an item was taken, `false` if the ring is empty.
+ */
+static bool tryPop( AgentMessageRing_t * pRing,
+                    void ** ppItem );
+
+/*-----------------------------------------------------------*/
+
+static bool tryPush( AgentMessageRing_t * pRing,
+                     void * pItem )
+{
+    bool pushed = false, full = false;
+    AgentMessageRingSlot_t * pSlot = NULL;
+    size_t position = 0U;
+    atomic_val_t difference = 0;
+
+    position = ( size_t ) atomic_get( &( pRing->enqueuePosition ) );
+
+    while( ( pushed == false ) && ( full == false ) )
+    {
+        pSlot = &( pRing->pSlots[ position & pRing->mask ] );
+        difference = ( atomic_val_t ) ( ( size_t ) atomic_get( &( pSlot->sequence ) ) - position );
+
+        if( difference == 0 )
+        {
+            /* The slot is free: claim its position. */
+            pushed = atomic_cas( &( pRing->enqueuePosition ),
+                                 ( atomic_val_t ) position,
+                                 ( atomic_val_t ) ( position + 1U ) );
+
+            if( pushed == false )
+            {
+                position = ( size_t ) atomic_get( &( pRing->enqueuePosition ) );
+            }
+        }
+        else if( difference < 0 )
+        {
+            /* The slot still holds the item of the previous lap. */
+            full = true;
+        }
+        else
+        {
+            /* Another producer claimed this position first. */
+            position = ( size_t ) atomic_get( &( pRing->enqueuePosition ) );
+        }
+    }
+
+    if( pushed == true )
+    {
+        pSlot->pItem = pItem;
+
+        /* Publish the item to the consumer. */
+        ( void ) atomic_set( &( pSlot->sequence ), ( atomic_val_t ) ( position + 1U ) );
+    }
+
+    return pushed;
+}
+/*-----------------------------------------------------------*/
+
+static bool tryPop( AgentMessageRing_t * pRing,
+                    void ** ppItem )
+{
+    bool popped = false;
+    AgentMessageRingSlot_t * pSlot = NULL;
+    size_t position = pRing->dequeuePosition;
+
+    pSlot = &( pRing->pSlots[ position & pRing->mask ] );
+
+    if( ( size_t ) atomic_get( &( pSlot->sequence ) ) == ( position + 1U ) )
+    {
+        *ppItem = pSlot->pItem;
+        pRing->dequeuePosition = position + 1U;
+
+        /* Free the slot for the next lap of producers. */
+        ( void ) atomic_set( &( pSlot->sequence ), ( atomic_val_t ) ( position + pRing->mask + 1U ) );
+        popped = true;
+    }
+
+    return popped;
+}
+/*-----------------------------------------------------------*/
+
+bool AgentMessageRing_Init( AgentMessageRing_t * pRing,
+                            AgentMessageRingSlot_t * pSlots,
+                            size_t numSlots )
+{
+    bool ret = false;
+    size_t i;
+
+    if( ( pRing == NULL ) || ( pSlots == NULL ) || ( numSlots == 0U ) ||
+        ( ( numSlots & ( numSlots - 1U ) ) != 0U ) )
+    {
+        LogError( ( "Invalid ring parameters: the number of slots must be a power of two." ) );
+    }
+    else
+    {
+        for( i = 0; i < numSlots; i++ )
+        {
+            ( void ) atomic_set( &( pSlots[ i ].sequence ), ( atomic_val_t ) i );
+            pSlots[ i ].pItem = NULL;
+        }
+
+        pRing->pSlots = pSlots;
+        pRing->mask = numSlots - 1U;
+        ( void ) atomic_set( &( pRing->enqueuePosition ), 0 );
+        pRing->dequeuePosition = 0U;
+        ( void ) atomic_set( &( pRing->consumerWaiting ), 0 );
+        ( void ) k_sem_init( &( pRing->wakeSemaphore ), 0, 1 );
+        ret = true;
+    }
+
+    return ret;
+}
+/*-----------------------------------------------------------*/
+
+bool AgentMessageRing_Send( AgentMessageRing_t * pRing,
+                            void * pItem,
+                            uint32_t blockTimeMs )
+{
+    bool sent = false;
+    uint32_t startTimeMs = 0U;
+
+    assert( pRing != NULL );
+
+    sent = tryPush( pRing, pItem );
+
+    /* A full ring is not expected in normal operation, so instead of waking
+     * producers on every receive, a waiting producer polls the ring. */
+    if( ( sent == false ) && ( blockTimeMs > 0U ) && ( k_is_in_isr() == false ) )
+    {
+        startTimeMs = k_uptime_get_32();
+
+        do
+        {
+            ( void ) k_msleep( AGENT_MESSAGE_RING_FULL_POLL_MS );
+            sent = tryPush( pRing, pItem );
+        } while( ( sent == false ) && ( ( k_uptime_get_32() - startTimeMs ) < blockTimeMs ) );
+    }
+
+    /* Only the first producer to see the consumer waiting wakes it, so the
+     * kernel is not entered while the consumer is busy. */
+    if( ( sent == true ) && atomic_cas( &( pRing->consumerWaiting ), 1, 0 ) )
+    {
+        k_sem_give( &( pRing->wakeSemaphore ) );
+    }
+
+    return sent;
+}
+/*-----------------------------------------------------------*/
+
+bool AgentMessageRing_Receive( AgentMessageRing_t * pRing,
+                               void ** ppItem,
+                               uint32_t blockTimeMs )
+{
+    bool received = false;
+    uint32_t startTimeMs = 0U, elapsedTimeMs = 0U;
+
+    assert( pRing != NULL );
+    assert( ppItem != NULL );
+
+    received = tryPop( pRing, ppItem );
+    startTimeMs = k_uptime_get_32();
+
+    while( ( received == false ) && ( elapsedTimeMs < blockTimeMs ) )
+    {
+        /* Announce the wait before checking the ring again, so that an item
+         * pushed after the check always finds the flag set. */
+        ( void ) atomic_set( &( pRing->consumerWaiting ), 1 );
+        received = tryPop( pRing, ppItem );
+
+        if( received == false )
+        {
+            /* A wakeup may be stale, in which case the ring is checked again. */
+            ( void ) k_sem_take( &( pRing->wakeSemaphore ), K_MSEC( blockTimeMs - elapsedTimeMs ) );
+            received = tryPop( pRing, ppItem );
+            elapsedTimeMs = k_uptime_get_32() - startTimeMs;
+        }
+
+        ( void ) atomic_set( &( pRing->consumerWaiting ), 0 );
+    }
+
+    return received;
+}
+/*-----------------------------------------------------------*/
+
+struct k_sem * AgentMessageRing_PrepareWait( AgentMessageRing_t * pRing )
+{
+    assert( pRing != NULL );
+
+    /* As in #AgentMessageRing_Receive, an item pushed after this point always
+     * finds the flag set and gives the semaphore. */
+    ( void ) atomic_set( &( pRing->consumerWaiting ), 1 );
+
+    return &( pRing->wakeSemaphore );
+}
+/*-----------------------------------------------------------*/
+
+void AgentMessageRing_FinishWait( AgentMessageRing_t * pRing )
+{
+    assert( pRing != NULL );
+
+    ( void ) atomic_set( &( pRing->consumerWaiting ), 0 );
+}
+/*-----------------------------------------------------------*/
+
+size_t AgentMessageRing_GetDepth( const AgentMessageRing_t * pRing )
+{
+    size_t enqueuePosition = 0U, dequeuePosition = 0U, depth = 0U;
+
+    assert( pRing != NULL );
+
+    /* Read the consumer position first: it never passes the producer
+     * position, so the difference never wraps below zero. */
+    dequeuePosition = pRing->dequeuePosition;
+    enqueuePosition = ( size_t ) atomic_get( &( pRing->enqueuePosition ) );
+    depth = enqueuePosition - dequeuePosition;
+
+    /* Slots may be claimed by producers and read by the consumer meanwhile,
+     * so the depth is only a snapshot. */
+    if( depth > ( pRing->mask + 1U ) )
+    {
+        depth = pRing->mask + 1U;
+    }
+
+    return depth;
+}
+/*-----------------------------------------------------------*/
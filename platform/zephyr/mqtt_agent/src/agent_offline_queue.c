@@ -0,0 +1,504 @@
+/*
+ * AWS IoT Device Embedded C SDK for ZephyrRTOS
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file agent_offline_queue.c
+ * @brief Implementation of the store-and-forward queue of publishes.
+ */
+
+/* Standard includes. */
+#include <assert.h>
+#include <string.h>
+
+/* Random number generator include. */
+#include <random/rand32.h>
+
+#include "agent_offline_queue.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Random identifier of this boot, stored in the records so that those
+ * of a previous boot are told apart. Drawn by the first queue initialized,
+ * and never 0.
+ */
+static atomic_t bootId = ATOMIC_INIT( 0 );
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Copy data into the RAM ring, wrapping around its end.
+ *
+ * @param[in] pQueue The queue.
+ * @param[in] offset Offset in the ring, which may be past its end.
+ * @param[in] pData The data.
+ * @param[in] length Length of @p pData.
+ */
+static void ringCopyIn( AgentOfflineQueue_t * pQueue,
+                        size_t offset,
+                        const uint8_t * pData,
+                        size_t length );
+
+/**
+ * @brief Copy data out of the RAM ring, wrapping around its end.
+ *
+ * @param[in] pQueue The queue.
+ * @param[in] offset Offset in the ring, which may be past its end.
+ * @param[out] pData The data.
+ * @param[in] length Length of @p pData.
+ */
+static void ringCopyOut( const AgentOfflineQueue_t * pQueue,
+                         size_t offset,
+                         uint8_t * pData,
+                         size_t length );
+
+/**
+ * @brief Remove the oldest record of the RAM ring.
+ *
+ * @param[in] pQueue The queue.
+ * @param[out] pBuffer Buffer of #MQTT_AGENT_OFFLINE_MAX_RECORD_SIZE bytes for
+ * the record, or NULL to discard it.
+ *
+ * @return The length of the record, or 0 if the ring is empty.
+ */
+static size_t takeOldestRingRecord( AgentOfflineQueue_t * pQueue,
+                                    uint8_t * pBuffer );
+
+/**
+ * @brief Remove the oldest record of the queue, from the spill store if it
+ * has any, else from the RAM ring.
+ *
+ * @param[in] pQueue The queue.
+ * @param[out] pBuffer Buffer of #MQTT_AGENT_OFFLINE_MAX_RECORD_SIZE bytes for
+ * the record.
+ *
+ * @return The length of the record, or 0 if the queue is empty.
+ */
+static size_t takeOldestRecord( AgentOfflineQueue_t * pQueue,
+                                uint8_t * pBuffer );
+
+/**
+ * @brief Make room in the RAM ring for a record, by moving records to the
+ * spill store or by applying the drop policy.
+ *
+ * @param[in] pQueue The queue.
+ * @param[in] recordSize Size of the record.
+ *
+ * @return `true` if there is room for the record.
+ */
+static bool makeRoom( AgentOfflineQueue_t * pQueue,
+                      size_t recordSize );
+
+/**
+ * @brief Whether a record outlived its time to live, or has one and was
+ * queued in a previous boot.
+ *
+ * @param[in] pRecord The record.
+ *
+ * @return `true` if the record expired.
+ */
+static bool isExpired( const uint8_t * pRecord );
+
+/**
+ * @brief Work handler forwarding the oldest record of a queue.
+ *
+ * @param[in] pWork The drain work of the queue.
+ */
+static void drainWorkHandler( struct k_work * pWork );
+
+/**
+ * @brief Command complete callback of the forwarded publishes.
+ *
+ * @param[in] pCmdCallbackContext The queue.
+ * @param[in] pReturnInfo The result of the publish.
+ */
+static void drainCompleteCallback( MQTTAgentCommandContext_t * pCmdCallbackContext,
+                                   MQTTAgentReturnInfo_t * pReturnInfo );
+
+/*-----------------------------------------------------------*/
+
+static void ringCopyIn( AgentOfflineQueue_t * pQueue,
+                        size_t offset,
+                        const uint8_t * pData,
+                        size_t length )
+{
+    size_t start = offset % pQueue->ringSize;
+    size_t firstLength = pQueue->ringSize - start;
+
+    if( firstLength >= length )
+    {
+        ( void ) memcpy( &( pQueue->pRing[ start ] ), pData, length );
+    }
+    else
+    {
+        ( void ) memcpy( &( pQueue->pRing[ start ] ), pData, firstLength );
+        ( void ) memcpy( pQueue->pRing, &pData[ firstLength ], length - firstLength );
+    }
+}
+/*-----------------------------------------------------------*/
+
+static void ringCopyOut( const AgentOfflineQueue_t * pQueue,
+                         size_t offset,
+                         uint8_t * pData,
+                         size_t length )
+{
+    size_t start = offset % pQueue->ringSize;
+    size_t firstLength = pQueue->ringSize - start;
+
+    if( firstLength >= length )
+    {
+        ( void ) memcpy( pData, &( pQueue->pRing[ start ] ), length );
+    }
+    else
+    {
+        ( void ) memcpy( pData, &( pQueue->pRing[ start ] ), firstLength );
+        ( void ) memcpy( &pData[ firstLength ], pQueue->pRing, length - firstLength );
+    }
+}
+/*-----------------------------------------------------------*/
+
+static size_t takeOldestRingRecord( AgentOfflineQueue_t * pQueue,
+                                    uint8_t * pBuffer )
+{
+    AgentOfflineRecordHeader_t header;
+    size_t recordSize = 0U;
+
+    if( pQueue->ringUsed > 0U )
+    {
+        ringCopyOut( pQueue, pQueue->ringHead, ( uint8_t * ) &header, sizeof( header ) );
+        recordSize = sizeof( header ) + header.topicLength + header.payloadLength;
+        assert( recordSize <= pQueue->ringUsed );
+
+        if( pBuffer != NULL )
+        {
+            ringCopyOut( pQueue, pQueue->ringHead, pBuffer, recordSize );
+        }
+
+        pQueue->ringHead = ( pQueue->ringHead + recordSize ) % pQueue->ringSize;
+        pQueue->ringUsed -= recordSize;
+    }
+
+    return recordSize;
+}
+/*-----------------------------------------------------------*/
+
+static size_t takeOldestRecord( AgentOfflineQueue_t * pQueue,
+                                uint8_t * pBuffer )
+{
+    size_t recordSize = 0U;
+
+    /* The spill store only ever receives the oldest records of the ring, so
+     * its records are all older than those of the ring. */
+    if( pQueue->spillHasRecords )
+    {
+        recordSize = pQueue->pSpill->takeOldest( pQueue->pSpill->pContext, pBuffer, MQTT_AGENT_OFFLINE_MAX_RECORD_SIZE );
+        pQueue->spillHasRecords = ( recordSize > 0U );
+    }
+
+    if( recordSize == 0U )
+    {
+        recordSize = takeOldestRingRecord( pQueue, pBuffer );
+    }
+
+    return recordSize;
+}
+/*-----------------------------------------------------------*/
+
+static bool makeRoom( AgentOfflineQueue_t * pQueue,
+                      size_t recordSize )
+{
+    bool ret = true;
+    size_t spilledSize = 0U;
+    AgentOfflineRecordHeader_t header;
+
+    while( ret && ( ( pQueue->ringSize - pQueue->ringUsed ) < recordSize ) )
+    {
+        spilledSize = 0U;
+
+        if( pQueue->pSpill != NULL )
+        {
+            /* Move the oldest record of the ring to the spill store, or put
+             * it back in place if the store is full. */
+            ringCopyOut( pQueue, pQueue->ringHead, ( uint8_t * ) &header, sizeof( header ) );
+            spilledSize = sizeof( header ) + header.topicLength + header.payloadLength;
+            ringCopyOut( pQueue, pQueue->ringHead, pQueue->spillBuffer, spilledSize );
+
+            if( pQueue->pSpill->append( pQueue->pSpill->pContext, pQueue->spillBuffer, spilledSize ) )
+            {
+                ( void ) takeOldestRingRecord( pQueue, NULL );
+                pQueue->spillHasRecords = true;
+            }
+            else
+            {
+                spilledSize = 0U;
+            }
+        }
+
+        if( spilledSize > 0U )
+        {
+            /* Empty else marker. */
+        }
+        else if( pQueue->dropPolicy == AGENT_OFFLINE_DROP_OLDEST )
+        {
+            /* Dropping from a full spill store lets the next iteration move
+             * a record of the ring to it. */
+            ( void ) takeOldestRecord( pQueue, pQueue->spillBuffer );
+            pQueue->numDropped++;
+        }
+        else
+        {
+            ret = false;
+        }
+    }
+
+    return ret;
+}
+/*-----------------------------------------------------------*/
+
+static bool isExpired( const uint8_t * pRecord )
+{
+    AgentOfflineRecordHeader_t header;
+
+    ( void ) memcpy( &header, pRecord, sizeof( header ) );
+
+    /* The uptime of a record of a previous boot tells nothing of its age. */
+    return( ( header.ttlMs != AGENT_OFFLINE_NO_TTL ) &&
+            ( ( header.bootId != ( uint32_t ) atomic_get( &bootId ) ) ||
+              ( ( k_uptime_get_32() - header.enqueueTimeMs ) >= header.ttlMs ) ) );
+}
+/*-----------------------------------------------------------*/
+
+static void drainWorkHandler( struct k_work * pWork )
+{
+    AgentOfflineQueue_t * pQueue = CONTAINER_OF( k_work_delayable_from_work( pWork ), AgentOfflineQueue_t, drainWork );
+    AgentOfflineRecordHeader_t header;
+    MQTTAgentCommandInfo_t commandInfo = { 0 };
+    MQTTStatus_t status = MQTTSuccess;
+    bool publish = false;
+
+    ( void ) k_mutex_lock( &( pQueue->lock ), K_FOREVER );
+
+    if( pQueue->connected && !pQueue->publishInFlight )
+    {
+        /* Skip the expired records, including one that failed before. */
+        while( !publish &&
+               ( pQueue->recordPending || ( takeOldestRecord( pQueue, pQueue->drainBuffer ) > 0U ) ) )
+        {
+            pQueue->recordPending = true;
+
+            if( isExpired( pQueue->drainBuffer ) )
+            {
+                pQueue->recordPending = false;
+                pQueue->numExpired++;
+            }
+            else
+            {
+                publish = true;
+            }
+        }
+
+        if( publish )
+        {
+            ( void ) memcpy( &header, pQueue->drainBuffer, sizeof( header ) );
+            ( void ) memset( &( pQueue->publishInfo ), 0x00, sizeof( pQueue->publishInfo ) );
+            pQueue->publishInfo.qos = ( MQTTQoS_t ) header.qos;
+            pQueue->publishInfo.retain = ( header.retain != 0U );
+            pQueue->publishInfo.pTopicName = ( const char * ) &( pQueue->drainBuffer[ sizeof( header ) ] );
+            pQueue->publishInfo.topicNameLength = header.topicLength;
+            pQueue->publishInfo.pPayload = &( pQueue->drainBuffer[ sizeof( header ) + header.topicLength ] );
+            pQueue->publishInfo.payloadLength = header.payloadLength;
+            pQueue->publishInFlight = true;
+        }
+    }
+
+    ( void ) k_mutex_unlock( &( pQueue->lock ) );
+
+    if( publish )
+    {
+        commandInfo.cmdCompleteCallback = drainCompleteCallback;
+        commandInfo.pCmdCompleteCallbackContext = ( MQTTAgentCommandContext_t * ) pQueue;
+        commandInfo.blockTimeMs = 0U;
+
+        status = MQTTAgent_Publish( pQueue->pAgentContext, &( pQueue->publishInfo ), &commandInfo );
+
+        if( status != MQTTSuccess )
+        {
+            LogDebug( ( "Failed to forward a queued publish: %s.", MQTT_Status_strerror( status ) ) );
+
+            ( void ) k_mutex_lock( &( pQueue->lock ), K_FOREVER );
+            pQueue->publishInFlight = false;
+            ( void ) k_mutex_unlock( &( pQueue->lock ) );
+
+            ( void ) k_work_schedule( &( pQueue->drainWork ), K_MSEC( MQTT_AGENT_OFFLINE_RETRY_DELAY_MS ) );
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+static void drainCompleteCallback( MQTTAgentCommandContext_t * pCmdCallbackContext,
+                                   MQTTAgentReturnInfo_t * pReturnInfo )
+{
+    AgentOfflineQueue_t * pQueue = ( AgentOfflineQueue_t * ) pCmdCallbackContext;
+    bool forwarded = false;
+
+    assert( pQueue != NULL );
+    assert( pReturnInfo != NULL );
+
+    forwarded = ( pReturnInfo->returnCode == MQTTSuccess );
+
+    ( void ) k_mutex_lock( &( pQueue->lock ), K_FOREVER );
+
+    pQueue->publishInFlight = false;
+
+    /* A record is kept until its publish completes, so that one lost with the
+     * connection is sent again. */
+    if( forwarded )
+    {
+        pQueue->recordPending = false;
+        pQueue->numForwarded++;
+    }
+
+    ( void ) k_mutex_unlock( &( pQueue->lock ) );
+
+    ( void ) k_work_schedule( &( pQueue->drainWork ),
+                              K_MSEC( forwarded ? pQueue->drainIntervalMs : MQTT_AGENT_OFFLINE_RETRY_DELAY_MS ) );
+}
+/*-----------------------------------------------------------*/
+
+bool AgentOfflineQueue_Init( AgentOfflineQueue_t * pQueue,
+                             MQTTAgentContext_t * pAgentContext,
+                             uint8_t * pRingStorage,
+                             size_t ringSize,
+                             const AgentOfflineSpillInterface_t * pSpill,
+                             AgentOfflineDropPolicy_t dropPolicy,
+                             uint32_t drainIntervalMs )
+{
+    bool ret = false;
+
+    if( ( pQueue == NULL ) || ( pAgentContext == NULL ) || ( pRingStorage == NULL ) ||
+        ( ringSize < MQTT_AGENT_OFFLINE_MAX_RECORD_SIZE ) ||
+        ( ( pSpill != NULL ) && ( ( pSpill->append == NULL ) || ( pSpill->takeOldest == NULL ) ) ) )
+    {
+        LogError( ( "Invalid offline queue parameters." ) );
+    }
+    else
+    {
+        ( void ) atomic_cas( &bootId, 0, ( atomic_val_t ) ( sys_rand32_get() | 1U ) );
+
+        ( void ) memset( pQueue, 0x00, sizeof( AgentOfflineQueue_t ) );
+        ( void ) k_mutex_init( &( pQueue->lock ) );
+        k_work_init_delayable( &( pQueue->drainWork ), drainWorkHandler );
+        pQueue->pAgentContext = pAgentContext;
+        pQueue->pRing = pRingStorage;
+        pQueue->ringSize = ringSize;
+        pQueue->pSpill = pSpill;
+
+        /* The spill store may hold records of a previous boot. */
+        pQueue->spillHasRecords = ( pSpill != NULL );
+        pQueue->dropPolicy = dropPolicy;
+        pQueue->drainIntervalMs = drainIntervalMs;
+        ret = true;
+    }
+
+    return ret;
+}
+/*-----------------------------------------------------------*/
+
+bool AgentOfflineQueue_Publish( AgentOfflineQueue_t * pQueue,
+                                const MQTTPublishInfo_t * pPublishInfo,
+                                uint32_t ttlMs )
+{
+    bool ret = false;
+    bool connected = false;
+    AgentOfflineRecordHeader_t header = { 0 };
+    size_t recordSize = 0U;
+    size_t offset = 0U;
+
+    if( ( pQueue == NULL ) || ( pPublishInfo == NULL ) ||
+        ( pPublishInfo->pTopicName == NULL ) || ( pPublishInfo->topicNameLength == 0U ) ||
+        ( ( pPublishInfo->pPayload == NULL ) && ( pPublishInfo->payloadLength > 0U ) ) )
+    {
+        LogError( ( "Invalid offline publish parameters." ) );
+    }
+    else if( ( sizeof( header ) + pPublishInfo->topicNameLength + pPublishInfo->payloadLength ) > MQTT_AGENT_OFFLINE_MAX_RECORD_SIZE )
+    {
+        LogError( ( "Publish of %u bytes does not fit in an offline record.",
+                    ( unsigned int ) ( pPublishInfo->topicNameLength + pPublishInfo->payloadLength ) ) );
+    }
+    else
+    {
+        header.bootId = ( uint32_t ) atomic_get( &bootId );
+        header.enqueueTimeMs = k_uptime_get_32();
+        header.ttlMs = ttlMs;
+        header.payloadLength = ( uint32_t ) pPublishInfo->payloadLength;
+        header.topicLength = pPublishInfo->topicNameLength;
+        header.qos = ( uint8_t ) pPublishInfo->qos;
+        header.retain = pPublishInfo->retain ? 1U : 0U;
+        recordSize = sizeof( header ) + header.topicLength + header.payloadLength;
+
+        ( void ) k_mutex_lock( &( pQueue->lock ), K_FOREVER );
+
+        if( makeRoom( pQueue, recordSize ) )
+        {
+            offset = pQueue->ringHead + pQueue->ringUsed;
+            ringCopyIn( pQueue, offset, ( const uint8_t * ) &header, sizeof( header ) );
+            ringCopyIn( pQueue, offset + sizeof( header ), ( const uint8_t * ) pPublishInfo->pTopicName, header.topicLength );
+            ringCopyIn( pQueue, offset + sizeof( header ) + header.topicLength, pPublishInfo->pPayload, header.payloadLength );
+            pQueue->ringUsed += recordSize;
+            pQueue->numAccepted++;
+            ret = true;
+        }
+        else
+        {
+            pQueue->numDropped++;
+        }
+
+        connected = pQueue->connected;
+
+        ( void ) k_mutex_unlock( &( pQueue->lock ) );
+
+        /* Does nothing while the drain interval runs. */
+        if( ret && connected )
+        {
+            ( void ) k_work_schedule( &( pQueue->drainWork ), K_NO_WAIT );
+        }
+    }
+
+    return ret;
+}
+/*-----------------------------------------------------------*/
+
+void AgentOfflineQueue_SetConnected( AgentOfflineQueue_t * pQueue,
+                                     bool connected )
+{
+    assert( pQueue != NULL );
+
+    ( void ) k_mutex_lock( &( pQueue->lock ), K_FOREVER );
+    pQueue->connected = connected;
+    ( void ) k_mutex_unlock( &( pQueue->lock ) );
+
+    if( connected )
+    {
+        ( void ) k_work_schedule( &( pQueue->drainWork ), K_NO_WAIT );
+    }
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,282 @@
+/*
+ * AWS IoT Device Embedded C SDK for ZephyrRTOS
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file agent_publish_buffer.c
+ * @brief Implementation of the pool of reference-counted publish buffers.
+ */
+
+/* Standard includes. */
+#include <assert.h>
+#include <string.h>
+
+#include "agent_publish_buffer.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Command complete callback of the publishes made with
+ * #AgentPublishBuffer_Publish, which releases the reference of the agent.
+ *
+ * @param[in] pCmdCallbackContext The buffer published.
+ * @param[in] pReturnInfo The result of the publish.
+ */
+static void publishCompleteCallback( MQTTAgentCommandContext_t * pCmdCallbackContext,
+                                     MQTTAgentReturnInfo_t * pReturnInfo );
+
+/**
+ * @brief Command complete callback of the publishes made with
+ * #AgentPublishBuffer_PublishQoS0. It marks the command as one of a buffer,
+ * which is released with the command by #AgentPublishBuffer_ReleaseCommand.
+ *
+ * @param[in] pCmdCallbackContext The buffer published.
+ * @param[in] pReturnInfo The result of the publish.
+ */
+static void publishQoS0CompleteCallback( MQTTAgentCommandContext_t * pCmdCallbackContext,
+                                         MQTTAgentReturnInfo_t * pReturnInfo );
+
+/*-----------------------------------------------------------*/
+
+static void publishQoS0CompleteCallback( MQTTAgentCommandContext_t * pCmdCallbackContext,
+                                         MQTTAgentReturnInfo_t * pReturnInfo )
+{
+    ( void ) pCmdCallbackContext;
+
+    if( pReturnInfo->returnCode != MQTTSuccess )
+    {
+        LogDebug( ( "QoS 0 publish failed: %s.", MQTT_Status_strerror( pReturnInfo->returnCode ) ) );
+    }
+}
+/*-----------------------------------------------------------*/
+
+static void publishCompleteCallback( MQTTAgentCommandContext_t * pCmdCallbackContext,
+                                     MQTTAgentReturnInfo_t * pReturnInfo )
+{
+    AgentPublishBuffer_t * pBuffer = ( AgentPublishBuffer_t * ) pCmdCallbackContext;
+
+    assert( pBuffer != NULL );
+    assert( pReturnInfo != NULL );
+
+    if( pBuffer->completeCallback != NULL )
+    {
+        pBuffer->completeCallback( pBuffer->pCompleteCallbackContext, pReturnInfo->returnCode );
+    }
+
+    AgentPublishBuffer_Release( pBuffer );
+}
+/*-----------------------------------------------------------*/
+
+bool AgentPublishBuffer_InitPool( AgentPublishBufferPool_t * pPool,
+                                  void * pStorage,
+                                  size_t payloadSize,
+                                  size_t numBuffers )
+{
+    bool ret = false;
+
+    if( ( pPool == NULL ) || ( pStorage == NULL ) || ( numBuffers == 0U ) )
+    {
+        LogError( ( "Invalid publish buffer pool parameters." ) );
+    }
+    else if( k_mem_slab_init( &( pPool->slab ),
+                              pStorage,
+                              AGENT_PUBLISH_BUFFER_BLOCK_SIZE( payloadSize ),
+                              ( uint32_t ) numBuffers ) != 0 )
+    {
+        LogError( ( "Failed to initialize the slab of the publish buffer pool." ) );
+    }
+    else
+    {
+        pPool->payloadSize = payloadSize;
+        ret = true;
+    }
+
+    return ret;
+}
+/*-----------------------------------------------------------*/
+
+AgentPublishBuffer_t * AgentPublishBuffer_Allocate( AgentPublishBufferPool_t * pPool,
+                                                    uint32_t blockTimeMs )
+{
+    void * pBlock = NULL;
+    AgentPublishBuffer_t * pBuffer = NULL;
+
+    assert( pPool != NULL );
+
+    if( k_mem_slab_alloc( &( pPool->slab ), &pBlock, K_MSEC( blockTimeMs ) ) == 0 )
+    {
+        pBuffer = ( AgentPublishBuffer_t * ) pBlock;
+        ( void ) memset( pBuffer, 0x00, sizeof( AgentPublishBuffer_t ) );
+        pBuffer->pPool = pPool;
+        ( void ) atomic_set( &( pBuffer->referenceCount ), 1 );
+    }
+    else
+    {
+        LogError( ( "No publish buffer available." ) );
+    }
+
+    return pBuffer;
+}
+/*-----------------------------------------------------------*/
+
+uint8_t * AgentPublishBuffer_GetPayload( AgentPublishBuffer_t * pBuffer )
+{
+    assert( pBuffer != NULL );
+
+    return ( uint8_t * ) &pBuffer[ 1 ];
+}
+/*-----------------------------------------------------------*/
+
+size_t AgentPublishBuffer_GetCapacity( const AgentPublishBuffer_t * pBuffer )
+{
+    assert( pBuffer != NULL );
+
+    return pBuffer->pPool->payloadSize;
+}
+/*-----------------------------------------------------------*/
+
+void AgentPublishBuffer_Retain( AgentPublishBuffer_t * pBuffer )
+{
+    atomic_val_t previousCount;
+
+    assert( pBuffer != NULL );
+
+    previousCount = atomic_inc( &( pBuffer->referenceCount ) );
+
+    /* A buffer already returned to its pool must not be revived. */
+    assert( previousCount > 0 );
+    ( void ) previousCount;
+}
+/*-----------------------------------------------------------*/
+
+void AgentPublishBuffer_Release( AgentPublishBuffer_t * pBuffer )
+{
+    void * pBlock = pBuffer;
+
+    assert( pBuffer != NULL );
+
+    if( atomic_dec( &( pBuffer->referenceCount ) ) == 1 )
+    {
+        k_mem_slab_free( &( pBuffer->pPool->slab ), &pBlock );
+    }
+}
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t AgentPublishBuffer_Publish( MQTTAgentContext_t * pAgentContext,
+                                         AgentPublishBuffer_t * pBuffer,
+                                         uint32_t blockTimeMs,
+                                         AgentPublishCompleteCallback_t completeCallback,
+                                         void * pCompleteCallbackContext )
+{
+    MQTTStatus_t status = MQTTBadParameter;
+    MQTTAgentCommandInfo_t commandInfo = { 0 };
+
+    if( ( pAgentContext == NULL ) || ( pBuffer == NULL ) ||
+        ( pBuffer->publishInfo.payloadLength > pBuffer->pPool->payloadSize ) )
+    {
+        LogError( ( "Invalid publish buffer parameters." ) );
+    }
+    else
+    {
+        pBuffer->publishInfo.pPayload = AgentPublishBuffer_GetPayload( pBuffer );
+        pBuffer->completeCallback = completeCallback;
+        pBuffer->pCompleteCallbackContext = pCompleteCallbackContext;
+
+        /* The buffer is its own command context, so that the callback finds it
+         * without any lookup. */
+        commandInfo.cmdCompleteCallback = publishCompleteCallback;
+        commandInfo.pCmdCompleteCallbackContext = ( MQTTAgentCommandContext_t * ) pBuffer;
+        commandInfo.blockTimeMs = blockTimeMs;
+
+        status = MQTTAgent_Publish( pAgentContext, &( pBuffer->publishInfo ), &commandInfo );
+    }
+
+    /* The agent does not hold the buffer if the publish was not queued. */
+    if( ( status != MQTTSuccess ) && ( pBuffer != NULL ) )
+    {
+        AgentPublishBuffer_Release( pBuffer );
+    }
+
+    return status;
+}
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t AgentPublishBuffer_PublishQoS0( MQTTAgentContext_t * pAgentContext,
+                                             AgentPublishBuffer_t * pBuffer,
+                                             uint32_t blockTimeMs )
+{
+    MQTTStatus_t status = MQTTBadParameter;
+    MQTTAgentCommand_t * pCommand = NULL;
+
+    if( ( pAgentContext == NULL ) || ( pBuffer == NULL ) ||
+        ( pBuffer->publishInfo.pTopicName == NULL ) || ( pBuffer->publishInfo.topicNameLength == 0U ) ||
+        ( pBuffer->publishInfo.payloadLength > pBuffer->pPool->payloadSize ) )
+    {
+        LogError( ( "Invalid publish buffer parameters." ) );
+    }
+    else
+    {
+        pBuffer->publishInfo.qos = MQTTQoS0;
+        pBuffer->publishInfo.pPayload = AgentPublishBuffer_GetPayload( pBuffer );
+
+        pCommand = &( pBuffer->command );
+        pCommand->commandType = PUBLISH;
+        pCommand->pArgs = &( pBuffer->publishInfo );
+        pCommand->pCommandCompleteCallback = publishQoS0CompleteCallback;
+        pCommand->pCmdContext = ( MQTTAgentCommandContext_t * ) pBuffer;
+
+        if( pAgentContext->agentInterface.send( pAgentContext->agentInterface.pMsgCtx, &pCommand, blockTimeMs ) )
+        {
+            status = MQTTSuccess;
+        }
+        else
+        {
+            status = MQTTSendFailed;
+        }
+    }
+
+    /* The agent does not hold the buffer if the publish was not queued. */
+    if( ( status != MQTTSuccess ) && ( pBuffer != NULL ) )
+    {
+        AgentPublishBuffer_Release( pBuffer );
+    }
+
+    return status;
+}
+/*-----------------------------------------------------------*/
+
+bool AgentPublishBuffer_ReleaseCommand( MQTTAgentCommand_t * pCommand )
+{
+    bool released = false;
+
+    /* Only the commands of this module have this callback, which tells them
+     * apart from commands of other origins without reading their context. It
+     * is cleared so that releasing the command twice is rejected. */
+    if( ( pCommand != NULL ) && ( pCommand->pCommandCompleteCallback == publishQoS0CompleteCallback ) )
+    {
+        pCommand->pCommandCompleteCallback = NULL;
+        AgentPublishBuffer_Release( CONTAINER_OF( pCommand, AgentPublishBuffer_t, command ) );
+        released = true;
+    }
+
+    return released;
+}
+/*-----------------------------------------------------------*/
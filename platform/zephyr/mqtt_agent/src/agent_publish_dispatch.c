@@ -0,0 +1,446 @@
+/*
+ * AWS IoT Device Embedded C SDK for ZephyrRTOS
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file agent_publish_dispatch.c
+ * @brief Implementation of the dispatch of incoming publishes to a pool of
+ * work queues.
+ */
+
+/* Standard includes. */
+#include <assert.h>
+#include <string.h>
+
+#include "agent_publish_dispatch.h"
+
+/**
+ * @brief State of the fan out of a publish to its subscriptions.
+ */
+typedef struct FanOut
+{
+    AgentPublishDispatcher_t * pDispatcher;  /**< @brief The dispatcher. */
+    const MQTTPublishInfo_t * pPublishInfo;  /**< @brief The incoming publish. */
+    AgentDispatchedPublish_t * pPublish;     /**< @brief Its copy, or NULL. */
+    bool copied;                             /**< @brief A copy was attempted. */
+    uint32_t numDropped;                     /**< @brief Deliveries dropped. */
+} FanOut_t;
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Work handler of the workers, which runs one delivery of a ready
+ * subscription at a time until no subscription is ready.
+ *
+ * @param[in] pWork The work item of the worker.
+ */
+static void runDeliveries( struct k_work * pWork );
+
+/**
+ * @brief Copy an incoming publish.
+ *
+ * @param[in] pDispatcher The dispatcher.
+ * @param[in] pPublishInfo The publish.
+ *
+ * @return The copy, or NULL if no memory was available.
+ */
+static AgentDispatchedPublish_t * copyPublish( AgentPublishDispatcher_t * pDispatcher,
+                                               const MQTTPublishInfo_t * pPublishInfo );
+
+/**
+ * @brief Drop a reference to a copy of a publish, freeing it with the last.
+ *
+ * @param[in] pDispatcher The dispatcher.
+ * @param[in] pPublish The copy.
+ */
+static void releasePublish( AgentPublishDispatcher_t * pDispatcher,
+                            AgentDispatchedPublish_t * pPublish );
+
+/**
+ * @brief Queue a delivery for a subscription, waking an idle worker if the
+ * subscription becomes ready.
+ *
+ * @param[in] pDispatcher The dispatcher.
+ * @param[in] pLane The lane of the subscription.
+ * @param[in] pDelivery The delivery.
+ */
+static void queueDelivery( AgentPublishDispatcher_t * pDispatcher,
+                           AgentPublishDispatchLane_t * pLane,
+                           AgentPublishDelivery_t * pDelivery );
+
+/**
+ * @brief Get the lane of a subscription, from its callback and context, so
+ * that it does not depend on where the subscription is stored. Unrelated
+ * subscriptions may share a lane.
+ *
+ * @param[in] pSubscription The subscription.
+ *
+ * @return Index of the lane.
+ */
+static size_t getLaneIndex( const SubscriptionElement_t * pSubscription );
+
+/**
+ * @brief Match callback queueing a delivery for a subscription matching a
+ * publish.
+ *
+ * @param[in] pMatchContext The fan out.
+ * @param[in] pSubscription The subscription.
+ */
+static void dispatchToSubscription( void * pMatchContext,
+                                    const SubscriptionElement_t * pSubscription );
+
+/*-----------------------------------------------------------*/
+
+static AgentDispatchedPublish_t * copyPublish( AgentPublishDispatcher_t * pDispatcher,
+                                               const MQTTPublishInfo_t * pPublishInfo )
+{
+    AgentDispatchedPublish_t * pPublish = NULL;
+    void * pBlock = NULL;
+    uint8_t * pData = NULL;
+
+    if( ( ( size_t ) pPublishInfo->topicNameLength + pPublishInfo->payloadLength ) > pDispatcher->maxPublishSize )
+    {
+        LogError( ( "Publish of %u bytes is too large to dispatch.",
+                    ( unsigned int ) ( pPublishInfo->topicNameLength + pPublishInfo->payloadLength ) ) );
+    }
+    else if( k_mem_slab_alloc( &( pDispatcher->publishes ), &pBlock, K_NO_WAIT ) != 0 )
+    {
+        LogWarn( ( "No memory to dispatch a publish." ) );
+    }
+    else
+    {
+        pPublish = ( AgentDispatchedPublish_t * ) pBlock;
+        pData = ( uint8_t * ) &( pPublish[ 1 ] );
+
+        memcpy( pData, pPublishInfo->pTopicName, pPublishInfo->topicNameLength );
+
+        if( pPublishInfo->payloadLength > 0U )
+        {
+            memcpy( &( pData[ pPublishInfo->topicNameLength ] ), pPublishInfo->pPayload, pPublishInfo->payloadLength );
+        }
+
+        pPublish->publishInfo = *pPublishInfo;
+        pPublish->publishInfo.pTopicName = ( const char * ) pData;
+        pPublish->publishInfo.pPayload = &( pData[ pPublishInfo->topicNameLength ] );
+        atomic_set( &( pPublish->references ), 1 );
+    }
+
+    return pPublish;
+}
+/*-----------------------------------------------------------*/
+
+static void releasePublish( AgentPublishDispatcher_t * pDispatcher,
+                            AgentDispatchedPublish_t * pPublish )
+{
+    void * pBlock = pPublish;
+
+    if( atomic_dec( &( pPublish->references ) ) == 1 )
+    {
+        k_mem_slab_free( &( pDispatcher->publishes ), &pBlock );
+    }
+}
+/*-----------------------------------------------------------*/
+
+static void queueDelivery( AgentPublishDispatcher_t * pDispatcher,
+                           AgentPublishDispatchLane_t * pLane,
+                           AgentPublishDelivery_t * pDelivery )
+{
+    AgentPublishDispatchWorker_t * pIdleWorker = NULL;
+    k_spinlock_key_t key;
+    size_t index = 0U;
+
+    key = k_spin_lock( &( pDispatcher->lock ) );
+
+    sys_slist_append( &( pLane->deliveries ), &( pDelivery->node ) );
+
+    if( !pLane->scheduled )
+    {
+        pLane->scheduled = true;
+        sys_slist_append( &( pDispatcher->readyLanes ), &( pLane->readyNode ) );
+
+        /* A busy worker checks the ready list before it goes idle, so a
+         * worker only needs to be woken when one is idle. */
+        for( index = 0U; ( index < pDispatcher->numWorkers ) && ( pIdleWorker == NULL ); index++ )
+        {
+            if( !pDispatcher->workers[ index ].busy )
+            {
+                pIdleWorker = &( pDispatcher->workers[ index ] );
+                pIdleWorker->busy = true;
+            }
+        }
+    }
+
+    k_spin_unlock( &( pDispatcher->lock ), key );
+
+    if( pIdleWorker != NULL )
+    {
+        ( void ) k_work_submit_to_queue( pIdleWorker->pWorkQueue, &( pIdleWorker->work ) );
+    }
+}
+/*-----------------------------------------------------------*/
+
+static void runDeliveries( struct k_work * pWork )
+{
+    AgentPublishDispatchWorker_t * pWorker = CONTAINER_OF( pWork, AgentPublishDispatchWorker_t, work );
+    AgentPublishDispatcher_t * pDispatcher = pWorker->pDispatcher;
+    AgentPublishDispatchLane_t * pLane = NULL;
+    AgentPublishDelivery_t * pDelivery = NULL;
+    sys_snode_t * pNode = NULL;
+    k_spinlock_key_t key;
+    void * pBlock = NULL;
+
+    do
+    {
+        key = k_spin_lock( &( pDispatcher->lock ) );
+
+        pNode = sys_slist_get( &( pDispatcher->readyLanes ) );
+
+        if( pNode == NULL )
+        {
+            pWorker->busy = false;
+            pLane = NULL;
+        }
+        else
+        {
+            /* The lane stays scheduled while it is out of the ready list, so
+             * no other worker runs the same subscription. */
+            pLane = CONTAINER_OF( pNode, AgentPublishDispatchLane_t, readyNode );
+            pDelivery = CONTAINER_OF( sys_slist_get( &( pLane->deliveries ) ), AgentPublishDelivery_t, node );
+        }
+
+        k_spin_unlock( &( pDispatcher->lock ), key );
+
+        if( pLane != NULL )
+        {
+            pDelivery->callback( pDelivery->pCallbackContext, &( pDelivery->pPublish->publishInfo ) );
+
+            releasePublish( pDispatcher, pDelivery->pPublish );
+            pBlock = pDelivery;
+            k_mem_slab_free( &( pDispatcher->deliveries ), &pBlock );
+
+            /* Queue the subscription behind the other ready ones, so that a
+             * subscription receiving a burst does not hold the worker. */
+            key = k_spin_lock( &( pDispatcher->lock ) );
+
+            if( sys_slist_is_empty( &( pLane->deliveries ) ) )
+            {
+                pLane->scheduled = false;
+            }
+            else
+            {
+                sys_slist_append( &( pDispatcher->readyLanes ), &( pLane->readyNode ) );
+            }
+
+            k_spin_unlock( &( pDispatcher->lock ), key );
+        }
+    } while( pLane != NULL );
+}
+/*-----------------------------------------------------------*/
+
+static size_t getLaneIndex( const SubscriptionElement_t * pSubscription )
+{
+    uint32_t key = ( uint32_t ) ( uintptr_t ) pSubscription->incomingPublishCallback;
+
+    /* Mix the bits, as the low bits of pointers are mostly zero. */
+    key = ( key * 31U ) ^ ( uint32_t ) ( uintptr_t ) pSubscription->pIncomingPublishCallbackContext;
+    key ^= key >> 16;
+    key *= 0x45D9F3BU;
+    key ^= key >> 16;
+
+    return ( size_t ) ( key % AGENT_PUBLISH_DISPATCH_NUM_LANES );
+}
+/*-----------------------------------------------------------*/
+
+static void dispatchToSubscription( void * pMatchContext,
+                                    const SubscriptionElement_t * pSubscription )
+{
+    FanOut_t * pFanOut = ( FanOut_t * ) pMatchContext;
+    AgentPublishDispatcher_t * pDispatcher = pFanOut->pDispatcher;
+    AgentPublishDelivery_t * pDelivery = NULL;
+    void * pBlock = NULL;
+
+    /* The publish is copied once, for the first subscription that matches. */
+    if( !pFanOut->copied )
+    {
+        pFanOut->pPublish = copyPublish( pDispatcher, pFanOut->pPublishInfo );
+        pFanOut->copied = true;
+    }
+
+    if( ( pFanOut->pPublish != NULL ) &&
+        ( k_mem_slab_alloc( &( pDispatcher->deliveries ), &pBlock, K_NO_WAIT ) == 0 ) )
+    {
+        pDelivery = ( AgentPublishDelivery_t * ) pBlock;
+        pDelivery->callback = pSubscription->incomingPublishCallback;
+        pDelivery->pCallbackContext = pSubscription->pIncomingPublishCallbackContext;
+        pDelivery->pPublish = pFanOut->pPublish;
+        ( void ) atomic_inc( &( pFanOut->pPublish->references ) );
+
+        queueDelivery( pDispatcher, &( pDispatcher->lanes[ getLaneIndex( pSubscription ) ] ), pDelivery );
+    }
+    else
+    {
+        pFanOut->numDropped++;
+    }
+}
+/*-----------------------------------------------------------*/
+
+bool AgentPublishDispatch_Init( AgentPublishDispatcher_t * pDispatcher,
+                                struct k_work_q * const * pWorkQueues,
+                                size_t numWorkQueues,
+                                void * pPublishStorage,
+                                size_t numPublishes,
+                                size_t maxPublishSize,
+                                AgentPublishDelivery_t * pDeliveryStorage,
+                                size_t numDeliveries )
+{
+    bool returnStatus = false;
+    size_t index = 0U;
+
+    if( ( pDispatcher == NULL ) ||
+        ( pWorkQueues == NULL ) ||
+        ( numWorkQueues == 0U ) ||
+        ( numWorkQueues > AGENT_PUBLISH_DISPATCH_MAX_WORKERS ) ||
+        ( pPublishStorage == NULL ) ||
+        ( numPublishes == 0U ) ||
+        ( pDeliveryStorage == NULL ) ||
+        ( numDeliveries == 0U ) )
+    {
+        LogError( ( "Invalid parameter. pDispatcher=%p, pWorkQueues=%p, numWorkQueues=%u,"
+                    " pPublishStorage=%p, numPublishes=%u, pDeliveryStorage=%p, numDeliveries=%u.",
+                    pDispatcher,
+                    pWorkQueues,
+                    ( unsigned int ) numWorkQueues,
+                    pPublishStorage,
+                    ( unsigned int ) numPublishes,
+                    pDeliveryStorage,
+                    ( unsigned int ) numDeliveries ) );
+    }
+    else
+    {
+        memset( pDispatcher, 0x00, sizeof( AgentPublishDispatcher_t ) );
+
+        sys_slist_init( &( pDispatcher->readyLanes ) );
+
+        for( index = 0U; index < AGENT_PUBLISH_DISPATCH_NUM_LANES; index++ )
+        {
+            sys_slist_init( &( pDispatcher->lanes[ index ].deliveries ) );
+        }
+
+        for( index = 0U; index < numWorkQueues; index++ )
+        {
+            k_work_init( &( pDispatcher->workers[ index ].work ), runDeliveries );
+            pDispatcher->workers[ index ].pWorkQueue = pWorkQueues[ index ];
+            pDispatcher->workers[ index ].pDispatcher = pDispatcher;
+        }
+
+        pDispatcher->numWorkers = numWorkQueues;
+        pDispatcher->maxPublishSize = maxPublishSize;
+
+        returnStatus = ( k_mem_slab_init( &( pDispatcher->publishes ),
+                                          pPublishStorage,
+                                          AGENT_PUBLISH_DISPATCH_BLOCK_SIZE( maxPublishSize ),
+                                          numPublishes ) == 0 ) &&
+                       ( k_mem_slab_init( &( pDispatcher->deliveries ),
+                                          pDeliveryStorage,
+                                          sizeof( AgentPublishDelivery_t ),
+                                          numDeliveries ) == 0 );
+
+        if( !returnStatus )
+        {
+            LogError( ( "Failed to initialize the storage of the dispatcher." ) );
+        }
+    }
+
+    return returnStatus;
+}
+/*-----------------------------------------------------------*/
+
+bool AgentPublishDispatch_HandleIncomingPublishes( AgentPublishDispatcher_t * pDispatcher,
+                                                   SubscriptionList_t * pSubscriptionList,
+                                                   MQTTPublishInfo_t * pPublishInfo )
+{
+    FanOut_t fanOut = { 0 };
+    bool publishHandled = false;
+
+    assert( pDispatcher != NULL );
+
+    if( ( pSubscriptionList == NULL ) ||
+        ( pPublishInfo == NULL ) )
+    {
+        LogError( ( "Invalid parameter. pSubscriptionList=%p, pPublishInfo=%p,",
+                    pSubscriptionList,
+                    pPublishInfo ) );
+    }
+    else
+    {
+        fanOut.pDispatcher = pDispatcher;
+        fanOut.pPublishInfo = pPublishInfo;
+
+        publishHandled = forEachMatchingSubscription( pSubscriptionList,
+                                                      pPublishInfo,
+                                                      dispatchToSubscription,
+                                                      &fanOut );
+
+        if( fanOut.numDropped > 0U )
+        {
+            ( void ) atomic_add( &( pDispatcher->droppedDeliveries ), ( atomic_val_t ) fanOut.numDropped );
+
+            if( pPublishInfo->qos == MQTTQoS0 )
+            {
+                LogWarn( ( "Dropped %u deliveries of a publish.", ( unsigned int ) fanOut.numDropped ) );
+            }
+            else
+            {
+                /* coreMQTT acknowledges the publish once this returns, so the
+                 * broker will not send it again. */
+                LogError( ( "Lost %u deliveries of an acknowledged QoS %u publish.",
+                            ( unsigned int ) fanOut.numDropped,
+                            ( unsigned int ) pPublishInfo->qos ) );
+                ( void ) atomic_add( &( pDispatcher->droppedAcknowledgedDeliveries ), ( atomic_val_t ) fanOut.numDropped );
+            }
+        }
+
+        /* Drop the reference held while fanning out. */
+        if( fanOut.pPublish != NULL )
+        {
+            releasePublish( pDispatcher, fanOut.pPublish );
+        }
+    }
+
+    return publishHandled;
+}
+/*-----------------------------------------------------------*/
+
+uint32_t AgentPublishDispatch_GetDroppedDeliveries( AgentPublishDispatcher_t * pDispatcher )
+{
+    assert( pDispatcher != NULL );
+
+    return ( uint32_t ) atomic_get( &( pDispatcher->droppedDeliveries ) );
+}
+/*-----------------------------------------------------------*/
+
+uint32_t AgentPublishDispatch_GetDroppedAcknowledgedDeliveries( AgentPublishDispatcher_t * pDispatcher )
+{
+    assert( pDispatcher != NULL );
+
+    return ( uint32_t ) atomic_get( &( pDispatcher->droppedAcknowledgedDeliveries ) );
+}
+/*-----------------------------------------------------------*/
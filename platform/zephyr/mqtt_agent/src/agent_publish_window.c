@@ -0,0 +1,199 @@
+/*
+ * AWS IoT Device Embedded C SDK for ZephyrRTOS
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file agent_publish_window.c
+ * @brief Implementation of the credit windows of agent publishers.
+ */
+
+/* Standard includes. */
+#include <assert.h>
+
+#include "agent_publish_window.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Command complete callback of the publishes made with
+ * #AgentPublishWindow_Publish, which gives their credit back.
+ *
+ * @param[in] pCmdCallbackContext The slot of the publish.
+ * @param[in] pReturnInfo The result of the publish.
+ */
+static void windowedPublishCallback( MQTTAgentCommandContext_t * pCmdCallbackContext,
+                                     MQTTAgentReturnInfo_t * pReturnInfo );
+
+/**
+ * @brief Free the slot of a publish and give its credit back.
+ *
+ * @param[in] pSlot The slot.
+ */
+static void releaseSlot( AgentPublishWindowSlot_t * pSlot );
+
+/*-----------------------------------------------------------*/
+
+static void releaseSlot( AgentPublishWindowSlot_t * pSlot )
+{
+    AgentPublishWindow_t * pWindow = pSlot->pWindow;
+    void * pBlock = pSlot;
+
+    k_mem_slab_free( &( pWindow->slots ), &pBlock );
+    AgentPublishWindow_Return( pWindow );
+}
+/*-----------------------------------------------------------*/
+
+static void windowedPublishCallback( MQTTAgentCommandContext_t * pCmdCallbackContext,
+                                     MQTTAgentReturnInfo_t * pReturnInfo )
+{
+    AgentPublishWindowSlot_t * pSlot = ( AgentPublishWindowSlot_t * ) pCmdCallbackContext;
+
+    assert( pSlot != NULL );
+    assert( pReturnInfo != NULL );
+
+    if( pSlot->cmdCompleteCallback != NULL )
+    {
+        pSlot->cmdCompleteCallback( pSlot->pCmdCompleteCallbackContext, pReturnInfo );
+    }
+
+    releaseSlot( pSlot );
+}
+/*-----------------------------------------------------------*/
+
+bool AgentPublishWindow_Init( AgentPublishWindow_t * pWindow,
+                              AgentPublishWindowSlot_t * pSlotStorage,
+                              uint32_t windowSize )
+{
+    bool ret = false;
+
+    if( ( pWindow == NULL ) || ( pSlotStorage == NULL ) || ( windowSize == 0U ) )
+    {
+        LogError( ( "Invalid publish window parameters." ) );
+    }
+    else if( k_mem_slab_init( &( pWindow->slots ),
+                              pSlotStorage,
+                              sizeof( AgentPublishWindowSlot_t ),
+                              windowSize ) != 0 )
+    {
+        LogError( ( "Failed to initialize the slots of the publish window." ) );
+    }
+    else
+    {
+        ( void ) k_sem_init( &( pWindow->credits ), windowSize, windowSize );
+        pWindow->windowSize = windowSize;
+        pWindow->creditsCallback = NULL;
+        pWindow->pCreditsCallbackContext = NULL;
+        ret = true;
+    }
+
+    return ret;
+}
+/*-----------------------------------------------------------*/
+
+void AgentPublishWindow_SetCreditsCallback( AgentPublishWindow_t * pWindow,
+                                            AgentCreditsReturnedCallback_t creditsCallback,
+                                            void * pCreditsCallbackContext )
+{
+    assert( pWindow != NULL );
+
+    pWindow->creditsCallback = creditsCallback;
+    pWindow->pCreditsCallbackContext = pCreditsCallbackContext;
+}
+/*-----------------------------------------------------------*/
+
+uint32_t AgentPublishWindow_GetCredits( AgentPublishWindow_t * pWindow )
+{
+    assert( pWindow != NULL );
+
+    return k_sem_count_get( &( pWindow->credits ) );
+}
+/*-----------------------------------------------------------*/
+
+bool AgentPublishWindow_Acquire( AgentPublishWindow_t * pWindow,
+                                 uint32_t blockTimeMs )
+{
+    assert( pWindow != NULL );
+
+    return( k_sem_take( &( pWindow->credits ), K_MSEC( blockTimeMs ) ) == 0 );
+}
+/*-----------------------------------------------------------*/
+
+void AgentPublishWindow_Return( AgentPublishWindow_t * pWindow )
+{
+    assert( pWindow != NULL );
+
+    k_sem_give( &( pWindow->credits ) );
+
+    if( pWindow->creditsCallback != NULL )
+    {
+        pWindow->creditsCallback( pWindow->pCreditsCallbackContext,
+                                  k_sem_count_get( &( pWindow->credits ) ) );
+    }
+}
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t AgentPublishWindow_Publish( AgentPublishWindow_t * pWindow,
+                                         const MQTTAgentContext_t * pAgentContext,
+                                         MQTTPublishInfo_t * pPublishInfo,
+                                         const MQTTAgentCommandInfo_t * pCommandInfo )
+{
+    MQTTStatus_t status = MQTTBadParameter;
+    MQTTAgentCommandInfo_t commandInfo = { 0 };
+    AgentPublishWindowSlot_t * pSlot = NULL;
+    void * pBlock = NULL;
+
+    if( ( pWindow == NULL ) || ( pAgentContext == NULL ) ||
+        ( pPublishInfo == NULL ) || ( pCommandInfo == NULL ) )
+    {
+        LogError( ( "Invalid publish window parameters." ) );
+    }
+    else if( !AgentPublishWindow_Acquire( pWindow, pCommandInfo->blockTimeMs ) )
+    {
+        LogDebug( ( "No publish credit returned within %u ms.", ( unsigned int ) pCommandInfo->blockTimeMs ) );
+        status = MQTTNoMemory;
+    }
+    else
+    {
+        /* There are as many slots as credits, so a credit guarantees a slot. */
+        ( void ) k_mem_slab_alloc( &( pWindow->slots ), &pBlock, K_NO_WAIT );
+        assert( pBlock != NULL );
+
+        pSlot = ( AgentPublishWindowSlot_t * ) pBlock;
+        pSlot->pWindow = pWindow;
+        pSlot->cmdCompleteCallback = pCommandInfo->cmdCompleteCallback;
+        pSlot->pCmdCompleteCallbackContext = pCommandInfo->pCmdCompleteCallbackContext;
+
+        commandInfo.cmdCompleteCallback = windowedPublishCallback;
+        commandInfo.pCmdCompleteCallbackContext = ( MQTTAgentCommandContext_t * ) pSlot;
+        commandInfo.blockTimeMs = pCommandInfo->blockTimeMs;
+
+        status = MQTTAgent_Publish( pAgentContext, pPublishInfo, &commandInfo );
+
+        /* The callback is never called for a publish that was not queued. */
+        if( status != MQTTSuccess )
+        {
+            releaseSlot( pSlot );
+        }
+    }
+
+    return status;
+}
+/*-----------------------------------------------------------*/
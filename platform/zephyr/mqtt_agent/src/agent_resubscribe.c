@@ -0,0 +1,517 @@
+/*
+ * AWS IoT Device Embedded C SDK for ZephyrRTOS
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file agent_resubscribe.c
+ * @brief Implementation of the resubscribe of a subscription list after a
+ * reconnection.
+ */
+
+/* Standard includes. */
+#include <assert.h>
+#include <string.h>
+
+#include "agent_resubscribe.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Size of the packet identifier and of the length prefix and options
+ * byte of each topic filter of a SUBSCRIBE packet.
+ */
+#define SUBSCRIBE_PACKET_ID_SIZE        ( 2U )
+#define SUBSCRIBE_FILTER_OVERHEAD       ( 3U )
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Command complete callback of the SUBSCRIBE packets, which removes the
+ * topic filters the broker refused from the subscription list.
+ *
+ * @param[in] pCmdCallbackContext The batch of the packet.
+ * @param[in] pReturnInfo The result of the subscribe.
+ */
+static void resubscribeCallback( MQTTAgentCommandContext_t * pCmdCallbackContext,
+                                 MQTTAgentReturnInfo_t * pReturnInfo );
+
+/**
+ * @brief Get the size of a SUBSCRIBE packet.
+ *
+ * @param[in] remainingLength Size of the packet after its fixed header.
+ *
+ * @return Size of the packet.
+ */
+static size_t getSubscribePacketSize( size_t remainingLength );
+
+/**
+ * @brief Check whether a topic filter is covered by one of a range of the
+ * topic filters of a resubscribe.
+ *
+ * @param[in] pResubscribe The resubscribe.
+ * @param[in] filter Index of the topic filter.
+ * @param[in] rangeStart Index of the first topic filter of the range.
+ * @param[in] rangeEnd Index past the last topic filter of the range.
+ * @param[in] isUnsentRange Whether the range holds topic filters not sent
+ * yet. Otherwise, only the sent topic filters the broker did not refuse are
+ * compared.
+ *
+ * @return `true` if a topic filter of the range other than @p filter covers
+ * it; `false` otherwise.
+ */
+static bool isCoveredInRange( const AgentResubscribe_t * pResubscribe,
+                              size_t filter,
+                              size_t rangeStart,
+                              size_t rangeEnd,
+                              bool isUnsentRange );
+
+/**
+ * @brief Start a round of a resubscribe: select the topic filters not sent
+ * yet that neither another one of them nor a sent topic filter the broker did
+ * not refuse covers, and pack them into SUBSCRIBE packets.
+ *
+ * The first round sends the topic filters no other one covers. A following
+ * round sends the topic filters that were covered only by filters the broker
+ * refused.
+ *
+ * @param[in] pResubscribe The resubscribe.
+ *
+ * @return Number of topic filters selected.
+ */
+static size_t startRound( AgentResubscribe_t * pResubscribe );
+
+/**
+ * @brief Set the state of the topic filters of a SUBSCRIBE packet.
+ *
+ * @param[in] pResubscribe The resubscribe.
+ * @param[in] pBatch The packet.
+ * @param[in] state The state.
+ */
+static void setBatchState( AgentResubscribe_t * pResubscribe,
+                           const AgentResubscribeBatch_t * pBatch,
+                           AgentResubscribeFilterState_t state );
+
+/**
+ * @brief Count the topic filters of a resubscribe that are not subscribed to
+ * at the broker.
+ *
+ * @param[in] pResubscribe The completed resubscribe.
+ *
+ * @return The topic filters that were not copied, that the broker refused or
+ * that failed, and those not sent that no accepted topic filter covers.
+ */
+static size_t countFailedFilters( const AgentResubscribe_t * pResubscribe );
+
+/**
+ * @brief Queue SUBSCRIBE packets of a resubscribe until
+ * #AGENT_RESUBSCRIBE_MAX_IN_FLIGHT are in flight, starting a new round once
+ * the packets of a round completed, or report the resubscribe once no topic
+ * filter is left to send.
+ *
+ * A packet that finds no free command or queue slot while others are in
+ * flight is queued again on their completion. Any other packet that cannot be
+ * queued is counted as failed, and the next one is tried.
+ *
+ * @param[in] pResubscribe The resubscribe.
+ *
+ * @return #MQTTSuccess if packets were queued or none was left, else the
+ * status of the last MQTTAgent_Subscribe that failed.
+ */
+static MQTTStatus_t queueBatches( AgentResubscribe_t * pResubscribe );
+
+/*-----------------------------------------------------------*/
+
+static size_t getSubscribePacketSize( size_t remainingLength )
+{
+    size_t packetSize = 1U + remainingLength;
+
+    /* The remaining length is encoded 7 bits per byte. */
+    do
+    {
+        packetSize++;
+        remainingLength >>= 7U;
+    } while( remainingLength > 0U );
+
+    return packetSize;
+}
+/*-----------------------------------------------------------*/
+
+static bool isCoveredInRange( const AgentResubscribe_t * pResubscribe,
+                              size_t filter,
+                              size_t rangeStart,
+                              size_t rangeEnd,
+                              bool isUnsentRange )
+{
+    const MQTTSubscribeInfo_t * pSubscribeInfo = pResubscribe->subscribeInfo;
+    size_t index = 0U;
+    bool isCovered = false;
+
+    for( index = rangeStart; ( index < rangeEnd ) && !isCovered; index++ )
+    {
+        if( ( index != filter ) &&
+            ( isUnsentRange || ( pResubscribe->filterStates[ index ] != AgentResubscribeFilterRefused ) ) )
+        {
+            isCovered = isTopicFilterCovered( pSubscribeInfo[ filter ].pTopicFilter,
+                                              pSubscribeInfo[ filter ].topicFilterLength,
+                                              pSubscribeInfo[ index ].pTopicFilter,
+                                              pSubscribeInfo[ index ].topicFilterLength );
+        }
+    }
+
+    return isCovered;
+}
+/*-----------------------------------------------------------*/
+
+static size_t startRound( AgentResubscribe_t * pResubscribe )
+{
+    MQTTSubscribeInfo_t * pSubscribeInfo = pResubscribe->subscribeInfo;
+    MQTTSubscribeInfo_t selectedInfo = { 0 };
+    size_t roundStart = pResubscribe->numSent;
+    size_t numSelected = 0U;
+    size_t numBatches = 0U;
+    size_t batchStart = roundStart;
+    size_t remainingLength = SUBSCRIBE_PACKET_ID_SIZE;
+    size_t filterSize = 0U;
+    size_t index = 0U;
+
+    /* Move the selected topic filters to the front of those not sent. This
+     * only reorders the unsent ones, so the selection of each does not
+     * depend on the order. */
+    for( index = roundStart; index < pResubscribe->numFilters; index++ )
+    {
+        if( !isCoveredInRange( pResubscribe, index, 0U, roundStart, false ) &&
+            !isCoveredInRange( pResubscribe, index, roundStart, pResubscribe->numFilters, true ) )
+        {
+            selectedInfo = pSubscribeInfo[ index ];
+            pSubscribeInfo[ index ] = pSubscribeInfo[ roundStart + numSelected ];
+            pSubscribeInfo[ roundStart + numSelected ] = selectedInfo;
+            pSubscribeInfo[ roundStart + numSelected ].qos = pResubscribe->qos;
+            pResubscribe->filterStates[ roundStart + numSelected ] = AgentResubscribeFilterSent;
+            numSelected++;
+        }
+    }
+
+    pResubscribe->numSent = roundStart + numSelected;
+
+    /* Pack the filters into packets that fit in the network buffer. A
+     * filter too large for a packet of its own still gets one, and fails
+     * when the agent serializes it. */
+    for( index = roundStart; index < pResubscribe->numSent; index++ )
+    {
+        filterSize = SUBSCRIBE_FILTER_OVERHEAD + pSubscribeInfo[ index ].topicFilterLength;
+
+        if( ( index > batchStart ) &&
+            ( getSubscribePacketSize( remainingLength + filterSize ) > pResubscribe->maxPacketSize ) )
+        {
+            pResubscribe->batches[ numBatches ].subscribeArgs.pSubscribeInfo = &( pSubscribeInfo[ batchStart ] );
+            pResubscribe->batches[ numBatches ].subscribeArgs.numSubscriptions = index - batchStart;
+            numBatches++;
+            batchStart = index;
+            remainingLength = SUBSCRIBE_PACKET_ID_SIZE;
+        }
+
+        remainingLength += filterSize;
+    }
+
+    if( pResubscribe->numSent > batchStart )
+    {
+        pResubscribe->batches[ numBatches ].subscribeArgs.pSubscribeInfo = &( pSubscribeInfo[ batchStart ] );
+        pResubscribe->batches[ numBatches ].subscribeArgs.numSubscriptions = pResubscribe->numSent - batchStart;
+        numBatches++;
+    }
+
+    pResubscribe->numBatches = numBatches;
+    pResubscribe->nextBatch = 0U;
+
+    if( numSelected > 0U )
+    {
+        LogInfo( ( "Resubscribing to %u topic filters in %u packets.",
+                   ( unsigned int ) numSelected,
+                   ( unsigned int ) numBatches ) );
+    }
+
+    return numSelected;
+}
+/*-----------------------------------------------------------*/
+
+static void setBatchState( AgentResubscribe_t * pResubscribe,
+                           const AgentResubscribeBatch_t * pBatch,
+                           AgentResubscribeFilterState_t state )
+{
+    size_t first = ( size_t ) ( pBatch->subscribeArgs.pSubscribeInfo - pResubscribe->subscribeInfo );
+    size_t index = 0U;
+
+    for( index = 0U; index < pBatch->subscribeArgs.numSubscriptions; index++ )
+    {
+        pResubscribe->filterStates[ first + index ] = state;
+    }
+}
+/*-----------------------------------------------------------*/
+
+static size_t countFailedFilters( const AgentResubscribe_t * pResubscribe )
+{
+    size_t numFailed = pResubscribe->numListed - pResubscribe->numFilters;
+    size_t index = 0U;
+    size_t other = 0U;
+    bool isCovered = false;
+
+    for( index = 0U; index < pResubscribe->numFilters; index++ )
+    {
+        if( index < pResubscribe->numSent )
+        {
+            isCovered = ( pResubscribe->filterStates[ index ] == AgentResubscribeFilterAccepted );
+        }
+        else
+        {
+            /* A topic filter not sent is delivered through an accepted one
+             * covering it. */
+            isCovered = false;
+
+            for( other = 0U; ( other < pResubscribe->numSent ) && !isCovered; other++ )
+            {
+                isCovered = ( pResubscribe->filterStates[ other ] == AgentResubscribeFilterAccepted ) &&
+                            isTopicFilterCovered( pResubscribe->subscribeInfo[ index ].pTopicFilter,
+                                                  pResubscribe->subscribeInfo[ index ].topicFilterLength,
+                                                  pResubscribe->subscribeInfo[ other ].pTopicFilter,
+                                                  pResubscribe->subscribeInfo[ other ].topicFilterLength );
+            }
+        }
+
+        if( !isCovered )
+        {
+            numFailed++;
+        }
+    }
+
+    return numFailed;
+}
+/*-----------------------------------------------------------*/
+
+static MQTTStatus_t queueBatches( AgentResubscribe_t * pResubscribe )
+{
+    MQTTStatus_t mqttStatus = MQTTSuccess;
+    MQTTStatus_t subscribeStatus = MQTTSuccess;
+    MQTTAgentCommandInfo_t commandParams = { 0 };
+    AgentResubscribeBatch_t * pBatch = NULL;
+    bool isWindowFull = false;
+    bool isDone = false;
+
+    /* The block time is 0 as this runs either before the command loop of the
+     * agent, or in it from a completion callback, which must not wait for the
+     * loop to free a command. */
+    commandParams.blockTimeMs = 0U;
+    commandParams.cmdCompleteCallback = resubscribeCallback;
+
+    while( !isWindowFull && !isDone )
+    {
+        if( pResubscribe->numInFlight == AGENT_RESUBSCRIBE_MAX_IN_FLIGHT )
+        {
+            isWindowFull = true;
+        }
+        else if( pResubscribe->nextBatch < pResubscribe->numBatches )
+        {
+            pBatch = &( pResubscribe->batches[ pResubscribe->nextBatch ] );
+            pBatch->pResubscribe = pResubscribe;
+            commandParams.pCmdCompleteCallbackContext = ( MQTTAgentCommandContext_t * ) pBatch;
+
+            subscribeStatus = MQTTAgent_Subscribe( pResubscribe->pAgentContext,
+                                                   &( pBatch->subscribeArgs ),
+                                                   &commandParams );
+
+            if( subscribeStatus == MQTTSuccess )
+            {
+                pResubscribe->nextBatch++;
+                pResubscribe->numInFlight++;
+            }
+            else if( ( ( subscribeStatus == MQTTNoMemory ) || ( subscribeStatus == MQTTSendFailed ) ) &&
+                     ( pResubscribe->numInFlight > 0U ) )
+            {
+                /* No free command or queue slot: one is freed as a packet in
+                 * flight completes, which queues this one again. */
+                isWindowFull = true;
+            }
+            else
+            {
+                LogError( ( "Failed to enqueue the MQTT subscribe command. mqttStatus=%s.",
+                            MQTT_Status_strerror( subscribeStatus ) ) );
+                setBatchState( pResubscribe, pBatch, AgentResubscribeFilterFailed );
+                pResubscribe->nextBatch++;
+                mqttStatus = subscribeStatus;
+            }
+        }
+        else if( pResubscribe->numInFlight > 0U )
+        {
+            /* The next round depends on the topic filters the broker refuses
+             * in this one. */
+            isWindowFull = true;
+        }
+        else if( pResubscribe->isStopped || ( startRound( pResubscribe ) == 0U ) )
+        {
+            isDone = true;
+        }
+        else
+        {
+            /* Empty else marker. */
+        }
+    }
+
+    if( isDone && ( pResubscribe->completeCallback != NULL ) )
+    {
+        pResubscribe->completeCallback( pResubscribe->pCompleteCallbackContext,
+                                        countFailedFilters( pResubscribe ) );
+    }
+
+    return mqttStatus;
+}
+/*-----------------------------------------------------------*/
+
+static void resubscribeCallback( MQTTAgentCommandContext_t * pCmdCallbackContext,
+                                 MQTTAgentReturnInfo_t * pReturnInfo )
+{
+    AgentResubscribeBatch_t * pBatch = ( AgentResubscribeBatch_t * ) pCmdCallbackContext;
+    AgentResubscribe_t * pResubscribe = NULL;
+    MQTTAgentSubscribeArgs_t * pSubscribeArgs = NULL;
+    size_t first = 0U;
+    size_t index = 0U;
+
+    assert( pBatch != NULL );
+    assert( pReturnInfo != NULL );
+
+    pResubscribe = pBatch->pResubscribe;
+    pSubscribeArgs = &( pBatch->subscribeArgs );
+    first = ( size_t ) ( pSubscribeArgs->pSubscribeInfo - pResubscribe->subscribeInfo );
+
+    assert( pResubscribe->numInFlight > 0U );
+    pResubscribe->numInFlight--;
+
+    if( pReturnInfo->returnCode == MQTTSuccess )
+    {
+        setBatchState( pResubscribe, pBatch, AgentResubscribeFilterAccepted );
+    }
+    else if( pReturnInfo->pSubackCodes == NULL )
+    {
+        /* The packet was not acknowledged, for example because the connection
+         * was lost. The subscriptions are kept for the next resubscribe, and
+         * the packets not queued yet are not sent. */
+        LogError( ( "Resubscribe of %u topic filters failed: %s.",
+                    ( unsigned int ) pSubscribeArgs->numSubscriptions,
+                    MQTT_Status_strerror( pReturnInfo->returnCode ) ) );
+        setBatchState( pResubscribe, pBatch, AgentResubscribeFilterFailed );
+
+        while( pResubscribe->nextBatch < pResubscribe->numBatches )
+        {
+            setBatchState( pResubscribe,
+                           &( pResubscribe->batches[ pResubscribe->nextBatch ] ),
+                           AgentResubscribeFilterFailed );
+            pResubscribe->nextBatch++;
+        }
+
+        pResubscribe->isStopped = true;
+    }
+    else
+    {
+        for( index = 0U; index < pSubscribeArgs->numSubscriptions; index++ )
+        {
+            if( pReturnInfo->pSubackCodes[ index ] == MQTTSubAckFailure )
+            {
+                LogError( ( "Failed to resubscribe to topic %.*s.",
+                            pSubscribeArgs->pSubscribeInfo[ index ].topicFilterLength,
+                            pSubscribeArgs->pSubscribeInfo[ index ].pTopicFilter ) );
+                removeSubscription( pResubscribe->pSubscriptionList,
+                                    pSubscribeArgs->pSubscribeInfo[ index ].pTopicFilter,
+                                    pSubscribeArgs->pSubscribeInfo[ index ].topicFilterLength );
+                pResubscribe->filterStates[ first + index ] = AgentResubscribeFilterRefused;
+            }
+            else
+            {
+                pResubscribe->filterStates[ first + index ] = AgentResubscribeFilterAccepted;
+            }
+        }
+    }
+
+    /* The topic filters a refused one covered are sent in the next round. */
+    ( void ) queueBatches( pResubscribe );
+}
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t AgentResubscribe_Start( AgentResubscribe_t * pResubscribe,
+                                     MQTTAgentContext_t * pAgentContext,
+                                     SubscriptionList_t * pSubscriptionList,
+                                     bool sessionPresent,
+                                     MQTTQoS_t qos,
+                                     size_t maxPacketSize,
+                                     AgentResubscribeCompleteCallback_t completeCallback,
+                                     void * pCompleteCallbackContext )
+{
+    MQTTStatus_t mqttStatus = MQTTSuccess;
+    size_t index = 0U;
+
+    assert( pResubscribe != NULL );
+    assert( pAgentContext != NULL );
+    assert( pSubscriptionList != NULL );
+
+    if( sessionPresent )
+    {
+        LogInfo( ( "The broker kept the session: subscriptions are not sent again." ) );
+    }
+    else
+    {
+        /* Copy the distinct topic filters, as the list may change once
+         * its read completes. */
+        pResubscribe->numFilters = copySubscriptionFilters( pSubscriptionList,
+                                                            pResubscribe->filterBuffer,
+                                                            sizeof( pResubscribe->filterBuffer ),
+                                                            pResubscribe->subscribeInfo,
+                                                            AGENT_RESUBSCRIBE_MAX_FILTERS,
+                                                            &( pResubscribe->numListed ) );
+
+        if( pResubscribe->numListed > pResubscribe->numFilters )
+        {
+            LogError( ( "%u topic filters did not fit in the resubscribe and are not sent.",
+                        ( unsigned int ) ( pResubscribe->numListed - pResubscribe->numFilters ) ) );
+        }
+
+        for( index = 0U; index < pResubscribe->numFilters; index++ )
+        {
+            pResubscribe->filterStates[ index ] = AgentResubscribeFilterCovered;
+        }
+
+        pResubscribe->pAgentContext = pAgentContext;
+        pResubscribe->pSubscriptionList = pSubscriptionList;
+        pResubscribe->qos = qos;
+        pResubscribe->maxPacketSize = maxPacketSize;
+        pResubscribe->completeCallback = completeCallback;
+        pResubscribe->pCompleteCallbackContext = pCompleteCallbackContext;
+        pResubscribe->numSent = 0U;
+        pResubscribe->numBatches = 0U;
+        pResubscribe->nextBatch = 0U;
+        pResubscribe->numInFlight = 0U;
+        pResubscribe->isStopped = false;
+
+        /* Only the topic filters no other one covers are sent, so that a
+         * publish matching several filters is delivered once. The packets
+         * past the first ones are queued as those complete. */
+        mqttStatus = queueBatches( pResubscribe );
+    }
+
+    return mqttStatus;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,549 @@
+/*
+ * AWS IoT Device Embedded C SDK for ZephyrRTOS
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file agent_subscriptions.c
+ * @brief Implementation of the subscriptions shared by the tasks using an
+ * MQTT agent.
+ */
+
+/* Standard includes. */
+#include <assert.h>
+#include <string.h>
+
+#include "agent_subscriptions.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Wait for a command that timed out to complete, as its completion
+ * and topic filters stay in use until then.
+ *
+ * The lock of the shared subscriptions must be held.
+ *
+ * @param[in] pSubscriptions The shared subscriptions.
+ * @param[in] timeoutMs Time to wait for the command.
+ *
+ * @return `true` if no command is pending; `false` otherwise.
+ */
+static bool waitForCommand( AgentSubscriptions_t * pSubscriptions,
+                            uint32_t timeoutMs );
+
+/**
+ * @brief Send a SUBSCRIBE or UNSUBSCRIBE for the topic filters prepared in the
+ * shared subscriptions, and wait for its acknowledgement.
+ *
+ * The lock of the shared subscriptions must be held, and no command pending.
+ *
+ * @param[in] pSubscriptions The shared subscriptions.
+ * @param[in] isSubscribe Send a SUBSCRIBE if `true`, an UNSUBSCRIBE otherwise.
+ * @param[in] numFilters Number of topic filters prepared.
+ * @param[in] timeoutMs Time to wait to queue the command and for its
+ * acknowledgement.
+ *
+ * @return #MQTTSuccess if the command was acknowledged, #MQTTRecvFailed if it
+ * did not complete in time, else the status of the command.
+ */
+static MQTTStatus_t sendCommand( AgentSubscriptions_t * pSubscriptions,
+                                 bool isSubscribe,
+                                 size_t numFilters,
+                                 uint32_t timeoutMs );
+
+/**
+ * @brief Copy the distinct topic filters of the subscription list.
+ *
+ * @param[in] pSubscriptions The shared subscriptions.
+ * @param[out] pNumFilters Number of distinct topic filters of the list.
+ *
+ * @return Number of topic filters copied.
+ */
+static size_t copyFilters( AgentSubscriptions_t * pSubscriptions,
+                           size_t * pNumFilters );
+
+/**
+ * @brief Check whether a copied topic filter other than the given ones covers
+ * a topic filter.
+ *
+ * @param[in] pSubscriptions The shared subscriptions.
+ * @param[in] numFilters Number of topic filters copied.
+ * @param[in] pTopicFilter The topic filter.
+ * @param[in] topicFilterLength Length of the topic filter.
+ * @param[in] pIgnoredFilter A topic filter not to compare with, or NULL.
+ * @param[in] ignoredFilterLength Length of the ignored topic filter.
+ *
+ * @return `true` if another copied topic filter covers the topic filter;
+ * `false` otherwise.
+ */
+static bool isCoveredByOther( const AgentSubscriptions_t * pSubscriptions,
+                              size_t numFilters,
+                              const char * pTopicFilter,
+                              uint16_t topicFilterLength,
+                              const char * pIgnoredFilter,
+                              uint16_t ignoredFilterLength );
+
+/**
+ * @brief Send the broker commands for a topic filter that got its first
+ * subscriber.
+ *
+ * @param[in] pSubscriptions The shared subscriptions, with the topic filter
+ * copied to its `topicFilter`.
+ * @param[in] topicFilterLength Length of the topic filter.
+ * @param[in] timeoutMs Time to wait to queue each command and for its
+ * acknowledgement.
+ *
+ * @return #MQTTSuccess if the broker delivers the publishes of the topic
+ * filter, else the status of the SUBSCRIBE.
+ */
+static MQTTStatus_t subscribeFirst( AgentSubscriptions_t * pSubscriptions,
+                                    uint16_t topicFilterLength,
+                                    uint32_t timeoutMs );
+
+/**
+ * @brief Send the broker commands for a topic filter that lost its last
+ * subscriber.
+ *
+ * @param[in] pSubscriptions The shared subscriptions, with the topic filter
+ * copied to its `topicFilter`.
+ * @param[in] topicFilterLength Length of the topic filter.
+ * @param[in] timeoutMs Time to wait to queue each command and for its
+ * acknowledgement.
+ *
+ * @return #MQTTSuccess if the commands succeeded or none was needed, else the
+ * status of the command that failed.
+ */
+static MQTTStatus_t unsubscribeLast( AgentSubscriptions_t * pSubscriptions,
+                                     uint16_t topicFilterLength,
+                                     uint32_t timeoutMs );
+
+/*-----------------------------------------------------------*/
+
+static bool waitForCommand( AgentSubscriptions_t * pSubscriptions,
+                            uint32_t timeoutMs )
+{
+    if( pSubscriptions->isCommandPending &&
+        AgentCompletion_Wait( &( pSubscriptions->completion ), timeoutMs, NULL ) )
+    {
+        pSubscriptions->isCommandPending = false;
+    }
+
+    if( pSubscriptions->isCommandPending )
+    {
+        LogError( ( "A previous command is still awaiting its acknowledgement." ) );
+    }
+
+    return !pSubscriptions->isCommandPending;
+}
+/*-----------------------------------------------------------*/
+
+static MQTTStatus_t sendCommand( AgentSubscriptions_t * pSubscriptions,
+                                 bool isSubscribe,
+                                 size_t numFilters,
+                                 uint32_t timeoutMs )
+{
+    MQTTStatus_t mqttStatus = MQTTSuccess;
+    MQTTAgentCommandInfo_t commandParams = { 0 };
+    size_t index = 0U;
+
+    for( index = 0U; index < numFilters; index++ )
+    {
+        pSubscriptions->subscribeInfo[ index ].qos = pSubscriptions->qos;
+    }
+
+    pSubscriptions->subscribeArgs.pSubscribeInfo = pSubscriptions->subscribeInfo;
+    pSubscriptions->subscribeArgs.numSubscriptions = numFilters;
+
+    AgentCompletion_Init( &( pSubscriptions->completion ) );
+    AgentCompletion_SetCommandInfo( &( pSubscriptions->completion ), &commandParams );
+    commandParams.blockTimeMs = timeoutMs;
+
+    if( isSubscribe )
+    {
+        mqttStatus = MQTTAgent_Subscribe( pSubscriptions->pAgentContext,
+                                          &( pSubscriptions->subscribeArgs ),
+                                          &commandParams );
+    }
+    else
+    {
+        mqttStatus = MQTTAgent_Unsubscribe( pSubscriptions->pAgentContext,
+                                            &( pSubscriptions->subscribeArgs ),
+                                            &commandParams );
+    }
+
+    if( mqttStatus != MQTTSuccess )
+    {
+        LogError( ( "Failed to enqueue the MQTT %s command. mqttStatus=%s.",
+                    isSubscribe ? "subscribe" : "unsubscribe",
+                    MQTT_Status_strerror( mqttStatus ) ) );
+    }
+    else if( !AgentCompletion_Wait( &( pSubscriptions->completion ), timeoutMs, &mqttStatus ) )
+    {
+        LogError( ( "Timed out waiting for the acknowledgement of %u topic filters, starting with %.*s.",
+                    ( unsigned int ) numFilters,
+                    pSubscriptions->subscribeInfo[ 0 ].topicFilterLength,
+                    pSubscriptions->subscribeInfo[ 0 ].pTopicFilter ) );
+        pSubscriptions->isCommandPending = true;
+        mqttStatus = MQTTRecvFailed;
+    }
+    else if( mqttStatus != MQTTSuccess )
+    {
+        LogError( ( "Failed to %s %u topic filters, starting with %.*s. mqttStatus=%s.",
+                    isSubscribe ? "subscribe to" : "unsubscribe from",
+                    ( unsigned int ) numFilters,
+                    pSubscriptions->subscribeInfo[ 0 ].topicFilterLength,
+                    pSubscriptions->subscribeInfo[ 0 ].pTopicFilter,
+                    MQTT_Status_strerror( mqttStatus ) ) );
+    }
+    else
+    {
+        /* Empty else marker. */
+    }
+
+    return mqttStatus;
+}
+/*-----------------------------------------------------------*/
+
+static size_t copyFilters( AgentSubscriptions_t * pSubscriptions,
+                           size_t * pNumFilters )
+{
+    return copySubscriptionFilters( pSubscriptions->pSubscriptionList,
+                                    pSubscriptions->filterBuffer,
+                                    sizeof( pSubscriptions->filterBuffer ),
+                                    pSubscriptions->filters,
+                                    AGENT_SUBSCRIPTIONS_MAX_FILTERS,
+                                    pNumFilters );
+}
+/*-----------------------------------------------------------*/
+
+static bool isCoveredByOther( const AgentSubscriptions_t * pSubscriptions,
+                              size_t numFilters,
+                              const char * pTopicFilter,
+                              uint16_t topicFilterLength,
+                              const char * pIgnoredFilter,
+                              uint16_t ignoredFilterLength )
+{
+    const MQTTSubscribeInfo_t * pFilter = NULL;
+    size_t index = 0U;
+    bool isCovered = false;
+
+    for( index = 0U; ( index < numFilters ) && !isCovered; index++ )
+    {
+        pFilter = &( pSubscriptions->filters[ index ] );
+
+        /* Skip the topic filter itself and the ignored one. */
+        if( ( ( pFilter->topicFilterLength != topicFilterLength ) ||
+              ( memcmp( pFilter->pTopicFilter, pTopicFilter, topicFilterLength ) != 0 ) ) &&
+            ( ( pIgnoredFilter == NULL ) ||
+              ( pFilter->topicFilterLength != ignoredFilterLength ) ||
+              ( memcmp( pFilter->pTopicFilter, pIgnoredFilter, ignoredFilterLength ) != 0 ) ) )
+        {
+            isCovered = isTopicFilterCovered( pTopicFilter,
+                                              topicFilterLength,
+                                              pFilter->pTopicFilter,
+                                              pFilter->topicFilterLength );
+        }
+    }
+
+    return isCovered;
+}
+/*-----------------------------------------------------------*/
+
+static MQTTStatus_t subscribeFirst( AgentSubscriptions_t * pSubscriptions,
+                                    uint16_t topicFilterLength,
+                                    uint32_t timeoutMs )
+{
+    MQTTStatus_t mqttStatus = MQTTSuccess;
+    const char * pTopicFilter = pSubscriptions->topicFilter;
+    const MQTTSubscribeInfo_t * pFilter = NULL;
+    size_t numFilters = 0U;
+    size_t numListed = 0U;
+    size_t numCovered = 0U;
+    size_t index = 0U;
+
+    /* The list holds the topic filter already. A filter missing from an
+     * incomplete copy only costs a redundant subscription at the broker. */
+    numFilters = copyFilters( pSubscriptions, &numListed );
+
+    if( isCoveredByOther( pSubscriptions, numFilters, pTopicFilter, topicFilterLength, NULL, 0U ) )
+    {
+        LogDebug( ( "Topic filter %.*s is covered by a subscription at the broker.",
+                    topicFilterLength,
+                    pTopicFilter ) );
+    }
+    else
+    {
+        pSubscriptions->subscribeInfo[ 0 ].pTopicFilter = pTopicFilter;
+        pSubscriptions->subscribeInfo[ 0 ].topicFilterLength = topicFilterLength;
+        mqttStatus = sendCommand( pSubscriptions, true, 1U, timeoutMs );
+
+        /* The topic filters it covers, and that no other filter covers, were
+         * subscribed to at the broker until now. */
+        for( index = 0U; ( mqttStatus == MQTTSuccess ) && ( index < numFilters ); index++ )
+        {
+            pFilter = &( pSubscriptions->filters[ index ] );
+
+            if( ( ( pFilter->topicFilterLength != topicFilterLength ) ||
+                  ( memcmp( pFilter->pTopicFilter, pTopicFilter, topicFilterLength ) != 0 ) ) &&
+                isTopicFilterCovered( pFilter->pTopicFilter,
+                                      pFilter->topicFilterLength,
+                                      pTopicFilter,
+                                      topicFilterLength ) &&
+                !isCoveredByOther( pSubscriptions,
+                                   numFilters,
+                                   pFilter->pTopicFilter,
+                                   pFilter->topicFilterLength,
+                                   pTopicFilter,
+                                   topicFilterLength ) )
+            {
+                pSubscriptions->subscribeInfo[ numCovered ] = *pFilter;
+                numCovered++;
+            }
+        }
+
+        /* The topic filter is subscribed to whatever the outcome, which only
+         * leaves the covered filters delivered twice if it fails. */
+        if( numCovered > 0U )
+        {
+            ( void ) sendCommand( pSubscriptions, false, numCovered, timeoutMs );
+        }
+    }
+
+    return mqttStatus;
+}
+/*-----------------------------------------------------------*/
+
+static MQTTStatus_t unsubscribeLast( AgentSubscriptions_t * pSubscriptions,
+                                     uint16_t topicFilterLength,
+                                     uint32_t timeoutMs )
+{
+    MQTTStatus_t mqttStatus = MQTTSuccess;
+    const char * pTopicFilter = pSubscriptions->topicFilter;
+    const MQTTSubscribeInfo_t * pFilter = NULL;
+    size_t numFilters = 0U;
+    size_t numListed = 0U;
+    size_t numExposed = 0U;
+    size_t index = 0U;
+
+    /* The list no longer holds the topic filter. */
+    numFilters = copyFilters( pSubscriptions, &numListed );
+
+    if( numListed > numFilters )
+    {
+        /* A filter it covers may be missing from the copy, and would no
+         * longer be delivered. */
+        LogWarn( ( "Topic filter %.*s is kept at the broker, as only %u of %u topic filters could be compared.",
+                   topicFilterLength,
+                   pTopicFilter,
+                   ( unsigned int ) numFilters,
+                   ( unsigned int ) numListed ) );
+    }
+    else if( isCoveredByOther( pSubscriptions, numFilters, pTopicFilter, topicFilterLength, NULL, 0U ) )
+    {
+        LogDebug( ( "Topic filter %.*s was covered by a subscription at the broker.",
+                    topicFilterLength,
+                    pTopicFilter ) );
+    }
+    else
+    {
+        /* Subscribe to the topic filters it covered, and that no other
+         * filter covers, before they stop being delivered. */
+        for( index = 0U; index < numFilters; index++ )
+        {
+            pFilter = &( pSubscriptions->filters[ index ] );
+
+            if( isTopicFilterCovered( pFilter->pTopicFilter,
+                                      pFilter->topicFilterLength,
+                                      pTopicFilter,
+                                      topicFilterLength ) &&
+                !isCoveredByOther( pSubscriptions,
+                                   numFilters,
+                                   pFilter->pTopicFilter,
+                                   pFilter->topicFilterLength,
+                                   NULL,
+                                   0U ) )
+            {
+                pSubscriptions->subscribeInfo[ numExposed ] = *pFilter;
+                numExposed++;
+            }
+        }
+
+        if( numExposed > 0U )
+        {
+            mqttStatus = sendCommand( pSubscriptions, true, numExposed, timeoutMs );
+        }
+
+        if( mqttStatus == MQTTSuccess )
+        {
+            pSubscriptions->subscribeInfo[ 0 ].pTopicFilter = pTopicFilter;
+            pSubscriptions->subscribeInfo[ 0 ].topicFilterLength = topicFilterLength;
+            mqttStatus = sendCommand( pSubscriptions, false, 1U, timeoutMs );
+        }
+    }
+
+    return mqttStatus;
+}
+/*-----------------------------------------------------------*/
+
+void AgentSubscriptions_Init( AgentSubscriptions_t * pSubscriptions,
+                              MQTTAgentContext_t * pAgentContext,
+                              SubscriptionList_t * pSubscriptionList,
+                              MQTTQoS_t qos )
+{
+    assert( pSubscriptions != NULL );
+    assert( pAgentContext != NULL );
+    assert( pSubscriptionList != NULL );
+
+    memset( pSubscriptions, 0x00, sizeof( AgentSubscriptions_t ) );
+    pSubscriptions->pAgentContext = pAgentContext;
+    pSubscriptions->pSubscriptionList = pSubscriptionList;
+    pSubscriptions->qos = qos;
+    ( void ) k_mutex_init( &( pSubscriptions->lock ) );
+}
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t AgentSubscriptions_Subscribe( AgentSubscriptions_t * pSubscriptions,
+                                           const char * pTopicFilter,
+                                           uint16_t topicFilterLength,
+                                           IncomingPubCallback_t incomingPublishCallback,
+                                           void * pIncomingPublishCallbackContext,
+                                           uint32_t timeoutMs )
+{
+    MQTTStatus_t mqttStatus = MQTTSuccess;
+    bool isFirst = false;
+    bool isLast = false;
+
+    assert( pSubscriptions != NULL );
+
+    if( ( pTopicFilter == NULL ) ||
+        ( topicFilterLength == 0U ) ||
+        ( topicFilterLength > AGENT_SUBSCRIPTIONS_MAX_FILTER_LENGTH ) )
+    {
+        LogError( ( "Invalid parameter. pTopicFilter=%p, topicFilterLength=%u.",
+                    pTopicFilter,
+                    ( unsigned int ) topicFilterLength ) );
+        mqttStatus = MQTTBadParameter;
+    }
+    else
+    {
+        ( void ) k_mutex_lock( &( pSubscriptions->lock ), K_FOREVER );
+
+        if( !waitForCommand( pSubscriptions, timeoutMs ) )
+        {
+            mqttStatus = MQTTRecvFailed;
+        }
+        else if( !acquireSubscription( pSubscriptions->pSubscriptionList,
+                                       pTopicFilter,
+                                       topicFilterLength,
+                                       incomingPublishCallback,
+                                       pIncomingPublishCallbackContext,
+                                       &isFirst ) )
+        {
+            mqttStatus = MQTTNoMemory;
+        }
+        else if( isFirst )
+        {
+            /* Copied, as the commands may outlive the caller's topic filter
+             * if their acknowledgement times out. */
+            memcpy( pSubscriptions->topicFilter, pTopicFilter, topicFilterLength );
+            mqttStatus = subscribeFirst( pSubscriptions, topicFilterLength, timeoutMs );
+
+            if( mqttStatus != MQTTSuccess )
+            {
+                ( void ) releaseSubscription( pSubscriptions->pSubscriptionList,
+                                              pTopicFilter,
+                                              topicFilterLength,
+                                              incomingPublishCallback,
+                                              pIncomingPublishCallbackContext,
+                                              &isLast );
+            }
+        }
+        else
+        {
+            LogDebug( ( "Topic filter %.*s is already subscribed to.",
+                        topicFilterLength,
+                        pTopicFilter ) );
+        }
+
+        ( void ) k_mutex_unlock( &( pSubscriptions->lock ) );
+    }
+
+    return mqttStatus;
+}
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t AgentSubscriptions_Unsubscribe( AgentSubscriptions_t * pSubscriptions,
+                                             const char * pTopicFilter,
+                                             uint16_t topicFilterLength,
+                                             IncomingPubCallback_t incomingPublishCallback,
+                                             void * pIncomingPublishCallbackContext,
+                                             uint32_t timeoutMs )
+{
+    MQTTStatus_t mqttStatus = MQTTSuccess;
+    bool isLast = false;
+
+    assert( pSubscriptions != NULL );
+
+    if( ( pTopicFilter == NULL ) ||
+        ( topicFilterLength == 0U ) ||
+        ( topicFilterLength > AGENT_SUBSCRIPTIONS_MAX_FILTER_LENGTH ) )
+    {
+        LogError( ( "Invalid parameter. pTopicFilter=%p, topicFilterLength=%u.",
+                    pTopicFilter,
+                    ( unsigned int ) topicFilterLength ) );
+        mqttStatus = MQTTBadParameter;
+    }
+    else
+    {
+        ( void ) k_mutex_lock( &( pSubscriptions->lock ), K_FOREVER );
+
+        if( !waitForCommand( pSubscriptions, timeoutMs ) )
+        {
+            mqttStatus = MQTTRecvFailed;
+        }
+        else if( !releaseSubscription( pSubscriptions->pSubscriptionList,
+                                       pTopicFilter,
+                                       topicFilterLength,
+                                       incomingPublishCallback,
+                                       pIncomingPublishCallbackContext,
+                                       &isLast ) )
+        {
+            LogWarn( ( "Topic filter %.*s was not subscribed to.",
+                       topicFilterLength,
+                       pTopicFilter ) );
+        }
+        else if( isLast )
+        {
+            memcpy( pSubscriptions->topicFilter, pTopicFilter, topicFilterLength );
+            mqttStatus = unsubscribeLast( pSubscriptions, topicFilterLength, timeoutMs );
+        }
+        else
+        {
+            LogDebug( ( "Topic filter %.*s is still subscribed to by other tasks.",
+                        topicFilterLength,
+                        pTopicFilter ) );
+        }
+
+        ( void ) k_mutex_unlock( &( pSubscriptions->lock ) );
+    }
+
+    return mqttStatus;
+}
+/*-----------------------------------------------------------*/
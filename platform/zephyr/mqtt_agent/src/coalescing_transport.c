@@ -0,0 +1,277 @@
+/*
+ * AWS IoT Device Embedded C SDK for ZephyrRTOS
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file coalescing_transport.c
+ * @brief Implementation of the transport wrapper that coalesces the packets
+ * written by the MQTT agent.
+ */
+
+/* Standard includes. */
+#include <assert.h>
+#include <string.h>
+
+/* Kernel Header */
+#include <zephyr.h>
+
+#include "coalescing_transport.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Each compilation unit that consumes the NetworkContext must define it.
+ */
+struct NetworkContext
+{
+    CoalescingTransport_t * pParams;
+};
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Write bytes to the underlying transport until all are written, an
+ * error occurs, or #COALESCING_TRANSPORT_FLUSH_TIMEOUT_MS elapses without
+ * progress.
+ *
+ * @param[in] pCoalescingTransport The transport.
+ * @param[in] pBuffer The bytes to write.
+ * @param[in] bytesToSend Number of bytes to write.
+ *
+ * @return `true` if every byte was written, else `false`.
+ */
+static bool sendAll( CoalescingTransport_t * pCoalescingTransport,
+                     const uint8_t * pBuffer,
+                     size_t bytesToSend );
+
+/*-----------------------------------------------------------*/
+
+static bool sendAll( CoalescingTransport_t * pCoalescingTransport,
+                     const uint8_t * pBuffer,
+                     size_t bytesToSend )
+{
+    size_t bytesSent = 0U;
+    int32_t sendResult = 0;
+    uint32_t lastProgressTimeMs = k_uptime_get_32();
+
+    while( ( bytesSent < bytesToSend ) && ( sendResult >= 0 ) )
+    {
+        sendResult = pCoalescingTransport->transport.send( pCoalescingTransport->transport.pNetworkContext,
+                                                           &pBuffer[ bytesSent ],
+                                                           bytesToSend - bytesSent );
+
+        if( sendResult > 0 )
+        {
+            bytesSent += ( size_t ) sendResult;
+            lastProgressTimeMs = k_uptime_get_32();
+        }
+        else if( sendResult == 0 )
+        {
+            if( ( k_uptime_get_32() - lastProgressTimeMs ) >= COALESCING_TRANSPORT_FLUSH_TIMEOUT_MS )
+            {
+                LogError( ( "Timed out writing %u coalesced bytes.", ( unsigned int ) ( bytesToSend - bytesSent ) ) );
+                sendResult = -1;
+            }
+            else
+            {
+                k_yield();
+            }
+        }
+        else
+        {
+            LogError( ( "Failed to write coalesced bytes: Error=%d.", ( int ) sendResult ) );
+        }
+    }
+
+    return bytesSent == bytesToSend;
+}
+/*-----------------------------------------------------------*/
+
+bool CoalescingTransport_Init( CoalescingTransport_t * pCoalescingTransport,
+                               const TransportInterface_t * pTransport,
+                               uint8_t * pBuffer,
+                               size_t bufferSize )
+{
+    bool ret = false;
+
+    if( ( pCoalescingTransport == NULL ) || ( pTransport == NULL ) ||
+        ( pTransport->send == NULL ) || ( pTransport->recv == NULL ) ||
+        ( pBuffer == NULL ) || ( bufferSize == 0U ) )
+    {
+        LogError( ( "Invalid coalescing transport parameters." ) );
+    }
+    else
+    {
+        pCoalescingTransport->transport = *pTransport;
+        pCoalescingTransport->pBuffer = pBuffer;
+        pCoalescingTransport->bufferSize = bufferSize;
+        CoalescingTransport_Reset( pCoalescingTransport );
+        ret = true;
+    }
+
+    return ret;
+}
+/*-----------------------------------------------------------*/
+
+void CoalescingTransport_Reset( CoalescingTransport_t * pCoalescingTransport )
+{
+    assert( pCoalescingTransport != NULL );
+
+    pCoalescingTransport->bufferedBytes = 0U;
+    pCoalescingTransport->corked = false;
+    pCoalescingTransport->failed = false;
+}
+/*-----------------------------------------------------------*/
+
+void CoalescingTransport_Cork( CoalescingTransport_t * pCoalescingTransport )
+{
+    assert( pCoalescingTransport != NULL );
+
+    pCoalescingTransport->corked = true;
+}
+/*-----------------------------------------------------------*/
+
+bool CoalescingTransport_Flush( CoalescingTransport_t * pCoalescingTransport )
+{
+    assert( pCoalescingTransport != NULL );
+
+    pCoalescingTransport->corked = false;
+
+    if( ( pCoalescingTransport->bufferedBytes > 0U ) && !pCoalescingTransport->failed )
+    {
+        pCoalescingTransport->failed = !sendAll( pCoalescingTransport,
+                                                 pCoalescingTransport->pBuffer,
+                                                 pCoalescingTransport->bufferedBytes );
+    }
+
+    pCoalescingTransport->bufferedBytes = 0U;
+
+    return !pCoalescingTransport->failed;
+}
+/*-----------------------------------------------------------*/
+
+void CoalescingTransport_AgentReceiveHook( void * pHookContext,
+                                           const MQTTAgentCommand_t * pCommand )
+{
+    CoalescingTransport_t * pCoalescingTransport = ( CoalescingTransport_t * ) pHookContext;
+
+    assert( pCoalescingTransport != NULL );
+
+    if( pCommand == NULL )
+    {
+        /* The agent is idle: nothing more will be coalesced. */
+        ( void ) CoalescingTransport_Flush( pCoalescingTransport );
+    }
+    else
+    {
+        switch( pCommand->commandType )
+        {
+            case PUBLISH:
+            case SUBSCRIBE:
+            case UNSUBSCRIBE:
+            case PING:
+            case PROCESSLOOP:
+                /* These commands only write packets; their responses are
+                 * processed later by the agent. */
+                CoalescingTransport_Cork( pCoalescingTransport );
+                break;
+
+            default:
+                /* Commands such as CONNECT wait for a response to what was
+                 * written, so nothing may be held back. */
+                ( void ) CoalescingTransport_Flush( pCoalescingTransport );
+                break;
+        }
+    }
+}
+/*-----------------------------------------------------------*/
+
+int32_t CoalescingTransport_Send( NetworkContext_t * pNetworkContext,
+                                  const void * pBuffer,
+                                  size_t bytesToSend )
+{
+    CoalescingTransport_t * pCoalescingTransport = NULL;
+    int32_t bytesSent = -1;
+
+    assert( pNetworkContext != NULL && pNetworkContext->pParams != NULL );
+    assert( pBuffer != NULL );
+
+    pCoalescingTransport = pNetworkContext->pParams;
+
+    if( pCoalescingTransport->failed )
+    {
+        /* Report the loss of coalesced bytes to the MQTT library. */
+        bytesSent = -1;
+    }
+    else if( !pCoalescingTransport->corked )
+    {
+        bytesSent = pCoalescingTransport->transport.send( pCoalescingTransport->transport.pNetworkContext,
+                                                          pBuffer,
+                                                          bytesToSend );
+    }
+    else
+    {
+        if( bytesToSend > ( pCoalescingTransport->bufferSize - pCoalescingTransport->bufferedBytes ) )
+        {
+            /* Make room by writing the bytes already coalesced. */
+            pCoalescingTransport->failed = !sendAll( pCoalescingTransport,
+                                                     pCoalescingTransport->pBuffer,
+                                                     pCoalescingTransport->bufferedBytes );
+            pCoalescingTransport->bufferedBytes = 0U;
+        }
+
+        if( pCoalescingTransport->failed )
+        {
+            bytesSent = -1;
+        }
+        else if( bytesToSend > pCoalescingTransport->bufferSize )
+        {
+            /* Too large to be coalesced. */
+            pCoalescingTransport->failed = !sendAll( pCoalescingTransport, pBuffer, bytesToSend );
+            bytesSent = pCoalescingTransport->failed ? -1 : ( int32_t ) bytesToSend;
+        }
+        else
+        {
+            memcpy( &pCoalescingTransport->pBuffer[ pCoalescingTransport->bufferedBytes ], pBuffer, bytesToSend );
+            pCoalescingTransport->bufferedBytes += bytesToSend;
+            bytesSent = ( int32_t ) bytesToSend;
+        }
+    }
+
+    return bytesSent;
+}
+/*-----------------------------------------------------------*/
+
+int32_t CoalescingTransport_Recv( NetworkContext_t * pNetworkContext,
+                                  void * pBuffer,
+                                  size_t bytesToRecv )
+{
+    CoalescingTransport_t * pCoalescingTransport = NULL;
+
+    assert( pNetworkContext != NULL && pNetworkContext->pParams != NULL );
+
+    pCoalescingTransport = pNetworkContext->pParams;
+
+    return pCoalescingTransport->transport.recv( pCoalescingTransport->transport.pNetworkContext,
+                                                 pBuffer,
+                                                 bytesToRecv );
+}
+/*-----------------------------------------------------------*/
@@ -27,67 +27,1548 @@
 
 /* Standard includes. */
 #include <string.h>
+#include <assert.h>
 
 /* Subscription manager header include. */
 #include "subscription_manager.h"
 
 /*-----------------------------------------------------------*/
 
-bool addSubscription( SubscriptionElement_t * pSubscriptionList,
+/**
+ * @brief Block of the root of the trie of the topic filters with wildcards,
+ * which is never a child or an element, so it also marks the absence of a
+ * node or an element.
+ */
+#define ROOT_NODE                ( 0U )
+#define NO_NODE                  ( 0U )
+#define NO_ELEMENT               ( 0U )
+
+/**
+ * @brief Number of blocks taken by an object.
+ */
+#define BLOCKS_FOR( size )       SUBSCRIPTION_MANAGER_BLOCKS_FOR( size )
+
+/**
+ * @brief Number of blocks of an element.
+ */
+#define ELEMENT_BLOCKS           BLOCKS_FOR( sizeof( SubscriptionElement_t ) )
+
+/**
+ * @brief Number of blocks of a node, followed by a level of a given length.
+ */
+#define NODE_BLOCKS( length )    BLOCKS_FOR( sizeof( SubscriptionTrieNode_t ) + ( size_t ) ( length ) )
+
+/**
+ * @brief Blocks are indexed with 16 bits.
+ */
+#define MAX_BLOCKS               ( 0xFFFFU )
+
+/**
+ * @brief Number of bits of a word of the bitmap of the blocks in use.
+ */
+#define BITS_PER_WORD            ( 32U )
+
+/**
+ * @brief Offset basis and prime of the 32-bit FNV-1a hash.
+ */
+#define FNV_OFFSET_BASIS         ( 2166136261U )
+#define FNV_PRIME                ( 16777619U )
+
+/**
+ * @brief Maximum number of branches of the trie pending while matching a
+ * topic: at most one sibling per level, plus the `+` and literal children of
+ * the deepest level.
+ */
+#define MATCH_STACK_SIZE         ( 2U * ( SUBSCRIPTION_MANAGER_MAX_TOPIC_LEVELS + 1U ) )
+
+/**
+ * @brief The levels of a topic name or filter, split once so that each level is
+ * hashed a single time.
+ */
+typedef struct TopicLevels
+{
+    uint32_t topicHash;                                             /**< @brief Hash of the whole topic. */
+    size_t numLevels;                                               /**< @brief Number of levels, including those not kept. */
+    uint16_t levelStart[ SUBSCRIPTION_MANAGER_MAX_TOPIC_LEVELS ];   /**< @brief Start of the first levels. */
+    uint16_t levelLength[ SUBSCRIPTION_MANAGER_MAX_TOPIC_LEVELS ];  /**< @brief Length of the first levels. */
+    uint32_t levelHash[ SUBSCRIPTION_MANAGER_MAX_TOPIC_LEVELS ];    /**< @brief Hash of the first levels. */
+} TopicLevels_t;
+
+/**
+ * @brief A branch of the trie to match against the rest of a topic.
+ */
+typedef struct MatchBranch
+{
+    uint16_t node;  /**< @brief The last node matched. */
+    uint16_t level; /**< @brief Index of the next level of the topic, the number of levels once every level matched. */
+} MatchBranch_t;
+
+/**
+ * @brief Copies of the subscriptions matching a publish, whose callbacks are
+ * invoked once the list is known to be consistent.
+ */
+typedef struct MatchCollector
+{
+    SubscriptionElement_t matches[ SUBSCRIPTION_MANAGER_MAX_MATCHES ]; /**< @brief The copies. */
+    size_t numMatches;                                                 /**< @brief Number of copies. */
+    size_t numMissed;                                                  /**< @brief Matches left out for lack of room. */
+} MatchCollector_t;
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Start changing a subscription list, making the sequence count odd.
+ *
+ * @param[in] pSubscriptionList The subscription list.
+ */
+static void beginWrite( SubscriptionList_t * pSubscriptionList );
+
+/**
+ * @brief Finish changing a subscription list, making the sequence count even.
+ *
+ * @param[in] pSubscriptionList The subscription list.
+ */
+static void endWrite( SubscriptionList_t * pSubscriptionList );
+
+/**
+ * @brief Start reading a subscription list, once no write is in progress.
+ *
+ * @param[in] pSubscriptionList The subscription list.
+ *
+ * @return The sequence count, which is even.
+ */
+static uint32_t beginRead( const SubscriptionList_t * pSubscriptionList );
+
+/**
+ * @brief Check that a subscription list did not change since a sequence count
+ * was read, so that what was read since is consistent.
+ *
+ * @param[in] pSubscriptionList The subscription list.
+ * @param[in] sequence The sequence count.
+ *
+ * @return `true` if the list did not change; `false` otherwise.
+ */
+static bool isReadConsistent( const SubscriptionList_t * pSubscriptionList,
+                              uint32_t sequence );
+
+/**
+ * @brief Check whether a subscription list changed while it was read.
+ *
+ * @param[in] pSubscriptionList The subscription list.
+ * @param[in,out] pSequence The sequence count from #beginRead, updated for the
+ * next read if the list changed.
+ *
+ * @return `true` if the list changed and must be read again; `false` otherwise.
+ */
+static bool retryRead( const SubscriptionList_t * pSubscriptionList,
+                       uint32_t * pSequence );
+
+/**
+ * @brief Take free consecutive blocks, the first that fit.
+ *
+ * @param[in] pSubscriptionList The subscription list.
+ * @param[in] numBlocks Number of blocks.
+ *
+ * @return The first block, or #NO_NODE if no blocks fit.
+ */
+static uint16_t allocateBlocks( SubscriptionList_t * pSubscriptionList,
+                                size_t numBlocks );
+
+/**
+ * @brief Give back consecutive blocks.
+ *
+ * @param[in] pSubscriptionList The subscription list.
+ * @param[in] firstBlock The first block.
+ * @param[in] numBlocks Number of blocks.
+ */
+static void freeBlocks( SubscriptionList_t * pSubscriptionList,
+                        uint16_t firstBlock,
+                        size_t numBlocks );
+
+/**
+ * @brief Get a node from its block.
+ *
+ * @param[in] pSubscriptionList The subscription list.
+ * @param[in] block The block, which may be read while the list changes.
+ *
+ * @return The node, or NULL if it would not lie within the blocks.
+ */
+static SubscriptionTrieNode_t * getNode( const SubscriptionList_t * pSubscriptionList,
+                                         uint16_t block );
+
+/**
+ * @brief Get an element from its block.
+ *
+ * @param[in] pSubscriptionList The subscription list.
+ * @param[in] block The block, which may be read while the list changes.
+ *
+ * @return The element, or NULL if it would not lie within the blocks.
+ */
+static SubscriptionElement_t * getElement( const SubscriptionList_t * pSubscriptionList,
+                                           uint16_t block );
+
+/**
+ * @brief Get the text of the level of a node, which follows the node.
+ *
+ * @param[in] pNode The node.
+ *
+ * @return The text.
+ */
+static char * getLevelText( const SubscriptionTrieNode_t * pNode );
+
+/**
+ * @brief Get the end of a topic level.
+ *
+ * @param[in] pString The topic name or filter.
+ * @param[in] length Length of the topic name or filter.
+ * @param[in] levelStart Start of the level.
+ *
+ * @return Index of the `/` ending the level, or @p length for the last level.
+ */
+static uint16_t getLevelEnd( const char * pString,
+                             uint16_t length,
+                             uint16_t levelStart );
+
+/**
+ * @brief Split a topic name or filter in levels and hash them.
+ *
+ * @param[in] pString The topic name or filter.
+ * @param[in] length Its length.
+ * @param[out] pLevels The levels.
+ */
+static void splitLevels( const char * pString,
+                         uint16_t length,
+                         TopicLevels_t * pLevels );
+
+/**
+ * @brief Validate a topic filter.
+ *
+ * @param[in] pTopicFilter The topic filter.
+ * @param[in] topicFilterLength Length of the topic filter.
+ *
+ * @return `true` if wildcards only span whole levels, `#` is last, and the
+ * filter has at most #SUBSCRIPTION_MANAGER_MAX_TOPIC_LEVELS levels; `false`
+ * otherwise.
+ */
+static bool isValidFilter( const char * pTopicFilter,
+                           uint16_t topicFilterLength );
+
+/**
+ * @brief Check if a topic filter has wildcards.
+ *
+ * @param[in] pTopicFilter The topic filter.
+ * @param[in] topicFilterLength Length of the topic filter.
+ *
+ * @return `true` if the filter contains `+` or `#`; `false` otherwise.
+ */
+static bool hasWildcard( const char * pTopicFilter,
+                         uint16_t topicFilterLength );
+
+/**
+ * @brief Check whether the levels of the path from the root of the trie of the
+ * topic filters without wildcards to a node are those of a topic.
+ *
+ * @param[in] pSubscriptionList The subscription list.
+ * @param[in] node The node.
+ * @param[in] pTopic The topic name or filter.
+ * @param[in] pLevels The levels of the topic.
+ * @param[in] sequence The sequence count the list is read under, checked
+ * before comparing the levels.
+ *
+ * @return `true` if the path spells the topic; `false` otherwise.
+ */
+static bool isExactPath( const SubscriptionList_t * pSubscriptionList,
+                         uint16_t node,
+                         const char * pTopic,
+                         const TopicLevels_t * pLevels,
+                         uint32_t sequence );
+
+/**
+ * @brief Find the node where a topic filter without wildcards ends, from the
+ * hash table.
+ *
+ * @param[in] pSubscriptionList The subscription list.
+ * @param[in] pTopic The topic filter, or a topic name.
+ * @param[in] pLevels The levels of the topic.
+ * @param[in] sequence The sequence count the list is read under.
+ *
+ * @return The node, or #NO_NODE if no subscription has the filter.
+ */
+static uint16_t findExactNode( const SubscriptionList_t * pSubscriptionList,
+                               const char * pTopic,
+                               const TopicLevels_t * pLevels,
+                               uint32_t sequence );
+
+/**
+ * @brief Find the node where a topic filter ends, from the trie or the hash
+ * table.
+ *
+ * @param[in] pSubscriptionList The subscription list.
+ * @param[in] pTopicFilter The topic filter.
+ * @param[in] pLevels The levels of the topic filter.
+ * @param[in] isWildcard Whether the topic filter has wildcards.
+ * @param[in] sequence The sequence count the list is read under.
+ *
+ * @return The node, or #NO_NODE if no subscription has the filter.
+ */
+static uint16_t findSubscriptionNode( const SubscriptionList_t * pSubscriptionList,
+                                      const char * pTopicFilter,
+                                      const TopicLevels_t * pLevels,
+                                      bool isWildcard,
+                                      uint32_t sequence );
+
+/**
+ * @brief Add a node ending a topic filter without wildcards to the hash table.
+ *
+ * @param[in] pSubscriptionList The subscription list.
+ * @param[in] node The node.
+ * @param[in] filterHash Hash of the topic filter.
+ */
+static void linkExactNode( SubscriptionList_t * pSubscriptionList,
+                           uint16_t node,
+                           uint32_t filterHash );
+
+/**
+ * @brief Remove a node ending a topic filter without wildcards from the hash
+ * table.
+ *
+ * @param[in] pSubscriptionList The subscription list.
+ * @param[in] node The node.
+ */
+static void unlinkExactNode( SubscriptionList_t * pSubscriptionList,
+                             uint16_t node );
+
+/**
+ * @brief Free the elements of a list of elements with the same topic filter.
+ *
+ * @param[in] pSubscriptionList The subscription list.
+ * @param[in,out] pFirstElement Head of the list, emptied.
+ *
+ * @return Number of elements freed.
+ */
+static uint16_t clearElements( SubscriptionList_t * pSubscriptionList,
+                               uint16_t * pFirstElement );
+
+/**
+ * @brief Find the child of a node with a given level.
+ *
+ * @param[in] pSubscriptionList The subscription list.
+ * @param[in] parent The node.
+ * @param[in] pLevel The level.
+ * @param[in] levelLength Length of the level.
+ * @param[in] levelHash Hash of the level.
+ *
+ * @return The child, or #NO_NODE.
+ */
+static uint16_t findChild( const SubscriptionList_t * pSubscriptionList,
+                           uint16_t parent,
+                           const char * pLevel,
+                           uint16_t levelLength,
+                           uint32_t levelHash );
+
+/**
+ * @brief Find the node where a topic filter ends in a trie.
+ *
+ * @param[in] pSubscriptionList The subscription list.
+ * @param[in] root Root of the trie.
+ * @param[in] pTopicFilter The topic filter, whose wildcards are compared as
+ * text.
+ * @param[in] pLevels The levels of the topic filter.
+ *
+ * @return The node, or #NO_NODE if no subscription has the filter.
+ */
+static uint16_t findFilterNode( const SubscriptionList_t * pSubscriptionList,
+                                uint16_t root,
+                                const char * pTopicFilter,
+                                const TopicLevels_t * pLevels );
+
+/**
+ * @brief Add the levels of a topic filter to a trie, for one more element,
+ * copying the levels missing from the trie.
+ *
+ * @param[in] pSubscriptionList The subscription list.
+ * @param[in] root Root of the trie.
+ * @param[in] pTopicFilter The topic filter, which must be valid.
+ * @param[in] pLevels The levels of the topic filter.
+ *
+ * @return The node where the filter ends, or #NO_NODE if there are not enough
+ * free blocks.
+ */
+static uint16_t insertFilter( SubscriptionList_t * pSubscriptionList,
+                              uint16_t root,
+                              const char * pTopicFilter,
+                              const TopicLevels_t * pLevels );
+
+/**
+ * @brief Release the levels of a topic filter, for elements that were removed,
+ * freeing the nodes no longer used.
+ *
+ * @param[in] pSubscriptionList The subscription list.
+ * @param[in] node The node where the filter ends.
+ * @param[in] numElements Number of elements removed.
+ */
+static void releaseFilter( SubscriptionList_t * pSubscriptionList,
+                           uint16_t node,
+                           uint16_t numElements );
+
+/**
+ * @brief Get the node following a node of a trie, visiting the trie depth
+ * first.
+ *
+ * @param[in] pSubscriptionList The subscription list.
+ * @param[in] node The node.
+ * @param[in] root Root of the trie.
+ *
+ * @return The next node, or #NO_NODE once every node was visited.
+ */
+static uint16_t getNextNode( const SubscriptionList_t * pSubscriptionList,
+                             uint16_t node,
+                             uint16_t root );
+
+/**
+ * @brief Write the topic filter ending at a node.
+ *
+ * @param[in] pSubscriptionList The subscription list.
+ * @param[in] node The node.
+ * @param[in] root Root of the trie of the node.
+ * @param[in] sequence The sequence count the list is read under, checked
+ * before copying the levels.
+ * @param[out] pBuffer Buffer the filter is written to.
+ * @param[in] bufferSize Size of @p pBuffer.
+ *
+ * @return Length of the filter, or 0 if it does not fit.
+ */
+static size_t writeFilter( const SubscriptionList_t * pSubscriptionList,
+                           uint16_t node,
+                           uint16_t root,
+                           uint32_t sequence,
+                           char * pBuffer,
+                           size_t bufferSize );
+
+/**
+ * @brief Copy the elements of a list of elements with the same topic filter.
+ *
+ * A context-callback pair already copied for another topic filter is not
+ * copied again, so that it gets one copy of a publish matching several of its
+ * filters. The list may be read while it changes, so the number of elements
+ * followed is bounded.
+ *
+ * @param[in] pSubscriptionList The subscription list.
+ * @param[in] firstElement Head of the list.
+ * @param[in,out] pCollector The copies.
+ *
+ * @return `true` if the list is not empty; `false` otherwise.
+ */
+static bool collectElements( const SubscriptionList_t * pSubscriptionList,
+                             uint16_t firstElement,
+                             MatchCollector_t * pCollector );
+
+/**
+ * @brief Copy the subscriptions matching a topic.
+ *
+ * The list may be read while it changes: what is copied is only meaningful if
+ * the sequence count is unchanged afterwards. Levels are only compared while it
+ * is unchanged, and every walk of the list is bounded.
+ *
+ * @param[in] pSubscriptionList The subscription list.
+ * @param[in] pTopic The topic name.
+ * @param[in] pLevels The levels of the topic name.
+ * @param[in] sequence The sequence count the list is read under.
+ * @param[out] pCollector The copies.
+ *
+ * @return `true` if a subscription matched; `false` otherwise.
+ */
+static bool collectMatches( const SubscriptionList_t * pSubscriptionList,
+                            const char * pTopic,
+                            const TopicLevels_t * pLevels,
+                            uint32_t sequence,
+                            MatchCollector_t * pCollector );
+
+/**
+ * @brief Match callback of #handleIncomingPublishes, which invokes the callback
+ * of the subscription.
+ *
+ * @param[in] pMatchContext The publish.
+ * @param[in] pSubscription The subscription.
+ */
+static void invokeSubscription( void * pMatchContext,
+                                const SubscriptionElement_t * pSubscription );
+
+/*-----------------------------------------------------------*/
+
+static void beginWrite( SubscriptionList_t * pSubscriptionList )
+{
+    ( void ) k_mutex_lock( &( pSubscriptionList->writeLock ), K_FOREVER );
+
+    ( void ) atomic_inc( &( pSubscriptionList->sequence ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static void endWrite( SubscriptionList_t * pSubscriptionList )
+{
+    ( void ) atomic_inc( &( pSubscriptionList->sequence ) );
+
+    ( void ) k_mutex_unlock( &( pSubscriptionList->writeLock ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static uint32_t beginRead( const SubscriptionList_t * pSubscriptionList )
+{
+    uint32_t sequence = ( uint32_t ) atomic_get( &( pSubscriptionList->sequence ) );
+
+    /* The count is odd while a writer changes the list. The writer may have
+     * been preempted by this reader, so rather than spin, sleep a tick, which
+     * lets it run whatever its priority. */
+    while( ( sequence & 1U ) != 0U )
+    {
+        ( void ) k_sleep( K_TICKS( 1 ) );
+        sequence = ( uint32_t ) atomic_get( &( pSubscriptionList->sequence ) );
+    }
+
+    return sequence;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool isReadConsistent( const SubscriptionList_t * pSubscriptionList,
+                              uint32_t sequence )
+{
+    /* Order the reads of the list before the read of the count. */
+    __atomic_thread_fence( __ATOMIC_ACQUIRE );
+
+    return ( uint32_t ) atomic_get( &( pSubscriptionList->sequence ) ) == sequence;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool retryRead( const SubscriptionList_t * pSubscriptionList,
+                       uint32_t * pSequence )
+{
+    bool isChanged = false;
+
+    if( !isReadConsistent( pSubscriptionList, *pSequence ) )
+    {
+        *pSequence = beginRead( pSubscriptionList );
+        isChanged = true;
+    }
+
+    return isChanged;
+}
+
+/*-----------------------------------------------------------*/
+
+static uint16_t allocateBlocks( SubscriptionList_t * pSubscriptionList,
+                                size_t numBlocks )
+{
+    const uint32_t * pUsedBlocks = pSubscriptionList->pUsedBlocks;
+    size_t block = 0U;
+    size_t runStart = 0U;
+    size_t runLength = 0U;
+    uint16_t firstBlock = NO_NODE;
+
+    if( numBlocks <= pSubscriptionList->numFreeBlocks )
+    {
+        for( block = 0U; ( block < pSubscriptionList->numBlocks ) && ( runLength < numBlocks ); block++ )
+        {
+            if( ( pUsedBlocks[ block / BITS_PER_WORD ] & ( 1UL << ( block % BITS_PER_WORD ) ) ) != 0U )
+            {
+                runLength = 0U;
+            }
+            else
+            {
+                if( runLength == 0U )
+                {
+                    runStart = block;
+                }
+
+                runLength++;
+            }
+        }
+    }
+
+    if( ( runLength == numBlocks ) && ( numBlocks > 0U ) )
+    {
+        for( block = runStart; block < runStart + numBlocks; block++ )
+        {
+            pSubscriptionList->pUsedBlocks[ block / BITS_PER_WORD ] |= ( 1UL << ( block % BITS_PER_WORD ) );
+        }
+
+        pSubscriptionList->numFreeBlocks -= ( uint16_t ) numBlocks;
+        memset( &( pSubscriptionList->pBlocks[ runStart * SUBSCRIPTION_MANAGER_BLOCK_SIZE ] ),
+                0x00,
+                numBlocks * SUBSCRIPTION_MANAGER_BLOCK_SIZE );
+        firstBlock = ( uint16_t ) runStart;
+    }
+
+    return firstBlock;
+}
+
+/*-----------------------------------------------------------*/
+
+static void freeBlocks( SubscriptionList_t * pSubscriptionList,
+                        uint16_t firstBlock,
+                        size_t numBlocks )
+{
+    size_t block = 0U;
+
+    for( block = firstBlock; block < ( size_t ) firstBlock + numBlocks; block++ )
+    {
+        pSubscriptionList->pUsedBlocks[ block / BITS_PER_WORD ] &= ~( 1UL << ( block % BITS_PER_WORD ) );
+    }
+
+    pSubscriptionList->numFreeBlocks += ( uint16_t ) numBlocks;
+}
+
+/*-----------------------------------------------------------*/
+
+static SubscriptionTrieNode_t * getNode( const SubscriptionList_t * pSubscriptionList,
+                                         uint16_t block )
+{
+    SubscriptionTrieNode_t * pNode = NULL;
+
+    if( ( ( size_t ) block + NODE_BLOCKS( 0U ) ) <= pSubscriptionList->numBlocks )
+    {
+        pNode = ( SubscriptionTrieNode_t * ) &( pSubscriptionList->pBlocks[ ( size_t ) block * SUBSCRIPTION_MANAGER_BLOCK_SIZE ] );
+    }
+
+    return pNode;
+}
+
+/*-----------------------------------------------------------*/
+
+static SubscriptionElement_t * getElement( const SubscriptionList_t * pSubscriptionList,
+                                           uint16_t block )
+{
+    SubscriptionElement_t * pElement = NULL;
+
+    if( ( ( size_t ) block + ELEMENT_BLOCKS ) <= pSubscriptionList->numBlocks )
+    {
+        pElement = ( SubscriptionElement_t * ) &( pSubscriptionList->pBlocks[ ( size_t ) block * SUBSCRIPTION_MANAGER_BLOCK_SIZE ] );
+    }
+
+    return pElement;
+}
+
+/*-----------------------------------------------------------*/
+
+static char * getLevelText( const SubscriptionTrieNode_t * pNode )
+{
+    return ( char * ) &( pNode[ 1 ] );
+}
+
+/*-----------------------------------------------------------*/
+
+static uint16_t getLevelEnd( const char * pString,
+                             uint16_t length,
+                             uint16_t levelStart )
+{
+    uint16_t levelEnd = levelStart;
+
+    while( ( levelEnd < length ) && ( pString[ levelEnd ] != '/' ) )
+    {
+        levelEnd++;
+    }
+
+    return levelEnd;
+}
+
+/*-----------------------------------------------------------*/
+
+static void splitLevels( const char * pString,
+                         uint16_t length,
+                         TopicLevels_t * pLevels )
+{
+    uint32_t topicHash = FNV_OFFSET_BASIS;
+    uint32_t levelHash = FNV_OFFSET_BASIS;
+    uint16_t levelStart = 0U;
+    uint16_t index = 0U;
+
+    pLevels->numLevels = 0U;
+
+    for( index = 0U; index <= length; index++ )
+    {
+        if( ( index == length ) || ( pString[ index ] == '/' ) )
+        {
+            if( pLevels->numLevels < SUBSCRIPTION_MANAGER_MAX_TOPIC_LEVELS )
+            {
+                pLevels->levelStart[ pLevels->numLevels ] = levelStart;
+                pLevels->levelLength[ pLevels->numLevels ] = ( uint16_t ) ( index - levelStart );
+                pLevels->levelHash[ pLevels->numLevels ] = levelHash;
+            }
+
+            pLevels->numLevels++;
+            levelHash = FNV_OFFSET_BASIS;
+            levelStart = ( uint16_t ) ( index + 1U );
+        }
+        else
+        {
+            levelHash = ( levelHash ^ ( uint8_t ) pString[ index ] ) * FNV_PRIME;
+        }
+
+        if( index < length )
+        {
+            topicHash = ( topicHash ^ ( uint8_t ) pString[ index ] ) * FNV_PRIME;
+        }
+    }
+
+    pLevels->topicHash = topicHash;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool isValidFilter( const char * pTopicFilter,
+                           uint16_t topicFilterLength )
+{
+    bool isValid = true;
+    uint32_t levelStart = 0U;
+    uint16_t levelEnd = 0U;
+    size_t numLevels = 0U;
+    size_t index = 0U;
+
+    while( isValid && ( levelStart <= topicFilterLength ) )
+    {
+        levelEnd = getLevelEnd( pTopicFilter, topicFilterLength, ( uint16_t ) levelStart );
+        numLevels++;
+
+        for( index = levelStart; ( index < levelEnd ) && isValid; index++ )
+        {
+            if( ( pTopicFilter[ index ] == '+' ) || ( pTopicFilter[ index ] == '#' ) )
+            {
+                /* A wildcard is a whole level, and `#` is the last one. */
+                isValid = ( levelEnd - levelStart == 1U ) &&
+                          ( ( pTopicFilter[ index ] == '+' ) || ( levelEnd == topicFilterLength ) );
+            }
+        }
+
+        levelStart = ( uint32_t ) levelEnd + 1U;
+    }
+
+    if( isValid && ( numLevels > SUBSCRIPTION_MANAGER_MAX_TOPIC_LEVELS ) )
+    {
+        LogError( ( "Topic filter %.*s has more than %u levels.",
+                    topicFilterLength,
+                    pTopicFilter,
+                    ( unsigned int ) SUBSCRIPTION_MANAGER_MAX_TOPIC_LEVELS ) );
+        isValid = false;
+    }
+
+    return isValid;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool hasWildcard( const char * pTopicFilter,
+                         uint16_t topicFilterLength )
+{
+    uint16_t index = 0U;
+
+    while( ( index < topicFilterLength ) &&
+           ( pTopicFilter[ index ] != '+' ) &&
+           ( pTopicFilter[ index ] != '#' ) )
+    {
+        index++;
+    }
+
+    return index < topicFilterLength;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool isExactPath( const SubscriptionList_t * pSubscriptionList,
+                         uint16_t node,
+                         const char * pTopic,
+                         const TopicLevels_t * pLevels,
+                         uint32_t sequence )
+{
+    const SubscriptionTrieNode_t * pNode = NULL;
+    size_t level = pLevels->numLevels;
+    bool isMatched = ( pLevels->numLevels <= SUBSCRIPTION_MANAGER_MAX_TOPIC_LEVELS );
+
+    /* Compare the levels from the last, going up to the root. */
+    while( isMatched && ( level > 0U ) )
+    {
+        level--;
+        pNode = getNode( pSubscriptionList, node );
+
+        /* The text of the level and its length are only used together once
+         * they are known to belong to the same node. */
+        isMatched = ( pNode != NULL ) &&
+                    ( pNode->levelHash == pLevels->levelHash[ level ] ) &&
+                    ( pNode->levelLength == pLevels->levelLength[ level ] ) &&
+                    isReadConsistent( pSubscriptionList, sequence ) &&
+                    ( memcmp( getLevelText( pNode ), &( pTopic[ pLevels->levelStart[ level ] ] ), pLevels->levelLength[ level ] ) == 0 );
+
+        if( isMatched )
+        {
+            node = pNode->parent;
+        }
+    }
+
+    return isMatched && ( node == pSubscriptionList->exactRoot );
+}
+
+/*-----------------------------------------------------------*/
+
+static uint16_t findExactNode( const SubscriptionList_t * pSubscriptionList,
+                               const char * pTopic,
+                               const TopicLevels_t * pLevels,
+                               uint32_t sequence )
+{
+    const SubscriptionTrieNode_t * pNode = NULL;
+    uint16_t node = pSubscriptionList->pBuckets[ pLevels->topicHash % SUBSCRIPTION_MANAGER_HASH_BUCKETS ];
+    size_t numVisits = 0U;
+    bool isFound = false;
+
+    /* The bucket may be read while it changes, so the number of nodes
+     * followed is bounded. */
+    while( ( node != NO_NODE ) && !isFound && ( numVisits < pSubscriptionList->numBlocks ) )
+    {
+        pNode = getNode( pSubscriptionList, node );
+
+        if( pNode == NULL )
+        {
+            node = NO_NODE;
+        }
+        else
+        {
+            isFound = ( pNode->filterHash == pLevels->topicHash ) &&
+                      isExactPath( pSubscriptionList, node, pTopic, pLevels, sequence );
+
+            if( !isFound )
+            {
+                node = pNode->nextInBucket;
+                numVisits++;
+            }
+        }
+    }
+
+    return isFound ? node : NO_NODE;
+}
+
+/*-----------------------------------------------------------*/
+
+static uint16_t findSubscriptionNode( const SubscriptionList_t * pSubscriptionList,
+                                      const char * pTopicFilter,
+                                      const TopicLevels_t * pLevels,
+                                      bool isWildcard,
+                                      uint32_t sequence )
+{
+    uint16_t node = NO_NODE;
+
+    if( isWildcard )
+    {
+        node = findFilterNode( pSubscriptionList, ROOT_NODE, pTopicFilter, pLevels );
+    }
+    else
+    {
+        node = findExactNode( pSubscriptionList, pTopicFilter, pLevels, sequence );
+    }
+
+    return node;
+}
+
+/*-----------------------------------------------------------*/
+
+static void linkExactNode( SubscriptionList_t * pSubscriptionList,
+                           uint16_t node,
+                           uint32_t filterHash )
+{
+    SubscriptionTrieNode_t * pNode = getNode( pSubscriptionList, node );
+    uint16_t * pBucket = &( pSubscriptionList->pBuckets[ filterHash % SUBSCRIPTION_MANAGER_HASH_BUCKETS ] );
+
+    pNode->filterHash = filterHash;
+    pNode->nextInBucket = *pBucket;
+    *pBucket = node;
+}
+
+/*-----------------------------------------------------------*/
+
+static void unlinkExactNode( SubscriptionList_t * pSubscriptionList,
+                             uint16_t node )
+{
+    SubscriptionTrieNode_t * pNode = getNode( pSubscriptionList, node );
+    uint16_t * pLink = &( pSubscriptionList->pBuckets[ pNode->filterHash % SUBSCRIPTION_MANAGER_HASH_BUCKETS ] );
+
+    while( *pLink != node )
+    {
+        pLink = &( getNode( pSubscriptionList, *pLink )->nextInBucket );
+    }
+
+    *pLink = pNode->nextInBucket;
+    pNode->nextInBucket = NO_NODE;
+}
+
+/*-----------------------------------------------------------*/
+
+static uint16_t clearElements( SubscriptionList_t * pSubscriptionList,
+                               uint16_t * pFirstElement )
+{
+    uint16_t element = *pFirstElement;
+    uint16_t nextElement = NO_ELEMENT;
+    uint16_t numElements = 0U;
+
+    *pFirstElement = NO_ELEMENT;
+
+    while( element != NO_ELEMENT )
+    {
+        nextElement = getElement( pSubscriptionList, element )->nextElement;
+        freeBlocks( pSubscriptionList, element, ELEMENT_BLOCKS );
+        numElements++;
+        element = nextElement;
+    }
+
+    return numElements;
+}
+
+/*-----------------------------------------------------------*/
+
+static uint16_t findChild( const SubscriptionList_t * pSubscriptionList,
+                           uint16_t parent,
+                           const char * pLevel,
+                           uint16_t levelLength,
+                           uint32_t levelHash )
+{
+    const SubscriptionTrieNode_t * pChild = NULL;
+    uint16_t child = getNode( pSubscriptionList, parent )->firstChild;
+    bool isFound = false;
+
+    while( ( child != NO_NODE ) && !isFound )
+    {
+        pChild = getNode( pSubscriptionList, child );
+        isFound = ( pChild->levelHash == levelHash ) &&
+                  ( pChild->levelLength == levelLength ) &&
+                  ( memcmp( getLevelText( pChild ), pLevel, levelLength ) == 0 );
+
+        if( !isFound )
+        {
+            child = pChild->nextSibling;
+        }
+    }
+
+    return child;
+}
+
+/*-----------------------------------------------------------*/
+
+static uint16_t findFilterNode( const SubscriptionList_t * pSubscriptionList,
+                                uint16_t root,
+                                const char * pTopicFilter,
+                                const TopicLevels_t * pLevels )
+{
+    uint16_t node = root;
+    size_t level = 0U;
+
+    /* A filter with more levels than are stored cannot have been added. */
+    bool isFound = ( pLevels->numLevels <= SUBSCRIPTION_MANAGER_MAX_TOPIC_LEVELS );
+
+    for( level = 0U; ( level < pLevels->numLevels ) && isFound; level++ )
+    {
+        node = findChild( pSubscriptionList,
+                          node,
+                          &( pTopicFilter[ pLevels->levelStart[ level ] ] ),
+                          pLevels->levelLength[ level ],
+                          pLevels->levelHash[ level ] );
+        isFound = ( node != NO_NODE );
+    }
+
+    return isFound ? node : NO_NODE;
+}
+
+/*-----------------------------------------------------------*/
+
+static uint16_t insertFilter( SubscriptionList_t * pSubscriptionList,
+                              uint16_t root,
+                              const char * pTopicFilter,
+                              const TopicLevels_t * pLevels )
+{
+    SubscriptionTrieNode_t * pNode = NULL;
+    SubscriptionTrieNode_t * pParent = NULL;
+    const char * pLevel = NULL;
+    uint16_t newNodes[ SUBSCRIPTION_MANAGER_MAX_TOPIC_LEVELS ] = { 0 };
+    uint16_t node = root;
+    uint16_t child = NO_NODE;
+    size_t firstNewLevel = pLevels->numLevels;
+    size_t level = 0U;
+    bool isAllocated = true;
+
+    /* Find the levels missing from the trie. */
+    for( level = 0U; ( level < pLevels->numLevels ) && ( firstNewLevel == pLevels->numLevels ); level++ )
+    {
+        node = findChild( pSubscriptionList,
+                          node,
+                          &( pTopicFilter[ pLevels->levelStart[ level ] ] ),
+                          pLevels->levelLength[ level ],
+                          pLevels->levelHash[ level ] );
+
+        if( node == NO_NODE )
+        {
+            firstNewLevel = level;
+        }
+    }
+
+    /* Take their blocks before changing the trie, to be able to fail. */
+    for( level = firstNewLevel; ( level < pLevels->numLevels ) && isAllocated; level++ )
+    {
+        newNodes[ level ] = allocateBlocks( pSubscriptionList, NODE_BLOCKS( pLevels->levelLength[ level ] ) );
+        isAllocated = ( newNodes[ level ] != NO_NODE );
+    }
+
+    if( !isAllocated )
+    {
+        LogError( ( "No storage left for topic filter %.*s.",
+                    ( int ) ( pLevels->levelStart[ pLevels->numLevels - 1U ] + pLevels->levelLength[ pLevels->numLevels - 1U ] ),
+                    pTopicFilter ) );
+
+        for( level = firstNewLevel; level < pLevels->numLevels; level++ )
+        {
+            if( newNodes[ level ] != NO_NODE )
+            {
+                freeBlocks( pSubscriptionList, newNodes[ level ], NODE_BLOCKS( pLevels->levelLength[ level ] ) );
+            }
+        }
+
+        node = NO_NODE;
+    }
+    else
+    {
+        node = root;
+
+        for( level = 0U; level < pLevels->numLevels; level++ )
+        {
+            pLevel = &( pTopicFilter[ pLevels->levelStart[ level ] ] );
+
+            if( level < firstNewLevel )
+            {
+                child = findChild( pSubscriptionList,
+                                   node,
+                                   pLevel,
+                                   pLevels->levelLength[ level ],
+                                   pLevels->levelHash[ level ] );
+            }
+            else
+            {
+                child = newNodes[ level ];
+                pNode = getNode( pSubscriptionList, child );
+                pParent = getNode( pSubscriptionList, node );
+                pNode->levelHash = pLevels->levelHash[ level ];
+                pNode->levelType = SUBSCRIPTION_LEVEL_LITERAL;
+                pNode->levelLength = pLevels->levelLength[ level ];
+                memcpy( getLevelText( pNode ), pLevel, pNode->levelLength );
+                pNode->parent = node;
+                pNode->nextSibling = pParent->firstChild;
+                pParent->firstChild = child;
+
+                if( pNode->levelLength == 1U )
+                {
+                    if( pLevel[ 0 ] == '+' )
+                    {
+                        pNode->levelType = SUBSCRIPTION_LEVEL_SINGLE_WILDCARD;
+                    }
+                    else if( pLevel[ 0 ] == '#' )
+                    {
+                        pNode->levelType = SUBSCRIPTION_LEVEL_MULTI_WILDCARD;
+                    }
+                    else
+                    {
+                        /* Empty else marker. */
+                    }
+                }
+            }
+
+            getNode( pSubscriptionList, child )->refCount++;
+            node = child;
+        }
+    }
+
+    return node;
+}
+
+/*-----------------------------------------------------------*/
+
+static void releaseFilter( SubscriptionList_t * pSubscriptionList,
+                           uint16_t node,
+                           uint16_t numElements )
+{
+    SubscriptionTrieNode_t * pNode = NULL;
+    uint16_t parent = ROOT_NODE;
+    uint16_t * pLink = NULL;
+
+    while( ( node != ROOT_NODE ) && ( node != pSubscriptionList->exactRoot ) )
+    {
+        pNode = getNode( pSubscriptionList, node );
+        parent = pNode->parent;
+        pNode->refCount -= numElements;
+
+        if( pNode->refCount == 0U )
+        {
+            /* Unlink the node from its parent. */
+            pLink = &( getNode( pSubscriptionList, parent )->firstChild );
+
+            while( *pLink != node )
+            {
+                pLink = &( getNode( pSubscriptionList, *pLink )->nextSibling );
+            }
+
+            *pLink = pNode->nextSibling;
+            freeBlocks( pSubscriptionList, node, NODE_BLOCKS( pNode->levelLength ) );
+        }
+
+        node = parent;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static uint16_t getNextNode( const SubscriptionList_t * pSubscriptionList,
+                             uint16_t node,
+                             uint16_t root )
+{
+    const SubscriptionTrieNode_t * pNode = getNode( pSubscriptionList, node );
+    uint16_t nextNode = NO_NODE;
+    size_t depth = 0U;
+
+    if( pNode == NULL )
+    {
+        /* Empty else marker. */
+    }
+    else if( pNode->firstChild != NO_NODE )
+    {
+        nextNode = pNode->firstChild;
+    }
+    else
+    {
+        /* Go up to the first node with a next sibling. The depth is bounded in
+         * case the trie changes under the walk. */
+        while( ( pNode != NULL ) &&
+               ( node != root ) &&
+               ( nextNode == NO_NODE ) &&
+               ( depth <= SUBSCRIPTION_MANAGER_MAX_TOPIC_LEVELS ) )
+        {
+            nextNode = pNode->nextSibling;
+            node = pNode->parent;
+            pNode = getNode( pSubscriptionList, node );
+            depth++;
+        }
+    }
+
+    return nextNode;
+}
+
+/*-----------------------------------------------------------*/
+
+static size_t writeFilter( const SubscriptionList_t * pSubscriptionList,
+                           uint16_t node,
+                           uint16_t root,
+                           uint32_t sequence,
+                           char * pBuffer,
+                           size_t bufferSize )
+{
+    const SubscriptionTrieNode_t * pPath[ SUBSCRIPTION_MANAGER_MAX_TOPIC_LEVELS ];
+    uint16_t levelLength[ SUBSCRIPTION_MANAGER_MAX_TOPIC_LEVELS ];
+    const SubscriptionTrieNode_t * pNode = getNode( pSubscriptionList, node );
+    size_t numLevels = 0U;
+    size_t filterLength = 0U;
+    size_t offset = 0U;
+    size_t level = 0U;
+
+    /* Collect the levels from the last, going up to the root. */
+    while( ( pNode != NULL ) && ( node != root ) && ( numLevels < SUBSCRIPTION_MANAGER_MAX_TOPIC_LEVELS ) )
+    {
+        pPath[ numLevels ] = pNode;
+        levelLength[ numLevels ] = pNode->levelLength;
+        filterLength += ( size_t ) levelLength[ numLevels ] + 1U;
+        numLevels++;
+        node = pNode->parent;
+        pNode = getNode( pSubscriptionList, node );
+    }
+
+    /* The levels are only copied once they are known to be consistent. */
+    if( ( node == root ) &&
+        ( numLevels > 0U ) &&
+        ( filterLength - 1U <= bufferSize ) &&
+        isReadConsistent( pSubscriptionList, sequence ) )
+    {
+        for( level = numLevels; level > 0U; level-- )
+        {
+            memcpy( &( pBuffer[ offset ] ), getLevelText( pPath[ level - 1U ] ), levelLength[ level - 1U ] );
+            offset += levelLength[ level - 1U ];
+
+            if( level > 1U )
+            {
+                pBuffer[ offset ] = '/';
+                offset++;
+            }
+        }
+    }
+
+    return offset;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool collectElements( const SubscriptionList_t * pSubscriptionList,
+                             uint16_t firstElement,
+                             MatchCollector_t * pCollector )
+{
+    const SubscriptionElement_t * pElement = getElement( pSubscriptionList, firstElement );
+    size_t numElements = 0U;
+    size_t index = 0U;
+    bool isCopied = false;
+
+    while( ( pElement != NULL ) && ( firstElement != NO_ELEMENT ) && ( numElements < pSubscriptionList->numBlocks ) )
+    {
+        isCopied = false;
+
+        for( index = 0U; ( index < pCollector->numMatches ) && !isCopied; index++ )
+        {
+            isCopied = ( pCollector->matches[ index ].incomingPublishCallback == pElement->incomingPublishCallback ) &&
+                       ( pCollector->matches[ index ].pIncomingPublishCallbackContext == pElement->pIncomingPublishCallbackContext );
+        }
+
+        if( isCopied )
+        {
+            /* Empty else marker. */
+        }
+        else if( pCollector->numMatches < SUBSCRIPTION_MANAGER_MAX_MATCHES )
+        {
+            pCollector->matches[ pCollector->numMatches ] = *pElement;
+            pCollector->numMatches++;
+        }
+        else
+        {
+            pCollector->numMissed++;
+        }
+
+        firstElement = pElement->nextElement;
+        pElement = getElement( pSubscriptionList, firstElement );
+        numElements++;
+    }
+
+    return numElements > 0U;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool collectMatches( const SubscriptionList_t * pSubscriptionList,
+                            const char * pTopic,
+                            const TopicLevels_t * pLevels,
+                            uint32_t sequence,
+                            MatchCollector_t * pCollector )
+{
+    MatchBranch_t stack[ MATCH_STACK_SIZE ];
+    MatchBranch_t branch = { 0 };
+    const SubscriptionTrieNode_t * pNode = NULL;
+    const SubscriptionTrieNode_t * pChild = NULL;
+    size_t numBranches = 0U;
+    size_t numVisits = 0U;
+    uint16_t node = NO_NODE;
+    uint16_t child = NO_NODE;
+    bool isSystemTopic = false, isMatched = false, isLevelMatched = false;
+
+    /* Topic filters without wildcards match the topic exactly. */
+    node = findExactNode( pSubscriptionList, pTopic, pLevels, sequence );
+
+    if( node != NO_NODE )
+    {
+        isMatched = collectElements( pSubscriptionList,
+                                     getNode( pSubscriptionList, node )->firstElement,
+                                     pCollector );
+    }
+
+    /* Wildcards at the first level do not match topics starting with `$`. */
+    isSystemTopic = ( pTopic[ 0 ] == '$' );
+
+    /* Topic filters with wildcards are matched level by level. Each node is
+     * visited at most once, unless the trie changes under the walk. */
+    stack[ 0 ].node = ROOT_NODE;
+    stack[ 0 ].level = 0U;
+    numBranches = 1U;
+
+    while( numBranches > 0U )
+    {
+        numBranches--;
+        branch = stack[ numBranches ];
+        pNode = getNode( pSubscriptionList, branch.node );
+        child = ( pNode != NULL ) ? pNode->firstChild : NO_NODE;
+        pChild = getNode( pSubscriptionList, child );
+
+        while( ( child != NO_NODE ) && ( pChild != NULL ) && ( numVisits < pSubscriptionList->numBlocks ) )
+        {
+            numVisits++;
+
+            if( ( pChild->levelType != SUBSCRIPTION_LEVEL_LITERAL ) &&
+                isSystemTopic &&
+                ( branch.node == ROOT_NODE ) )
+            {
+                /* Empty else marker. */
+            }
+            else if( pChild->levelType == SUBSCRIPTION_LEVEL_MULTI_WILDCARD )
+            {
+                /* `#` matches the remaining levels, and the parent level
+                 * once every level matched. */
+                isMatched |= collectElements( pSubscriptionList,
+                                              pChild->firstElement,
+                                              pCollector );
+            }
+            else if( branch.level >= pLevels->numLevels )
+            {
+                /* Every level matched, so only `#` can match. */
+            }
+            else
+            {
+                /* The text of the level and its length are only used
+                 * together once they are known to belong to the same node. */
+                isLevelMatched = ( pChild->levelType == SUBSCRIPTION_LEVEL_SINGLE_WILDCARD ) ||
+                                 ( ( pChild->levelHash == pLevels->levelHash[ branch.level ] ) &&
+                                   ( pChild->levelLength == pLevels->levelLength[ branch.level ] ) &&
+                                   isReadConsistent( pSubscriptionList, sequence ) &&
+                                   ( memcmp( getLevelText( pChild ), &( pTopic[ pLevels->levelStart[ branch.level ] ] ), pLevels->levelLength[ branch.level ] ) == 0 ) );
+
+                if( isLevelMatched && ( ( size_t ) branch.level + 1U == pLevels->numLevels ) )
+                {
+                    isMatched |= collectElements( pSubscriptionList,
+                                                  pChild->firstElement,
+                                                  pCollector );
+                }
+
+                /* Topic filters have at most as many levels as are
+                 * stored, so a node with children is never deeper. */
+                if( isLevelMatched && ( pChild->firstChild != NO_NODE ) && ( numBranches < MATCH_STACK_SIZE ) )
+                {
+                    stack[ numBranches ].node = child;
+                    stack[ numBranches ].level = ( uint16_t ) ( branch.level + 1U );
+                    numBranches++;
+                }
+            }
+
+            child = pChild->nextSibling;
+            pChild = getNode( pSubscriptionList, child );
+        }
+    }
+
+    return isMatched;
+}
+
+/*-----------------------------------------------------------*/
+
+static void invokeSubscription( void * pMatchContext,
+                                const SubscriptionElement_t * pSubscription )
+{
+    pSubscription->incomingPublishCallback( pSubscription->pIncomingPublishCallbackContext,
+                                            ( MQTTPublishInfo_t * ) pMatchContext );
+}
+
+/*-----------------------------------------------------------*/
+
+bool initSubscriptionList( SubscriptionList_t * pSubscriptionList,
+                           void * pStorage,
+                           size_t storageSize )
+{
+    uint8_t * pBytes = ( uint8_t * ) pStorage;
+    size_t bucketsSize = SUBSCRIPTION_MANAGER_HASH_BUCKETS * sizeof( uint16_t );
+    size_t bitmapSize = 0U;
+    size_t blocksOffset = 0U;
+    size_t numBlocks = 0U;
+    bool returnStatus = false;
+
+    if( ( pSubscriptionList == NULL ) ||
+        ( pStorage == NULL ) ||
+        ( ( ( uintptr_t ) pStorage % SUBSCRIPTION_MANAGER_BLOCK_SIZE ) != 0U ) ||
+        ( ( SUBSCRIPTION_MANAGER_BLOCK_SIZE % sizeof( void * ) ) != 0U ) )
+    {
+        LogError( ( "Invalid parameter. pSubscriptionList=%p, pStorage=%p,"
+                    " which must be aligned to SUBSCRIPTION_MANAGER_BLOCK_SIZE,"
+                    " a multiple of the size of a pointer.",
+                    pSubscriptionList,
+                    pStorage ) );
+    }
+    else
+    {
+        /* The storage holds the bitmap of the blocks in use, the buckets, then
+         * the blocks. */
+        if( storageSize > bucketsSize )
+        {
+            numBlocks = ( ( storageSize - bucketsSize ) * 8U ) / ( ( SUBSCRIPTION_MANAGER_BLOCK_SIZE * 8U ) + 1U );
+        }
+
+        numBlocks = ( numBlocks > MAX_BLOCKS ) ? MAX_BLOCKS : numBlocks;
+
+        /* Rounding may leave too little room for the estimate. */
+        bitmapSize = ( ( numBlocks + BITS_PER_WORD - 1U ) / BITS_PER_WORD ) * sizeof( uint32_t );
+        blocksOffset = ROUND_UP( bitmapSize + bucketsSize, SUBSCRIPTION_MANAGER_BLOCK_SIZE );
+
+        while( ( numBlocks > 0U ) &&
+               ( ( blocksOffset + ( numBlocks * SUBSCRIPTION_MANAGER_BLOCK_SIZE ) ) > storageSize ) )
+        {
+            numBlocks--;
+        }
+
+        /* The roots of the tries take the first blocks. */
+        if( numBlocks < ( 2U * NODE_BLOCKS( 0U ) ) )
+        {
+            LogError( ( "Storage of %u bytes is too small for a subscription list.",
+                        ( unsigned int ) storageSize ) );
+        }
+        else
+        {
+            memset( pSubscriptionList, 0x00, sizeof( SubscriptionList_t ) );
+            memset( pStorage, 0x00, blocksOffset + ( numBlocks * SUBSCRIPTION_MANAGER_BLOCK_SIZE ) );
+            ( void ) k_mutex_init( &( pSubscriptionList->writeLock ) );
+
+            pSubscriptionList->pUsedBlocks = ( uint32_t * ) pBytes;
+            pSubscriptionList->pBuckets = ( uint16_t * ) &( pBytes[ bitmapSize ] );
+            pSubscriptionList->pBlocks = &( pBytes[ blocksOffset ] );
+            pSubscriptionList->numBlocks = ( uint16_t ) numBlocks;
+            pSubscriptionList->numFreeBlocks = ( uint16_t ) numBlocks;
+
+            ( void ) allocateBlocks( pSubscriptionList, NODE_BLOCKS( 0U ) );
+            pSubscriptionList->exactRoot = allocateBlocks( pSubscriptionList, NODE_BLOCKS( 0U ) );
+
+            LogInfo( ( "Subscription list of %u blocks of %u bytes.",
+                       ( unsigned int ) numBlocks,
+                       ( unsigned int ) SUBSCRIPTION_MANAGER_BLOCK_SIZE ) );
+            returnStatus = true;
+        }
+    }
+
+    return returnStatus;
+}
+
+/*-----------------------------------------------------------*/
+
+bool addSubscription( SubscriptionList_t * pSubscriptionList,
                       const char * pTopicFilterString,
                       uint16_t topicFilterLength,
                       IncomingPubCallback_t incomingPublishCallback,
                       void * pIncomingPublishCallbackContext )
 {
-    int32_t index = 0;
-    size_t availableIndex = SUBSCRIPTION_MANAGER_MAX_SUBSCRIPTIONS;
+    bool isFirst = false;
+
+    return acquireSubscription( pSubscriptionList,
+                                pTopicFilterString,
+                                topicFilterLength,
+                                incomingPublishCallback,
+                                pIncomingPublishCallbackContext,
+                                &isFirst );
+}
+
+/*-----------------------------------------------------------*/
+
+bool acquireSubscription( SubscriptionList_t * pSubscriptionList,
+                          const char * pTopicFilterString,
+                          uint16_t topicFilterLength,
+                          IncomingPubCallback_t incomingPublishCallback,
+                          void * pIncomingPublishCallbackContext,
+                          bool * pIsFirst )
+{
+    SubscriptionTrieNode_t * pNode = NULL;
+    SubscriptionElement_t * pElement = NULL;
+    uint16_t node = NO_NODE;
+    uint16_t element = NO_ELEMENT;
+    uint16_t newElement = NO_ELEMENT;
+    TopicLevels_t levels;
+    uint32_t sequence = 0U;
+    bool isWildcard = false;
     bool returnStatus = false;
 
     if( ( pSubscriptionList == NULL ) ||
         ( pTopicFilterString == NULL ) ||
         ( topicFilterLength == 0U ) ||
-        ( incomingPublishCallback == NULL ) )
+        ( incomingPublishCallback == NULL ) ||
+        ( pIsFirst == NULL ) )
     {
         LogError( ( "Invalid parameter. pSubscriptionList=%p, pTopicFilterString=%p,"
-                    " topicFilterLength=%u, incomingPublishCallback=%p.",
+                    " topicFilterLength=%u, incomingPublishCallback=%p, pIsFirst=%p.",
                     pSubscriptionList,
                     pTopicFilterString,
                     ( unsigned int ) topicFilterLength,
-                    incomingPublishCallback ) );
+                    incomingPublishCallback,
+                    pIsFirst ) );
+    }
+    else if( pSubscriptionList->pBlocks == NULL )
+    {
+        LogError( ( "Subscription list is not initialized." ) );
+    }
+    else if( !isValidFilter( pTopicFilterString, topicFilterLength ) )
+    {
+        LogError( ( "Invalid topic filter %.*s.",
+                    topicFilterLength,
+                    pTopicFilterString ) );
     }
     else
     {
-        /* Start at end of array, so that we will insert at the first available index.
-         * Scans backwards to find duplicates. */
-        for( index = ( int32_t ) SUBSCRIPTION_MANAGER_MAX_SUBSCRIPTIONS - 1; index >= 0; index-- )
+        *pIsFirst = false;
+        isWildcard = hasWildcard( pTopicFilterString, topicFilterLength );
+        splitLevels( pTopicFilterString, topicFilterLength, &levels );
+
+        beginWrite( pSubscriptionList );
+        sequence = ( uint32_t ) atomic_get( &( pSubscriptionList->sequence ) );
+
+        /* Find the elements with the same topic filter. */
+        node = findSubscriptionNode( pSubscriptionList, pTopicFilterString, &levels, isWildcard, sequence );
+        element = ( node != NO_NODE ) ? getNode( pSubscriptionList, node )->firstElement : NO_ELEMENT;
+
+        /* If a subscription already exists, don't do anything. */
+        while( ( element != NO_ELEMENT ) && !returnStatus )
+        {
+            pElement = getElement( pSubscriptionList, element );
+
+            if( ( pElement->incomingPublishCallback == incomingPublishCallback ) &&
+                ( pElement->pIncomingPublishCallbackContext == pIncomingPublishCallbackContext ) )
+            {
+                LogWarn( ( "Subscription already exists.\n" ) );
+                returnStatus = true;
+            }
+
+            element = pElement->nextElement;
+        }
+
+        if( !returnStatus )
         {
-            if( pSubscriptionList[ index ].filterStringLength == 0 )
+            newElement = allocateBlocks( pSubscriptionList, ELEMENT_BLOCKS );
+
+            if( newElement == NO_ELEMENT )
             {
-                availableIndex = index;
+                LogError( ( "No storage left for a subscription to %.*s.",
+                            topicFilterLength,
+                            pTopicFilterString ) );
             }
-            else if( ( pSubscriptionList[ index ].filterStringLength == topicFilterLength ) &&
-                     ( strncmp( pTopicFilterString, pSubscriptionList[ index ].pSubscriptionFilterString, ( size_t ) topicFilterLength ) == 0 ) )
+            else
             {
-                /* If a subscription already exists, don't do anything. */
-                if( ( pSubscriptionList[ index ].incomingPublishCallback == incomingPublishCallback ) &&
-                    ( pSubscriptionList[ index ].pIncomingPublishCallbackContext == pIncomingPublishCallbackContext ) )
+                /* Copy the levels of the filter missing from the trie, and
+                 * count the element in the levels already there. */
+                node = insertFilter( pSubscriptionList,
+                                     isWildcard ? ROOT_NODE : pSubscriptionList->exactRoot,
+                                     pTopicFilterString,
+                                     &levels );
+
+                if( node == NO_NODE )
+                {
+                    freeBlocks( pSubscriptionList, newElement, ELEMENT_BLOCKS );
+                }
+                else
                 {
-                    LogWarn( ( "Subscription already exists.\n" ) );
-                    availableIndex = SUBSCRIPTION_MANAGER_MAX_SUBSCRIPTIONS;
+                    pNode = getNode( pSubscriptionList, node );
+                    *pIsFirst = ( pNode->firstElement == NO_ELEMENT );
+
+                    if( !isWildcard && *pIsFirst )
+                    {
+                        linkExactNode( pSubscriptionList, node, levels.topicHash );
+                    }
+
+                    pElement = getElement( pSubscriptionList, newElement );
+                    pElement->incomingPublishCallback = incomingPublishCallback;
+                    pElement->pIncomingPublishCallbackContext = pIncomingPublishCallbackContext;
+                    pElement->nextElement = pNode->firstElement;
+                    pNode->firstElement = newElement;
                     returnStatus = true;
-                    break;
                 }
             }
         }
 
-        if( availableIndex < SUBSCRIPTION_MANAGER_MAX_SUBSCRIPTIONS )
-        {
-            pSubscriptionList[ availableIndex ].pSubscriptionFilterString = pTopicFilterString;
-            pSubscriptionList[ availableIndex ].filterStringLength = topicFilterLength;
-            pSubscriptionList[ availableIndex ].incomingPublishCallback = incomingPublishCallback;
-            pSubscriptionList[ availableIndex ].pIncomingPublishCallbackContext = pIncomingPublishCallbackContext;
-            returnStatus = true;
-        }
+        endWrite( pSubscriptionList );
     }
 
     return returnStatus;
@@ -95,11 +1576,16 @@ bool addSubscription( SubscriptionElement_t * pSubscriptionList,
 
 /*-----------------------------------------------------------*/
 
-void removeSubscription( SubscriptionElement_t * pSubscriptionList,
+void removeSubscription( SubscriptionList_t * pSubscriptionList,
                          const char * pTopicFilterString,
                          uint16_t topicFilterLength )
 {
-    int32_t index = 0;
+    SubscriptionTrieNode_t * pNode = NULL;
+    uint16_t node = NO_NODE;
+    uint16_t numElements = 0U;
+    TopicLevels_t levels;
+    uint32_t sequence = 0U;
+    bool isWildcard = false;
 
     if( ( pSubscriptionList == NULL ) ||
         ( pTopicFilterString == NULL ) ||
@@ -111,28 +1597,194 @@ void removeSubscription( SubscriptionElement_t * pSubscriptionList,
                     pTopicFilterString,
                     ( unsigned int ) topicFilterLength ) );
     }
+    else if( pSubscriptionList->pBlocks == NULL )
+    {
+        LogError( ( "Subscription list is not initialized." ) );
+    }
+    else
+    {
+        isWildcard = hasWildcard( pTopicFilterString, topicFilterLength );
+        splitLevels( pTopicFilterString, topicFilterLength, &levels );
+
+        beginWrite( pSubscriptionList );
+        sequence = ( uint32_t ) atomic_get( &( pSubscriptionList->sequence ) );
+
+        node = findSubscriptionNode( pSubscriptionList, pTopicFilterString, &levels, isWildcard, sequence );
+
+        if( node != NO_NODE )
+        {
+            pNode = getNode( pSubscriptionList, node );
+
+            if( !isWildcard )
+            {
+                unlinkExactNode( pSubscriptionList, node );
+            }
+
+            numElements = clearElements( pSubscriptionList, &( pNode->firstElement ) );
+            releaseFilter( pSubscriptionList, node, numElements );
+        }
+
+        endWrite( pSubscriptionList );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+bool releaseSubscription( SubscriptionList_t * pSubscriptionList,
+                          const char * pTopicFilterString,
+                          uint16_t topicFilterLength,
+                          IncomingPubCallback_t incomingPublishCallback,
+                          void * pIncomingPublishCallbackContext,
+                          bool * pIsLast )
+{
+    SubscriptionTrieNode_t * pNode = NULL;
+    SubscriptionElement_t * pElement = NULL;
+    uint16_t * pLink = NULL;
+    uint16_t node = NO_NODE;
+    TopicLevels_t levels;
+    uint32_t sequence = 0U;
+    bool isWildcard = false;
+    bool returnStatus = false;
+
+    if( ( pSubscriptionList == NULL ) ||
+        ( pTopicFilterString == NULL ) ||
+        ( topicFilterLength == 0U ) ||
+        ( pIsLast == NULL ) )
+    {
+        LogError( ( "Invalid parameter. pSubscriptionList=%p, pTopicFilterString=%p,"
+                    " topicFilterLength=%u, pIsLast=%p.",
+                    pSubscriptionList,
+                    pTopicFilterString,
+                    ( unsigned int ) topicFilterLength,
+                    pIsLast ) );
+    }
+    else if( pSubscriptionList->pBlocks == NULL )
+    {
+        LogError( ( "Subscription list is not initialized." ) );
+    }
     else
     {
-        for( index = 0; index < SUBSCRIPTION_MANAGER_MAX_SUBSCRIPTIONS; index++ )
+        *pIsLast = false;
+        isWildcard = hasWildcard( pTopicFilterString, topicFilterLength );
+        splitLevels( pTopicFilterString, topicFilterLength, &levels );
+
+        beginWrite( pSubscriptionList );
+        sequence = ( uint32_t ) atomic_get( &( pSubscriptionList->sequence ) );
+
+        node = findSubscriptionNode( pSubscriptionList, pTopicFilterString, &levels, isWildcard, sequence );
+
+        if( node != NO_NODE )
         {
-            if( pSubscriptionList[ index ].filterStringLength == topicFilterLength )
+            pNode = getNode( pSubscriptionList, node );
+            pLink = &( pNode->firstElement );
+
+            /* Find the element of the context-callback pair. */
+            while( ( *pLink != NO_ELEMENT ) && !returnStatus )
             {
-                if( strncmp( pSubscriptionList[ index ].pSubscriptionFilterString, pTopicFilterString, topicFilterLength ) == 0 )
+                pElement = getElement( pSubscriptionList, *pLink );
+
+                if( ( pElement->incomingPublishCallback == incomingPublishCallback ) &&
+                    ( pElement->pIncomingPublishCallbackContext == pIncomingPublishCallbackContext ) )
+                {
+                    returnStatus = true;
+                }
+                else
                 {
-                    memset( &( pSubscriptionList[ index ] ), 0x00, sizeof( SubscriptionElement_t ) );
+                    pLink = &( pElement->nextElement );
                 }
             }
         }
+
+        if( returnStatus )
+        {
+            freeBlocks( pSubscriptionList, *pLink, ELEMENT_BLOCKS );
+            *pLink = pElement->nextElement;
+            *pIsLast = ( pNode->firstElement == NO_ELEMENT );
+
+            if( *pIsLast && !isWildcard )
+            {
+                unlinkExactNode( pSubscriptionList, node );
+            }
+
+            releaseFilter( pSubscriptionList, node, 1U );
+        }
+
+        endWrite( pSubscriptionList );
+    }
+
+    return returnStatus;
+}
+
+/*-----------------------------------------------------------*/
+
+bool forEachMatchingSubscription( SubscriptionList_t * pSubscriptionList,
+                                  const MQTTPublishInfo_t * pPublishInfo,
+                                  SubscriptionMatchCallback_t matchCallback,
+                                  void * pMatchContext )
+{
+    MatchCollector_t collector;
+    TopicLevels_t levels;
+    uint32_t sequence = 0U;
+    size_t index = 0U;
+    bool isMatched = false;
+
+    if( ( pSubscriptionList == NULL ) ||
+        ( pPublishInfo == NULL ) ||
+        ( matchCallback == NULL ) )
+    {
+        LogError( ( "Invalid parameter. pSubscriptionList=%p, pPublishInfo=%p, matchCallback=%p.",
+                    pSubscriptionList,
+                    pPublishInfo,
+                    matchCallback ) );
+    }
+    else if( ( pSubscriptionList->pBlocks != NULL ) &&
+             ( pPublishInfo->pTopicName != NULL ) &&
+             ( pPublishInfo->topicNameLength > 0U ) )
+    {
+        splitLevels( pPublishInfo->pTopicName, pPublishInfo->topicNameLength, &levels );
+
+        /* Match again if a writer changed the list meanwhile. */
+        sequence = beginRead( pSubscriptionList );
+
+        do
+        {
+            collector.numMatches = 0U;
+            collector.numMissed = 0U;
+            isMatched = collectMatches( pSubscriptionList,
+                                        pPublishInfo->pTopicName,
+                                        &levels,
+                                        sequence,
+                                        &collector );
+        } while( retryRead( pSubscriptionList, &sequence ) );
+
+        if( collector.numMissed > 0U )
+        {
+            LogWarn( ( "%u subscriptions matching topic %.*s were left out.",
+                       ( unsigned int ) collector.numMissed,
+                       pPublishInfo->topicNameLength,
+                       pPublishInfo->pTopicName ) );
+        }
+
+        /* The callbacks run on the copies, so they may change the list. */
+        for( index = 0U; index < collector.numMatches; index++ )
+        {
+            matchCallback( pMatchContext, &( collector.matches[ index ] ) );
+        }
+    }
+    else
+    {
+        /* Empty else marker. */
     }
+
+    return isMatched;
 }
 
 /*-----------------------------------------------------------*/
 
-bool handleIncomingPublishes( SubscriptionElement_t * pSubscriptionList,
+bool handleIncomingPublishes( SubscriptionList_t * pSubscriptionList,
                               MQTTPublishInfo_t * pPublishInfo )
 {
-    int32_t index = 0;
-    bool isMatched = false, publishHandled = false;
+    bool publishHandled = false;
 
     if( ( pSubscriptionList == NULL ) ||
         ( pPublishInfo == NULL ) )
@@ -143,25 +1795,175 @@ bool handleIncomingPublishes( SubscriptionElement_t * pSubscriptionList,
     }
     else
     {
-        for( index = 0; index < SUBSCRIPTION_MANAGER_MAX_SUBSCRIPTIONS; index++ )
+        publishHandled = forEachMatchingSubscription( pSubscriptionList,
+                                                      pPublishInfo,
+                                                      invokeSubscription,
+                                                      pPublishInfo );
+    }
+
+    return publishHandled;
+}
+
+/*-----------------------------------------------------------*/
+
+size_t copySubscriptionFilters( SubscriptionList_t * pSubscriptionList,
+                                char * pBuffer,
+                                size_t bufferSize,
+                                MQTTSubscribeInfo_t * pSubscribeInfo,
+                                size_t maxFilters,
+                                size_t * pNumFilters )
+{
+    const SubscriptionTrieNode_t * pNode = NULL;
+    uint16_t roots[ 2 ] = { ROOT_NODE, NO_NODE };
+    uint16_t node = NO_NODE;
+    uint32_t sequence = 0U;
+    size_t numCopied = 0U;
+    size_t numFilters = 0U;
+    size_t numVisits = 0U;
+    size_t bufferUsed = 0U;
+    size_t filterLength = 0U;
+    size_t index = 0U;
+
+    assert( pSubscriptionList != NULL );
+    assert( ( pBuffer != NULL ) || ( bufferSize == 0U ) );
+    assert( ( pSubscribeInfo != NULL ) || ( maxFilters == 0U ) );
+    assert( pNumFilters != NULL );
+
+    if( pSubscriptionList->pBlocks != NULL )
+    {
+        roots[ 1 ] = pSubscriptionList->exactRoot;
+        sequence = beginRead( pSubscriptionList );
+
+        /* Copy the filters again if a writer changed the list meanwhile. */
+        do
         {
-            if( pSubscriptionList[ index ].filterStringLength > 0 )
+            numCopied = 0U;
+            numFilters = 0U;
+            bufferUsed = 0U;
+            numVisits = 0U;
+
+            for( index = 0U; index < 2U; index++ )
             {
-                MQTT_MatchTopic( pPublishInfo->pTopicName,
-                                 pPublishInfo->topicNameLength,
-                                 pSubscriptionList[ index ].pSubscriptionFilterString,
-                                 pSubscriptionList[ index ].filterStringLength,
-                                 &isMatched );
+                node = getNextNode( pSubscriptionList, roots[ index ], roots[ index ] );
 
-                if( isMatched == true )
+                while( ( node != NO_NODE ) && ( numVisits < pSubscriptionList->numBlocks ) )
                 {
-                    pSubscriptionList[ index ].incomingPublishCallback( pSubscriptionList[ index ].pIncomingPublishCallbackContext,
-                                                                        pPublishInfo );
-                    publishHandled = true;
+                    pNode = getNode( pSubscriptionList, node );
+
+                    if( ( pNode != NULL ) && ( pNode->firstElement != NO_ELEMENT ) )
+                    {
+                        numFilters++;
+                        filterLength = 0U;
+
+                        if( numCopied < maxFilters )
+                        {
+                            filterLength = writeFilter( pSubscriptionList,
+                                                        node,
+                                                        roots[ index ],
+                                                        sequence,
+                                                        &( pBuffer[ bufferUsed ] ),
+                                                        bufferSize - bufferUsed );
+                        }
+
+                        if( filterLength > 0U )
+                        {
+                            pSubscribeInfo[ numCopied ].pTopicFilter = &( pBuffer[ bufferUsed ] );
+                            pSubscribeInfo[ numCopied ].topicFilterLength = ( uint16_t ) filterLength;
+                            bufferUsed += filterLength;
+                            numCopied++;
+                        }
+                    }
+
+                    node = getNextNode( pSubscriptionList, node, roots[ index ] );
+                    numVisits++;
                 }
             }
+        } while( retryRead( pSubscriptionList, &sequence ) );
+    }
+
+    *pNumFilters = numFilters;
+
+    return numCopied;
+}
+/*-----------------------------------------------------------*/
+
+bool isTopicFilterCovered( const char * pTopicFilter,
+                           uint16_t topicFilterLength,
+                           const char * pCoveringFilter,
+                           uint16_t coveringFilterLength )
+{
+    uint32_t levelStart = 0U;
+    uint32_t coveringStart = 0U;
+    uint16_t levelEnd = 0U;
+    uint16_t coveringEnd = 0U;
+    uint16_t levelLength = 0U;
+    bool isCovered = false;
+    bool isCompared = false;
+
+    assert( pTopicFilter != NULL );
+    assert( pCoveringFilter != NULL );
+
+    /* Compare the filters level by level, until the covering filter ends with
+     * `#` or a level of the filter is not covered. */
+    while( !isCompared )
+    {
+        levelEnd = getLevelEnd( pTopicFilter, topicFilterLength, ( uint16_t ) levelStart );
+        coveringEnd = getLevelEnd( pCoveringFilter, coveringFilterLength, ( uint16_t ) coveringStart );
+        levelLength = ( uint16_t ) ( levelEnd - levelStart );
+
+        if( ( levelStart == 0U ) &&
+            ( levelLength > 0U ) &&
+            ( pTopicFilter[ 0 ] == '$' ) &&
+            ( coveringEnd == 1U ) &&
+            ( ( pCoveringFilter[ 0 ] == '+' ) || ( pCoveringFilter[ 0 ] == '#' ) ) )
+        {
+            /* Wildcards at the first level do not match topics starting with
+             * `$`. */
+            isCompared = true;
+        }
+        else if( ( coveringEnd - coveringStart == 1U ) && ( pCoveringFilter[ coveringStart ] == '#' ) )
+        {
+            isCovered = true;
+            isCompared = true;
+        }
+        else if( ( coveringEnd - coveringStart == 1U ) && ( pCoveringFilter[ coveringStart ] == '+' ) )
+        {
+            /* `+` covers any level but `#`. */
+            isCompared = ( levelLength == 1U ) && ( pTopicFilter[ levelStart ] == '#' );
+        }
+        else
+        {
+            /* A level of text, including `+`, is only covered by the same text. */
+            isCompared = ( coveringEnd - coveringStart != levelLength ) ||
+                         ( memcmp( &( pCoveringFilter[ coveringStart ] ), &( pTopicFilter[ levelStart ] ), levelLength ) != 0 );
+        }
+
+        if( isCompared )
+        {
+            /* Empty else marker. */
+        }
+        else if( ( levelEnd == topicFilterLength ) && ( coveringEnd == coveringFilterLength ) )
+        {
+            isCovered = true;
+            isCompared = true;
+        }
+        else if( levelEnd == topicFilterLength )
+        {
+            /* A filter ending with `/#` also matches its parent level. */
+            isCovered = ( coveringFilterLength - coveringEnd == 2U ) &&
+                        ( pCoveringFilter[ coveringEnd + 1U ] == '#' );
+            isCompared = true;
+        }
+        else if( coveringEnd == coveringFilterLength )
+        {
+            isCompared = true;
+        }
+        else
+        {
+            levelStart = ( uint32_t ) levelEnd + 1U;
+            coveringStart = ( uint32_t ) coveringEnd + 1U;
         }
     }
 
-    return publishHandled;
+    return isCovered;
 }
@@ -0,0 +1,134 @@
+/*
+ * AWS IoT Device Embedded C SDK for ZephyrRTOS
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file entropy_pool_zephyr.h
+ * @brief Pool of random bytes from the Zephyr cryptographically secure RNG,
+ * refilled by a low-priority thread so that TLS connections do not wait on
+ * the RNG.
+ */
+
+#ifndef ENTROPY_POOL_ZEPHYR_H_
+#define ENTROPY_POOL_ZEPHYR_H_
+
+/**************************************************/
+/******* DO NOT CHANGE the following order ********/
+/**************************************************/
+
+/* Logging related header files are required to be included in the following order:
+ * 1. Include the header file "logging_levels.h".
+ * 2. Define LIBRARY_LOG_NAME and  LIBRARY_LOG_LEVEL.
+ * 3. Include the header file "logging_stack.h".
+ */
+
+/* Include header that defines log levels. */
+#include "logging_levels.h"
+
+/* Logging configuration for the entropy pool. */
+#ifndef LIBRARY_LOG_NAME
+    #define LIBRARY_LOG_NAME     "EntropyPool"
+#endif
+#ifndef LIBRARY_LOG_LEVEL
+    #define LIBRARY_LOG_LEVEL    LOG_ERROR
+#endif
+
+#include "logging_stack.h"
+
+/************ End of logging configuration ****************/
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Number of random bytes kept in the pool.
+ */
+#ifndef ENTROPY_POOL_SIZE
+    #define ENTROPY_POOL_SIZE    ( 128U )
+#endif
+
+/**
+ * @brief Number of bytes in the pool below which the refill thread is woken.
+ */
+#ifndef ENTROPY_POOL_REFILL_THRESHOLD
+    #define ENTROPY_POOL_REFILL_THRESHOLD    ( ENTROPY_POOL_SIZE / 2U )
+#endif
+
+/**
+ * @brief Number of bytes requested from the RNG at a time by the refill thread.
+ */
+#ifndef ENTROPY_POOL_REFILL_CHUNK_SIZE
+    #define ENTROPY_POOL_REFILL_CHUNK_SIZE    ( 32U )
+#endif
+
+/**
+ * @brief Stack size of the refill thread.
+ */
+#ifndef ENTROPY_POOL_THREAD_STACK_SIZE
+    #define ENTROPY_POOL_THREAD_STACK_SIZE    ( 1024U )
+#endif
+
+/**
+ * @brief Priority of the refill thread. It runs when no application thread of
+ * higher priority is ready.
+ */
+#ifndef ENTROPY_POOL_THREAD_PRIORITY
+    #define ENTROPY_POOL_THREAD_PRIORITY    ( K_LOWEST_APPLICATION_THREAD_PRIO )
+#endif
+
+/**
+ * @brief Start the thread that fills the pool.
+ *
+ * Until this is called, the pool stays empty and #EntropyPool_Get reads the
+ * RNG directly. Calling it again has no effect.
+ */
+void EntropyPool_Start( void );
+
+/**
+ * @brief Take random bytes from the pool without blocking.
+ *
+ * The bytes returned are removed from the pool, so they are never handed out
+ * twice. The refill thread is woken when the pool runs low.
+ *
+ * @param[out] pBuffer Buffer to fill.
+ * @param[in] length Size of @p pBuffer.
+ *
+ * @return Number of bytes written to @p pBuffer, which is less than @p length
+ * if the pool did not hold enough bytes.
+ */
+size_t EntropyPool_Read( uint8_t * pBuffer,
+                         size_t length );
+
+/**
+ * @brief Fill a buffer with random bytes, taken from the pool when available
+ * and read from the RNG otherwise.
+ *
+ * @param[out] pBuffer Buffer to fill.
+ * @param[in] length Size of @p pBuffer.
+ *
+ * @return 0 on success; otherwise, the error returned by the RNG.
+ */
+int EntropyPool_Get( uint8_t * pBuffer,
+                     size_t length );
+
+#endif /* ifndef ENTROPY_POOL_ZEPHYR_H_ */
@@ -66,6 +66,9 @@
 #include <mbedtls/ssl.h>
 #include <mbedtls/x509.h>
 
+/* Root CA store include. */
+#include "root_ca_store.h"
+
 /**
  * @brief Secured connection context.
  */
@@ -113,6 +116,18 @@ typedef struct NetworkCredentials
 
     const uint8_t * pRootCa;     /**< @brief String representing a trusted server root certificate. */
     size_t rootCaSize;           /**< @brief Size associated with #NetworkCredentials.pRootCa. */
+
+    /**
+     * @brief Store of trusted server root certificates, used instead of
+     * #NetworkCredentials.pRootCa when not NULL.
+     *
+     * Only the root CA matching the issuer of the server certificate chain is
+     * parsed, during verification. This requires mbed TLS to be built with
+     * MBEDTLS_X509_TRUSTED_CERTIFICATE_CALLBACK; otherwise every certificate of
+     * the store is parsed when connecting.
+     */
+    const RootCaStore_t * pRootCaStore;
+
     const uint8_t * pClientCert; /**< @brief String representing the client certificate. */
     size_t clientCertSize;       /**< @brief Size associated with #NetworkCredentials.pClientCert. */
     const uint8_t * pPrivateKey; /**< @brief String representing the client certificate's private key. */
@@ -196,4 +211,17 @@ int32_t MbedTLS_send( NetworkContext_t * pNetworkContext,
                       const void * pBuffer,
                       size_t bytesToSend );
 
+/**
+ * @brief Get the number of received bytes that were already read from the
+ * socket and decrypted, but not yet returned by #MbedTLS_recv.
+ *
+ * These bytes do not make the socket readable, so a caller waiting for the
+ * socket to be readable must check them first.
+ *
+ * @param[in] pNetworkContext The network context.
+ *
+ * @return The number of bytes pending.
+ */
+size_t MbedTLS_GetPendingBytes( NetworkContext_t * pNetworkContext );
+
 #endif /* ifndef MBEDTLS_ZEPHYR_H */
@@ -0,0 +1,142 @@
+/*
+ * AWS IoT Device Embedded C SDK for ZephyrRTOS
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file root_ca_store.h
+ * @brief Store of trusted root CA certificates, indexed by subject, whose
+ * entries are only parsed when a server certificate chain refers to them.
+ */
+
+#ifndef ROOT_CA_STORE_H_
+#define ROOT_CA_STORE_H_
+
+/**************************************************/
+/******* DO NOT CHANGE the following order ********/
+/**************************************************/
+
+/* Logging related header files are required to be included in the following order:
+ * 1. Include the header file "logging_levels.h".
+ * 2. Define LIBRARY_LOG_NAME and  LIBRARY_LOG_LEVEL.
+ * 3. Include the header file "logging_stack.h".
+ */
+
+/* Include header that defines log levels. */
+#include "logging_levels.h"
+
+/* Logging configuration for the root CA store. */
+#ifndef LIBRARY_LOG_NAME
+    #define LIBRARY_LOG_NAME     "RootCaStore"
+#endif
+#ifndef LIBRARY_LOG_LEVEL
+    #define LIBRARY_LOG_LEVEL    LOG_ERROR
+#endif
+
+#include "logging_stack.h"
+
+/************ End of logging configuration ****************/
+
+/* Standard includes. */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* mbed TLS includes. */
+#include <mbedtls/x509_crt.h>
+
+/**
+ * @brief A trusted root CA certificate in the store.
+ *
+ * The certificate itself is not copied; it is expected to live in read-only
+ * memory (flash) for the lifetime of the store. DER-encoded certificates are
+ * parsed in place without copying. PEM-encoded certificates must include the
+ * terminating NULL character in #RootCaEntry_t.certificateSize.
+ */
+typedef struct RootCaEntry
+{
+    const uint8_t * pCertificate; /**< @brief PEM or DER encoded root CA certificate. */
+    size_t certificateSize;       /**< @brief Size associated with #RootCaEntry_t.pCertificate. */
+    uint32_t subjectHash;         /**< @brief Hash of the certificate subject. Set by #RootCaStore_Init. */
+} RootCaEntry_t;
+
+/**
+ * @brief Trusted root CA store, indexed by the hash of each certificate subject.
+ */
+typedef struct RootCaStore
+{
+    RootCaEntry_t * pEntries; /**< @brief Entries of the store, sorted by #RootCaEntry_t.subjectHash. */
+    size_t numEntries;        /**< @brief Number of entries in #RootCaStore_t.pEntries. */
+} RootCaStore_t;
+
+/**
+ * @brief Index the certificates of a root CA store.
+ *
+ * Only the subject of each certificate is located and hashed; certificates are
+ * not parsed into mbed TLS structures and no heap memory is retained.
+ *
+ * @param[out] pStore The store to initialize.
+ * @param[in] pEntries Array of entries with #RootCaEntry_t.pCertificate and
+ * #RootCaEntry_t.certificateSize set. The array is sorted in place and must
+ * remain valid for the lifetime of the store.
+ * @param[in] numEntries Number of entries in @p pEntries.
+ *
+ * @return `true` if every certificate was indexed, `false` if a parameter was
+ * invalid or a certificate could not be decoded.
+ */
+bool RootCaStore_Init( RootCaStore_t * pStore,
+                       RootCaEntry_t * pEntries,
+                       size_t numEntries );
+
+/**
+ * @brief Parse the root CA certificates that may have issued a certificate.
+ *
+ * This function matches the `mbedtls_x509_crt_ca_cb_t` signature and is
+ * registered with `mbedtls_ssl_conf_ca_cb` by the mbed TLS transport when a
+ * store is provided in the network credentials. Only the entries whose subject
+ * hash equals the hash of @p pChild issuer are parsed.
+ *
+ * @param[in] pContext The #RootCaStore_t to search.
+ * @param[in] pChild The certificate whose issuer is looked up.
+ * @param[out] ppCandidates Newly allocated chain of candidate issuers, or NULL
+ * if none matched. Ownership is transferred to mbed TLS.
+ *
+ * @return 0 on success, including when no candidate was found; otherwise, a
+ * negative mbed TLS error code.
+ */
+int RootCaStore_FindCandidates( void * pContext,
+                                const mbedtls_x509_crt * pChild,
+                                mbedtls_x509_crt ** ppCandidates );
+
+/**
+ * @brief Parse every certificate of the store into a chain.
+ *
+ * Used as a fallback when mbed TLS is built without
+ * MBEDTLS_X509_TRUSTED_CERTIFICATE_CALLBACK.
+ *
+ * @param[in] pStore The store to parse.
+ * @param[out] pChain Initialized chain to which the certificates are added.
+ *
+ * @return 0 on success; otherwise, a negative mbed TLS error code.
+ */
+int RootCaStore_ParseAll( const RootCaStore_t * pStore,
+                          mbedtls_x509_crt * pChain );
+
+#endif /* ifndef ROOT_CA_STORE_H_ */
@@ -74,6 +74,17 @@ typedef struct ServerInfo
     uint16_t port;          /**< @brief Server port in host-order. */
 } ServerInfo_t;
 
+/**
+ * @brief Function called on a newly created socket before it is connected.
+ *
+ * @param[in] tcpSocket The socket descriptor.
+ * @param[in] pSetupContext Context passed to #Sockets_ConnectWithSetup.
+ *
+ * @return 0 if the socket is ready to be connected; otherwise, a negative value.
+ */
+typedef int32_t ( * SocketSetupHook_t )( int32_t tcpSocket,
+                                         void * pSetupContext );
+
 /**
  * @brief Establish a connection to server.
  *
@@ -92,6 +103,35 @@ SocketStatus_t Sockets_Connect( int32_t * pTcpSocket,
                                 uint32_t sendTimeoutMs,
                                 uint32_t recvTimeoutMs );
 
+/**
+ * @brief Establish a connection to server, using a given socket protocol and
+ * configuring each socket before it is connected.
+ *
+ * This is used by transports whose protocol runs in the network stack, such as
+ * Zephyr TLS sockets, which perform their handshake when connecting.
+ *
+ * @param[out] pTcpSocket The output parameter to return the created socket descriptor.
+ * @param[in] pServerInfo Server connection info.
+ * @param[in] sendTimeoutMs Timeout for transport send.
+ * @param[in] recvTimeoutMs Timeout for transport recv.
+ * @param[in] protocol Protocol of the socket, such as IPPROTO_TCP or IPPROTO_TLS_1_2.
+ * @param[in] setupHook Function to configure the socket before connecting. Can be NULL.
+ * @param[in] pSetupContext Context passed to @p setupHook.
+ *
+ * @note A timeout of 0 means infinite timeout.
+ *
+ * @return #SOCKETS_SUCCESS if successful;
+ * #SOCKETS_INVALID_PARAMETER, #SOCKETS_DNS_FAILURE, #SOCKETS_API_ERROR,
+ * #SOCKETS_CONNECT_FAILURE on error.
+ */
+SocketStatus_t Sockets_ConnectWithSetup( int32_t * pTcpSocket,
+                                         const ServerInfo_t * pServerInfo,
+                                         uint32_t sendTimeoutMs,
+                                         uint32_t recvTimeoutMs,
+                                         int32_t protocol,
+                                         SocketSetupHook_t setupHook,
+                                         void * pSetupContext );
+
 /**
  * @brief End connection to server.
  *
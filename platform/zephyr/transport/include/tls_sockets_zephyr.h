@@ -0,0 +1,167 @@
+/*
+ * AWS IoT Device Embedded C SDK for ZephyrRTOS
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file tls_sockets_zephyr.h
+ * @brief TLS transport interface header for the TLS sockets of the Zephyr
+ * network stack.
+ *
+ * This transport offers the same interface as the mbed TLS transport of
+ * mbedtls_zephyr.h, with the TLS session managed by the Zephyr network stack
+ * instead of the application. It requires CONFIG_NET_SOCKETS_SOCKOPT_TLS, and
+ * CONFIG_NET_SOCKETS_TLS_MAX_APP_PROTOCOLS to be non-zero for ALPN.
+ */
+
+#ifndef TLS_SOCKETS_ZEPHYR_H_
+#define TLS_SOCKETS_ZEPHYR_H_
+
+/**************************************************/
+/******* DO NOT CHANGE the following order ********/
+/**************************************************/
+
+/* Logging related header files are required to be included in the following order:
+ * 1. Include the header file "logging_levels.h".
+ * 2. Define LIBRARY_LOG_NAME and  LIBRARY_LOG_LEVEL.
+ * 3. Include the header file "logging_stack.h".
+ */
+
+/* Include header that defines log levels. */
+#include "logging_levels.h"
+
+/* Logging configuration for the TLS sockets transport. */
+#ifndef LIBRARY_LOG_NAME
+    #define LIBRARY_LOG_NAME     "TlsSockets"
+#endif
+#ifndef LIBRARY_LOG_LEVEL
+    #define LIBRARY_LOG_LEVEL    LOG_ERROR
+#endif
+
+#include "logging_stack.h"
+
+/************ End of logging configuration ****************/
+
+/* Zephyr credential store include. */
+#include <net/tls_credentials.h>
+
+/* Transport includes. */
+#include "transport_interface.h"
+
+/* Zephyr Sockets library include. */
+#include "sockets_zephyr.h"
+
+/* The credentials and status types are shared with the mbed TLS transport. */
+#include "mbedtls_zephyr.h"
+
+/**
+ * @brief Security tag under which the credentials are added to the Zephyr
+ * credential store when #TlsSocketsParams_t.secTag is 0.
+ */
+#ifndef TLS_SOCKETS_DEFAULT_SEC_TAG
+    #define TLS_SOCKETS_DEFAULT_SEC_TAG    ( 1 )
+#endif
+
+/**
+ * @brief Parameters for the network context of the transport interface
+ * implementation that uses Zephyr TLS sockets.
+ */
+typedef struct TlsSocketsParams
+{
+    int32_t tcpSocket;
+
+    /**
+     * @brief Security tag of the credentials used by the connection, or 0 for
+     * #TLS_SOCKETS_DEFAULT_SEC_TAG.
+     *
+     * The credentials given to #TlsSockets_Connect are added to the Zephyr
+     * credential store under this tag, unless they were already added. When no
+     * credentials are given, the ones already provisioned under this tag are
+     * used.
+     */
+    sec_tag_t secTag;
+} TlsSocketsParams_t;
+
+/**
+ * @brief Create a TLS connection with Zephyr TLS sockets.
+ *
+ * @param[out] pNetworkContext Pointer to a network context to contain the
+ * initialized socket handle.
+ * @param[in] pServerInfo Server connection info.
+ * @param[in] pNetworkCredentials Credentials for the TLS connection. The
+ * certificates and key are referenced by the credential store, not copied, and
+ * must remain valid for as long as they are in use. #NetworkCredentials_t.pRootCaStore
+ * is not supported by this transport.
+ * @param[in] receiveTimeoutMs Receive socket timeout.
+ * @param[in] sendTimeoutMs Send socket timeout.
+ *
+ * @return #TLS_TRANSPORT_SUCCESS, #TLS_TRANSPORT_INVALID_PARAMETER, #TLS_TRANSPORT_INVALID_CREDENTIALS,
+ * #TLS_TRANSPORT_HANDSHAKE_FAILED, #TLS_TRANSPORT_INTERNAL_ERROR, or #TLS_TRANSPORT_CONNECT_FAILURE.
+ */
+TlsTransportStatus_t TlsSockets_Connect( NetworkContext_t * pNetworkContext,
+                                         const ServerInfo_t * pServerInfo,
+                                         const NetworkCredentials_t * pNetworkCredentials,
+                                         uint32_t receiveTimeoutMs,
+                                         uint32_t sendTimeoutMs );
+
+/**
+ * @brief Gracefully disconnect an established TLS connection.
+ *
+ * @param[in] pNetworkContext Network context.
+ */
+SocketStatus_t TlsSockets_Disconnect( NetworkContext_t * pNetworkContext );
+
+/**
+ * @brief Receives data from an established TLS connection.
+ *
+ * This is the TLS sockets version of the transport interface's
+ * #TransportRecv_t function.
+ *
+ * @param[in] pNetworkContext The Network context.
+ * @param[out] pBuffer Buffer to receive bytes into.
+ * @param[in] bytesToRecv Number of bytes to receive from the network.
+ *
+ * @return Number of bytes (> 0) received if successful;
+ * 0 if the socket times out without reading any bytes;
+ * negative value on error.
+ */
+int32_t TlsSockets_recv( NetworkContext_t * pNetworkContext,
+                         void * pBuffer,
+                         size_t bytesToRecv );
+
+/**
+ * @brief Sends data over an established TLS connection.
+ *
+ * This is the TLS sockets version of the transport interface's
+ * #TransportSend_t function.
+ *
+ * @param[in] pNetworkContext The network context.
+ * @param[in] pBuffer Buffer containing the bytes to send.
+ * @param[in] bytesToSend Number of bytes to send from the buffer.
+ *
+ * @return Number of bytes (> 0) sent on success;
+ * 0 if the socket times out without sending any bytes;
+ * else a negative value to represent error.
+ */
+int32_t TlsSockets_send( NetworkContext_t * pNetworkContext,
+                         const void * pBuffer,
+                         size_t bytesToSend );
+
+#endif /* ifndef TLS_SOCKETS_ZEPHYR_H_ */
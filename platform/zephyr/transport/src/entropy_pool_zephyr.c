@@ -0,0 +1,223 @@
+/*
+ * AWS IoT Device Embedded C SDK for ZephyrRTOS
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file entropy_pool_zephyr.c
+ * @brief Implementation of the entropy pool, refilled in the background from
+ * the Zephyr cryptographically secure RNG.
+ */
+
+/* Standard includes. */
+#include <assert.h>
+#include <string.h>
+
+/* Zephyr includes. */
+#include <zephyr.h>
+#include <random/rand32.h>
+
+#include "entropy_pool_zephyr.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Random bytes of the pool. Only the first #entropyPoolCount bytes are
+ * valid; bytes are taken from the end.
+ */
+static uint8_t entropyPool[ ENTROPY_POOL_SIZE ];
+
+/**
+ * @brief Number of valid bytes in #entropyPool.
+ */
+static size_t entropyPoolCount = 0U;
+
+/**
+ * @brief Lock protecting #entropyPool and #entropyPoolCount. A spinlock is used
+ * since it is only held to copy a few bytes and readers must not block.
+ */
+static struct k_spinlock entropyPoolLock;
+
+/**
+ * @brief Semaphore given to wake the refill thread.
+ */
+static K_SEM_DEFINE( refillSemaphore, 0, 1 );
+
+/**
+ * @brief Stack of the refill thread.
+ */
+static K_THREAD_STACK_DEFINE( refillThreadStack, ENTROPY_POOL_THREAD_STACK_SIZE );
+
+/**
+ * @brief The refill thread.
+ */
+static struct k_thread refillThread;
+
+/**
+ * @brief Set once the refill thread is started.
+ */
+static atomic_t poolStarted = ATOMIC_INIT( 0 );
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Fill the pool from the RNG until it is full or the RNG fails.
+ *
+ * The RNG is read outside of the lock, so readers are never held up by it.
+ */
+static void refillPool( void );
+
+/**
+ * @brief Entry of the refill thread.
+ *
+ * @param[in] pArg1 Unused.
+ * @param[in] pArg2 Unused.
+ * @param[in] pArg3 Unused.
+ */
+static void refillThreadEntry( void * pArg1,
+                               void * pArg2,
+                               void * pArg3 );
+
+/*-----------------------------------------------------------*/
+
+static void refillPool( void )
+{
+    uint8_t chunk[ ENTROPY_POOL_REFILL_CHUNK_SIZE ];
+    size_t space = 0U, chunkSize = 0U;
+    k_spinlock_key_t key;
+    int rngStatus = 0;
+
+    do
+    {
+        key = k_spin_lock( &entropyPoolLock );
+        space = ENTROPY_POOL_SIZE - entropyPoolCount;
+        k_spin_unlock( &entropyPoolLock, key );
+
+        if( space > 0U )
+        {
+            chunkSize = ( space < sizeof( chunk ) ) ? space : sizeof( chunk );
+            rngStatus = sys_csrand_get( chunk, chunkSize );
+
+            if( rngStatus == 0 )
+            {
+                key = k_spin_lock( &entropyPoolLock );
+
+                /* Readers only remove bytes, so the space cannot have shrunk. */
+                memcpy( &entropyPool[ entropyPoolCount ], chunk, chunkSize );
+                entropyPoolCount += chunkSize;
+                k_spin_unlock( &entropyPoolLock, key );
+            }
+            else
+            {
+                LogError( ( "Failed to refill the entropy pool: Error=%d.", rngStatus ) );
+            }
+        }
+    } while( ( space > 0U ) && ( rngStatus == 0 ) );
+
+    /* Do not leave random bytes on the stack. */
+    memset( chunk, 0, sizeof( chunk ) );
+}
+/*-----------------------------------------------------------*/
+
+static void refillThreadEntry( void * pArg1,
+                               void * pArg2,
+                               void * pArg3 )
+{
+    ( void ) pArg1;
+    ( void ) pArg2;
+    ( void ) pArg3;
+
+    for( ; ; )
+    {
+        refillPool();
+
+        /* Wait until readers take the pool below the refill threshold. */
+        ( void ) k_sem_take( &refillSemaphore, K_FOREVER );
+    }
+}
+/*-----------------------------------------------------------*/
+
+void EntropyPool_Start( void )
+{
+    if( atomic_cas( &poolStarted, 0, 1 ) )
+    {
+        ( void ) k_thread_create( &refillThread,
+                                  refillThreadStack,
+                                  K_THREAD_STACK_SIZEOF( refillThreadStack ),
+                                  refillThreadEntry,
+                                  NULL,
+                                  NULL,
+                                  NULL,
+                                  ENTROPY_POOL_THREAD_PRIORITY,
+                                  0,
+                                  K_NO_WAIT );
+        ( void ) k_thread_name_set( &refillThread, "entropy_pool" );
+    }
+}
+/*-----------------------------------------------------------*/
+
+size_t EntropyPool_Read( uint8_t * pBuffer,
+                         size_t length )
+{
+    size_t bytesRead = 0U, bytesLeft = 0U;
+    k_spinlock_key_t key;
+
+    assert( pBuffer != NULL );
+
+    key = k_spin_lock( &entropyPoolLock );
+
+    bytesRead = ( length < entropyPoolCount ) ? length : entropyPoolCount;
+    entropyPoolCount -= bytesRead;
+    memcpy( pBuffer, &entropyPool[ entropyPoolCount ], bytesRead );
+
+    /* Bytes handed out must not remain in the pool. */
+    memset( &entropyPool[ entropyPoolCount ], 0, bytesRead );
+    bytesLeft = entropyPoolCount;
+
+    k_spin_unlock( &entropyPoolLock, key );
+
+    if( ( bytesLeft < ENTROPY_POOL_REFILL_THRESHOLD ) && ( atomic_get( &poolStarted ) != 0 ) )
+    {
+        k_sem_give( &refillSemaphore );
+    }
+
+    return bytesRead;
+}
+/*-----------------------------------------------------------*/
+
+int EntropyPool_Get( uint8_t * pBuffer,
+                     size_t length )
+{
+    int rngStatus = 0;
+    size_t bytesRead = 0U;
+
+    assert( pBuffer != NULL );
+
+    bytesRead = EntropyPool_Read( pBuffer, length );
+
+    /* Read whatever the pool could not provide from the RNG. */
+    if( bytesRead < length )
+    {
+        rngStatus = sys_csrand_get( &pBuffer[ bytesRead ], length - bytesRead );
+    }
+
+    return rngStatus;
+}
+/*-----------------------------------------------------------*/
@@ -32,7 +32,6 @@
 
 /* Zephyr includes. */
 #include <net/socket.h>
-#include <random/rand32.h>
 
 /* mbed TLS includes. */
 #include <mbedtls/error.h>
@@ -40,6 +39,9 @@
 /* TLS transport header. */
 #include "mbedtls_zephyr.h"
 
+/* Entropy pool header. */
+#include "entropy_pool_zephyr.h"
+
 /*-----------------------------------------------------------*/
 
 /**
@@ -166,6 +168,22 @@ static int32_t setRootCa( SSLContext_t * pSslContext,
                           const uint8_t * pRootCa,
                           size_t rootCaSize );
 
+/**
+ * @brief Use a root CA store to look up trusted root certificates.
+ *
+ * When mbed TLS supports trusted certificate callbacks, the store is searched
+ * during verification and only the root CA matching the issuer of the server
+ * certificate chain is parsed. Otherwise, every certificate of the store is
+ * parsed into the trusted list of root certificates.
+ *
+ * @param[out] pSslContext SSL context to which the store is to be added.
+ * @param[in] pRootCaStore Indexed store of trusted server root CAs.
+ *
+ * @return 0 on success; otherwise, failure;
+ */
+static int32_t setRootCaStore( SSLContext_t * pSslContext,
+                               const RootCaStore_t * pRootCaStore );
+
 /**
  * @brief Set X509 certificate as client certificate for the server to authenticate.
  *
@@ -295,8 +313,9 @@ static int mbedtls_platform_entropy_poll( void * data,
     ( void ) data;
 
     /* TLS requires a secure random number generator; thus, this function uses
-     * uses the RNG function provided by Zephyr.  */
-    rngStatus = sys_csrand_get( output, len );
+     * the RNG provided by Zephyr, through the entropy pool so that bytes
+     * generated in the background are used first. */
+    rngStatus = EntropyPool_Get( output, len );
 
     if( rngStatus == 0 )
     {
@@ -371,6 +390,45 @@ static int32_t setRootCa( SSLContext_t * pSslContext,
 }
 /*-----------------------------------------------------------*/
 
+static int32_t setRootCaStore( SSLContext_t * pSslContext,
+                               const RootCaStore_t * pRootCaStore )
+{
+    int32_t mbedtlsError = 0;
+
+    assert( pSslContext != NULL );
+    assert( pRootCaStore != NULL );
+
+    #if defined( MBEDTLS_X509_TRUSTED_CERTIFICATE_CALLBACK )
+        /* Root CAs are parsed on demand by the store during verification. */
+        mbedtls_ssl_conf_ca_cb( &( pSslContext->config ),
+                                RootCaStore_FindCandidates,
+                                ( void * ) pRootCaStore );
+    #else
+        LogDebug( ( "MBEDTLS_X509_TRUSTED_CERTIFICATE_CALLBACK is not enabled: "
+                    "Parsing all %u root CA certificates of the store.",
+                    ( unsigned int ) pRootCaStore->numEntries ) );
+
+        mbedtlsError = RootCaStore_ParseAll( pRootCaStore,
+                                             &( pSslContext->rootCa ) );
+
+        if( mbedtlsError != 0 )
+        {
+            LogError( ( "Failed to parse the root CA store: mbedTLSError= %s : %s.",
+                        mbedtlsHighLevelCodeOrDefault( mbedtlsError ),
+                        mbedtlsLowLevelCodeOrDefault( mbedtlsError ) ) );
+        }
+        else
+        {
+            mbedtls_ssl_conf_ca_chain( &( pSslContext->config ),
+                                       &( pSslContext->rootCa ),
+                                       NULL );
+        }
+    #endif /* if defined( MBEDTLS_X509_TRUSTED_CERTIFICATE_CALLBACK ) */
+
+    return mbedtlsError;
+}
+/*-----------------------------------------------------------*/
+
 static int32_t setClientCertificate( SSLContext_t * pSslContext,
                                      const uint8_t * pClientCert,
                                      size_t clientCertSize )
@@ -443,9 +501,17 @@ static int32_t setCredentials( SSLContext_t * pSslContext,
     mbedtls_ssl_conf_cert_profile( &( pSslContext->config ),
                                    &( pSslContext->certProfile ) );
 
-    mbedtlsError = setRootCa( pSslContext,
-                              pNetworkCredentials->pRootCa,
-                              pNetworkCredentials->rootCaSize );
+    if( pNetworkCredentials->pRootCaStore != NULL )
+    {
+        mbedtlsError = setRootCaStore( pSslContext,
+                                       pNetworkCredentials->pRootCaStore );
+    }
+    else
+    {
+        mbedtlsError = setRootCa( pSslContext,
+                                  pNetworkCredentials->pRootCa,
+                                  pNetworkCredentials->rootCaSize );
+    }
 
     if( ( pNetworkCredentials->pClientCert != NULL ) &&
         ( pNetworkCredentials->pPrivateKey != NULL ) )
@@ -547,7 +613,8 @@ static TlsTransportStatus_t tlsSetup( NetworkContext_t * pNetworkContext,
     assert( pNetworkContext->pParams != NULL );
     assert( pHostName != NULL );
     assert( pNetworkCredentials != NULL );
-    assert( pNetworkCredentials->pRootCa != NULL );
+    assert( ( pNetworkCredentials->pRootCa != NULL ) ||
+            ( pNetworkCredentials->pRootCaStore != NULL ) );
 
     pTlsTransportParams = pNetworkContext->pParams;
     /* Initialize the mbed TLS context structures. */
@@ -728,9 +795,10 @@ TlsTransportStatus_t MbedTLS_Connect( NetworkContext_t * pNetworkContext,
                     pNetworkCredentials ) );
         returnStatus = TLS_TRANSPORT_INVALID_PARAMETER;
     }
-    else if( ( pNetworkCredentials->pRootCa == NULL ) )
+    else if( ( pNetworkCredentials->pRootCa == NULL ) &&
+             ( pNetworkCredentials->pRootCaStore == NULL ) )
     {
-        LogError( ( "pRootCa cannot be NULL." ) );
+        LogError( ( "pRootCa and pRootCaStore cannot both be NULL." ) );
         returnStatus = TLS_TRANSPORT_INVALID_PARAMETER;
     }
 
@@ -1000,3 +1068,18 @@ int32_t MbedTLS_send( NetworkContext_t * pNetworkContext,
     return tlsStatus;
 }
 /*-----------------------------------------------------------*/
+
+size_t MbedTLS_GetPendingBytes( NetworkContext_t * pNetworkContext )
+{
+    size_t pendingBytes = 0U;
+
+    if( ( pNetworkContext != NULL ) && ( pNetworkContext->pParams != NULL ) )
+    {
+        /* Bytes of a decrypted record that were read from the socket, but not
+         * yet by the application. */
+        pendingBytes = mbedtls_ssl_get_bytes_avail( &( pNetworkContext->pParams->sslContext.context ) );
+    }
+
+    return pendingBytes;
+}
+/*-----------------------------------------------------------*/
@@ -0,0 +1,498 @@
+/*
+ * AWS IoT Device Embedded C SDK for ZephyrRTOS
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file root_ca_store.c
+ * @brief Implementation of the lazily parsed root CA store.
+ */
+
+/* Standard includes. */
+#include <assert.h>
+#include <string.h>
+
+/* mbed TLS includes. */
+#include <mbedtls/error.h>
+#include <mbedtls/pem.h>
+#include <mbedtls/platform.h>
+
+/* Root CA store header. */
+#include "root_ca_store.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief ASN.1 tag of a constructed SEQUENCE.
+ */
+#define DER_TAG_SEQUENCE            ( 0x30U )
+
+/**
+ * @brief ASN.1 tag of the explicit version field of a TBSCertificate.
+ */
+#define DER_TAG_EXPLICIT_VERSION    ( 0xA0U )
+
+/**
+ * @brief FNV-1a 32 bit offset basis.
+ */
+#define FNV_OFFSET_BASIS            ( 2166136261UL )
+
+/**
+ * @brief FNV-1a 32 bit prime.
+ */
+#define FNV_PRIME                   ( 16777619UL )
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Hash a raw, DER-encoded X.509 name.
+ *
+ * @param[in] pName The name, including its tag and length.
+ * @param[in] nameLength Length of @p pName.
+ *
+ * @return FNV-1a hash of the name.
+ */
+static uint32_t hashName( const uint8_t * pName,
+                          size_t nameLength );
+
+/**
+ * @brief Read the tag and length of a DER element.
+ *
+ * @param[in, out] ppCursor Start of the element; advanced to its contents.
+ * @param[in] pEnd End of the buffer containing the element.
+ * @param[out] pTag Tag of the element.
+ * @param[out] pLength Length of the contents of the element.
+ *
+ * @return `true` if the header was read and the contents fit in the buffer.
+ */
+static bool derReadHeader( const uint8_t ** ppCursor,
+                           const uint8_t * pEnd,
+                           uint8_t * pTag,
+                           size_t * pLength );
+
+/**
+ * @brief Locate the subject of a DER-encoded certificate without parsing it.
+ *
+ * @param[in] pDer The DER-encoded certificate.
+ * @param[in] derLength Length of @p pDer.
+ * @param[out] ppSubject Start of the subject, including its tag and length.
+ * @param[out] pSubjectLength Length of the subject.
+ *
+ * @return `true` if the subject was found.
+ */
+static bool derFindSubject( const uint8_t * pDer,
+                            size_t derLength,
+                            const uint8_t ** ppSubject,
+                            size_t * pSubjectLength );
+
+/**
+ * @brief Compute the subject hash of a store entry.
+ *
+ * @param[in, out] pEntry Entry whose #RootCaEntry_t.subjectHash is set.
+ *
+ * @return `true` on success; `false` if the certificate could not be decoded.
+ */
+static bool indexEntry( RootCaEntry_t * pEntry );
+
+/**
+ * @brief Parse a store entry and add it to a certificate chain.
+ *
+ * DER certificates reference the entry in place; PEM certificates are decoded
+ * into a heap buffer owned by the chain.
+ *
+ * @param[in] pEntry Entry to parse.
+ * @param[in, out] pChain Chain to add the certificate to.
+ *
+ * @return 0 on success; otherwise, a negative mbed TLS error code.
+ */
+static int parseEntry( const RootCaEntry_t * pEntry,
+                       mbedtls_x509_crt * pChain );
+
+/*-----------------------------------------------------------*/
+
+static uint32_t hashName( const uint8_t * pName,
+                          size_t nameLength )
+{
+    uint32_t hash = FNV_OFFSET_BASIS;
+    size_t i;
+
+    for( i = 0; i < nameLength; i++ )
+    {
+        hash ^= pName[ i ];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+/*-----------------------------------------------------------*/
+
+static bool derReadHeader( const uint8_t ** ppCursor,
+                           const uint8_t * pEnd,
+                           uint8_t * pTag,
+                           size_t * pLength )
+{
+    const uint8_t * pCursor = *ppCursor;
+    size_t length = 0U, numLengthBytes = 0U, i;
+    bool status = false;
+
+    if( ( pEnd - pCursor ) >= 2 )
+    {
+        *pTag = *pCursor++;
+        length = *pCursor++;
+
+        /* Lengths of 128 bytes or more use the long form, where the low bits
+         * give the number of length bytes that follow. */
+        if( ( length & 0x80U ) != 0U )
+        {
+            numLengthBytes = length & 0x7FU;
+            length = 0U;
+
+            if( ( numLengthBytes > 0U ) &&
+                ( numLengthBytes <= sizeof( uint32_t ) ) &&
+                ( ( size_t ) ( pEnd - pCursor ) >= numLengthBytes ) )
+            {
+                for( i = 0; i < numLengthBytes; i++ )
+                {
+                    length = ( length << 8 ) | *pCursor++;
+                }
+
+                status = true;
+            }
+        }
+        else
+        {
+            status = true;
+        }
+    }
+
+    if( status && ( ( size_t ) ( pEnd - pCursor ) >= length ) )
+    {
+        *ppCursor = pCursor;
+        *pLength = length;
+    }
+    else
+    {
+        status = false;
+    }
+
+    return status;
+}
+/*-----------------------------------------------------------*/
+
+static bool derFindSubject( const uint8_t * pDer,
+                            size_t derLength,
+                            const uint8_t ** ppSubject,
+                            size_t * pSubjectLength )
+{
+    const uint8_t * pCursor = pDer;
+    const uint8_t * pEnd = pDer + derLength;
+    const uint8_t * pElement = NULL;
+    uint8_t tag = 0U;
+    size_t length = 0U;
+    uint32_t field = 0U;
+    bool status = false;
+
+    /* Certificate ::= SEQUENCE { tbsCertificate TBSCertificate, ... } */
+    status = derReadHeader( &pCursor, pEnd, &tag, &length ) && ( tag == DER_TAG_SEQUENCE );
+
+    if( status )
+    {
+        pEnd = pCursor + length;
+        status = derReadHeader( &pCursor, pEnd, &tag, &length ) && ( tag == DER_TAG_SEQUENCE );
+    }
+
+    if( status )
+    {
+        pEnd = pCursor + length;
+
+        /* TBSCertificate ::= SEQUENCE { [0] version OPTIONAL, serialNumber,
+         * signature, issuer, validity, subject, ... }
+         * Skip the four fields preceding the subject, plus the version if present. */
+        while( status && ( field < 5U ) )
+        {
+            pElement = pCursor;
+            status = derReadHeader( &pCursor, pEnd, &tag, &length );
+
+            if( status )
+            {
+                pCursor += length;
+
+                if( tag != DER_TAG_EXPLICIT_VERSION )
+                {
+                    field++;
+                }
+            }
+        }
+    }
+
+    /* The last element read is the subject Name. */
+    if( status && ( tag == DER_TAG_SEQUENCE ) )
+    {
+        *ppSubject = pElement;
+        *pSubjectLength = ( size_t ) ( pCursor - pElement );
+    }
+    else
+    {
+        status = false;
+    }
+
+    return status;
+}
+/*-----------------------------------------------------------*/
+
+static bool indexEntry( RootCaEntry_t * pEntry )
+{
+    const uint8_t * pSubject = NULL;
+    size_t subjectLength = 0U;
+    bool status = false;
+
+    #if defined( MBEDTLS_PEM_PARSE_C )
+        mbedtls_pem_context pem;
+        size_t usedLength = 0U;
+    #endif
+
+    if( pEntry->pCertificate[ 0 ] == DER_TAG_SEQUENCE )
+    {
+        status = derFindSubject( pEntry->pCertificate,
+                                 pEntry->certificateSize,
+                                 &pSubject,
+                                 &subjectLength );
+
+        if( status )
+        {
+            pEntry->subjectHash = hashName( pSubject, subjectLength );
+        }
+    }
+
+    #if defined( MBEDTLS_PEM_PARSE_C )
+        else
+        {
+            /* Decode the PEM certificate once to locate its subject. The decoded
+             * buffer is released immediately. */
+            mbedtls_pem_init( &pem );
+
+            status = ( mbedtls_pem_read_buffer( &pem,
+                                                "-----BEGIN CERTIFICATE-----",
+                                                "-----END CERTIFICATE-----",
+                                                pEntry->pCertificate,
+                                                NULL,
+                                                0,
+                                                &usedLength ) == 0 );
+
+            if( status )
+            {
+                status = derFindSubject( pem.buf, pem.buflen, &pSubject, &subjectLength );
+            }
+
+            if( status )
+            {
+                pEntry->subjectHash = hashName( pSubject, subjectLength );
+            }
+
+            mbedtls_pem_free( &pem );
+        }
+    #endif /* if defined( MBEDTLS_PEM_PARSE_C ) */
+
+    return status;
+}
+/*-----------------------------------------------------------*/
+
+static int parseEntry( const RootCaEntry_t * pEntry,
+                       mbedtls_x509_crt * pChain )
+{
+    int mbedtlsError = 0;
+
+    if( pEntry->pCertificate[ 0 ] == DER_TAG_SEQUENCE )
+    {
+        /* The certificate is in flash, so it can be referenced in place. */
+        mbedtlsError = mbedtls_x509_crt_parse_der_nocopy( pChain,
+                                                          pEntry->pCertificate,
+                                                          pEntry->certificateSize );
+    }
+    else
+    {
+        mbedtlsError = mbedtls_x509_crt_parse( pChain,
+                                               pEntry->pCertificate,
+                                               pEntry->certificateSize );
+    }
+
+    if( mbedtlsError != 0 )
+    {
+        LogError( ( "Failed to parse root CA certificate with subject hash 0x%08x: mbedTLSError= %s : %s.",
+                    ( unsigned int ) pEntry->subjectHash,
+                    mbedtls_high_level_strerr( mbedtlsError ),
+                    mbedtls_low_level_strerr( mbedtlsError ) ) );
+    }
+
+    return mbedtlsError;
+}
+/*-----------------------------------------------------------*/
+
+bool RootCaStore_Init( RootCaStore_t * pStore,
+                       RootCaEntry_t * pEntries,
+                       size_t numEntries )
+{
+    RootCaEntry_t entry;
+    size_t i, j;
+    bool status = true;
+
+    if( ( pStore == NULL ) || ( pEntries == NULL ) || ( numEntries == 0U ) )
+    {
+        LogError( ( "Invalid parameter. pStore=%p, pEntries=%p, numEntries=%u.",
+                    pStore,
+                    pEntries,
+                    ( unsigned int ) numEntries ) );
+        status = false;
+    }
+
+    for( i = 0; status && ( i < numEntries ); i++ )
+    {
+        if( ( pEntries[ i ].pCertificate == NULL ) || ( pEntries[ i ].certificateSize == 0U ) )
+        {
+            LogError( ( "Root CA store entry %u has no certificate.", ( unsigned int ) i ) );
+            status = false;
+        }
+        else if( !indexEntry( &( pEntries[ i ] ) ) )
+        {
+            LogError( ( "Failed to locate the subject of root CA store entry %u.", ( unsigned int ) i ) );
+            status = false;
+        }
+        else
+        {
+            /* Insert the entry into the sorted prefix of the array. Stores are
+             * small, so an insertion sort is sufficient. */
+            entry = pEntries[ i ];
+
+            for( j = i; ( j > 0U ) && ( pEntries[ j - 1U ].subjectHash > entry.subjectHash ); j-- )
+            {
+                pEntries[ j ] = pEntries[ j - 1U ];
+            }
+
+            pEntries[ j ] = entry;
+        }
+    }
+
+    if( status )
+    {
+        pStore->pEntries = pEntries;
+        pStore->numEntries = numEntries;
+    }
+
+    return status;
+}
+/*-----------------------------------------------------------*/
+
+int RootCaStore_FindCandidates( void * pContext,
+                                const mbedtls_x509_crt * pChild,
+                                mbedtls_x509_crt ** ppCandidates )
+{
+    const RootCaStore_t * pStore = ( const RootCaStore_t * ) pContext;
+    mbedtls_x509_crt * pChain = NULL;
+    uint32_t issuerHash = 0U;
+    size_t low = 0U, high = 0U, middle = 0U;
+    int mbedtlsError = 0;
+    bool found = false;
+
+    assert( pStore != NULL );
+    assert( pChild != NULL );
+    assert( ppCandidates != NULL );
+
+    *ppCandidates = NULL;
+    issuerHash = hashName( pChild->issuer_raw.p, pChild->issuer_raw.len );
+
+    /* Find the first entry with a subject hash not less than the issuer hash. */
+    high = pStore->numEntries;
+
+    while( low < high )
+    {
+        middle = low + ( ( high - low ) / 2U );
+
+        if( pStore->pEntries[ middle ].subjectHash < issuerHash )
+        {
+            low = middle + 1U;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    /* Parse every entry sharing the hash; mbed TLS compares the names to pick
+     * the actual issuer. */
+    for( ; ( low < pStore->numEntries ) && ( pStore->pEntries[ low ].subjectHash == issuerHash ); low++ )
+    {
+        if( pChain == NULL )
+        {
+            pChain = mbedtls_calloc( 1, sizeof( mbedtls_x509_crt ) );
+
+            if( pChain == NULL )
+            {
+                LogError( ( "Failed to allocate a root CA certificate context." ) );
+                mbedtlsError = MBEDTLS_ERR_X509_ALLOC_FAILED;
+                break;
+            }
+
+            mbedtls_x509_crt_init( pChain );
+        }
+
+        /* An entry that fails to parse is skipped so that another candidate
+         * may still verify the chain. */
+        if( parseEntry( &( pStore->pEntries[ low ] ), pChain ) == 0 )
+        {
+            found = true;
+        }
+    }
+
+    if( found )
+    {
+        *ppCandidates = pChain;
+    }
+    else if( pChain != NULL )
+    {
+        mbedtls_x509_crt_free( pChain );
+        mbedtls_free( pChain );
+    }
+    else
+    {
+        LogDebug( ( "No root CA in the store matches issuer hash 0x%08x.",
+                    ( unsigned int ) issuerHash ) );
+    }
+
+    return mbedtlsError;
+}
+/*-----------------------------------------------------------*/
+
+int RootCaStore_ParseAll( const RootCaStore_t * pStore,
+                          mbedtls_x509_crt * pChain )
+{
+    size_t i;
+    int mbedtlsError = 0;
+
+    assert( pStore != NULL );
+    assert( pChain != NULL );
+
+    for( i = 0; ( i < pStore->numEntries ) && ( mbedtlsError == 0 ); i++ )
+    {
+        mbedtlsError = parseEntry( &( pStore->pEntries[ i ] ), pChain );
+    }
+
+    return mbedtlsError;
+}
+/*-----------------------------------------------------------*/
@@ -65,16 +65,41 @@ static SocketStatus_t resolveHostName( const char * pHostName,
  * @param[in] pHostName Server host name.
  * @param[in] hostNameLength Length associated with host name.
  * @param[in] port Server port in host-order.
+ * @param[in] protocol Protocol of the created socket.
+ * @param[in] setupHook Function to configure the socket before connecting. Can be NULL.
+ * @param[in] pSetupContext Context passed to @p setupHook.
  * @param[out] pTcpSocket The output parameter to return the created socket.
  *
- * @return #SOCKETS_SUCCESS if successful; #SOCKETS_CONNECT_FAILURE on error.
+ * @return #SOCKETS_SUCCESS if successful; #SOCKETS_API_ERROR, #SOCKETS_CONNECT_FAILURE on error.
  */
 static SocketStatus_t attemptConnection( struct zsock_addrinfo * pListHead,
                                          const char * pHostName,
                                          size_t hostNameLength,
                                          uint16_t port,
+                                         int32_t protocol,
+                                         SocketSetupHook_t setupHook,
+                                         void * pSetupContext,
                                          int32_t * pTcpSocket );
 
+/**
+ * @brief Validate the parameters of a connection request and resolve the host.
+ *
+ * @param[out] pTcpSocket The output parameter to return the created socket descriptor.
+ * @param[in] pServerInfo Server connection info.
+ * @param[in] protocol Protocol of the created socket.
+ * @param[in] setupHook Function to configure the socket before connecting. Can be NULL.
+ * @param[in] pSetupContext Context passed to @p setupHook.
+ *
+ * @return #SOCKETS_SUCCESS if successful;
+ * #SOCKETS_INVALID_PARAMETER, #SOCKETS_DNS_FAILURE, #SOCKETS_API_ERROR,
+ * #SOCKETS_CONNECT_FAILURE on error.
+ */
+static SocketStatus_t connectToServer( int32_t * pTcpSocket,
+                                       const ServerInfo_t * pServerInfo,
+                                       int32_t protocol,
+                                       SocketSetupHook_t setupHook,
+                                       void * pSetupContext );
+
 /**
  * @brief Connect to server using the provided address record.
  *
@@ -194,6 +219,9 @@ static SocketStatus_t attemptConnection( struct zsock_addrinfo * pListHead,
                                          const char * pHostName,
                                          size_t hostNameLength,
                                          uint16_t port,
+                                         int32_t protocol,
+                                         SocketSetupHook_t setupHook,
+                                         void * pSetupContext,
                                          int32_t * pTcpSocket )
 {
     SocketStatus_t returnStatus = SOCKETS_CONNECT_FAILURE;
@@ -217,13 +245,23 @@ static SocketStatus_t attemptConnection( struct zsock_addrinfo * pListHead,
     {
         *pTcpSocket = zsock_socket( pIndex->ai_family,
                                     pIndex->ai_socktype,
-                                    pIndex->ai_protocol );
+                                    protocol );
 
         if( *pTcpSocket == -1 )
         {
             continue;
         }
 
+        /* Let the caller configure the socket before the connection, which
+         * is where protocols offloaded to the stack perform their handshake. */
+        if( ( setupHook != NULL ) && ( setupHook( *pTcpSocket, pSetupContext ) != 0 ) )
+        {
+            LogError( ( "Failed to set up socket %d before connecting.", ( int ) *pTcpSocket ) );
+            ( void ) zsock_close( *pTcpSocket );
+            returnStatus = SOCKETS_API_ERROR;
+            break;
+        }
+
         /* Attempt to connect to a resolved DNS address of the host. */
         returnStatus = connectToAddress( pIndex->ai_addr, port, *pTcpSocket );
 
@@ -253,10 +291,11 @@ static SocketStatus_t attemptConnection( struct zsock_addrinfo * pListHead,
 }
 /*-----------------------------------------------------------*/
 
-SocketStatus_t Sockets_Connect( int32_t * pTcpSocket,
-                                const ServerInfo_t * pServerInfo,
-                                uint32_t sendTimeoutMs,
-                                uint32_t recvTimeoutMs )
+static SocketStatus_t connectToServer( int32_t * pTcpSocket,
+                                       const ServerInfo_t * pServerInfo,
+                                       int32_t protocol,
+                                       SocketSetupHook_t setupHook,
+                                       void * pSetupContext )
 {
     SocketStatus_t returnStatus = SOCKETS_SUCCESS;
     struct zsock_addrinfo * pListHead = NULL;
@@ -299,6 +338,9 @@ SocketStatus_t Sockets_Connect( int32_t * pTcpSocket,
                                           pServerInfo->pHostName,
                                           pServerInfo->hostNameLength,
                                           pServerInfo->port,
+                                          protocol,
+                                          setupHook,
+                                          pSetupContext,
                                           pTcpSocket );
     }
 
@@ -306,6 +348,41 @@ SocketStatus_t Sockets_Connect( int32_t * pTcpSocket,
 }
 /*-----------------------------------------------------------*/
 
+SocketStatus_t Sockets_Connect( int32_t * pTcpSocket,
+                                const ServerInfo_t * pServerInfo,
+                                uint32_t sendTimeoutMs,
+                                uint32_t recvTimeoutMs )
+{
+    ( void ) sendTimeoutMs;
+    ( void ) recvTimeoutMs;
+
+    return connectToServer( pTcpSocket,
+                            pServerInfo,
+                            IPPROTO_TCP,
+                            NULL,
+                            NULL );
+}
+/*-----------------------------------------------------------*/
+
+SocketStatus_t Sockets_ConnectWithSetup( int32_t * pTcpSocket,
+                                         const ServerInfo_t * pServerInfo,
+                                         uint32_t sendTimeoutMs,
+                                         uint32_t recvTimeoutMs,
+                                         int32_t protocol,
+                                         SocketSetupHook_t setupHook,
+                                         void * pSetupContext )
+{
+    ( void ) sendTimeoutMs;
+    ( void ) recvTimeoutMs;
+
+    return connectToServer( pTcpSocket,
+                            pServerInfo,
+                            protocol,
+                            setupHook,
+                            pSetupContext );
+}
+/*-----------------------------------------------------------*/
+
 SocketStatus_t Sockets_Disconnect( int32_t tcpSocket )
 {
     SocketStatus_t returnStatus = SOCKETS_SUCCESS;
@@ -0,0 +1,498 @@
+/*
+ * AWS IoT Device Embedded C SDK for ZephyrRTOS
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/**
+ * @file tls_sockets_zephyr.c
+ * @brief TLS transport interface implementations. This implementation uses
+ * the TLS sockets of the Zephyr network stack.
+ */
+
+/* Standard includes. */
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+
+/* Zephyr includes. */
+#include <net/socket.h>
+#include <net/tls_credentials.h>
+
+/* TLS sockets transport header. */
+#include "tls_sockets_zephyr.h"
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Each compilation unit that consumes the NetworkContext must define it.
+ * It should contain a single pointer as seen below whenever the header file
+ * of this transport implementation is included to your project.
+ *
+ * @note When using multiple transports in the same compilation unit,
+ *       define this pointer as void *.
+ */
+struct NetworkContext
+{
+    TlsSocketsParams_t * pParams;
+};
+
+/**
+ * @brief Context of the socket setup hook called before the TLS handshake.
+ */
+typedef struct SocketSetupContext
+{
+    const char * pHostName;                          /**< @brief Server name used for SNI. */
+    size_t hostNameLength;                           /**< @brief Length of #SocketSetupContext_t.pHostName. */
+    const NetworkCredentials_t * pNetworkCredentials; /**< @brief Credentials of the connection. */
+    sec_tag_t secTag;                                /**< @brief Security tag of the credentials. */
+} SocketSetupContext_t;
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Add a credential to the Zephyr credential store.
+ *
+ * A credential that was already added under the same tag is kept.
+ *
+ * @param[in] secTag Security tag of the credential.
+ * @param[in] type Type of the credential.
+ * @param[in] pCredential The credential.
+ * @param[in] credentialSize Size of @p pCredential.
+ *
+ * @return #TLS_TRANSPORT_SUCCESS, or #TLS_TRANSPORT_INVALID_CREDENTIALS on error.
+ */
+static TlsTransportStatus_t addCredential( sec_tag_t secTag,
+                                           enum tls_credential_type type,
+                                           const uint8_t * pCredential,
+                                           size_t credentialSize );
+
+/**
+ * @brief Add the credentials of a connection to the Zephyr credential store.
+ *
+ * @param[in] secTag Security tag of the credentials.
+ * @param[in] pNetworkCredentials Credentials for the TLS connection.
+ *
+ * @return #TLS_TRANSPORT_SUCCESS, or #TLS_TRANSPORT_INVALID_CREDENTIALS on error.
+ */
+static TlsTransportStatus_t addCredentials( sec_tag_t secTag,
+                                            const NetworkCredentials_t * pNetworkCredentials );
+
+/**
+ * @brief Configure the TLS options of a socket before it is connected.
+ *
+ * @param[in] tcpSocket The TLS socket.
+ * @param[in] pSetupContext The #SocketSetupContext_t of the connection.
+ *
+ * @return 0 on success; otherwise, -1.
+ */
+static int32_t setupTlsSocket( int32_t tcpSocket,
+                               void * pSetupContext );
+
+/**
+ * @brief Log possible error from send/recv.
+ *
+ * @param[in] errorNumber Error number to be logged.
+ */
+static void logTransportError( int32_t errorNumber );
+
+/*-----------------------------------------------------------*/
+
+static TlsTransportStatus_t addCredential( sec_tag_t secTag,
+                                           enum tls_credential_type type,
+                                           const uint8_t * pCredential,
+                                           size_t credentialSize )
+{
+    TlsTransportStatus_t returnStatus = TLS_TRANSPORT_SUCCESS;
+    int credentialStatus = 0;
+
+    assert( pCredential != NULL );
+
+    credentialStatus = tls_credential_add( secTag, type, pCredential, credentialSize );
+
+    /* Credentials outlive connections, so a reconnection finds the credentials
+     * of the previous connection in the store. */
+    if( ( credentialStatus != 0 ) && ( credentialStatus != -EEXIST ) )
+    {
+        LogError( ( "Failed to add credential of type %d under tag %d: Error=%d.",
+                    ( int ) type,
+                    ( int ) secTag,
+                    credentialStatus ) );
+        returnStatus = TLS_TRANSPORT_INVALID_CREDENTIALS;
+    }
+
+    return returnStatus;
+}
+/*-----------------------------------------------------------*/
+
+static TlsTransportStatus_t addCredentials( sec_tag_t secTag,
+                                            const NetworkCredentials_t * pNetworkCredentials )
+{
+    TlsTransportStatus_t returnStatus = TLS_TRANSPORT_SUCCESS;
+
+    assert( pNetworkCredentials != NULL );
+
+    if( pNetworkCredentials->pRootCa != NULL )
+    {
+        returnStatus = addCredential( secTag,
+                                      TLS_CREDENTIAL_CA_CERTIFICATE,
+                                      pNetworkCredentials->pRootCa,
+                                      pNetworkCredentials->rootCaSize );
+    }
+
+    /* The client certificate is stored as the "server" certificate, which is
+     * the name of the own certificate of an endpoint in the credential store. */
+    if( ( returnStatus == TLS_TRANSPORT_SUCCESS ) &&
+        ( pNetworkCredentials->pClientCert != NULL ) )
+    {
+        returnStatus = addCredential( secTag,
+                                      TLS_CREDENTIAL_SERVER_CERTIFICATE,
+                                      pNetworkCredentials->pClientCert,
+                                      pNetworkCredentials->clientCertSize );
+    }
+
+    if( ( returnStatus == TLS_TRANSPORT_SUCCESS ) &&
+        ( pNetworkCredentials->pPrivateKey != NULL ) )
+    {
+        returnStatus = addCredential( secTag,
+                                      TLS_CREDENTIAL_PRIVATE_KEY,
+                                      pNetworkCredentials->pPrivateKey,
+                                      pNetworkCredentials->privateKeySize );
+    }
+
+    return returnStatus;
+}
+/*-----------------------------------------------------------*/
+
+static int32_t setupTlsSocket( int32_t tcpSocket,
+                               void * pSetupContext )
+{
+    int32_t returnStatus = 0;
+    const SocketSetupContext_t * pContext = pSetupContext;
+    const NetworkCredentials_t * pNetworkCredentials = NULL;
+    sec_tag_t secTagList[ 1 ];
+    int peerVerify = TLS_PEER_VERIFY_REQUIRED;
+    size_t numAlpnProtos = 0;
+
+    assert( pContext != NULL );
+
+    pNetworkCredentials = pContext->pNetworkCredentials;
+    secTagList[ 0 ] = pContext->secTag;
+
+    returnStatus = zsock_setsockopt( tcpSocket,
+                                     SOL_TLS,
+                                     TLS_SEC_TAG_LIST,
+                                     secTagList,
+                                     sizeof( secTagList ) );
+
+    if( returnStatus == 0 )
+    {
+        returnStatus = zsock_setsockopt( tcpSocket,
+                                         SOL_TLS,
+                                         TLS_PEER_VERIFY,
+                                         &peerVerify,
+                                         sizeof( peerVerify ) );
+    }
+
+    /* The hostname is also used to verify the server certificate, so it is
+     * set regardless of SNI unless SNI is disabled. */
+    if( ( returnStatus == 0 ) && ( pNetworkCredentials->disableSni == false ) )
+    {
+        returnStatus = zsock_setsockopt( tcpSocket,
+                                         SOL_TLS,
+                                         TLS_HOSTNAME,
+                                         pContext->pHostName,
+                                         pContext->hostNameLength );
+    }
+
+    if( ( returnStatus == 0 ) && ( pNetworkCredentials->pAlpnProtos != NULL ) )
+    {
+        /* The stack takes the protocols as an array of pointers whose length
+         * is given by the option length, without the NULL terminator. */
+        while( pNetworkCredentials->pAlpnProtos[ numAlpnProtos ] != NULL )
+        {
+            numAlpnProtos++;
+        }
+
+        if( numAlpnProtos > 0U )
+        {
+            returnStatus = zsock_setsockopt( tcpSocket,
+                                             SOL_TLS,
+                                             TLS_ALPN_LIST,
+                                             pNetworkCredentials->pAlpnProtos,
+                                             numAlpnProtos * sizeof( const char * ) );
+        }
+    }
+
+    if( returnStatus != 0 )
+    {
+        LogError( ( "Failed to set TLS option of socket %d: errno=%d.",
+                    ( int ) tcpSocket,
+                    errno ) );
+        returnStatus = -1;
+    }
+
+    return returnStatus;
+}
+/*-----------------------------------------------------------*/
+
+static void logTransportError( int32_t errorNumber )
+{
+    /* Remove unused parameter warning. */
+    ( void ) errorNumber;
+
+    LogError( ( "A transport error occurred: %d.", errorNumber ) );
+}
+/*-----------------------------------------------------------*/
+
+TlsTransportStatus_t TlsSockets_Connect( NetworkContext_t * pNetworkContext,
+                                         const ServerInfo_t * pServerInfo,
+                                         const NetworkCredentials_t * pNetworkCredentials,
+                                         uint32_t receiveTimeoutMs,
+                                         uint32_t sendTimeoutMs )
+{
+    TlsSocketsParams_t * pTlsSocketsParams = NULL;
+    TlsTransportStatus_t returnStatus = TLS_TRANSPORT_SUCCESS;
+    SocketStatus_t socketStatus = SOCKETS_SUCCESS;
+    SocketSetupContext_t setupContext;
+
+    if( ( pNetworkContext == NULL ) ||
+        ( pNetworkContext->pParams == NULL ) ||
+        ( pServerInfo == NULL ) ||
+        ( pServerInfo->pHostName == NULL ) ||
+        ( pNetworkCredentials == NULL ) )
+    {
+        LogError( ( "Invalid input parameter(s): Arguments cannot be NULL. pNetworkContext=%p, "
+                    "pServerInfo=%p, pNetworkCredentials=%p.",
+                    pNetworkContext,
+                    pServerInfo,
+                    pNetworkCredentials ) );
+        returnStatus = TLS_TRANSPORT_INVALID_PARAMETER;
+    }
+    else if( pNetworkCredentials->pRootCaStore != NULL )
+    {
+        LogError( ( "pRootCaStore is not supported by the TLS sockets transport." ) );
+        returnStatus = TLS_TRANSPORT_INVALID_PARAMETER;
+    }
+    else
+    {
+        pTlsSocketsParams = pNetworkContext->pParams;
+
+        if( pTlsSocketsParams->secTag == 0 )
+        {
+            pTlsSocketsParams->secTag = TLS_SOCKETS_DEFAULT_SEC_TAG;
+        }
+
+        returnStatus = addCredentials( pTlsSocketsParams->secTag, pNetworkCredentials );
+    }
+
+    /* Establish the TLS session with the server. The handshake is performed by
+     * the network stack when the socket connects, so a handshake failure is
+     * reported as a connection failure. */
+    if( returnStatus == TLS_TRANSPORT_SUCCESS )
+    {
+        setupContext.pHostName = pServerInfo->pHostName;
+        setupContext.hostNameLength = pServerInfo->hostNameLength;
+        setupContext.pNetworkCredentials = pNetworkCredentials;
+        setupContext.secTag = pTlsSocketsParams->secTag;
+
+        socketStatus = Sockets_ConnectWithSetup( &( pTlsSocketsParams->tcpSocket ),
+                                                 pServerInfo,
+                                                 sendTimeoutMs,
+                                                 receiveTimeoutMs,
+                                                 IPPROTO_TLS_1_2,
+                                                 setupTlsSocket,
+                                                 &setupContext );
+
+        if( socketStatus == SOCKETS_API_ERROR )
+        {
+            returnStatus = TLS_TRANSPORT_INTERNAL_ERROR;
+        }
+        else if( socketStatus != SOCKETS_SUCCESS )
+        {
+            LogError( ( "Failed to establish a TLS session with %.*s: Error=%d.",
+                        ( int ) pServerInfo->hostNameLength,
+                        pServerInfo->pHostName,
+                        socketStatus ) );
+            returnStatus = TLS_TRANSPORT_CONNECT_FAILURE;
+        }
+        else
+        {
+            LogInfo( ( "(Network connection %p) TLS handshake successful.",
+                       pNetworkContext ) );
+        }
+    }
+
+    return returnStatus;
+}
+/*-----------------------------------------------------------*/
+
+SocketStatus_t TlsSockets_Disconnect( NetworkContext_t * pNetworkContext )
+{
+    SocketStatus_t returnStatus = SOCKETS_SUCCESS;
+
+    if( ( pNetworkContext == NULL ) || ( pNetworkContext->pParams == NULL ) )
+    {
+        LogError( ( "Parameter check failed: pNetworkContext is NULL." ) );
+        returnStatus = SOCKETS_INVALID_PARAMETER;
+    }
+    else
+    {
+        /* Closing a TLS socket notifies the server of the closure. */
+        returnStatus = Sockets_Disconnect( pNetworkContext->pParams->tcpSocket );
+    }
+
+    return returnStatus;
+}
+/*-----------------------------------------------------------*/
+
+int32_t TlsSockets_recv( NetworkContext_t * pNetworkContext,
+                         void * pBuffer,
+                         size_t bytesToRecv )
+{
+    TlsSocketsParams_t * pTlsSocketsParams = NULL;
+    int32_t bytesReceived = -1, pollStatus = 1;
+    struct zsock_pollfd pollFds;
+
+    assert( pNetworkContext != NULL && pNetworkContext->pParams != NULL );
+    assert( pBuffer != NULL );
+    assert( bytesToRecv > 0 );
+
+    pTlsSocketsParams = pNetworkContext->pParams;
+
+    /* The TLS socket reports readability once decrypted data is available. */
+    pollFds.events = ZSOCK_POLLIN | ZSOCK_POLLPRI;
+    pollFds.revents = 0;
+    pollFds.fd = pTlsSocketsParams->tcpSocket;
+
+    /* Speculative read for the start of a payload.
+     * Note: This is done to avoid blocking when
+     * no data is available to be read from the socket. */
+    if( bytesToRecv == 1U )
+    {
+        /* The smallest non-zero block time of 1ms is used, as a timeout of
+         * zero does not detect data on the socket. */
+        pollStatus = zsock_poll( &pollFds, 1, 1 );
+    }
+
+    if( pollStatus > 0 )
+    {
+        bytesReceived = ( int32_t ) zsock_recv( pTlsSocketsParams->tcpSocket,
+                                                pBuffer,
+                                                bytesToRecv,
+                                                0 );
+
+        if( ( bytesReceived < 0 ) && ( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) ) )
+        {
+            /* The receive timeout expired before a full record was decrypted. */
+            bytesReceived = 0;
+        }
+        else if( bytesReceived == 0 )
+        {
+            /* Peer has closed the connection. Treat as an error. */
+            bytesReceived = -1;
+        }
+        else if( bytesReceived < 0 )
+        {
+            logTransportError( errno );
+        }
+        else
+        {
+            /* Empty else marker. */
+        }
+    }
+    else if( pollStatus < 0 )
+    {
+        /* An error occurred while polling. */
+        logTransportError( errno );
+        bytesReceived = -1;
+    }
+    else
+    {
+        /* No data available to receive. */
+        bytesReceived = 0;
+    }
+
+    return bytesReceived;
+}
+/*-----------------------------------------------------------*/
+
+int32_t TlsSockets_send( NetworkContext_t * pNetworkContext,
+                         const void * pBuffer,
+                         size_t bytesToSend )
+{
+    TlsSocketsParams_t * pTlsSocketsParams = NULL;
+    int32_t bytesSent = -1, pollStatus = -1;
+    struct zsock_pollfd pollFds;
+
+    assert( pNetworkContext != NULL && pNetworkContext->pParams != NULL );
+    assert( pBuffer != NULL );
+    assert( bytesToSend > 0 );
+
+    pTlsSocketsParams = pNetworkContext->pParams;
+
+    pollFds.events = ZSOCK_POLLOUT;
+    pollFds.revents = 0;
+    pollFds.fd = pTlsSocketsParams->tcpSocket;
+
+    /* Check if data can be written to the socket, to avoid blocking on send()
+     * when the TX buffer is full. */
+    pollStatus = zsock_poll( &pollFds, 1, 0 );
+
+    if( pollStatus > 0 )
+    {
+        bytesSent = ( int32_t ) zsock_send( pTlsSocketsParams->tcpSocket,
+                                            pBuffer,
+                                            bytesToSend,
+                                            0 );
+
+        if( ( bytesSent < 0 ) && ( ( errno == EAGAIN ) || ( errno == EWOULDBLOCK ) ) )
+        {
+            /* The record could not be written before the send timeout. */
+            bytesSent = 0;
+        }
+        else if( bytesSent == 0 )
+        {
+            /* Peer has closed the connection. Treat as an error. */
+            bytesSent = -1;
+        }
+        else if( bytesSent < 0 )
+        {
+            logTransportError( errno );
+        }
+        else
+        {
+            /* Empty else marker. */
+        }
+    }
+    else if( pollStatus < 0 )
+    {
+        /* An error occurred while polling. */
+        logTransportError( errno );
+        bytesSent = -1;
+    }
+    else
+    {
+        /* Socket is not available for sending data. */
+        bytesSent = 0;
+    }
+
+    return bytesSent;
+}
+/*-----------------------------------------------------------*/
@@ -15,7 +15,15 @@ set( PLAINTEXT_SOURCES
 
 # Platform mbedtls library source files.
 set( MBEDTLS_SOURCES
-     ${CMAKE_CURRENT_LIST_DIR}/transport/src/mbedtls_zephyr.c )
+     ${CMAKE_CURRENT_LIST_DIR}/transport/src/mbedtls_zephyr.c
+     ${CMAKE_CURRENT_LIST_DIR}/transport/src/root_ca_store.c
+     ${CMAKE_CURRENT_LIST_DIR}/transport/src/entropy_pool_zephyr.c )
+
+# Platform TLS sockets library source files. This transport offers the
+# interface of the mbedtls library with the TLS session run by the Zephyr
+# network stack, and can be built instead of MBEDTLS_SOURCES.
+set( TLS_SOCKETS_SOURCES
+     ${CMAKE_CURRENT_LIST_DIR}/transport/src/tls_sockets_zephyr.c )
 
 # Platform transport library include directories.
 set( COMMON_TRANSPORT_INCLUDE_PUBLIC_DIRS
@@ -23,7 +31,16 @@ set( COMMON_TRANSPORT_INCLUDE_PUBLIC_DIRS
 
 set( MQTT_AGENT_ZEPHYR_SOURCES
      ${CMAKE_CURRENT_LIST_DIR}/mqtt_agent/src/agent_interface_zephyr.c
-     ${CMAKE_CURRENT_LIST_DIR}/mqtt_agent/src/subscription_manager.c )
+     ${CMAKE_CURRENT_LIST_DIR}/mqtt_agent/src/subscription_manager.c
+     ${CMAKE_CURRENT_LIST_DIR}/mqtt_agent/src/agent_message_ring.c
+     ${CMAKE_CURRENT_LIST_DIR}/mqtt_agent/src/coalescing_transport.c
+     ${CMAKE_CURRENT_LIST_DIR}/mqtt_agent/src/agent_publish_buffer.c
+     ${CMAKE_CURRENT_LIST_DIR}/mqtt_agent/src/agent_completion.c
+     ${CMAKE_CURRENT_LIST_DIR}/mqtt_agent/src/agent_publish_window.c
+     ${CMAKE_CURRENT_LIST_DIR}/mqtt_agent/src/agent_offline_queue.c
+     ${CMAKE_CURRENT_LIST_DIR}/mqtt_agent/src/agent_resubscribe.c
+     ${CMAKE_CURRENT_LIST_DIR}/mqtt_agent/src/agent_subscriptions.c
+     ${CMAKE_CURRENT_LIST_DIR}/mqtt_agent/src/agent_publish_dispatch.c )
 
 set( MQTT_AGENT_ZEPHYR_INCLUDE_PUBLIC_DIRS
      ${CMAKE_CURRENT_LIST_DIR}/mqtt_agent/include )